@@ -0,0 +1,129 @@
+#include "asset_registry.h"
+#include "mesh_loader.h"
+
+#include <filesystem>
+#include <limits>
+
+namespace {
+
+bool fileStamp(const std::string& path, uintmax_t& size, long long& writeTime) {
+	std::error_code error;
+	size = std::filesystem::file_size(path, error);
+	if (error) {
+		return false;
+	}
+	writeTime = static_cast<long long>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+	return !error;
+}
+
+}
+
+AssetRegistry::AssetRegistry(size_t gpuBudgetBytes, size_t cpuBudgetBytes, VertexFormat format, const LoadOptions& options)
+	: gpuBudget(gpuBudgetBytes), cpuBudget(cpuBudgetBytes), format(format), options(options) { }
+
+std::shared_ptr<Model> AssetRegistry::find(const std::string& path) {
+	auto pathIt = paths.find(path);
+	if (pathIt != paths.end()) {
+		uintmax_t size;
+		long long writeTime;
+		auto entryIt = entries.find(pathIt->second.sourceHash);
+		if (entryIt != entries.end() && fileStamp(path, size, writeTime)
+			&& size == pathIt->second.fileSize && writeTime == pathIt->second.writeTime) {
+			counters.hits++;
+			touch(entryIt->second, pathIt->second.sourceHash);
+			return entryIt->second.model;
+		}
+		// The file changed (or its model was evicted), the old mapping is no use any more.
+		paths.erase(pathIt);
+	}
+
+	counters.misses++;
+	return nullptr;
+}
+
+std::shared_ptr<Model> AssetRegistry::insert(const std::string& path, uint64_t sourceHash, MeshData&& mesh, PackedMesh&& packed) {
+	PathEntry pathEntry = { sourceHash, 0, 0 };
+	fileStamp(path, pathEntry.fileSize, pathEntry.writeTime);
+	paths[path] = pathEntry;
+
+	auto entryIt = entries.find(sourceHash);
+	if (entryIt != entries.end()) {
+		// Same content under another path, share the resident copy.
+		touch(entryIt->second, sourceHash);
+		return entryIt->second.model;
+	}
+
+	Entry entry;
+	entry.model = std::make_shared<Model>(format);
+	entry.model->beginUpload(std::move(mesh), std::move(packed));
+	lru.push_front(sourceHash);
+	entry.lruPosition = lru.begin();
+	std::shared_ptr<Model> model = entry.model;
+	entries.emplace(sourceHash, std::move(entry));
+
+	evict();
+	return model;
+}
+
+std::shared_ptr<Model> AssetRegistry::load(const std::string& path) {
+	std::shared_ptr<Model> model = find(path);
+	if (model) {
+		return model;
+	}
+
+	MeshData mesh;
+	uint64_t sourceHash;
+	if (!loadMesh(path, mesh, sourceHash, options)) {
+		return nullptr;
+	}
+
+	PackedMesh packed = packMesh(mesh, format);
+	model = insert(path, sourceHash, std::move(mesh), std::move(packed));
+	model->continueUpload(std::numeric_limits<size_t>::max());
+	updateResidentBytes();
+	return model;
+}
+
+void AssetRegistry::setBudget(size_t gpuBudgetBytes, size_t cpuBudgetBytes) {
+	gpuBudget = gpuBudgetBytes;
+	cpuBudget = cpuBudgetBytes;
+	evict();
+}
+
+void AssetRegistry::touch(Entry& entry, uint64_t sourceHash) {
+	lru.erase(entry.lruPosition);
+	lru.push_front(sourceHash);
+	entry.lruPosition = lru.begin();
+}
+
+void AssetRegistry::updateResidentBytes() {
+	counters.residentModels = entries.size();
+	counters.residentGpuBytes = 0;
+	counters.residentCpuBytes = 0;
+	for (const auto& entry : entries) {
+		counters.residentGpuBytes += entry.second.model->gpuBytes();
+		counters.residentCpuBytes += entry.second.model->cpuBytes();
+	}
+}
+
+void AssetRegistry::evict() {
+	updateResidentBytes();
+
+	// Walk from the least recently used end. Models someone still holds a handle to are in use and stay.
+	auto it = lru.end();
+	while (it != lru.begin() && (counters.residentGpuBytes > gpuBudget || counters.residentCpuBytes > cpuBudget)) {
+		--it;
+		auto entryIt = entries.find(*it);
+		if (entryIt->second.model.use_count() > 1) {
+			continue;
+		}
+
+		counters.residentGpuBytes -= entryIt->second.model->gpuBytes();
+		counters.residentCpuBytes -= entryIt->second.model->cpuBytes();
+		counters.residentModels--;
+		counters.evictions++;
+
+		entries.erase(entryIt);
+		it = lru.erase(it);
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef ASSET_REGISTRY_H
+#define ASSET_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "mesh_data.h"
+#include "mesh_loader.h"
+#include "model.h"
+#include "vertex_format.h"
+
+// Keeps loaded models resident on the GPU and hands out shared handles to them.
+// Models are keyed by the content hash of their source, so two paths with identical files share one VAO/VBO/EBO,
+// and by path, so revisiting a model that is still resident costs nothing. Once the resident models go over the
+// GPU or CPU byte budget, the least recently used ones that nobody else holds a handle to are evicted.
+// Only use it from the GL thread.
+class AssetRegistry
+{
+public:
+	struct Stats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+		size_t residentModels = 0;
+		size_t residentGpuBytes = 0;
+		size_t residentCpuBytes = 0;
+	};
+
+	// Every model the registry creates uses format, and load() builds meshes with options.
+	AssetRegistry(size_t gpuBudgetBytes, size_t cpuBudgetBytes, VertexFormat format = VertexFormat::Float, const LoadOptions& options = LoadOptions());
+
+	// Returns the resident model for path, or nullptr if it has to be loaded.
+	// A path only hits while the file on disk still has the size and write time it had when it was loaded.
+	std::shared_ptr<Model> find(const std::string& path);
+
+	// Registers a freshly loaded mesh, packed into getVertexFormat() (see ModelLoader). If a model with the same content is
+	// already resident it is returned instead, otherwise a new model is created and its upload started (see
+	// Model::continueUpload).
+	std::shared_ptr<Model> insert(const std::string& path, uint64_t sourceHash, MeshData&& mesh, PackedMesh&& packed);
+
+	// find(), and on a miss a blocking load and full upload. Returns nullptr if the file cannot be loaded.
+	std::shared_ptr<Model> load(const std::string& path);
+
+	void setBudget(size_t gpuBudgetBytes, size_t cpuBudgetBytes);
+	const Stats& stats() const { return counters; }
+	VertexFormat getVertexFormat() const { return format; }
+
+private:
+	struct Entry
+	{
+		std::shared_ptr<Model> model;
+		std::list<uint64_t>::iterator lruPosition;
+	};
+
+	struct PathEntry
+	{
+		uint64_t sourceHash;
+		uintmax_t fileSize;
+		long long writeTime;
+	};
+
+	std::unordered_map<uint64_t, Entry> entries; // By content hash
+	std::unordered_map<std::string, PathEntry> paths;
+	std::list<uint64_t> lru;                     // Most recently used at the front
+
+	size_t gpuBudget;
+	size_t cpuBudget;
+	VertexFormat format;
+	LoadOptions options;
+	Stats counters;
+
+	void touch(Entry& entry, uint64_t sourceHash);
+	void updateResidentBytes();
+	void evict();
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "bounds.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Same as the meshlet culler: SSE2 is always there on x64.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BOUNDS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+
+struct Extremes
+{
+	float min[3];
+	float max[3];
+
+	Extremes() {
+		std::fill(min, min + 3, std::numeric_limits<float>::max());
+		std::fill(max, max + 3, -std::numeric_limits<float>::max());
+	}
+
+	void grow(int axis, float value) {
+		if (std::isfinite(value)) {
+			min[axis] = std::min(min[axis], value);
+			max[axis] = std::max(max[axis], value);
+		}
+	}
+};
+
+void reduceRange(const glm::vec3* points, size_t begin, size_t end, Extremes& extremes) {
+	size_t i = begin;
+#ifdef BOUNDS_SSE2
+	// Four points are twelve floats, so three loads cover them without any shuffling: the accumulators hold xyzx, yzxy
+	// and zxyz, and are folded into x, y and z once at the end.
+	const __m128 big = _mm_set1_ps(std::numeric_limits<float>::max());
+	const __m128 negativeBig = _mm_set1_ps(-std::numeric_limits<float>::max());
+	__m128 min[3] = { big, big, big };
+	__m128 max[3] = { negativeBig, negativeBig, negativeBig };
+	for (; i + 4 <= end; i += 4) {
+		const float* floats = &points[i].x;
+		for (int k = 0; k < 3; k++) {
+			__m128 value = _mm_loadu_ps(floats + k * 4);
+			// v - v is 0 for finite values and NaN for infinities and NaNs, which fail the compare.
+			__m128 finite = _mm_cmpeq_ps(_mm_sub_ps(value, value), _mm_setzero_ps());
+			min[k] = _mm_min_ps(min[k], _mm_or_ps(_mm_and_ps(finite, value), _mm_andnot_ps(finite, big)));
+			max[k] = _mm_max_ps(max[k], _mm_or_ps(_mm_and_ps(finite, value), _mm_andnot_ps(finite, negativeBig)));
+		}
+	}
+	float lanes[2][12];
+	for (int k = 0; k < 3; k++) {
+		_mm_storeu_ps(lanes[0] + k * 4, min[k]);
+		_mm_storeu_ps(lanes[1] + k * 4, max[k]);
+	}
+	for (int lane = 0; lane < 12; lane++) {
+		extremes.min[lane % 3] = std::min(extremes.min[lane % 3], lanes[0][lane]);
+		extremes.max[lane % 3] = std::max(extremes.max[lane % 3], lanes[1][lane]);
+	}
+#endif
+	for (; i < end; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			extremes.grow(axis, points[i][axis]);
+		}
+	}
+}
+
+// In doubles, finite points far out (1e19 or so) would overflow a float once squared.
+double rangeRadiusSquared(const glm::vec3* points, size_t begin, size_t end, const glm::vec3& center) {
+	double radiusSquared = 0.0;
+	for (size_t i = begin; i < end; i++) {
+		double dx = static_cast<double>(points[i].x) - center.x;
+		double dy = static_cast<double>(points[i].y) - center.y;
+		double dz = static_cast<double>(points[i].z) - center.z;
+		double distanceSquared = dx * dx + dy * dy + dz * dz;
+		// NaN never compares greater, so only the infinities of broken points need catching.
+		if (distanceSquared > radiusSquared && std::isfinite(distanceSquared)) {
+			radiusSquared = distanceSquared;
+		}
+	}
+	return radiusSquared;
+}
+
+// reduceRange and rangeRadiusSquared for the points a range of indices refers to.
+void reduceIndexedRange(const glm::vec3* points, size_t pointCount, const unsigned int* indices, size_t begin, size_t end, Extremes& extremes) {
+	for (size_t i = begin; i < end; i++) {
+		if (indices[i] < pointCount) {
+			for (int axis = 0; axis < 3; axis++) {
+				extremes.grow(axis, points[indices[i]][axis]);
+			}
+		}
+	}
+}
+
+double indexedRadiusSquared(const glm::vec3* points, size_t pointCount, const unsigned int* indices, size_t begin, size_t end, const glm::vec3& center) {
+	double radiusSquared = 0.0;
+	for (size_t i = begin; i < end; i++) {
+		if (indices[i] < pointCount) {
+			radiusSquared = std::max(radiusSquared, rangeRadiusSquared(points, indices[i], indices[i] + 1, center));
+		}
+	}
+	return radiusSquared;
+}
+
+// Both passes over count items in blocks, spread over the global thread pool: reduce(begin, end, extremes) for the box,
+// then radiusSquared(begin, end, center) for the sphere.
+template <typename Reduce, typename RadiusSquared>
+Bounds computeBounds(size_t count, const Reduce& reduce, const RadiusSquared& radiusSquared) {
+	Bounds bounds;
+	size_t blocks = (count + blockSize - 1) / blockSize;
+	if (blocks == 0) {
+		return bounds;
+	}
+
+	std::vector<Extremes> partial(blocks);
+	auto reduceBlock = [&](size_t block) {
+		reduce(block * blockSize, std::min(count, (block + 1) * blockSize), partial[block]);
+	};
+	if (blocks > 1) {
+		ThreadPool::global().parallelFor(blocks, reduceBlock);
+	}
+	else {
+		reduceBlock(0);
+	}
+
+	Extremes total;
+	for (const Extremes& part : partial) {
+		for (int axis = 0; axis < 3; axis++) {
+			total.min[axis] = std::min(total.min[axis], part.min[axis]);
+			total.max[axis] = std::max(total.max[axis], part.max[axis]);
+		}
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		// An axis without a single finite coordinate.
+		if (total.min[axis] > total.max[axis]) {
+			total.min[axis] = total.max[axis] = 0.0f;
+		}
+		bounds.min[axis] = total.min[axis];
+		bounds.max[axis] = total.max[axis];
+	}
+	bounds.center = (bounds.min + bounds.max) * 0.5f;
+
+	// The farthest point from the box's center, rather than half the diagonal, which overshoots for anything round.
+	std::vector<double> radiiSquared(blocks);
+	auto radiusBlock = [&](size_t block) {
+		radiiSquared[block] = radiusSquared(block * blockSize, std::min(count, (block + 1) * blockSize), bounds.center);
+	};
+	if (blocks > 1) {
+		ThreadPool::global().parallelFor(blocks, radiusBlock);
+	}
+	else {
+		radiusBlock(0);
+	}
+	bounds.radius = static_cast<float>(std::sqrt(*std::max_element(radiiSquared.begin(), radiiSquared.end())));
+	return bounds;
+}
+
+}
+
+Bounds computePointBounds(const glm::vec3* points, size_t count) {
+	return computeBounds(count,
+		[&](size_t begin, size_t end, Extremes& extremes) { reduceRange(points, begin, end, extremes); },
+		[&](size_t begin, size_t end, const glm::vec3& center) { return rangeRadiusSquared(points, begin, end, center); });
+}
+
+Bounds computeIndexedBounds(const glm::vec3* points, size_t pointCount, const unsigned int* indices, size_t indexCount) {
+	return computeBounds(indexCount,
+		[&](size_t begin, size_t end, Extremes& extremes) { reduceIndexedRange(points, pointCount, indices, begin, end, extremes); },
+		[&](size_t begin, size_t end, const glm::vec3& center) { return indexedRadiusSquared(points, pointCount, indices, begin, end, center); });
+}
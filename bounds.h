@@ -0,0 +1,27 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <cstddef>
+
+#include "glm/glm/glm.hpp"
+
+// Axis aligned box and bounding sphere around a set of points. The sphere is centered on the box, so the two share a
+// center and the radius is never more than half the box's diagonal.
+struct Bounds
+{
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 max = glm::vec3(0.0f);
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// Bounds of points[0, count), all zero for no points. Coordinates that are not finite are left out, so a few broken
+// vertices do not blow up the bounds of the whole mesh. Big inputs are split over the global thread pool, and the
+// min/max reduction runs four floats at a time with SSE2.
+Bounds computePointBounds(const glm::vec3* points, size_t count);
+
+// Same for the points indices[0, indexCount) refer to, like the triangles of one submesh. Indices past pointCount are
+// skipped. The points are gathered, so this one is scalar.
+Bounds computeIndexedBounds(const glm::vec3* points, size_t pointCount, const unsigned int* indices, size_t indexCount);
+
+#endif
@@ -0,0 +1,940 @@
+#include "bvh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+// Same as the meshlet culler: SSE2 is always there on x64.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+
+// Centroid bins per axis for the SAH sweep. Small ranges use fewer, setting up and sweeping the bins would cost more than
+// binning the triangles.
+const unsigned int binCount = 16;
+const unsigned int minBinCount = 4;
+
+// Ranges at least this big are binned in parallel while the top of the tree is built.
+const size_t parallelBinTriangles = size_t(1) << 17;
+
+// Below this, a subtree is always built by one task on its own.
+const size_t minTaskTriangles = 4096;
+
+// Deeper ranges become leaves whatever their size, which also bounds the traversal stacks.
+const unsigned int maxBuildDepth = 64;
+const unsigned int stackSize = 4 * (maxBuildDepth + 1);
+
+const uint32_t emptyLane = 0xFFFFFFFF;
+
+// Cost of visiting a node relative to testing one triangle, for the SAH.
+const float traversalCost = 2.0f;
+
+struct Box
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+	void grow(const glm::vec3& point) {
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void grow(const Box& box) {
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	// Half the surface area, which is all the SAH needs. Empty boxes come out as 0. In doubles, since meshes with
+	// coordinates far out (1e19 or so) would overflow it as a float and leave every split costing infinity.
+	double area() const {
+		double x = std::max(static_cast<double>(max.x) - min.x, 0.0);
+		double y = std::max(static_cast<double>(max.y) - min.y, 0.0);
+		double z = std::max(static_cast<double>(max.z) - min.z, 0.0);
+		return x * y + y * z + z * x;
+	}
+};
+
+// Triangle bounds, moved around by the partitioning instead of the triangles themselves.
+struct PrimRef
+{
+	glm::vec3 min;
+	uint32_t id;
+	glm::vec3 max;
+	uint32_t padding; // Keeps min and max at 16 byte steps for the binning
+
+	// Twice the box center, halving it would change nothing.
+	glm::vec3 centroid() const { return min + max; }
+};
+
+struct BuildNode
+{
+	Box box;
+	uint32_t child = 0; // Inner nodes: the children are child and child + 1
+	uint32_t first = 0; // Leaves: triangles first .. first + count - 1
+	uint32_t count = 0;
+};
+
+// Four floats per corner rather than a Box, so the binning can grow them with one SSE2 min or max each. The last lane
+// is junk.
+struct Bin
+{
+	float boxMin[4], boxMax[4];
+	float centroidMin[4], centroidMax[4];
+	uint32_t count;
+
+	Bin() {
+		const float big = std::numeric_limits<float>::max();
+		std::fill(boxMin, boxMin + 4, big);
+		std::fill(boxMax, boxMax + 4, -big);
+		std::fill(centroidMin, centroidMin + 4, big);
+		std::fill(centroidMax, centroidMax + 4, -big);
+		count = 0;
+	}
+
+	Box box() const { return makeBox(boxMin, boxMax); }
+	Box centroids() const { return makeBox(centroidMin, centroidMax); }
+
+	void merge(const Bin& other) {
+		for (int i = 0; i < 3; i++) {
+			boxMin[i] = std::min(boxMin[i], other.boxMin[i]);
+			boxMax[i] = std::max(boxMax[i], other.boxMax[i]);
+			centroidMin[i] = std::min(centroidMin[i], other.centroidMin[i]);
+			centroidMax[i] = std::max(centroidMax[i], other.centroidMax[i]);
+		}
+		count += other.count;
+	}
+
+private:
+	static Box makeBox(const float* min, const float* max) {
+		Box box;
+		box.min = glm::vec3(min[0], min[1], min[2]);
+		box.max = glm::vec3(max[0], max[1], max[2]);
+		return box;
+	}
+};
+
+struct Binning
+{
+	Bin bins[3][binCount];
+
+	void reset(unsigned int count) {
+		for (int axis = 0; axis < 3; axis++) {
+			std::fill(bins[axis], bins[axis] + count, Bin());
+		}
+	}
+
+	void merge(const Binning& other, unsigned int count) {
+		for (int axis = 0; axis < 3; axis++) {
+			for (unsigned int b = 0; b < count; b++) {
+				bins[axis][b].merge(other.bins[axis][b]);
+			}
+		}
+	}
+};
+
+struct BinMapping
+{
+	glm::vec3 origin;
+	glm::vec3 scale; // 0 on axes where every centroid is the same
+	unsigned int count;
+
+	BinMapping(const Box& centroids, size_t triangles)
+		: origin(centroids.min), count(static_cast<unsigned int>(std::min<size_t>(binCount, minBinCount + triangles / 4))) {
+		glm::vec3 extent = centroids.max - centroids.min;
+		for (int axis = 0; axis < 3; axis++) {
+			float axisScale = count / extent[axis];
+			scale[axis] = extent[axis] > 0.0f && std::isfinite(axisScale) ? axisScale : 0.0f;
+		}
+	}
+
+	unsigned int bin(const glm::vec3& centroid, int axis) const {
+		return static_cast<unsigned int>(std::min((centroid[axis] - origin[axis]) * scale[axis], static_cast<float>(count - 1)));
+	}
+};
+
+void binRange(const PrimRef* refs, size_t begin, size_t end, const BinMapping& mapping, Binning& binning) {
+#ifdef BVH_SSE2
+	// The id lane of min is masked off, small ids read as floats would be denormals that some CPUs add very slowly. The
+	// padding lane of max is 0, so the junk lane of everything below stays 0.
+	const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 origin = _mm_setr_ps(mapping.origin.x, mapping.origin.y, mapping.origin.z, 0.0f);
+	const __m128 scale = _mm_setr_ps(mapping.scale.x, mapping.scale.y, mapping.scale.z, 0.0f);
+	const __m128 last = _mm_set1_ps(static_cast<float>(mapping.count - 1));
+	for (size_t i = begin; i < end; i++) {
+		__m128 min = _mm_and_ps(_mm_loadu_ps(&refs[i].min.x), xyz);
+		__m128 max = _mm_loadu_ps(&refs[i].max.x);
+		__m128 centroid = _mm_add_ps(min, max);
+		alignas(16) int32_t index[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(index),
+			_mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(centroid, origin), scale), last)));
+		for (int axis = 0; axis < 3; axis++) {
+			Bin& bin = binning.bins[axis][index[axis]];
+			_mm_storeu_ps(bin.boxMin, _mm_min_ps(_mm_loadu_ps(bin.boxMin), min));
+			_mm_storeu_ps(bin.boxMax, _mm_max_ps(_mm_loadu_ps(bin.boxMax), max));
+			_mm_storeu_ps(bin.centroidMin, _mm_min_ps(_mm_loadu_ps(bin.centroidMin), centroid));
+			_mm_storeu_ps(bin.centroidMax, _mm_max_ps(_mm_loadu_ps(bin.centroidMax), centroid));
+			bin.count++;
+		}
+	}
+#else
+	for (size_t i = begin; i < end; i++) {
+		glm::vec3 centroid = refs[i].centroid();
+		for (int axis = 0; axis < 3; axis++) {
+			Bin& bin = binning.bins[axis][mapping.bin(centroid, axis)];
+			for (int k = 0; k < 3; k++) {
+				bin.boxMin[k] = std::min(bin.boxMin[k], refs[i].min[k]);
+				bin.boxMax[k] = std::max(bin.boxMax[k], refs[i].max[k]);
+				bin.centroidMin[k] = std::min(bin.centroidMin[k], centroid[k]);
+				bin.centroidMax[k] = std::max(bin.centroidMax[k], centroid[k]);
+			}
+			bin.count++;
+		}
+	}
+#endif
+}
+
+struct Split
+{
+	size_t middle;
+	Box boxes[2];
+	Box centroids[2];
+};
+
+// Picks the cheapest binned SAH split of refs[begin, end) and partitions the range by it. Returns false if the range is
+// better off as a leaf. binning is scratch space, kept by the caller because it is too big to set up for every node.
+bool splitRange(std::vector<PrimRef>& refs, size_t begin, size_t end, const Box& box, const Box& centroids, unsigned int depth,
+	bool parallel, Binning& binning, Split& split) {
+	size_t count = end - begin;
+	if (count <= 1 || depth >= maxBuildDepth) {
+		return false;
+	}
+
+	BinMapping mapping(centroids, count);
+	if (mapping.scale == glm::vec3(0.0f)) {
+		// Every centroid is in the same spot, no plane can separate them. Halving still keeps the leaves small.
+		if (count <= bvhMaxLeafTriangles) {
+			return false;
+		}
+		split.middle = begin + count / 2;
+		split.boxes[0] = split.boxes[1] = Box();
+		for (size_t i = begin; i < end; i++) {
+			Box& side = split.boxes[i < split.middle ? 0 : 1];
+			side.grow(refs[i].min);
+			side.grow(refs[i].max);
+		}
+		split.centroids[0] = split.centroids[1] = centroids;
+		return true;
+	}
+
+	binning.reset(mapping.count);
+	if (parallel && count >= parallelBinTriangles) {
+		size_t blocks = (count + blockSize - 1) / blockSize;
+		std::vector<Binning> partial(blocks);
+		ThreadPool::global().parallelFor(blocks, [&](size_t block) {
+			binRange(refs.data(), begin + block * blockSize, std::min(end, begin + (block + 1) * blockSize), mapping, partial[block]);
+		});
+		for (const Binning& part : partial) {
+			binning.merge(part, mapping.count);
+		}
+	}
+	else {
+		binRange(refs.data(), begin, end, mapping, binning);
+	}
+
+	// Sweep from both ends; splitting after bin b costs the area weighted triangle counts of both sides.
+	double bestCost = std::numeric_limits<double>::max();
+	int bestAxis = -1;
+	unsigned int bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (mapping.scale[axis] == 0.0f) {
+			continue;
+		}
+		const Bin* bins = binning.bins[axis];
+		double rightCost[binCount];
+		Box right;
+		uint32_t rightCount = 0;
+		for (unsigned int b = mapping.count - 1; b > 0; b--) {
+			right.grow(bins[b].box());
+			rightCount += bins[b].count;
+			rightCost[b] = right.area() * rightCount;
+		}
+		Box left;
+		uint32_t leftCount = 0;
+		for (unsigned int b = 0; b + 1 < mapping.count; b++) {
+			left.grow(bins[b].box());
+			leftCount += bins[b].count;
+			if (leftCount == 0 || leftCount == count) {
+				continue;
+			}
+			double cost = left.area() * leftCount + rightCost[b + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	// A split costs a node visit on top of the triangle tests.
+	double area = box.area();
+	double splitCost = area > 0.0 ? traversalCost + bestCost / area : std::numeric_limits<double>::max();
+	if (bestAxis < 0 || (count <= bvhMaxLeafTriangles && splitCost >= static_cast<double>(count))) {
+		return false;
+	}
+
+	const Bin* bins = binning.bins[bestAxis];
+	split.boxes[0] = split.boxes[1] = Box();
+	split.centroids[0] = split.centroids[1] = Box();
+	for (unsigned int b = 0; b < mapping.count; b++) {
+		int side = b <= bestBin ? 0 : 1;
+		split.boxes[side].grow(bins[b].box());
+		split.centroids[side].grow(bins[b].centroids());
+	}
+	auto middle = std::partition(refs.begin() + begin, refs.begin() + end, [&](const PrimRef& ref) {
+		return mapping.bin(ref.centroid(), bestAxis) <= bestBin;
+	});
+	split.middle = middle - refs.begin();
+	return true;
+}
+
+void buildSubtree(std::vector<BuildNode>& nodes, uint32_t index, std::vector<PrimRef>& refs, size_t begin, size_t end,
+	const Box& box, const Box& centroids, unsigned int depth, Binning& binning) {
+	nodes[index].box = box;
+	Split split;
+	if (!splitRange(refs, begin, end, box, centroids, depth, false, binning, split)) {
+		nodes[index].first = static_cast<uint32_t>(begin);
+		nodes[index].count = static_cast<uint32_t>(end - begin);
+		return;
+	}
+
+	uint32_t child = static_cast<uint32_t>(nodes.size());
+	nodes.resize(nodes.size() + 2);
+	nodes[index].child = child;
+	buildSubtree(nodes, child, refs, begin, split.middle, split.boxes[0], split.centroids[0], depth + 1, binning);
+	buildSubtree(nodes, child + 1, refs, split.middle, end, split.boxes[1], split.centroids[1], depth + 1, binning);
+}
+
+// Folds the binary tree into four wide nodes by pulling in the grandchildren with the biggest boxes. Nodes come out depth
+// first, so a node's first inner child sits right behind it.
+struct Collapser
+{
+	const std::vector<BuildNode>& binary;
+	double rootArea;
+	BvhStats& stats;
+
+	template <typename Node>
+	uint32_t collapse(std::vector<Node>& out, uint32_t index, unsigned int depth) {
+		uint32_t self = static_cast<uint32_t>(out.size());
+		out.emplace_back();
+		stats.depth = std::max(stats.depth, depth + 1);
+		if (rootArea > 0.0) {
+			stats.sahCost += static_cast<float>(binary[index].box.area() / rootArea);
+		}
+
+		uint32_t lanes[4];
+		unsigned int laneCount = 0;
+		if (binary[index].count > 0) {
+			lanes[laneCount++] = index;
+		}
+		else {
+			lanes[laneCount++] = binary[index].child;
+			lanes[laneCount++] = binary[index].child + 1;
+		}
+		while (laneCount < 4) {
+			int widest = -1;
+			double widestArea = -1.0;
+			for (unsigned int i = 0; i < laneCount; i++) {
+				const BuildNode& lane = binary[lanes[i]];
+				if (lane.count == 0 && lane.box.area() > widestArea) {
+					widest = static_cast<int>(i);
+					widestArea = lane.box.area();
+				}
+			}
+			if (widest < 0) {
+				break;
+			}
+			uint32_t child = binary[lanes[widest]].child;
+			lanes[widest] = child;
+			lanes[laneCount++] = child + 1;
+		}
+
+		for (unsigned int i = 0; i < 4; i++) {
+			uint32_t children = emptyLane;
+			uint32_t count = 0;
+			Box box;
+			if (i < laneCount) {
+				const BuildNode& lane = binary[lanes[i]];
+				box = lane.box;
+				if (lane.count > 0) {
+					children = lane.first;
+					count = lane.count;
+					stats.leaves++;
+					if (rootArea > 0.0) {
+						stats.sahCost += static_cast<float>(box.area() / rootArea * count);
+					}
+				}
+				else {
+					children = collapse(out, lanes[i], depth + 1);
+				}
+			}
+			Node& node = out[self];
+			node.minX[i] = box.min.x;
+			node.minY[i] = box.min.y;
+			node.minZ[i] = box.min.z;
+			node.maxX[i] = box.max.x;
+			node.maxY[i] = box.max.y;
+			node.maxZ[i] = box.max.z;
+			node.children[i] = children;
+			node.counts[i] = count;
+		}
+		return self;
+	}
+};
+
+// Slab test of a ray against the four child boxes of node. Fills the entry distances and returns a bit per child hit
+// within [0, maxDistance]. Unused lanes have to be skipped by the caller.
+template <typename Node>
+int intersectChildren(const Node& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float* entry) {
+#ifdef BVH_SSE2
+	__m128 ox = _mm_set1_ps(origin.x);
+	__m128 oy = _mm_set1_ps(origin.y);
+	__m128 oz = _mm_set1_ps(origin.z);
+	__m128 ix = _mm_set1_ps(inverseDirection.x);
+	__m128 iy = _mm_set1_ps(inverseDirection.y);
+	__m128 iz = _mm_set1_ps(inverseDirection.z);
+	__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+	__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+	__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+	__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+	__m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+	__m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+	__m128 near = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), _mm_setzero_ps()));
+	__m128 far = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(maxDistance)));
+	_mm_storeu_ps(entry, near);
+	return _mm_movemask_ps(_mm_cmple_ps(near, far));
+#else
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		float x0 = (node.minX[i] - origin.x) * inverseDirection.x;
+		float x1 = (node.maxX[i] - origin.x) * inverseDirection.x;
+		float y0 = (node.minY[i] - origin.y) * inverseDirection.y;
+		float y1 = (node.maxY[i] - origin.y) * inverseDirection.y;
+		float z0 = (node.minZ[i] - origin.z) * inverseDirection.z;
+		float z1 = (node.maxZ[i] - origin.z) * inverseDirection.z;
+		float near = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+		float far = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), maxDistance));
+		entry[i] = near;
+		mask |= near <= far ? 1 << i : 0;
+	}
+	return mask;
+#endif
+}
+
+// Squared distances from point to the four child boxes of node, 0 inside them.
+template <typename Node>
+void childDistances(const Node& node, const glm::vec3& point, float* distances) {
+#ifdef BVH_SSE2
+	__m128 zero = _mm_setzero_ps();
+	__m128 px = _mm_set1_ps(point.x);
+	__m128 py = _mm_set1_ps(point.y);
+	__m128 pz = _mm_set1_ps(point.z);
+	__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), px), _mm_sub_ps(px, _mm_loadu_ps(node.maxX))), zero);
+	__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), py), _mm_sub_ps(py, _mm_loadu_ps(node.maxY))), zero);
+	__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), pz), _mm_sub_ps(pz, _mm_loadu_ps(node.maxZ))), zero);
+	_mm_storeu_ps(distances, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+#else
+	for (int i = 0; i < 4; i++) {
+		float dx = std::max(std::max(node.minX[i] - point.x, point.x - node.maxX[i]), 0.0f);
+		float dy = std::max(std::max(node.minY[i] - point.y, point.y - node.maxY[i]), 0.0f);
+		float dz = std::max(std::max(node.minZ[i] - point.z, point.z - node.maxZ[i]), 0.0f);
+		distances[i] = dx * dx + dy * dy + dz * dz;
+	}
+#endif
+}
+
+// A bit per child box of node that overlaps [boxMin, boxMax].
+template <typename Node>
+int overlapChildren(const Node& node, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+#ifdef BVH_SSE2
+	__m128 inside = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minX), _mm_set1_ps(boxMax.x)), _mm_cmpge_ps(_mm_loadu_ps(node.maxX), _mm_set1_ps(boxMin.x)));
+	inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minY), _mm_set1_ps(boxMax.y)), _mm_cmpge_ps(_mm_loadu_ps(node.maxY), _mm_set1_ps(boxMin.y))));
+	inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minZ), _mm_set1_ps(boxMax.z)), _mm_cmpge_ps(_mm_loadu_ps(node.maxZ), _mm_set1_ps(boxMin.z))));
+	return _mm_movemask_ps(inside);
+#else
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		bool inside = node.minX[i] <= boxMax.x && node.maxX[i] >= boxMin.x && node.minY[i] <= boxMax.y && node.maxY[i] >= boxMin.y
+			&& node.minZ[i] <= boxMax.z && node.maxZ[i] >= boxMin.z;
+		mask |= inside ? 1 << i : 0;
+	}
+	return mask;
+#endif
+}
+
+// Moller and Trumbore, both sides. Updates hit and returns true if the triangle is hit closer than hit.distance.
+bool intersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3* triangle, BvhRayHit& hit) {
+	glm::vec3 edge1 = triangle[1] - triangle[0];
+	glm::vec3 edge2 = triangle[2] - triangle[0];
+	glm::vec3 p = glm::cross(direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (determinant == 0.0f) {
+		return false;
+	}
+	float inverse = 1.0f / determinant;
+	glm::vec3 s = origin - triangle[0];
+	float u = glm::dot(s, p) * inverse;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	float t = glm::dot(edge2, q) * inverse;
+	if (!(t >= 0.0f && t <= hit.distance)) {
+		return false;
+	}
+	hit.distance = t;
+	hit.u = u;
+	hit.v = v;
+	return true;
+}
+
+// Ericson, Real-Time Collision Detection 5.1.5: works out which vertex, edge or the face the closest point is on.
+glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+	glm::vec3 ab = b - a;
+	glm::vec3 ac = c - a;
+	glm::vec3 ap = p - a;
+	float d1 = glm::dot(ab, ap);
+	float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		return a;
+	}
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp);
+	float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		return b;
+	}
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		return a + ab * (d1 / (d1 - d3));
+	}
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp);
+	float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		return c;
+	}
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		return a + ac * (d2 / (d2 - d6));
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	}
+
+	float denominator = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Separating axis test of Akenine-Moller: the box's face normals, the triangle's normal and the nine edge cross products.
+bool triangleOverlapsBox(const glm::vec3& center, const glm::vec3& half, const glm::vec3* triangle) {
+	glm::vec3 v[3] = { triangle[0] - center, triangle[1] - center, triangle[2] - center };
+	for (int axis = 0; axis < 3; axis++) {
+		if (std::min(v[0][axis], std::min(v[1][axis], v[2][axis])) > half[axis]
+			|| std::max(v[0][axis], std::max(v[1][axis], v[2][axis])) < -half[axis]) {
+			return false;
+		}
+	}
+
+	glm::vec3 edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+	glm::vec3 normal = glm::cross(edges[0], edges[1]);
+	if (std::abs(glm::dot(normal, v[0])) > glm::dot(half, glm::abs(normal))) {
+		return false;
+	}
+
+	for (const glm::vec3& edge : edges) {
+		for (int axis = 0; axis < 3; axis++) {
+			glm::vec3 unit(0.0f);
+			unit[axis] = 1.0f;
+			glm::vec3 separating = glm::cross(unit, edge);
+			float p0 = glm::dot(v[0], separating);
+			float p1 = glm::dot(v[1], separating);
+			float p2 = glm::dot(v[2], separating);
+			float radius = glm::dot(half, glm::abs(separating));
+			if (std::min(p0, std::min(p1, p2)) > radius || std::max(p0, std::max(p1, p2)) < -radius) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+}
+
+BvhStats Bvh::build(const std::vector<glm::vec3>& vertices, const unsigned int* indices, size_t triangleCount) {
+	auto start = std::chrono::steady_clock::now();
+	BvhStats stats;
+	clear();
+
+	ThreadPool& pool = ThreadPool::global();
+	size_t blocks = (triangleCount + blockSize - 1) / blockSize;
+
+	// Triangles with an index out of range or a position that is not finite are left out.
+	std::vector<PrimRef> all(triangleCount);
+	std::vector<uint8_t> valid(triangleCount);
+	pool.parallelFor(blocks, [&](size_t block) {
+		size_t end = std::min(triangleCount, (block + 1) * blockSize);
+		for (size_t t = block * blockSize; t < end; t++) {
+			valid[t] = 0;
+			if (indices[t * 3] >= vertices.size() || indices[t * 3 + 1] >= vertices.size() || indices[t * 3 + 2] >= vertices.size()) {
+				continue;
+			}
+			const glm::vec3& a = vertices[indices[t * 3]];
+			const glm::vec3& b = vertices[indices[t * 3 + 1]];
+			const glm::vec3& c = vertices[indices[t * 3 + 2]];
+			PrimRef& ref = all[t];
+			ref.min = glm::min(a, glm::min(b, c));
+			ref.max = glm::max(a, glm::max(b, c));
+			ref.id = static_cast<uint32_t>(t);
+			ref.padding = 0;
+			valid[t] = std::isfinite(ref.min.x + ref.min.y + ref.min.z + ref.max.x + ref.max.y + ref.max.z) ? 1 : 0;
+		}
+	});
+	std::vector<PrimRef> refs;
+	refs.reserve(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (valid[t]) {
+			refs.push_back(all[t]);
+		}
+	}
+	all = std::vector<PrimRef>();
+	valid = std::vector<uint8_t>();
+	if (refs.empty()) {
+		return stats;
+	}
+
+	Box rootBox;
+	Box rootCentroids;
+	for (const PrimRef& ref : refs) {
+		rootBox.grow(ref.min);
+		rootBox.grow(ref.max);
+		rootCentroids.grow(ref.centroid());
+	}
+
+	// The top of the tree is split on this thread, with the binning spread over the pool, until the ranges are small
+	// enough to hand out as whole subtrees.
+	struct Pending
+	{
+		uint32_t node;
+		size_t begin, end;
+		Box box, centroids;
+		unsigned int depth;
+	};
+	size_t taskTriangles = std::max(minTaskTriangles, refs.size() / (pool.size() * 4));
+	std::vector<BuildNode> binary(1);
+	std::vector<Pending> queue = { { 0, 0, refs.size(), rootBox, rootCentroids, 0 } };
+	std::vector<Pending> tasks;
+	Binning binning;
+	while (!queue.empty()) {
+		Pending range = queue.back();
+		queue.pop_back();
+		if (range.end - range.begin <= taskTriangles) {
+			tasks.push_back(range);
+			continue;
+		}
+
+		binary[range.node].box = range.box;
+		Split split;
+		if (!splitRange(refs, range.begin, range.end, range.box, range.centroids, range.depth, true, binning, split)) {
+			binary[range.node].first = static_cast<uint32_t>(range.begin);
+			binary[range.node].count = static_cast<uint32_t>(range.end - range.begin);
+			continue;
+		}
+		uint32_t child = static_cast<uint32_t>(binary.size());
+		binary.resize(binary.size() + 2);
+		binary[range.node].child = child;
+		queue.push_back({ child, range.begin, split.middle, split.boxes[0], split.centroids[0], range.depth + 1 });
+		queue.push_back({ child + 1, split.middle, range.end, split.boxes[1], split.centroids[1], range.depth + 1 });
+	}
+
+	// Subtrees only touch their own part of refs, and their nodes go into their own arrays until they are stitched on.
+	std::vector<std::vector<BuildNode>> subtrees(tasks.size());
+	pool.parallelFor(tasks.size(), [&](size_t i) {
+		const Pending& task = tasks[i];
+		subtrees[i].resize(1);
+		Binning scratch;
+		buildSubtree(subtrees[i], 0, refs, task.begin, task.end, task.box, task.centroids, task.depth, scratch);
+	});
+	for (size_t i = 0; i < tasks.size(); i++) {
+		std::vector<BuildNode>& subtree = subtrees[i];
+		uint32_t offset = static_cast<uint32_t>(binary.size()) - 1;
+		for (BuildNode& node : subtree) {
+			if (node.count == 0) {
+				node.child += offset;
+			}
+		}
+		binary[tasks[i].node] = subtree[0];
+		binary.insert(binary.end(), subtree.begin() + 1, subtree.end());
+		subtree = std::vector<BuildNode>();
+	}
+
+	Collapser collapser = { binary, rootBox.area(), stats };
+	nodes.reserve(binary.size() / 2 + 1);
+	collapser.collapse(nodes, 0, 0);
+
+	// Triangles are copied out in leaf order so a leaf is one contiguous read.
+	triangleIds.resize(refs.size());
+	triangleVertices.resize(refs.size() * 3);
+	size_t refBlocks = (refs.size() + blockSize - 1) / blockSize;
+	pool.parallelFor(refBlocks, [&](size_t block) {
+		size_t end = std::min(refs.size(), (block + 1) * blockSize);
+		for (size_t i = block * blockSize; i < end; i++) {
+			uint32_t t = refs[i].id;
+			triangleIds[i] = t;
+			triangleVertices[i * 3] = vertices[indices[t * 3]];
+			triangleVertices[i * 3 + 1] = vertices[indices[t * 3 + 1]];
+			triangleVertices[i * 3 + 2] = vertices[indices[t * 3 + 2]];
+		}
+	});
+
+	stats.triangles = refs.size();
+	stats.nodes = nodes.size();
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+void Bvh::clear() {
+	nodes = std::vector<Node>();
+	triangleVertices = std::vector<glm::vec3>();
+	triangleIds = std::vector<uint32_t>();
+}
+
+bool Bvh::isValidTree(const Node* nodes, size_t nodeCount, size_t triangleCount) {
+	if (nodeCount == 0) {
+		return triangleCount == 0;
+	}
+	// Children always come after their parent, so one pass in order sees every parent's depth before its children.
+	std::vector<uint8_t> depths(nodeCount, 0);
+	for (size_t n = 0; n < nodeCount; n++) {
+		const Node& node = nodes[n];
+		for (int i = 0; i < 4; i++) {
+			uint32_t child = node.children[i];
+			if (child == emptyLane) {
+				continue;
+			}
+			if (node.counts[i] > 0) {
+				if (static_cast<uint64_t>(child) + node.counts[i] > triangleCount) {
+					return false;
+				}
+			}
+			else if (child <= n || child >= nodeCount || depths[n] >= maxBuildDepth) {
+				return false;
+			}
+			else {
+				depths[child] = static_cast<uint8_t>(depths[n] + 1);
+			}
+		}
+	}
+	return true;
+}
+
+void Bvh::assign(const Node* treeNodes, size_t nodeCount, const glm::vec3* vertices, const uint32_t* ids, size_t triangleCount) {
+	nodes.assign(treeNodes, treeNodes + nodeCount);
+	triangleVertices.assign(vertices, vertices + triangleCount * 3);
+	triangleIds.assign(ids, ids + triangleCount);
+}
+
+size_t Bvh::bytes() const {
+	return nodes.capacity() * sizeof(Node) + triangleVertices.capacity() * sizeof(glm::vec3) + triangleIds.capacity() * sizeof(uint32_t);
+}
+
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, BvhRayHit& hit) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	// Zero components become tiny ones, so the slabs never see 0 * infinity.
+	glm::vec3 inverseDirection;
+	for (int axis = 0; axis < 3; axis++) {
+		float d = direction[axis];
+		inverseDirection[axis] = 1.0f / (std::abs(d) > 1e-30f ? d : std::copysign(1e-30f, d));
+	}
+
+	struct Entry
+	{
+		uint32_t node;
+		float distance;
+	};
+	Entry stack[stackSize];
+	unsigned int top = 0;
+	stack[top++] = { 0, 0.0f };
+
+	BvhRayHit closest;
+	closest.distance = maxDistance;
+	uint32_t closestIndex = emptyLane;
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.distance > closest.distance) {
+			continue;
+		}
+
+		const Node& node = nodes[entry.node];
+		float entryDistances[4];
+		int mask = intersectChildren(node, origin, inverseDirection, closest.distance, entryDistances);
+
+		// Leaves are tested right away, which can only shrink the range the inner children are checked against.
+		int inner[4];
+		int innerCount = 0;
+		for (int i = 0; i < 4; i++) {
+			if (!(mask & (1 << i)) || node.children[i] == emptyLane) {
+				continue;
+			}
+			if (node.counts[i] == 0) {
+				inner[innerCount++] = i;
+				continue;
+			}
+			for (uint32_t t = node.children[i]; t < node.children[i] + node.counts[i]; t++) {
+				if (intersectTriangle(origin, direction, &triangleVertices[t * size_t(3)], closest)) {
+					closestIndex = t;
+				}
+			}
+		}
+
+		// Nearest child goes on top of the stack.
+		for (int i = 1; i < innerCount; i++) {
+			for (int j = i; j > 0 && entryDistances[inner[j]] > entryDistances[inner[j - 1]]; j--) {
+				std::swap(inner[j], inner[j - 1]);
+			}
+		}
+		for (int i = 0; i < innerCount; i++) {
+			if (entryDistances[inner[i]] <= closest.distance) {
+				stack[top++] = { node.children[inner[i]], entryDistances[inner[i]] };
+			}
+		}
+	}
+
+	if (closestIndex == emptyLane) {
+		return false;
+	}
+	hit = closest;
+	hit.triangle = triangleIds[closestIndex];
+	return true;
+}
+
+bool Bvh::closestPoint(const glm::vec3& point, float maxDistance, BvhPointHit& hit) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	struct Entry
+	{
+		uint32_t node;
+		float distance; // Squared
+	};
+	Entry stack[stackSize];
+	unsigned int top = 0;
+	stack[top++] = { 0, 0.0f };
+
+	float bestSquared = maxDistance * maxDistance;
+	uint32_t bestIndex = emptyLane;
+	glm::vec3 bestPoint(0.0f);
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.distance > bestSquared) {
+			continue;
+		}
+
+		const Node& node = nodes[entry.node];
+		float distances[4];
+		childDistances(node, point, distances);
+
+		int inner[4];
+		int innerCount = 0;
+		for (int i = 0; i < 4; i++) {
+			if (node.children[i] == emptyLane || distances[i] > bestSquared) {
+				continue;
+			}
+			if (node.counts[i] == 0) {
+				inner[innerCount++] = i;
+				continue;
+			}
+			for (uint32_t t = node.children[i]; t < node.children[i] + node.counts[i]; t++) {
+				const glm::vec3* triangle = &triangleVertices[t * size_t(3)];
+				glm::vec3 candidate = closestPointOnTriangle(point, triangle[0], triangle[1], triangle[2]);
+				glm::vec3 offset = candidate - point;
+				float distanceSquared = glm::dot(offset, offset);
+				if (distanceSquared <= bestSquared) {
+					bestSquared = distanceSquared;
+					bestIndex = t;
+					bestPoint = candidate;
+				}
+			}
+		}
+
+		for (int i = 1; i < innerCount; i++) {
+			for (int j = i; j > 0 && distances[inner[j]] > distances[inner[j - 1]]; j--) {
+				std::swap(inner[j], inner[j - 1]);
+			}
+		}
+		for (int i = 0; i < innerCount; i++) {
+			stack[top++] = { node.children[inner[i]], distances[inner[i]] };
+		}
+	}
+
+	if (bestIndex == emptyLane) {
+		return false;
+	}
+	hit.triangle = triangleIds[bestIndex];
+	hit.distance = std::sqrt(bestSquared);
+	hit.point = bestPoint;
+	return true;
+}
+
+size_t Bvh::overlapBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& triangles) const {
+	if (nodes.empty()) {
+		return 0;
+	}
+
+	glm::vec3 center = (boxMin + boxMax) * 0.5f;
+	glm::vec3 half = (boxMax - boxMin) * 0.5f;
+	size_t found = triangles.size();
+
+	uint32_t stack[stackSize];
+	unsigned int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		int mask = overlapChildren(node, boxMin, boxMax);
+		for (int i = 0; i < 4; i++) {
+			if (!(mask & (1 << i)) || node.children[i] == emptyLane) {
+				continue;
+			}
+			if (node.counts[i] == 0) {
+				stack[top++] = node.children[i];
+				continue;
+			}
+			for (uint32_t t = node.children[i]; t < node.children[i] + node.counts[i]; t++) {
+				if (triangleOverlapsBox(center, half, &triangleVertices[t * size_t(3)])) {
+					triangles.push_back(triangleIds[t]);
+				}
+			}
+		}
+	}
+	return triangles.size() - found;
+}
@@ -0,0 +1,88 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+// Leaves hold at most this many triangles, unless the build runs out of depth (see maxBuildDepth in bvh.cpp).
+const unsigned int bvhMaxLeafTriangles = 8;
+
+struct BvhStats
+{
+	size_t triangles = 0;
+	size_t nodes = 0;   // Four wide nodes
+	size_t leaves = 0;
+	unsigned int depth = 0;
+	float sahCost = 0.0f; // Expected node visits plus triangle tests for a random ray that hits the root box
+	double milliseconds = 0.0;
+};
+
+struct BvhRayHit
+{
+	uint32_t triangle; // Index into the triangles the BVH was built from, so the element buffer's triangle too
+	float distance;    // Along the ray, in units of the direction's length
+	float u, v;        // Barycentric coordinates of the hit: weights of the triangle's second and third vertex
+};
+
+struct BvhPointHit
+{
+	uint32_t triangle;
+	float distance;
+	glm::vec3 point; // Closest point on the triangle
+};
+
+// Bounding volume hierarchy over a triangle mesh for ray casts and proximity queries on the CPU.
+// Built top down with binned SAH splits, then collapsed into nodes of four children whose boxes are stored as structure
+// of arrays, so each visited node tests all four children at once with SSE2. The triangles are copied into leaf order,
+// so queries never touch the mesh itself. All queries are const and safe to run from several threads at once.
+class Bvh
+{
+public:
+	// Four children, each either an inner node (counts 0) or a leaf of counts triangles starting at children in leaf
+	// order. Lanes past the last child have a children of 0xFFFFFFFF.
+	struct Node
+	{
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t children[4]; // Node index, or the first triangle of a leaf
+		uint32_t counts[4];   // Triangles in a leaf child, 0 for inner children and unused lanes
+	};
+
+	// Builds over the first triangleCount triangles of indices, in parallel on the global thread pool.
+	BvhStats build(const std::vector<glm::vec3>& vertices, const unsigned int* indices, size_t triangleCount);
+	void clear();
+
+	bool empty() const { return nodes.empty(); }
+	size_t bytes() const;
+
+	// Closest hit along origin + t * direction for 0 <= t <= maxDistance. Both sides of the triangles count.
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, BvhRayHit& hit) const;
+
+	// Closest point on the mesh to point that is no further away than maxDistance.
+	bool closestPoint(const glm::vec3& point, float maxDistance, BvhPointHit& hit) const;
+
+	// Appends every triangle that intersects the box to triangles and returns how many there were.
+	size_t overlapBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& triangles) const;
+
+	// The built tree as it is stored, for the mesh cache.
+	const std::vector<Node>& getNodes() const { return nodes; }
+	const std::vector<glm::vec3>& getTriangleVertices() const { return triangleVertices; }
+	const std::vector<uint32_t>& getTriangleIds() const { return triangleIds; }
+
+	// True if the nodes could have come from build() over triangleCount triangles: every inner child comes after its
+	// parent, no deeper than the traversal stacks allow, and every leaf lies within the triangles. Stored trees are
+	// checked with this before they are used, since queries trust the indices.
+	static bool isValidTree(const Node* nodes, size_t nodeCount, size_t triangleCount);
+	// Takes over a stored tree that passed isValidTree(), with three vertices and one id per triangle.
+	void assign(const Node* treeNodes, size_t nodeCount, const glm::vec3* vertices, const uint32_t* ids, size_t triangleCount);
+
+private:
+	std::vector<Node> nodes; // nodes[0] is the root
+	std::vector<glm::vec3> triangleVertices; // Three per triangle, in leaf order
+	std::vector<uint32_t> triangleIds;       // Original index of each triangle in leaf order
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "content_hash.h"
+#include "thread_pool.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t prime3 = 0x165667B19E3779F9ull;
+
+const size_t blockSize = 16 << 20;
+
+inline uint64_t rotateLeft(uint64_t x, int bits) {
+	return (x << bits) | (x >> (64 - bits));
+}
+
+inline uint64_t readWord(const unsigned char* p) {
+	uint64_t word;
+	std::memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+inline uint64_t mixLane(uint64_t lane, uint64_t word) {
+	return rotateLeft(lane + word * prime2, 31) * prime1;
+}
+
+inline uint64_t avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Four independent lanes over 32 byte stripes keep several multiplies in flight, much like xxHash64.
+uint64_t hashBlock(const unsigned char* p, size_t size, uint64_t seed) {
+	const unsigned char* end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+		while (end - p >= 32) {
+			lanes[0] = mixLane(lanes[0], readWord(p));
+			lanes[1] = mixLane(lanes[1], readWord(p + 8));
+			lanes[2] = mixLane(lanes[2], readWord(p + 16));
+			lanes[3] = mixLane(lanes[3], readWord(p + 24));
+			p += 32;
+		}
+		h = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+	}
+	else {
+		h = seed + prime3;
+	}
+
+	h += static_cast<uint64_t>(size);
+	while (end - p >= 8) {
+		h = rotateLeft(h ^ mixLane(0, readWord(p)), 27) * prime1 + prime3;
+		p += 8;
+	}
+	while (p < end) {
+		h = rotateLeft(h ^ (*p * prime3), 11) * prime1;
+		p++;
+	}
+	return avalanche(h);
+}
+
+}
+
+uint64_t contentHash(const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	size_t blockCount = size == 0 ? 1 : (size + blockSize - 1) / blockSize;
+
+	std::vector<uint64_t> blockHashes(blockCount);
+	ThreadPool::global().parallelFor(blockCount, [&](size_t i) {
+		size_t offset = i * blockSize;
+		size_t length = size - offset < blockSize ? size - offset : blockSize;
+		blockHashes[i] = hashBlock(bytes + offset, length, i);
+	});
+
+	uint64_t h = avalanche(static_cast<uint64_t>(size) * prime1);
+	for (uint64_t blockHash : blockHashes) {
+		h = rotateLeft(h ^ blockHash, 29) * prime1 + prime2;
+	}
+	return avalanche(h);
+}
@@ -0,0 +1,12 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit non-cryptographic hash of a byte buffer, used to key caches on file contents.
+// Large buffers are hashed as fixed size blocks on the global thread pool and the block hashes are combined in order,
+// so the result only depends on the bytes, never on the number of threads.
+uint64_t contentHash(const void* data, size_t size);
+
+#endif
@@ -0,0 +1,57 @@
+#include "depth_view.h"
+#include "gl_state.h"
+
+DepthView::DepthView() {
+	glGenTextures(1, &texture);
+	GlState::current().bindTexture(GL_TEXTURE_2D, texture);
+	// Nearest, so the overlay shows the pixels the occlusion tests actually see.
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenVertexArrays(1, &vao);
+}
+
+DepthView::~DepthView() {
+	GlState& state = GlState::current();
+	state.deleteTextures(1, &texture);
+	state.deleteVertexArrays(1, &vao);
+}
+
+void DepthView::draw(Shader& shader, const std::vector<float>& depth, unsigned int width, unsigned int height, float nearPlane, float farPlane,
+	unsigned int windowWidth, unsigned int windowHeight, float scale) {
+	if (depth.size() < static_cast<size_t>(width) * height || width == 0 || height == 0) {
+		return;
+	}
+
+	GlState& state = GlState::current();
+	state.activeTexture(GL_TEXTURE0);
+	state.bindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (width != textureWidth || height != textureHeight) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, depth.data());
+		textureWidth = width;
+		textureHeight = height;
+	}
+	else {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, depth.data());
+	}
+
+	shader.use();
+	shader.setInt("depthTexture", 0);
+	shader.setFloat("nearPlane", nearPlane);
+	shader.setFloat("farPlane", farPlane);
+	// The rectangle in normalized device coordinates, from the bottom left corner.
+	shader.setVec4("rect", glm::vec4(-1.0f, -1.0f, 2.0f * width * scale / windowWidth, 2.0f * height * scale / windowHeight));
+
+	// Drawn over everything, including whatever the wireframe toggle left the polygon mode at. The cache knows that
+	// mode, so there is no glGet to wait on for it.
+	GLenum polygonMode = state.polygonMode();
+	state.polygonMode(GL_FILL);
+	state.disable(GL_DEPTH_TEST);
+	state.bindVertexArray(vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	state.enable(GL_DEPTH_TEST);
+	state.polygonMode(polygonMode);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+in vec2 TexCoord;
+out vec4 FragColor;
+
+uniform sampler2D depthTexture;
+uniform float nearPlane;
+uniform float farPlane;
+
+void main()
+{
+	// Back to view distance, then a log scale so a model a few units away still stands out from a far plane at 100.
+	// Near is white, empty pixels at the far plane are black.
+	float depth = texture(depthTexture, TexCoord).r * 2.0 - 1.0;
+	float distance = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - depth * (farPlane - nearPlane));
+	float shade = 1.0 - log(max(distance, nearPlane) / nearPlane) / log(farPlane / nearPlane);
+	FragColor = vec4(vec3(shade), 1.0);
+}
@@ -0,0 +1,33 @@
+#ifndef DEPTH_VIEW_H
+#define DEPTH_VIEW_H
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "shader.h"
+
+// Debug overlay that shows a CPU side depth buffer (see OcclusionCuller::depth()) in a corner of the window.
+// Needs a current GL context for its whole life.
+class DepthView
+{
+public:
+	DepthView();
+	~DepthView();
+
+	DepthView(const DepthView&) = delete;
+	DepthView& operator=(const DepthView&) = delete;
+
+	// Uploads depth (rows bottom up, [0, 1] like the depth buffer of a projection with nearPlane and farPlane) and draws
+	// it over the bottom left corner, scale times its own size in pixels.
+	void draw(Shader& shader, const std::vector<float>& depth, unsigned int width, unsigned int height, float nearPlane, float farPlane,
+		unsigned int windowWidth, unsigned int windowHeight, float scale = 2.0f);
+
+private:
+	GLuint texture = 0;
+	GLuint vao = 0; // Empty, the corners come from gl_VertexID
+	unsigned int textureWidth = 0;
+	unsigned int textureHeight = 0;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#version 330 core
+out vec2 TexCoord;
+
+// Where the quad goes, in normalized device coordinates: corner x, y, then width and height.
+uniform vec4 rect;
+
+void main()
+{
+	// Triangle strip corners 0..3: bottom left, bottom right, top left, top right.
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	TexCoord = corner;
+	gl_Position = vec4(rect.xy + corner * rect.zw, 0.0, 1.0);
+}
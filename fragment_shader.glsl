@@ -1,47 +1,79 @@
 #version 330 core
+// Scene uber-shader, see vertex_shader.glsl. Without LIGHTING or NORMAL_VIEW it draws the flat tint of the light source.
 out vec4 FragColor;
 
+in vec2 TexCoord;
+in vec3 Normal;
+in vec3 FragPos;
+in vec4 InstanceColor; // White unless instanced
+flat in int MaterialIndex;
+
+#ifdef LIGHTING
+// See GpuMaterial in model.h
 struct Material{
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
+    vec4 ambient;  // w is 1 if diffuseMap holds the material's texture
+    vec4 diffuse;  // w is the opacity
+    vec4 specular; // w is the shininess
 };
 
-struct Light{
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
+// The model's whole material table, uploaded once per model; each draw (or instance) only says which entry it uses.
+layout (std140) uniform Materials{
+    Material materials[256]; // maxMaterials
 };
+#ifdef DIFFUSE_MAP
+uniform sampler2D diffuseMap;
+#endif
 
-in vec3 Normal;
-in vec3 FragPos;
+// See FrameBlock and LightBlock in uniform_blocks.h; the w components are unused.
+layout (std140) uniform Frame{
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 viewPos;
+};
+layout (std140) uniform Light{
+    vec4 position;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+} light;
 
-uniform Material material;
-uniform vec3 viewPos;
-uniform Light light;
 vec3 phong(){
+    Material material = materials[MaterialIndex];
+#ifdef DIFFUSE_MAP
+    vec3 albedo = material.ambient.w > 0.0 ? texture(diffuseMap, TexCoord).rgb : vec3(1.0);
+#else
+    vec3 albedo = vec3(1.0);
+#endif
+
 	// ambient
-    vec3 ambient = light.ambient * material.ambient;
+    vec3 ambient = light.ambient.rgb * material.ambient.rgb * albedo;
   	
     // diffuse 
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(light.position - FragPos);
+    vec3 lightDir = normalize(light.position.xyz - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * (diff * material.diffuse);
+    vec3 diffuse = light.diffuse.rgb * (diff * material.diffuse.rgb * albedo);
     
     // specular
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = material.specular * spec * light.specular;  
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), max(material.specular.w, 1.0));
+    vec3 specular = material.specular.rgb * spec * light.specular.rgb;  
         
-    vec3 result = ambient + diffuse + specular;
+    vec3 result = (ambient + diffuse + specular) * InstanceColor.rgb;
     return result;
 }
+#endif
 
 void main(){
+#if defined(NORMAL_VIEW)
+	// Scaled from [-1, 1] to [0, 1]
+	FragColor = vec4(normalize(Normal) * 0.5 + 0.5, 1.0);
+#elif defined(LIGHTING)
 	vec3 finalColor = phong();
-	FragColor = vec4(finalColor, 1.0f);
+	FragColor = vec4(finalColor, materials[MaterialIndex].diffuse.w * InstanceColor.a);
+#else
+	FragColor = InstanceColor;
+#endif
 }
\ No newline at end of file
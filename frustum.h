@@ -0,0 +1,48 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cmath>
+
+#include "glm/glm/glm.hpp"
+
+// The six planes of a view frustum, facing inwards: p is on the inside of plane i if dot(planes[i], vec4(p, 1)) >= 0.
+// The planes are normalized, so that is also the signed distance in the space the planes are in.
+struct Frustum
+{
+	glm::vec4 planes[6]; // Left, right, bottom, top, near, far
+
+	// Planes of the clip volume of matrix (Gribb and Hartmann), in the space the matrix maps from: a projection * view
+	// matrix gives world space planes, projection * view * model gives the model's own space.
+	static Frustum fromMatrix(const glm::mat4& matrix) {
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++) {
+			rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+		}
+
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0];
+		frustum.planes[1] = rows[3] - rows[0];
+		frustum.planes[2] = rows[3] + rows[1];
+		frustum.planes[3] = rows[3] - rows[1];
+		frustum.planes[4] = rows[3] + rows[2];
+		frustum.planes[5] = rows[3] - rows[2];
+		for (glm::vec4& plane : frustum.planes) {
+			float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+			if (length > 0.0f) {
+				plane = plane / length;
+			}
+		}
+		return frustum;
+	}
+
+	bool intersectsSphere(const glm::vec3& center, float radius) const {
+		for (const glm::vec4& plane : planes) {
+			if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,362 @@
+#include "gl_state.h"
+
+#include <iostream>
+
+namespace {
+
+// Stands for state the cache does not know.
+const GLuint unknown = 0xFFFFFFFFu;
+
+// The buffer targets cached, with the glGet names of their bindings.
+const GLenum bufferTargets[][2] = {
+	{ GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING },
+	{ GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER },
+	{ GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER },
+	{ GL_PIXEL_PACK_BUFFER, GL_PIXEL_PACK_BUFFER_BINDING },
+	{ GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING },
+	{ GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING },
+};
+
+const GLenum cachedCaps[] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_POLYGON_OFFSET_FILL, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST };
+
+int bufferTargetIndex(GLenum target) {
+	for (int i = 0; i < static_cast<int>(sizeof(bufferTargets) / sizeof(bufferTargets[0])); i++) {
+		if (bufferTargets[i][0] == target) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int capIndex(GLenum cap) {
+	for (int i = 0; i < static_cast<int>(sizeof(cachedCaps) / sizeof(cachedCaps[0])); i++) {
+		if (cachedCaps[i] == cap) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+GLint integer(GLenum name) {
+	GLint value = 0;
+	glGetIntegerv(name, &value);
+	return value;
+}
+
+}
+
+GlState& GlState::current() {
+	static GlState state;
+	return state;
+}
+
+GlState::GlState() {
+	static_assert(sizeof(bufferTargets) / sizeof(bufferTargets[0]) == bufferTargetCount, "one cached binding per buffer target");
+	static_assert(sizeof(cachedCaps) / sizeof(cachedCaps[0]) == capCount, "one cached flag per cap");
+	invalidate();
+}
+
+template <typename Query>
+bool GlState::confirmed(GLint value, const Query& actual, const char* what) {
+	if (!checking) {
+		return true;
+	}
+	GLint real = actual();
+	if (real == value) {
+		return true;
+	}
+	std::cout << "ERROR::GL_STATE::MISMATCH: " << what << " is " << real << ", cached as " << value << std::endl;
+	counts.mismatches++;
+	return false;
+}
+
+void GlState::useProgram(GLuint value) {
+	if (value == program && confirmed(value, [] { return integer(GL_CURRENT_PROGRAM); }, "program")) {
+		counts.elided++;
+		return;
+	}
+	glUseProgram(value);
+	program = value;
+	counts.issued++;
+}
+
+void GlState::bindVertexArray(GLuint vao) {
+	if (vao == vertexArray && confirmed(vao, [] { return integer(GL_VERTEX_ARRAY_BINDING); }, "vertex array")) {
+		counts.elided++;
+		return;
+	}
+	glBindVertexArray(vao);
+	vertexArray = vao;
+	counts.issued++;
+}
+
+void GlState::bindBuffer(GLenum target, GLuint buffer) {
+	GLuint* cached = nullptr;
+	GLenum binding = 0;
+	if (target == GL_ELEMENT_ARRAY_BUFFER && vertexArray != unknown) {
+		cached = &boundVertexArray().elementBuffer;
+		binding = GL_ELEMENT_ARRAY_BUFFER_BINDING;
+	}
+	else if (bufferTargetIndex(target) >= 0) {
+		cached = &buffers[bufferTargetIndex(target)];
+		binding = bufferTargets[bufferTargetIndex(target)][1];
+	}
+
+	if (cached && *cached == buffer && confirmed(buffer, [binding] { return integer(binding); }, "buffer binding")) {
+		counts.elided++;
+		return;
+	}
+	glBindBuffer(target, buffer);
+	if (cached) {
+		*cached = buffer;
+	}
+	counts.issued++;
+}
+
+void GlState::bindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+	bool cachedIndex = target == GL_UNIFORM_BUFFER && index < uniformBindingCount;
+	if (cachedIndex && uniformBindings[index] == buffer && buffers[bufferTargetIndex(target)] == buffer
+		&& confirmed(buffer, [index] { GLint value = 0; glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, index, &value); return value; }, "uniform buffer binding")) {
+		counts.elided++;
+		return;
+	}
+	glBindBufferBase(target, index, buffer);
+	if (cachedIndex) {
+		uniformBindings[index] = buffer;
+	}
+	if (bufferTargetIndex(target) >= 0) {
+		buffers[bufferTargetIndex(target)] = buffer;
+	}
+	counts.issued++;
+}
+
+void GlState::activeTexture(GLenum unit) {
+	if (unit == activeUnit && confirmed(unit, [] { return integer(GL_ACTIVE_TEXTURE); }, "active texture unit")) {
+		counts.elided++;
+		return;
+	}
+	glActiveTexture(unit);
+	activeUnit = unit;
+	counts.issued++;
+}
+
+void GlState::bindTexture(GLenum target, GLuint texture) {
+	GLuint* cached = nullptr;
+	if (target == GL_TEXTURE_2D && activeUnit != unknown && activeUnit - GL_TEXTURE0 < textureUnitCount) {
+		cached = &textures[activeUnit - GL_TEXTURE0];
+	}
+	if (cached && *cached == texture && confirmed(texture, [] { return integer(GL_TEXTURE_BINDING_2D); }, "texture binding")) {
+		counts.elided++;
+		return;
+	}
+	glBindTexture(target, texture);
+	if (cached) {
+		*cached = texture;
+	}
+	counts.issued++;
+}
+
+void GlState::enable(GLenum cap) {
+	setCap(cap, true);
+}
+
+void GlState::disable(GLenum cap) {
+	setCap(cap, false);
+}
+
+void GlState::setCap(GLenum cap, bool enabled) {
+	int index = capIndex(cap);
+	if (index >= 0 && caps[index] == (enabled ? 1 : 0) && confirmed(enabled, [cap] { return static_cast<GLint>(glIsEnabled(cap)); }, "enable")) {
+		counts.elided++;
+		return;
+	}
+	if (enabled) {
+		glEnable(cap);
+	}
+	else {
+		glDisable(cap);
+	}
+	if (index >= 0) {
+		caps[index] = enabled ? 1 : 0;
+	}
+	counts.issued++;
+}
+
+void GlState::enableVertexAttribArray(GLuint index) {
+	setAttribute(index, true);
+}
+
+void GlState::disableVertexAttribArray(GLuint index) {
+	setAttribute(index, false);
+}
+
+void GlState::setAttribute(GLuint index, bool enabled) {
+	VertexArrayState* state = vertexArray != unknown && index < 32 ? &boundVertexArray() : nullptr;
+	uint32_t bit = state ? 1u << index : 0;
+	if (state && (state->knownAttributes & bit) && ((state->enabledAttributes & bit) != 0) == enabled
+		&& confirmed(enabled, [index] { GLint value = 0; glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &value); return value; }, "vertex attribute")) {
+		counts.elided++;
+		return;
+	}
+	if (enabled) {
+		glEnableVertexAttribArray(index);
+	}
+	else {
+		glDisableVertexAttribArray(index);
+	}
+	if (state) {
+		state->knownAttributes |= bit;
+		state->enabledAttributes = enabled ? state->enabledAttributes | bit : state->enabledAttributes & ~bit;
+	}
+	counts.issued++;
+}
+
+void GlState::polygonMode(GLenum mode) {
+	if (mode == currentPolygonMode
+		&& confirmed(mode, [] { GLint modes[2] = { 0, 0 }; glGetIntegerv(GL_POLYGON_MODE, modes); return modes[0]; }, "polygon mode")) {
+		counts.elided++;
+		return;
+	}
+	glPolygonMode(GL_FRONT_AND_BACK, mode);
+	currentPolygonMode = mode;
+	counts.issued++;
+}
+
+void GlState::depthFunc(GLenum func) {
+	if (func == currentDepthFunc && confirmed(func, [] { return integer(GL_DEPTH_FUNC); }, "depth function")) {
+		counts.elided++;
+		return;
+	}
+	glDepthFunc(func);
+	currentDepthFunc = func;
+	counts.issued++;
+}
+
+void GlState::deleteVertexArrays(GLsizei count, const GLuint* vaos) {
+	glDeleteVertexArrays(count, vaos);
+	for (GLsizei i = 0; i < count; i++) {
+		vertexArrays.erase(vaos[i]);
+		if (vaos[i] != 0 && vaos[i] == vertexArray) {
+			vertexArray = 0;
+		}
+	}
+}
+
+void GlState::deleteBuffers(GLsizei count, const GLuint* deleted) {
+	glDeleteBuffers(count, deleted);
+	for (GLsizei i = 0; i < count; i++) {
+		if (deleted[i] == 0) {
+			continue;
+		}
+		for (GLuint& buffer : buffers) {
+			buffer = buffer == deleted[i] ? 0 : buffer;
+		}
+		// Indexed bindings and the element buffers of vertex arrays that are not bound may keep the name alive, or not,
+		// depending on the driver; they are just forgotten.
+		for (GLuint& buffer : uniformBindings) {
+			buffer = buffer == deleted[i] ? unknown : buffer;
+		}
+		for (auto& entry : vertexArrays) {
+			if (entry.second.elementBuffer == deleted[i]) {
+				entry.second.elementBuffer = entry.first == vertexArray ? 0 : unknown;
+			}
+		}
+	}
+}
+
+void GlState::deleteTextures(GLsizei count, const GLuint* deleted) {
+	glDeleteTextures(count, deleted);
+	for (GLsizei i = 0; i < count; i++) {
+		for (GLuint& texture : textures) {
+			texture = deleted[i] != 0 && texture == deleted[i] ? 0 : texture;
+		}
+	}
+}
+
+void GlState::invalidate() {
+	program = unknown;
+	vertexArray = unknown;
+	for (GLuint& buffer : buffers) {
+		buffer = unknown;
+	}
+	for (GLuint& buffer : uniformBindings) {
+		buffer = unknown;
+	}
+	activeUnit = unknown;
+	for (GLuint& texture : textures) {
+		texture = unknown;
+	}
+	for (int8_t& cap : caps) {
+		cap = -1;
+	}
+	currentPolygonMode = unknown;
+	currentDepthFunc = unknown;
+	vertexArrays.clear();
+}
+
+bool GlState::verify() {
+	bool wasChecking = checking;
+	checking = true;
+	size_t before = counts.mismatches;
+
+	if (program != unknown) {
+		confirmed(program, [] { return integer(GL_CURRENT_PROGRAM); }, "program");
+	}
+	if (vertexArray != unknown) {
+		confirmed(vertexArray, [] { return integer(GL_VERTEX_ARRAY_BINDING); }, "vertex array");
+		auto state = vertexArrays.find(vertexArray);
+		if (state != vertexArrays.end()) {
+			if (state->second.elementBuffer != unknown) {
+				confirmed(state->second.elementBuffer, [] { return integer(GL_ELEMENT_ARRAY_BUFFER_BINDING); }, "element buffer binding");
+			}
+			for (GLuint index = 0; index < 32; index++) {
+				if (state->second.knownAttributes & (1u << index)) {
+					confirmed((state->second.enabledAttributes >> index) & 1u,
+						[index] { GLint value = 0; glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &value); return value; }, "vertex attribute");
+				}
+			}
+		}
+	}
+	for (unsigned int i = 0; i < bufferTargetCount; i++) {
+		if (buffers[i] != unknown) {
+			GLenum binding = bufferTargets[i][1];
+			confirmed(buffers[i], [binding] { return integer(binding); }, "buffer binding");
+		}
+	}
+	for (GLuint index = 0; index < uniformBindingCount; index++) {
+		if (uniformBindings[index] != unknown) {
+			confirmed(uniformBindings[index],
+				[index] { GLint value = 0; glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, index, &value); return value; }, "uniform buffer binding");
+		}
+	}
+	if (activeUnit != unknown) {
+		confirmed(activeUnit, [] { return integer(GL_ACTIVE_TEXTURE); }, "active texture unit");
+		// Only the active unit can be asked about without switching units.
+		if (activeUnit - GL_TEXTURE0 < textureUnitCount && textures[activeUnit - GL_TEXTURE0] != unknown) {
+			confirmed(textures[activeUnit - GL_TEXTURE0], [] { return integer(GL_TEXTURE_BINDING_2D); }, "texture binding");
+		}
+	}
+	for (unsigned int i = 0; i < capCount; i++) {
+		if (caps[i] >= 0) {
+			GLenum cap = cachedCaps[i];
+			confirmed(caps[i], [cap] { return static_cast<GLint>(glIsEnabled(cap)); }, "enable");
+		}
+	}
+	if (currentPolygonMode != unknown) {
+		confirmed(currentPolygonMode, [] { GLint modes[2] = { 0, 0 }; glGetIntegerv(GL_POLYGON_MODE, modes); return modes[0]; }, "polygon mode");
+	}
+	if (currentDepthFunc != unknown) {
+		confirmed(currentDepthFunc, [] { return integer(GL_DEPTH_FUNC); }, "depth function");
+	}
+
+	checking = wasChecking;
+	return counts.mismatches == before;
+}
+
+GlState::VertexArrayState& GlState::boundVertexArray() {
+	auto inserted = vertexArrays.emplace(vertexArray, VertexArrayState());
+	if (inserted.second) {
+		inserted.first->second.elementBuffer = unknown;
+	}
+	return inserted.first->second;
+}
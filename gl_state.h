@@ -0,0 +1,103 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// Calls that went through GlState, summed until GlState::resetStats().
+struct GlStateStats
+{
+	size_t issued = 0;
+	size_t elided = 0;     // Calls dropped because they would have set what was already set
+	size_t mismatches = 0; // Cached state glGet* disagreed with, found with checking on; each is a GL call that went around the cache
+};
+
+// Cache of the GL state the renderer changes: the program, the vertex array (with its element buffer and enabled
+// attributes, which are part of it), buffer bindings, the 2D texture of each unit, a handful of enables, the polygon
+// mode and the depth function. Every bind, use, enable and polygon mode change goes through it, and calls that would
+// not change anything are dropped. State starts out unknown, so the first call of each kind is always issued.
+// The viewer has one context and only uses it on the main thread, so there is one global cache and no locking.
+class GlState
+{
+public:
+	static GlState& current();
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	// GL_ELEMENT_ARRAY_BUFFER is cached for the bound vertex array, the common targets for the context, anything else is
+	// passed through.
+	void bindBuffer(GLenum target, GLuint buffer);
+	// Only GL_UNIFORM_BUFFER is cached. Also binds buffer to target, like GL does.
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+	void activeTexture(GLenum unit);
+	// Only GL_TEXTURE_2D is cached, for the active unit.
+	void bindTexture(GLenum target, GLuint texture);
+	void enable(GLenum cap);
+	void disable(GLenum cap);
+	// For the bound vertex array.
+	void enableVertexAttribArray(GLuint index);
+	void disableVertexAttribArray(GLuint index);
+	// Core profiles only take GL_FRONT_AND_BACK, so there is just the one mode.
+	void polygonMode(GLenum mode);
+	// Not a valid mode until the first polygonMode(mode) call.
+	GLenum polygonMode() const { return currentPolygonMode; }
+	void depthFunc(GLenum func);
+
+	// Deleting a bound object puts 0 in its place, which the cache has to follow.
+	void deleteVertexArrays(GLsizei count, const GLuint* vaos);
+	void deleteBuffers(GLsizei count, const GLuint* buffers);
+	void deleteTextures(GLsizei count, const GLuint* textures);
+
+	// Forgets everything, for after code that changed state without going through the cache.
+	void invalidate();
+
+	// With checking on, every call about to be dropped first compares the cache with glGet*. A mismatch is printed and
+	// counted, and the call issued after all. That is a glGet per call, so it is only for tracking down stray GL calls.
+	void setChecking(bool enabled) { checking = enabled; }
+	// Compares everything cached with glGet* right away. False if anything differs, which is printed.
+	bool verify();
+
+	const GlStateStats& stats() const { return counts; }
+	void resetStats() { counts = GlStateStats(); }
+
+private:
+	static const unsigned int bufferTargetCount = 6;
+	static const unsigned int uniformBindingCount = 16;
+	static const unsigned int textureUnitCount = 16;
+	static const unsigned int capCount = 6;
+
+	struct VertexArrayState
+	{
+		GLuint elementBuffer;
+		uint32_t enabledAttributes = 0;
+		uint32_t knownAttributes = 0; // Attributes whose bit in enabledAttributes is known
+	};
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint buffers[bufferTargetCount];
+	GLuint uniformBindings[uniformBindingCount];
+	GLenum activeUnit;
+	GLuint textures[textureUnitCount];
+	int8_t caps[capCount]; // 1 enabled, 0 disabled, -1 unknown
+	GLenum currentPolygonMode;
+	GLenum currentDepthFunc;
+	std::unordered_map<GLuint, VertexArrayState> vertexArrays;
+
+	bool checking = false;
+	GlStateStats counts;
+
+	GlState();
+
+	VertexArrayState& boundVertexArray();
+	void setCap(GLenum cap, bool enabled);
+	void setAttribute(GLuint index, bool enabled);
+	// True if value, the cached value, is what GL has too. Only asks GL (actual()) with checking on.
+	template <typename Query>
+	bool confirmed(GLint value, const Query& actual, const char* what);
+};
+
+#endif
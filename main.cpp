@@ -5,21 +5,41 @@
 #include <glm/glm/gtc/matrix_transform.hpp>
 #include <glm/glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 #include "stb_image.h"
 #include "camera.h"
 #include "shader.h"
 #include "model.h"
+#include "model_loader.h"
+#include "asset_registry.h"
+#include "obj_parser.h"
+#include "object_culling.h"
+#include "occlusion_culling.h"
+#include "depth_view.h"
+#include "gl_state.h"
+#include "uniform_blocks.h"
+#include "program_cache.h"
+#include "render_queue.h"
+#include "shader_variants.h"
 
 const unsigned int WIDTH = 1280;
 const unsigned int HEIGHT = 720;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void processInput(GLFWwindow* window);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+float projectedSphereRadius(const glm::vec3& center, float radius);
 
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f));
 float lastX = WIDTH / 2.0f;
@@ -30,13 +50,83 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
+// Preset models cycled through with [SPACE]. Their materials come from the MTL files next to them (see mesh_loader.h).
+const char* const presets[] = {
+	"./monkey.obj",
+	// Normal averaging process seems to have made the "patching" effect less noticable on the sphere.
+	"./sphere.obj",
+	// Normal Averaging seems to have fixed the polar lighting on the cube. Still not too happy with the interpolation of normals for these low-poly models.
+	"./cube.obj",
+	"./multiple.obj",
+	// The bunny, cow and dragon don't come with prepackaged normals, so are fairly boring to look at. May have to start calculating my own normals.
+	"./stanford-bunny.obj",
+	"./cow.obj",
+	// Dragon and beetle seem to be most affected by the strange rippling due to the normal averaging.
+	"./beetle.obj",
+	"./xyzrgb_dragon.obj",
+	// Shoutout to Valve :)
+	"./error.obj",
+};
+const unsigned int presetCount = sizeof(presets) / sizeof(presets[0]);
+const unsigned int errorPreset = presetCount - 1;
+
+// Models are centered and scaled to this bounding sphere radius, whatever units they were made in.
+const float displayRadius = 1.5f;
+
+// The subject is rasterized as an occluder from its finest LOD with at most this many triangles.
+const size_t occluderTriangles = 4096;
+
+// Bytes of a newly loaded model copied to the GPU per frame, so big models do not blow the frame budget.
+const size_t uploadBytesPerFrame = 16 << 20;
+
+// Models stay resident after being switched away from until these budgets are exceeded.
+const size_t assetGpuBudget = size_t(1) << 30;
+const size_t assetCpuBudget = size_t(2) << 30;
+
+// Unified vertices get UVs and authored normals right; LoadMode::Positions is the old one vertex per 'v' line behaviour.
+// Generated normals are hard across edges sharper than the crease angle, so the cube gets flat faces and the scans stay smooth.
+const LoadOptions loadOptions = { LoadMode::Unified, 60.0f };
+
+// Quantized positions/normals/UVs take about half the memory of floats; VertexFormat::Float uploads the meshes unchanged.
+const VertexFormat vertexFormat = VertexFormat::Compact;
+
+// Scene shader variants [L SHIFT] cycles through: Phong, the normals as colors, and the flat color the light source is
+// always drawn with. Instanced draws use the same ones with shaderfeature::instancing added.
+const uint32_t phongFeatures = shaderfeature::lighting | shaderfeature::diffuseMap;
+const uint32_t normalFeatures = shaderfeature::normalView;
+const uint32_t unlitFeatures = 0;
+const uint32_t shadingModes[] = { phongFeatures, normalFeatures, unlitFeatures };
+
+// Compares the GL state cache with glGet* before every call it drops. Only for finding GL calls that go around it; the
+// glGets stall the pipeline.
+const bool checkGlState = false;
+
+// Instancing stress test: the model on screen is also drawn as a field of this many copies in turn, each count for
+// stressFrames frames after stressWarmupFrames, and the frame times are printed once all of them are done.
+const size_t stressCounts[] = { 1000, 10000, 100000 };
+const unsigned int stressCountTotal = sizeof(stressCounts) / sizeof(stressCounts[0]);
+const unsigned int stressWarmupFrames = 10;
+const unsigned int stressFrames = 120;
+// Width and depth of the field in front of the camera, however many copies it has.
+const float stressFieldSize = 60.0f;
+
 unsigned int currentModel = 0;
 unsigned int currentShader = 0;
 bool canSwitchModel = true;
-bool canSwitchShader = true;
 bool toggleWireframe = true;
+unsigned int lodSetting = 0; // 0 picks the level of detail from the on screen size, n forces level n - 1
+bool meshletCulling = true;
+bool pickRequested = false;
+bool benchmarkRequested = false;
+bool queueBenchmarkRequested = false;
+bool scannerTestRequested = true; // Once at startup, then on request
+bool occlusionCulling = true;
+bool showOcclusionDepth = false;
+bool stressRequested = false;
+unsigned int soloSetting = 0; // 0 shows every submesh of the model, n only submesh n - 1
 
 int main() {
+	auto startupStart = std::chrono::steady_clock::now();
 
 	// Setup for window creation and OpenGL API
 
@@ -60,6 +150,7 @@ int main() {
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetKeyCallback(window, key_callback);
 
 	// tell GLFW to capture our mouse
@@ -72,22 +163,59 @@ int main() {
 		return -1;
 	}
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
+	GlState& glState = GlState::current();
+	glState.setChecking(checkGlState);
+	glState.enable(GL_DEPTH_TEST);
+	glState.enable(GL_CULL_FACE);
+	glState.polygonMode(GL_FILL);
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
 
-	// End of setup
+	programcache::init((GLADloadproc)glfwGetProcAddress);
 
-	Shader shader1("./vertex_shader.glsl", "./fragment_shader.glsl");
-	Shader normals("./vertex_shader.glsl", "./normals.glsl");
-	Shader lightSource("./light_vertex.glsl", "./lightSource.glsl");
+	// End of setup
 
-	Model subject;
-	subject.loadOBJ("./monkey.obj");
+	// Programs with a saved binary are ready right away. The rest only have their compiles submitted here, all at once,
+	// and finish while the startup model loads. Other scene variants (the instanced ones) compile when first used.
+	auto shaderStart = std::chrono::steady_clock::now();
+	ShaderVariants scene("./vertex_shader.glsl", "./fragment_shader.glsl");
+	std::vector<Shader*> compiling = scene.prepare({ phongFeatures, normalFeatures, unlitFeatures });
+	Shader depthViewShader("./depth_view_vertex.glsl", "./depth_view.glsl", true);
+	if (!depthViewShader.fromCache()) {
+		compiling.push_back(&depthViewShader);
+	}
+	size_t programCount = scene.compiledCount() + 1;
+	double shaderSubmitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count();
+
+	// The subject and the light start out as the same file, so they share one set of buffers.
+	AssetRegistry assets(assetGpuBudget, assetCpuBudget, vertexFormat, loadOptions);
+	std::shared_ptr<Model> subject = assets.load("./monkey.obj");
+	std::shared_ptr<Model> light = assets.load("./monkey.obj");
+	if (!subject || !light) {
+		std::cout << "Failed to load the startup model!" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
 
-	Model light;
-	light.loadOBJ("./monkey.obj");
+	auto shaderWaitStart = std::chrono::steady_clock::now();
+	Shader::finishAll(compiling);
+	auto shaderEnd = std::chrono::steady_clock::now();
+	std::cout << "Shaders: " << programCount << " programs, " << programCount - compiling.size() << " from saved binaries"
+		<< (programcache::binariesSupported() ? "" : " (not supported by the driver)") << ", "
+		<< (programcache::parallelCompileSupported() ? "parallel" : "serial") << " compiles; submitted in " << shaderSubmitMilliseconds
+		<< " ms, ready " << std::chrono::duration<double, std::milli>(shaderEnd - shaderStart).count() << " ms after, "
+		<< std::chrono::duration<double, std::milli>(shaderEnd - shaderWaitStart).count() << " ms of it waited for" << std::endl;
+
+	// Only lit variants read materials; each model binds its own table to this binding point when it draws. Camera and
+	// light go out once a frame in the other two blocks, whichever variants draw with them.
+	UniformBlockBuffer frameBlock(frameBlockBinding, sizeof(FrameBlock));
+	UniformBlockBuffer lightBlock(lightBlockBinding, sizeof(LightBlock));
+	scene.bindBlock("Materials", materialBlockBinding);
+	scene.bindBlock("Frame", frameBlockBinding);
+	scene.bindBlock("Light", lightBlockBinding);
+
+	// Every model draw of a frame goes through the queue, which sets the per object uniforms itself.
+	RenderQueue renderQueue;
 
 	
 	/* Textures are unused right now.
@@ -120,20 +248,77 @@ int main() {
 	
 
 	// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);  // Uncomment for Wireframe Mode!
-	bool modelCanChange = true;
-	float lastSwap = 0.0f;
 
-	bool loadSuccess = true;
-
-	Shader* shader = &shader1;
-
-	shader->use();
-	shader->setVec3("material.ambient", glm::vec3(0.329412f, 0.223529f, 0.027451f));
-	shader->setVec3("material.diffuse", glm::vec3(0.780392f, 0.568627f, 0.113725f));
-	shader->setVec3("material.specular", glm::vec3(0.992157f, 0.941176f, 0.807843f));
-	shader->setFloat("material.shininess", 27.897f);
-
-	glm::vec3 modelScale(1, 1, 1);
+	// Models are parsed on the loader's thread; the current model keeps rendering until its replacement is on the GPU.
+	ModelLoader loader(loadOptions, assets.getVertexFormat());
+	std::shared_ptr<Model> uploading;
+	int uploadingPreset = -1;
+
+	// Uniform, so the meshlet cones and the bounding sphere hold up under the model matrix.
+	float modelScale = subject->getBoundsRadius() > 0.0f ? displayRadius / subject->getBoundsRadius() : 1.0f;
+
+	// The subject's submeshes go through the same frustum test a big scene would, one object each (or the whole model
+	// as object 0 if it has none).
+	ObjectCuller objectCuller;
+	std::vector<uint32_t> visibleObjects;
+	unsigned int subjectCulledFrames = 0;
+	size_t submeshesCulled = 0;
+	size_t submeshesTested = 0;
+	unsigned int lastSolo = 0;
+	std::vector<uint8_t> visibleSubmeshes;
+
+	// The subject hides the light when it passes behind it.
+	OcclusionCuller occlusionCuller;
+	OcclusionStats occlusionTotals;
+	unsigned int occlusionFrames = 0;
+	DepthView depthView;
+
+	// Frame times per level of detail, reported once a second.
+	std::vector<double> lodSeconds;
+	std::vector<unsigned int> lodFrames;
+	int lastLod = -1;
+	float lastLodReport = 0.0f;
+
+	// Meshlet culling of the full detail level, summed over the same second.
+	MeshletDrawList meshletDraws;
+	CullStats cullTotals;
+	double cullMaxMilliseconds = 0.0;
+	unsigned int cullFrames = 0;
+
+	// Material and texture binds of the subject's draws, over the same second.
+	MaterialBindStats bindTotals;
+	unsigned int bindFrames = 0;
+
+	// Shader::uniformStats() are summed over the same second too, for every program, along with the uploads of the
+	// frame and light blocks and the CPU time from the start of the frame's draws to the swap.
+	unsigned int uniformFrames = 0;
+	size_t blockUploads = 0;
+	double submitMilliseconds = 0.0;
+
+	// Instancing stress test, see stressCounts. The field is culled with its own object culler, one object per copy.
+	struct StressTotals
+	{
+		double seconds = 0.0;
+		double cullMilliseconds = 0.0; // Frustum culling and sorting into levels of detail
+		double drawMilliseconds = 0.0; // Sorting and submitting the frame's draws, streaming the instances included
+		size_t drawn = 0;
+		size_t drawCalls = 0;
+		unsigned int frames = 0;
+	};
+	std::vector<StressTotals> stressTotals;
+	int stressStage = -1; // Index into stressCounts, -1 when the test is not running
+	unsigned int stressFrame = 0;
+	int stressTimedStage = -1; // Stage the last frame counted for, which its deltaTime goes to
+	const Model* stressModel = nullptr; // The field is rebuilt if another model is swapped in during the test
+	float stressScale = 1.0f;
+	ObjectCuller stressCuller;
+	std::vector<Instance> stressField;
+	std::vector<uint32_t> stressVisible;
+	std::vector<std::vector<Instance>> stressLods; // The visible copies by level of detail
+
+	// Triangle of the model on screen last picked, highlighted until the next pick or model swap.
+	const uint32_t noTriangle = std::numeric_limits<uint32_t>::max();
+	uint32_t pickedTriangle = noTriangle;
 
 	// Model Viewer Main Loop
 	// Move with						 [ W A S D]
@@ -141,6 +326,18 @@ int main() {
 	// Cycle through preset models with  [SPACE]
 	// Cycle through preset shaders with [L SHIFT]
 	// Toggle Wireframe Mode with		 [L ALT]
+	// Cycle through auto/forced LODs with [L CTRL]
+	// Toggle meshlet culling with		 [C]
+	// Benchmark object culling with	 [B]
+	// Benchmark the render queue with	 [R]
+	// Self-test the OBJ scanner kernels with [T]
+	// Toggle occlusion culling with	 [O]
+	// Show the occlusion depth buffer with [Z]
+	// Cycle through showing one submesh/all with [H]
+	// Run the instancing stress test with [I]
+	// Pick the triangle under the crosshair with [LEFT MOUSE]
+	std::cout << "Startup: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count()
+		<< " ms to the first frame" << std::endl;
 	while (!glfwWindowShouldClose(window)) {
 
 		float currentFrame = static_cast<float>(glfwGetTime());
@@ -149,6 +346,106 @@ int main() {
 
 		processInput(window);
 
+		// deltaTime is how long the last frame took, so it goes to the level that frame drew.
+		if (lastLod >= 0 && lastLod < static_cast<int>(lodFrames.size())) {
+			lodSeconds[lastLod] += deltaTime;
+			lodFrames[lastLod]++;
+		}
+		if (stressTimedStage >= 0) {
+			stressTotals[stressTimedStage].seconds += deltaTime;
+			// Frame times include waiting for the swap, so with vsync on nothing goes below the refresh interval.
+			if (stressStage < 0) {
+				std::cout << "Instancing stress test:" << std::endl;
+				for (unsigned int i = 0; i < stressCountTotal; i++) {
+					const StressTotals& totals = stressTotals[i];
+					std::cout << "  " << stressCounts[i] << " instances: " << totals.seconds * 1000.0 / totals.frames << " ms/frame, "
+						<< totals.drawn / totals.frames << " drawn after frustum culling in " << totals.drawCalls / totals.frames
+						<< " draw calls, culling " << totals.cullMilliseconds / totals.frames << " ms, submitting the frame "
+						<< totals.drawMilliseconds / totals.frames << " ms" << std::endl;
+				}
+			}
+			stressTimedStage = -1;
+		}
+		if (currentFrame - lastLodReport >= 1.0f) {
+			for (size_t i = 0; i < lodFrames.size(); i++) {
+				if (lodFrames[i] > 0) {
+					std::cout << "LOD " << i << " of " << lodFrames.size() << (lodSetting % (lodFrames.size() + 1) == 0 ? " (auto): " : " (forced): ")
+						<< subject->lodTriangles(static_cast<unsigned int>(i)) << " triangles, " << lodFrames[i] << " frames, "
+						<< lodSeconds[i] * 1000.0 / lodFrames[i] << " ms/frame" << std::endl;
+				}
+			}
+			if (cullFrames > 0) {
+				std::cout << "Meshlets: " << cullFrames << " frames, " << cullTotals.meshlets / cullFrames << " per frame, "
+					<< cullTotals.culledFraction() * 100.0f << "% culled (" << cullTotals.frustumCulled * 100.0f / cullTotals.meshlets << "% frustum, "
+					<< cullTotals.backfaceCulled * 100.0f / cullTotals.meshlets << "% back facing), " << cullTotals.drawRanges / cullFrames
+					<< " draws, culling " << cullTotals.milliseconds / cullFrames << " ms/frame (" << cullMaxMilliseconds << " max)" << std::endl;
+			}
+			if (bindFrames > 0) {
+				std::cout << "Materials: " << static_cast<double>(bindTotals.materialBinds) / bindFrames << " material binds, "
+					<< static_cast<double>(bindTotals.textureBinds) / bindFrames << " texture binds, "
+					<< static_cast<double>(bindTotals.multiDraws) / bindFrames << " multi-draws per frame" << std::endl;
+			}
+			if (uniformFrames > 0) {
+				const UniformStats& uniformStats = Shader::uniformStats();
+				std::cout << "Uniforms: " << static_cast<double>(uniformStats.uploads) / uniformFrames << " uploads, "
+					<< static_cast<double>(uniformStats.skipped) / uniformFrames << " unchanged values skipped, "
+					<< static_cast<double>(uniformStats.missing) / uniformFrames << " sets of missing uniforms, "
+					<< static_cast<double>(blockUploads) / uniformFrames << " block uploads per frame, CPU submit "
+					<< submitMilliseconds / uniformFrames << " ms/frame" << std::endl;
+				std::cout << "Shader variants: " << scene.compiledCount() << " compiled (" << scene.stats().compiled << " in the last second)" << std::endl;
+				const RenderQueueStats& queueStats = renderQueue.stats();
+				std::cout << "Render queue: " << static_cast<double>(queueStats.packets) / uniformFrames << " packets, "
+					<< static_cast<double>(queueStats.programSwitches) / uniformFrames << " program switches per frame, sort "
+					<< queueStats.sortMilliseconds / uniformFrames << " ms/frame, submit " << queueStats.submitMilliseconds / uniformFrames
+					<< " ms/frame" << std::endl;
+				const GlStateStats& glStats = glState.stats();
+				std::cout << "GL state: " << static_cast<double>(glStats.issued) / uniformFrames << " calls issued, "
+					<< static_cast<double>(glStats.elided) / uniformFrames << " redundant ones dropped per frame";
+				if (checkGlState) {
+					std::cout << ", " << glStats.mismatches << " mismatches";
+				}
+				std::cout << std::endl;
+			}
+			const AssetRegistry::Stats& assetStats = assets.stats();
+			std::cout << "Assets: " << assetStats.hits << " hits, " << assetStats.misses << " misses, " << assetStats.evictions << " evictions so far, "
+				<< assetStats.residentModels << " resident (" << assetStats.residentGpuBytes / (1024 * 1024) << " MB GPU, "
+				<< assetStats.residentCpuBytes / (1024 * 1024) << " MB CPU)" << std::endl;
+			if (subjectCulledFrames > 0) {
+				std::cout << "Model outside the frustum for " << subjectCulledFrames << " frames" << std::endl;
+			}
+			if (submeshesCulled > 0) {
+				std::cout << "Submeshes: " << submeshesCulled << " of " << submeshesTested << " outside the frustum" << std::endl;
+			}
+			if (occlusionFrames > 0) {
+				std::cout << "Occlusion: " << occlusionFrames << " frames, " << occlusionTotals.rasterizedTriangles / occlusionFrames << " of "
+					<< occlusionTotals.occluderTriangles / occlusionFrames << " occluder triangles rasterized, " << occlusionTotals.occluded << " of "
+					<< occlusionTotals.tested << " objects culled, rasterizer " << occlusionTotals.rasterMilliseconds / occlusionFrames
+					<< " ms/frame (" << occlusionTotals.waitMilliseconds / occlusionFrames << " ms waited for), tests "
+					<< occlusionTotals.testMilliseconds / occlusionFrames << " ms/frame" << std::endl;
+			}
+			lodSeconds.assign(subject->lodCount(), 0.0);
+			lodFrames.assign(subject->lodCount(), 0);
+			lastLodReport = currentFrame;
+			subjectCulledFrames = 0;
+			submeshesCulled = 0;
+			submeshesTested = 0;
+			occlusionTotals = OcclusionStats();
+			occlusionFrames = 0;
+			cullTotals = CullStats();
+			cullMaxMilliseconds = 0.0;
+			cullFrames = 0;
+			bindTotals = MaterialBindStats();
+			bindFrames = 0;
+			Shader::resetUniformStats();
+			scene.resetStats();
+			renderQueue.resetStats();
+			glState.resetStats();
+			uniformFrames = 0;
+			blockUploads = 0;
+			submitMilliseconds = 0.0;
+		}
+		uniformFrames++;
+
 		glm::vec3 background(0.1f, 0.1f, 0.1f);
 
 		// Rendering
@@ -156,166 +453,322 @@ int main() {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Model Swapping
-		if (!canSwitchModel) {
-			switch (currentModel % 9) {
-			case 0:
-				loadSuccess = subject.loadOBJ("./monkey.obj");
-				shader->use();
-				shader->setVec3("material.ambient", glm::vec3(0.329412f, 0.223529f, 0.027451f));
-				shader->setVec3("material.diffuse", glm::vec3(0.780392f, 0.568627f, 0.113725f));
-				shader->setVec3("material.specular", glm::vec3(0.992157f, 0.941176f, 0.807843f));
-				shader->setFloat("material.shininess", 27.897f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(1.0f);
-				break;
-			case 1:
-				// Normal averaging process seems to have made the "patching" effect less noticable on the sphere.
-				loadSuccess = subject.loadOBJ("./sphere.obj");
-				shader->use();
-				shader->setVec3("material.ambient", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.diffuse", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader->setFloat("material.shininess", 32.0f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(1.0f);
-				break;
-			case 2:
-				// Normal Averaging seems to have fixed the polar lighting on the cube. Still not too happy with the interpolation of normals for these low-poly models.
-				loadSuccess = subject.loadOBJ("./cube.obj");
-				shader->use();
-				shader->setVec3("material.ambient", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.diffuse", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader->setFloat("material.shininess", 32.0f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(1.0f);
-				break;
-			case 3:
-				loadSuccess = subject.loadOBJ("./multiple.obj");
-				shader->use();
-				shader->setVec3("material.ambient", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.diffuse", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader->setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader->setFloat("material.shininess", 32.0f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(1.0f);
-				break;
-			case 4: // The bunny, cow and dragon don't come with prepackaged normals, so are fairly boring to look at. May have to start calculating my own normals.
-				// Bunny is tiny
-				loadSuccess = subject.loadOBJ("./stanford-bunny.obj");
-				shader->use();
-				shader->setVec3("material.ambient", glm::vec3(0.25f, 0.20725f, 0.20725f));
-				shader->setVec3("material.diffuse", glm::vec3(1.0f, 0.829f, 0.829f));
-				shader->setVec3("material.specular", glm::vec3(0.296648f, 0.296648f, 0.296648f));
-				shader->setFloat("material.shininess", 11.264f);
-				modelScale = glm::vec3(10.0f);
-				canSwitchModel = true;
-				break;
-			case 5:
-				loadSuccess = subject.loadOBJ("./cow.obj");
-				shader1.use();
-				shader1.setVec3("material.ambient", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader1.setVec3("material.diffuse", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader1.setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader1.setFloat("material.shininess", 32.0f);
-				modelScale = glm::vec3(0.3f);
-				canSwitchModel = true;
-				break;
-			case 6:
-				// Dragon and beetle seem to be most affected by the strange rippling due to the normal averaging.
-				loadSuccess = subject.loadOBJ("./beetle.obj");
-				shader1.use();
-				shader1.setVec3("material.ambient", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader1.setVec3("material.diffuse", glm::vec3(1.0f, 0.5f, 0.31f));
-				shader1.setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader1.setFloat("material.shininess", 32.0f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(2.0f);
-				break;
-			case 7:
-				loadSuccess = subject.loadOBJ("./xyzrgb_dragon.obj");
-				shader1.use();
-				shader1.setVec3("material.ambient", glm::vec3(0.135f, 0.2225f, 0.1575f));
-				shader1.setVec3("material.diffuse", glm::vec3(0.54f, 0.89f, 0.63f));
-				shader1.setVec3("material.ambient", glm::vec3(0.316228f, 0.316228f, 0.316228f));
-				shader1.setFloat("material.shininess", 12.8f);
-				modelScale = glm::vec3(0.01f);
-				canSwitchModel = true;
-				break;
-			default:
-				// Shoutout to Valve :)
-				loadSuccess = subject.loadOBJ("./error.obj");
-				shader1.use();
-				shader1.setVec3("material.ambient", glm::vec3(1.0f, 0.0f, 0.0f));
-				shader1.setVec3("material.diffuse", glm::vec3(1.0f, 0.0f, 0.0f));
-				shader1.setVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-				shader1.setFloat("material.shininess", 32.0f);
-				canSwitchModel = true;
-				modelScale = glm::vec3(1.0f);
-				break;
+		// canSwitchModel stays false from the key press until the new model has been swapped in.
+		// Models that are still resident swap in immediately.
+		if (!canSwitchModel && !loader.busy() && uploadingPreset < 0) {
+			unsigned int preset = currentModel % presetCount;
+			std::shared_ptr<Model> resident = assets.find(presets[preset]);
+			if (resident) {
+				uploading = resident;
+				uploadingPreset = static_cast<int>(preset);
+			}
+			else {
+				loader.request(presets[preset], static_cast<int>(preset));
 			}
 		}
 
-		// Shader swapping
-		if (!canSwitchShader) {
-			switch (currentShader % 3) {
-			case 0:
-				shader = &shader1;
-				canSwitchShader = true;
-				break;
-			case 1:
-				shader = &normals;
-				canSwitchShader = true;
-				break;
-			default:
-				shader = &lightSource;
-				canSwitchShader = true;
-				break;
+		ModelLoader::Result loaded;
+		if (loader.poll(loaded)) {
+			if (loaded.success) {
+				uploading = assets.insert(loaded.path, loaded.sourceHash, std::move(loaded.mesh), std::move(loaded.packed));
+				uploadingPreset = loaded.tag;
+			}
+			else if (loaded.tag != static_cast<int>(errorPreset)) {
+				// Load error model if load failed
+				loader.request(presets[errorPreset], static_cast<int>(errorPreset));
+			}
+			else {
+				canSwitchModel = true;
 			}
 		}
 
-		// Load error model if load failed
-		if (!loadSuccess) {
-			loadSuccess = subject.loadOBJ("./error.obj");
+		if (uploading && (!uploading->isUploading() || uploading->continueUpload(uploadBytesPerFrame))) {
+			subject = std::move(uploading);
+			modelScale = subject->getBoundsRadius() > 0.0f ? displayRadius / subject->getBoundsRadius() : 1.0f;
+			uploadingPreset = -1;
+			canSwitchModel = true;
+			lodSeconds.assign(subject->lodCount(), 0.0);
+			lodFrames.assign(subject->lodCount(), 0);
+			lastLod = -1;
+			pickedTriangle = noTriangle;
+			soloSetting = 0;
+			lastSolo = 0;
 		}
 
 		// glBindTexture(GL_TEXTURE_2D, texture1);
 
 		glm::vec3 lightPosition = glm::vec3(5.0f * glm::sin(currentFrame), 2.0f* glm::cos(currentFrame), 3.0f);
 
-		shader->use();
-
-		shader->setVec3("light.position", lightPosition);
-		shader->setVec3("light.diffuse", glm::vec3(0.7f));
-		shader->setVec3("light.ambient", 0.5f * background);
-		shader->setVec3("light.specular", glm::vec3(1.0f));
-		shader->setVec3("viewPos", camera.Position);
+		auto submitStart = std::chrono::steady_clock::now();
+		uint32_t shading = shadingModes[currentShader % 3];
+		Shader& shader = scene.get(shading);
 
-		// pass projection matrix to shader (note that in this case it could change every frame)
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
-		shader->setMat4("projection", projection);
-		
+		LightBlock lightData;
+		lightData.position = glm::vec4(lightPosition, 1.0f);
+		lightData.diffuse = glm::vec4(glm::vec3(0.7f), 0.0f);
+		lightData.ambient = glm::vec4(0.5f * background, 0.0f);
+		lightData.specular = glm::vec4(glm::vec3(1.0f), 0.0f);
+		blockUploads += lightBlock.update(&lightData);
 
-		// camera/view transformation
+		// projection (note that in this case it could change every frame) and camera/view transformation
+		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE);
 		glm::mat4 view = camera.GetViewMatrix();
-		shader->setMat4("view", view);
+		FrameBlock frameData;
+		frameData.projection = projection;
+		frameData.view = view;
+		frameData.viewProjection = projection * view;
+		frameData.viewPos = glm::vec4(camera.Position, 1.0f);
+		blockUploads += frameBlock.update(&frameData);
+
+		if (benchmarkRequested) {
+			benchmarkRequested = false;
+			benchmarkObjectCulling(projection, view);
+		}
+		if (scannerTestRequested) {
+			scannerTestRequested = false;
+			obj::selfTest();
+		}
+		if (queueBenchmarkRequested) {
+			queueBenchmarkRequested = false;
+			benchmarkRenderQueue(*subject, { &scene.get(phongFeatures), &scene.get(normalFeatures), &scene.get(unlitFeatures) },
+				view, NEAR_PLANE, FAR_PLANE);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+		renderQueue.begin(view, NEAR_PLANE, FAR_PLANE);
 
-		glm::mat4 model = glm::scale(glm::mat4(1.0f), modelScale);
+		// Spins around the center of its bounds rather than wherever the file put its origin.
+		glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(modelScale));
 		model = glm::rotate(model, currentFrame, glm::vec3(0.f, 1.f, 0.f));
-		shader->setMat4("model", model);
-		subject.render(*shader);
+		model = glm::translate(model, -subject->getBoundsCenter());
+
+		// The occluders are rasterized on the culler's thread while this one culls and draws the subject. Any model swap
+		// for this frame has already happened, so the occluder's arrays stay put until finish().
+		if (occlusionCulling) {
+			occlusionCuller.begin(projection * view, { subject->getOccluder(occluderTriangles, model) });
+		}
+
+		glm::vec3 boundsMin = subject->getBoundsMin();
+		glm::vec3 boundsMax = subject->getBoundsMax();
+		size_t submeshCount = subject->submeshCount();
+		if (objectCuller.size() != std::max<size_t>(submeshCount, 1)) {
+			objectCuller.clear();
+			for (size_t i = 0; i < std::max<size_t>(submeshCount, 1); i++) {
+				objectCuller.add(ObjectBounds());
+			}
+		}
+		if (submeshCount == 0) {
+			objectCuller.set(0, ObjectBounds::transform(boundsMin, boundsMax, subject->getBoundsRadius(), model));
+		}
+		for (size_t i = 0; i < submeshCount; i++) {
+			const Submesh& submesh = subject->getSubmesh(i);
+			objectCuller.set(static_cast<uint32_t>(i), ObjectBounds::transform(submesh.boundsMin, submesh.boundsMax, submesh.radius, model));
+		}
+		objectCuller.cull(projection, view, visibleObjects);
+
+		// Submeshes that are culled or not soloed are left out of the subject's draw below.
+		unsigned int solo = soloSetting % (static_cast<unsigned int>(submeshCount) + 1);
+		if (solo != lastSolo) {
+			if (solo == 0) {
+				std::cout << "Showing all " << submeshCount << " submeshes" << std::endl;
+			}
+			else {
+				const Submesh& submesh = subject->getSubmesh(solo - 1);
+				std::cout << "Showing submesh " << solo - 1 << " \"" << submesh.name << "\" (material \""
+					<< subject->getMaterialName(submesh.material) << "\") only" << std::endl;
+			}
+			lastSolo = solo;
+		}
+		visibleSubmeshes.assign(submeshCount, 0);
+		bool subjectVisible = false;
+		for (uint32_t object : visibleObjects) {
+			if (submeshCount == 0 || solo == 0 || object == solo - 1) {
+				if (submeshCount > 0) {
+					visibleSubmeshes[object] = 1;
+				}
+				subjectVisible = true;
+			}
+		}
+		subjectCulledFrames += visibleObjects.empty() ? 1 : 0;
+		submeshesTested += submeshCount;
+		submeshesCulled += submeshCount - std::min(submeshCount, visibleObjects.size());
+
+		// Level of detail from the size of the bounding sphere on screen. The LOD errors are relative to the sphere
+		// around the box's corners, so that is the one that goes through the same transform as the mesh here.
+		glm::vec3 sphereCenter = glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+		float sphereRadius = 0.5f * glm::length(boundsMax - boundsMin) * modelScale;
+		float projectedRadius = projectedSphereRadius(sphereCenter, sphereRadius);
+
+		unsigned int lodCount = subject->lodCount();
+		unsigned int forcedLod = lodSetting % (lodCount + 1);
+		unsigned int lod = forcedLod > 0 ? forcedLod - 1 : subject->selectLod(projectedRadius);
+		// Meshlets only cover the full detail level, the coarser ones are small enough to draw whole.
+		// Skipped whole while its bounds are outside the frustum.
+		subject->resetBindStats();
+		if (subjectVisible) {
+			if (lod == 0 && meshletCulling) {
+				CullStats culled = subject->cullMeshlets(model, projection * view, camera.Position, meshletDraws);
+				renderQueue.addModel(RenderPass::Opaque, shader, *subject, model, lod, &meshletDraws, &visibleSubmeshes);
+				if (culled.meshlets > 0) {
+					cullTotals.meshlets += culled.meshlets;
+					cullTotals.frustumCulled += culled.frustumCulled;
+					cullTotals.backfaceCulled += culled.backfaceCulled;
+					cullTotals.drawRanges += culled.drawRanges;
+					cullTotals.milliseconds += culled.milliseconds;
+					cullMaxMilliseconds = std::max(cullMaxMilliseconds, culled.milliseconds);
+					cullFrames++;
+				}
+			}
+			else {
+				renderQueue.addModel(RenderPass::Opaque, shader, *subject, model, lod, nullptr, &visibleSubmeshes);
+			}
+		}
+		lastLod = static_cast<int>(lod);
+
+		// The stress test's field: copies of the subject laid out on a grid below the camera, each with its own level of
+		// detail, drawn with one renderInstanced call per level.
+		double stressCullMilliseconds = 0.0;
+		if (stressRequested) {
+			stressRequested = false;
+			if (stressStage < 0) {
+				stressStage = 0;
+				stressFrame = 0;
+				stressTotals.assign(stressCountTotal, StressTotals());
+			}
+		}
+		if (stressStage >= 0) {
+			size_t count = stressCounts[stressStage];
+			if (stressFrame == 0 || stressModel != subject.get()) {
+				size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+				float spacing = stressFieldSize / side;
+				// Bounding spheres at 0.4 of the spacing, so neighbours never touch.
+				stressScale = subject->getBoundsRadius() > 0.0f ? 0.4f * spacing / subject->getBoundsRadius() : 1.0f;
+				stressModel = subject.get();
+				stressField.resize(count);
+				stressCuller.clear();
+				stressCuller.reserve(count);
+				for (size_t i = 0; i < count; i++) {
+					float column = static_cast<float>(i % side);
+					glm::mat4 instance = glm::translate(glm::mat4(1.0f), glm::vec3((column + 0.5f) * spacing - 0.5f * stressFieldSize, -2.0f,
+						-5.0f - (i / side + 0.5f) * spacing));
+					// The golden angle, so neighbours never face the same way.
+					instance = glm::rotate(instance, i * 2.39996f, glm::vec3(0.0f, 1.0f, 0.0f));
+					instance = glm::scale(instance, glm::vec3(stressScale));
+					instance = glm::translate(instance, -subject->getBoundsCenter());
+					stressField[i].model = instance;
+					stressField[i].color = glm::vec4(glm::mix(glm::vec3(1.0f, 0.6f, 0.6f), glm::vec3(0.6f, 0.6f, 1.0f), column / side), 1.0f);
+					stressCuller.add(ObjectBounds::transform(boundsMin, boundsMax, subject->getBoundsRadius(), instance));
+				}
+			}
+
+			auto cullStart = std::chrono::steady_clock::now();
+			stressCuller.cull(projection, view, stressVisible);
+			stressLods.resize(lodCount);
+			for (std::vector<Instance>& instances : stressLods) {
+				instances.clear();
+			}
+			float instanceRadius = 0.5f * glm::length(boundsMax - boundsMin) * stressScale;
+			for (uint32_t i : stressVisible) {
+				// The field's transforms move the center of the bounds to their translation.
+				unsigned int instanceLod = forcedLod > 0 ? forcedLod - 1
+					: subject->selectLod(projectedSphereRadius(glm::vec3(stressField[i].model[3]), instanceRadius));
+				stressLods[std::min(instanceLod, lodCount - 1)].push_back(stressField[i]);
+			}
+
+			stressCullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+			Shader& instanced = scene.get(shading | shaderfeature::instancing);
+			for (unsigned int level = 0; level < lodCount; level++) {
+				renderQueue.addInstances(RenderPass::Opaque, instanced, *subject, stressLods[level].data(), stressLods[level].size(), level);
+			}
+		}
+
+		// The cursor is captured, so picking goes straight through the middle of the screen. The ray is taken into the
+		// model's own space, where the BVH is, instead of moving the BVH.
+		if (pickRequested) {
+			pickRequested = false;
+			glm::mat4 toModel = glm::inverse(model);
+			glm::vec3 origin = glm::vec3(toModel * glm::vec4(camera.Position, 1.0f));
+			glm::vec3 direction = glm::vec3(toModel * glm::vec4(camera.Front, 0.0f));
+			BvhRayHit hit;
+			auto pickStart = std::chrono::steady_clock::now();
+			bool picked = subject->getBvh().raycast(origin, direction, std::numeric_limits<float>::max(), hit);
+			double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pickStart).count();
+			if (picked) {
+				pickedTriangle = hit.triangle;
+				std::cout << "Picked triangle " << hit.triangle << " at distance " << hit.distance * glm::length(camera.Front) << " in "
+					<< microseconds << " us" << std::endl;
+			}
+			else {
+				pickedTriangle = noTriangle;
+				std::cout << "Picked nothing in " << microseconds << " us" << std::endl;
+			}
+		}
+
+		// Drawn over the model at full detail, whatever level the model itself is at. The offset pulls it in front of the
+		// same triangle already in the depth buffer.
+		Shader& unlit = scene.get<unlitFeatures>();
+		if (subjectVisible && pickedTriangle != noTriangle) {
+			renderQueue.addTriangle(RenderPass::Decal, unlit, *subject, pickedTriangle, model);
+		}
 
-		lightSource.use();
-		lightSource.setMat4("projection", projection);
-		lightSource.setMat4("view", view);
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, lightPosition);
 		model = glm::scale(model, glm::vec3(0.2f));
-		lightSource.setMat4("model", model);
 
-		lightSource.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
-		light.render(lightSource);
+		bool lightVisible = true;
+		if (occlusionCulling) {
+			occlusionCuller.finish();
+			lightVisible = occlusionCuller.isVisible(ObjectBounds::transform(light->getBoundsMin(), light->getBoundsMax(), light->getBoundsRadius(), model));
+
+			const OcclusionStats& occlusion = occlusionCuller.stats();
+			occlusionTotals.occluderTriangles += occlusion.occluderTriangles;
+			occlusionTotals.rasterizedTriangles += occlusion.rasterizedTriangles;
+			occlusionTotals.tested += occlusion.tested;
+			occlusionTotals.occluded += occlusion.occluded;
+			occlusionTotals.rasterMilliseconds += occlusion.rasterMilliseconds;
+			occlusionTotals.waitMilliseconds += occlusion.waitMilliseconds;
+			occlusionTotals.testMilliseconds += occlusion.testMilliseconds;
+			occlusionFrames++;
+		}
 
+		if (lightVisible) {
+			renderQueue.addModel(RenderPass::Opaque, unlit, *light, model);
+		}
+
+		auto queueStart = std::chrono::steady_clock::now();
+		renderQueue.submit();
+		double queueMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queueStart).count();
+
+		const MaterialBindStats& binds = subject->bindStats();
+		bindTotals.materialBinds += binds.materialBinds;
+		bindTotals.textureBinds += binds.textureBinds;
+		bindTotals.multiDraws += binds.multiDraws;
+		bindFrames++;
+
+		// The field went out with the rest of the frame's packets, so its frame is only counted once they are submitted.
+		if (stressStage >= 0) {
+			if (stressFrame >= stressWarmupFrames) {
+				StressTotals& totals = stressTotals[stressStage];
+				totals.cullMilliseconds += stressCullMilliseconds;
+				totals.drawMilliseconds += queueMilliseconds;
+				totals.drawn += stressVisible.size();
+				totals.drawCalls += binds.instancedDraws;
+				totals.frames++;
+				stressTimedStage = stressStage;
+			}
+			if (++stressFrame == stressWarmupFrames + stressFrames) {
+				stressFrame = 0;
+				if (++stressStage == static_cast<int>(stressCountTotal)) {
+					stressStage = -1;
+					stressModel = nullptr;
+				}
+			}
+		}
+
+		if (occlusionCulling && showOcclusionDepth) {
+			depthView.draw(depthViewShader, occlusionCuller.depth(), occlusionWidth, occlusionHeight, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		}
+
+		submitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
@@ -324,7 +777,6 @@ int main() {
 	return 0;
 }
 
-
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow* window)
@@ -355,19 +807,59 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 
 	if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_PRESS) 
 	{
-		if (canSwitchShader) {
-			// std::cout << "Switching Shader!" << std::endl;
-			currentShader++;
-			canSwitchShader = false;
-		}
+		// std::cout << "Switching Shader!" << std::endl;
+		currentShader++; // See shadingModes
+	}
+
+	if (key == GLFW_KEY_LEFT_CONTROL && action == GLFW_PRESS) {
+		lodSetting++;
+	}
+
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		meshletCulling = !meshletCulling;
+	}
+
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		benchmarkRequested = true;
+	}
+
+	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		queueBenchmarkRequested = true;
+	}
+
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		scannerTestRequested = true;
+	}
+
+	if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		occlusionCulling = !occlusionCulling;
+	}
+
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+		showOcclusionDepth = !showOcclusionDepth;
+	}
+
+	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		soloSetting++;
+	}
+
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		stressRequested = true;
 	}
 
 	if (key == GLFW_KEY_LEFT_ALT && action == GLFW_PRESS) {
-		toggleWireframe ? glPolygonMode(GL_FRONT_AND_BACK, GL_LINE) : glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		GlState::current().polygonMode(toggleWireframe ? GL_LINE : GL_FILL);
 		toggleWireframe = !toggleWireframe;
 	}
 }
 
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+		pickRequested = true;
+	}
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -406,4 +898,15 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	camera.ProcessMouseScroll(static_cast<float>(yoffset));
+}
+
+// Radius in pixels of a bounding sphere on screen, for picking a level of detail. Inside the sphere it covers everything.
+// ----------------------------------------------------------------------
+float projectedSphereRadius(const glm::vec3& center, float radius)
+{
+	float distance = glm::length(center - camera.Position);
+	if (distance <= radius) {
+		return std::numeric_limits<float>::max();
+	}
+	return radius / std::sqrt(distance * distance - radius * radius) / std::tan(glm::radians(camera.Zoom) * 0.5f) * (HEIGHT * 0.5f);
 }
\ No newline at end of file
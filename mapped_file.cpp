@@ -0,0 +1,110 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : fileData(nullptr), fileSize(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) { }
+#else
+MappedFile::MappedFile() : fileData(nullptr), fileSize(0), fd(-1) { }
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fileHandle, &size)) {
+		close();
+		return false;
+	}
+	fileSize = static_cast<size_t>(size.QuadPart);
+
+	// Mapping an empty file fails, but an empty file is still a valid (empty) model.
+	if (fileSize == 0) {
+		return true;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == nullptr) {
+		close();
+		return false;
+	}
+
+	fileData = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (fileData == nullptr) {
+		close();
+		return false;
+	}
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close();
+		return false;
+	}
+	fileSize = static_cast<size_t>(st.st_size);
+
+	if (fileSize == 0) {
+		return true;
+	}
+
+	void* view = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) {
+		close();
+		return false;
+	}
+	// The whole file is read front to back exactly once.
+	madvise(view, fileSize, MADV_SEQUENTIAL);
+	fileData = static_cast<const char*>(view);
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (fileData) {
+		UnmapViewOfFile(fileData);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+	}
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (fileData) {
+		munmap(const_cast<char*>(fileData), fileSize);
+	}
+	if (fd >= 0) {
+		::close(fd);
+	}
+	fd = -1;
+#endif
+	fileData = nullptr;
+	fileSize = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of an entire file.
+// The mapped bytes stay valid until close() is called or the object is destroyed.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	const char* data() const { return fileData; }
+	size_t size() const { return fileSize; }
+	const char* end() const { return fileData + fileSize; }
+
+private:
+	const char* fileData;
+	size_t fileSize;
+
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+};
+
+#endif
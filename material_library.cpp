@@ -0,0 +1,173 @@
+#include "material_library.h"
+#include "mapped_file.h"
+#include "obj_scanner.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+void trim(const char*& p, const char*& end) {
+	while (p < end && isSpace(*p)) {
+		p++;
+	}
+	while (end > p && isSpace(end[-1])) {
+		end--;
+	}
+}
+
+// Matches word and the whitespace after it at the start of [p, end), and moves p past both.
+bool keyword(const char*& p, const char* end, const char* word) {
+	size_t length = std::strlen(word);
+	if (static_cast<size_t>(end - p) <= length || std::memcmp(p, word, length) != 0 || !isSpace(p[length])) {
+		return false;
+	}
+	p += length;
+	while (p < end && isSpace(*p)) {
+		p++;
+	}
+	return true;
+}
+
+int countTokens(const char* p, const char* end) {
+	int count = 0;
+	bool inToken = false;
+	for (; p < end; p++) {
+		if (!isSpace(*p) && !inToken) {
+			count++;
+		}
+		inToken = !isSpace(*p);
+	}
+	return count;
+}
+
+inline bool startsNumber(const char* p, const char* end) {
+	return p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.');
+}
+
+// Ka r g b, where a lone r stands for all three. The 'spectral' and 'xyz' forms have no RGB to read and are skipped.
+void parseColor(const char* p, const char* end, glm::vec3& color, const obj::ScanKernels& kernels) {
+	if (!startsNumber(p, end)) {
+		return;
+	}
+	float values[3];
+	kernels.parseFloats(p, end, values, 3);
+	color = countTokens(p, end) >= 3 ? glm::vec3(values[0], values[1], values[2]) : glm::vec3(values[0]);
+}
+
+float parseScalar(const char* p, const char* end, float fallback, const obj::ScanKernels& kernels) {
+	if (!startsNumber(p, end)) {
+		return fallback;
+	}
+	float value;
+	kernels.parseFloats(p, end, &value, 1);
+	return value;
+}
+
+// map_Kd [-option values...] file
+// Options come first, so with any there the file is the last token. Without them the whole rest of the line is the
+// file, spaces and all.
+std::string parseMapFile(const char* p, const char* end) {
+	if (p < end && *p == '-') {
+		const char* last = end;
+		while (last > p && !isSpace(last[-1])) {
+			last--;
+		}
+		p = last;
+	}
+	return std::string(p, end - p);
+}
+
+}
+
+namespace mtl
+{
+	void parse(const char* begin, const char* end, const std::string& directory, std::vector<Material>& materials) {
+		const obj::ScanKernels& kernels = obj::bestScanKernels();
+		bool inMaterial = false;
+
+		const char* line = begin;
+		while (line < end) {
+			const char* lineEnd = kernels.findNewline(line, end);
+			const char* p = line;
+			const char* e = lineEnd;
+			trim(p, e);
+
+			if (keyword(p, e, "newmtl")) {
+				materials.emplace_back();
+				materials.back().name.assign(p, e - p);
+				inMaterial = true;
+			}
+			else if (inMaterial) {
+				// Properties before the first 'newmtl' have nothing to go to.
+				Material& material = materials.back();
+				if (keyword(p, e, "Ka")) {
+					parseColor(p, e, material.ambient, kernels);
+				}
+				else if (keyword(p, e, "Kd")) {
+					parseColor(p, e, material.diffuse, kernels);
+				}
+				else if (keyword(p, e, "Ks")) {
+					parseColor(p, e, material.specular, kernels);
+				}
+				else if (keyword(p, e, "Ns")) {
+					material.shininess = parseScalar(p, e, material.shininess, kernels);
+				}
+				else if (keyword(p, e, "d")) {
+					material.opacity = parseScalar(p, e, material.opacity, kernels);
+				}
+				else if (keyword(p, e, "Tr")) {
+					material.opacity = 1.0f - parseScalar(p, e, 1.0f - material.opacity, kernels);
+				}
+				else if (keyword(p, e, "map_Kd")) {
+					std::string file = parseMapFile(p, e);
+					material.diffuseMap = file.empty() ? file : directory + file;
+				}
+			}
+
+			line = lineEnd + 1;
+		}
+	}
+
+	bool load(const std::string& path, std::vector<Material>& materials) {
+		MappedFile file;
+		if (!file.open(path)) {
+			return false;
+		}
+		parse(file.data(), file.end(), directoryOf(path), materials);
+		return true;
+	}
+
+	bool loadTexture(const std::string& path, TextureImage& image) {
+		// Four channels whatever the file has, so every texture uploads the same way.
+		int width = 0, height = 0, channels = 0;
+		unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!data) {
+			return false;
+		}
+
+		// stb_image starts at the top row. Flipping here rather than with stbi_set_flip_vertically_on_load keeps the loader
+		// thread off stb_image's global state.
+		size_t rowBytes = static_cast<size_t>(width) * 4;
+		image.pixels.resize(rowBytes * height);
+		for (int y = 0; y < height; y++) {
+			std::memcpy(image.pixels.data() + y * rowBytes, data + (height - 1 - y) * rowBytes, rowBytes);
+		}
+		stbi_image_free(data);
+
+		image.path = path;
+		image.width = width;
+		image.height = height;
+		return true;
+	}
+
+	std::string directoryOf(const std::string& path) {
+		size_t separator = path.find_last_of("/\\");
+		return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef MATERIAL_LIBRARY_H
+#define MATERIAL_LIBRARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+// One 'newmtl' block of an MTL file, as the Phong shader uses it. The defaults are what faces get whose material no
+// library defines.
+struct Material
+{
+	std::string name;
+	glm::vec3 ambient = glm::vec3(1.0f, 0.5f, 0.31f); // 'Ka'
+	glm::vec3 diffuse = glm::vec3(1.0f, 0.5f, 0.31f); // 'Kd'
+	glm::vec3 specular = glm::vec3(0.5f);             // 'Ks'
+	float shininess = 32.0f; // 'Ns'
+	float opacity = 1.0f;    // 'd', or 1 - 'Tr'
+	std::string diffuseMap;  // 'map_Kd', made relative to the working directory like the OBJ path. Empty if there is none
+	int32_t texture = -1;    // Index into MeshData::textures, -1 without a diffuse map or if it could not be read
+};
+
+// A decoded diffuse map, waiting for upload.
+struct TextureImage
+{
+	std::string path;
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels; // RGBA, bottom row first the way glTexImage2D takes them
+};
+
+// MTL reader. Like the OBJ parser it works on the mapped bytes of the file, one line at a time, with no per-line allocations;
+// only the keywords the shaders have a use for are read, everything else is skipped.
+namespace mtl
+{
+	// Appends the materials defined in [begin, end). Texture paths are taken relative to directory, which is either
+	// empty or ends in a separator.
+	void parse(const char* begin, const char* end, const std::string& directory, std::vector<Material>& materials);
+
+	// Maps and parses one MTL file. Returns false if it cannot be opened.
+	bool load(const std::string& path, std::vector<Material>& materials);
+
+	// Decodes an image file into image (see TextureImage). Returns false if stb_image cannot read it.
+	bool loadTexture(const std::string& path, TextureImage& image);
+
+	// Everything up to and including the last '/' or '\\' of path, or "" if it has none.
+	std::string directoryOf(const std::string& path);
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char magic[4] = { 'M', 'V', 'M', 'C' };
+
+// Takes count elements of type T off the bytes left, if there are that many. The counts come from the file, so each is
+// checked against what is left before it is multiplied, and a crafted header cannot wrap the sum around to the file size.
+template <typename T>
+bool consume(uint64_t count, uint64_t& remaining) {
+	if (count > remaining / sizeof(T)) {
+		return false;
+	}
+	remaining -= count * sizeof(T);
+	return true;
+}
+
+// True if the arrays the header describes fill exactly payloadBytes.
+bool payloadMatches(const meshcache::Header& header, uint64_t payloadBytes) {
+	uint64_t remaining = payloadBytes;
+	return consume<glm::vec3>(header.vertexCount, remaining) && consume<glm::vec3>(header.normalCount, remaining)
+		&& consume<glm::vec2>(header.texCoordCount, remaining) && consume<unsigned int>(header.indexCount, remaining)
+		&& consume<MeshLod>(header.lodCount, remaining) && consume<Meshlet>(header.meshletCount, remaining)
+		&& consume<SubmeshRange>(header.submeshRangeCount, remaining) && consume<meshcache::SubmeshRecord>(header.submeshCount, remaining)
+		&& consume<Bvh::Node>(header.bvhNodeCount, remaining) && consume<glm::vec3>(header.bvhTriangleCount, remaining)
+		&& consume<glm::vec3>(header.bvhTriangleCount, remaining) && consume<glm::vec3>(header.bvhTriangleCount, remaining)
+		&& consume<uint32_t>(header.bvhTriangleCount, remaining) && consume<char>(header.nameBytes, remaining) && remaining == 0;
+}
+
+template <typename T>
+void writeArray(std::ofstream& out, const std::vector<T>& values) {
+	if (!values.empty()) {
+		out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+	}
+}
+
+}
+
+namespace meshcache
+{
+	static_assert(sizeof(Header) == 168, "Mesh cache header layout changed, bump formatVersion");
+	static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8, "Mesh cache stores tightly packed glm vectors");
+	static_assert(sizeof(MeshLod) == 12, "Mesh cache LOD layout changed, bump formatVersion");
+	static_assert(sizeof(Meshlet) == 44, "Mesh cache meshlet layout changed, bump formatVersion");
+	static_assert(sizeof(SubmeshRange) == 16 && sizeof(SubmeshRecord) == 32, "Mesh cache submesh layout changed, bump formatVersion");
+	static_assert(sizeof(Bvh::Node) == 128, "Mesh cache BVH node layout changed, bump formatVersion");
+
+	std::string sidecarPath(const std::string& objPath, const std::string& variant) {
+		return variant.empty() ? objPath + ".mvcache" : objPath + "." + variant + ".mvcache";
+	}
+
+	bool write(const std::string& path, const MeshData& mesh, uint64_t sourceHash, uint64_t sourceSize) {
+		Header header;
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = formatVersion;
+		header.sourceSize = sourceSize;
+		header.sourceHash = sourceHash;
+		header.vertexCount = mesh.vertices.size();
+		header.normalCount = mesh.normals.size();
+		header.texCoordCount = mesh.texCoords.size();
+		header.indexCount = mesh.vertexIndices.size();
+		header.lodCount = mesh.lods.size();
+		header.meshletCount = mesh.meshlets.size();
+		header.materialCount = mesh.materials.size();
+		header.submeshCount = mesh.submeshes.size();
+		header.submeshRangeCount = mesh.submeshRanges.size();
+		header.libraryCount = mesh.materialLibraries.size();
+		header.bvhNodeCount = mesh.bvh.getNodes().size();
+		header.bvhTriangleCount = mesh.bvh.getTriangleIds().size();
+
+		std::vector<SubmeshRecord> records(mesh.submeshes.size());
+		std::string names;
+		for (const std::string& material : mesh.materials) {
+			names.append(material.c_str(), material.size() + 1);
+		}
+		for (size_t i = 0; i < mesh.submeshes.size(); i++) {
+			const Submesh& submesh = mesh.submeshes[i];
+			records[i].material = submesh.material;
+			for (int axis = 0; axis < 3; axis++) {
+				records[i].boundsMin[axis] = submesh.boundsMin[axis];
+				records[i].boundsMax[axis] = submesh.boundsMax[axis];
+			}
+			records[i].radius = submesh.radius;
+			names.append(submesh.name.c_str(), submesh.name.size() + 1);
+		}
+		for (const std::string& library : mesh.materialLibraries) {
+			names.append(library.c_str(), library.size() + 1);
+		}
+		header.nameBytes = names.size();
+		for (int i = 0; i < 3; i++) {
+			header.boundsMin[i] = mesh.boundsMin[i];
+			header.boundsMax[i] = mesh.boundsMax[i];
+			header.sphereCenter[i] = mesh.sphereCenter[i];
+		}
+		header.sphereRadius = mesh.sphereRadius;
+
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out.is_open()) {
+				return false;
+			}
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			writeArray(out, mesh.vertices);
+			writeArray(out, mesh.normals);
+			writeArray(out, mesh.texCoords);
+			writeArray(out, mesh.vertexIndices);
+			writeArray(out, mesh.lods);
+			writeArray(out, mesh.meshlets);
+			writeArray(out, mesh.submeshRanges);
+			writeArray(out, records);
+			writeArray(out, mesh.bvh.getNodes());
+			writeArray(out, mesh.bvh.getTriangleVertices());
+			writeArray(out, mesh.bvh.getTriangleIds());
+			out.write(names.data(), names.size());
+			if (!out) {
+				out.close();
+				std::remove(tempPath.c_str());
+				return false;
+			}
+		}
+
+		// rename() will not replace an existing file on Windows.
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+
+	bool CacheFile::open(const std::string& path, uint64_t sourceHash, uint64_t sourceSize) {
+		close();
+		if (!file.open(path) || file.size() < sizeof(Header)) {
+			close();
+			return false;
+		}
+
+		const Header* candidate = reinterpret_cast<const Header*>(file.data());
+		bool valid = std::memcmp(candidate->magic, magic, sizeof(magic)) == 0
+			&& candidate->version == formatVersion
+			&& candidate->sourceSize == sourceSize
+			&& candidate->sourceHash == sourceHash
+			&& payloadMatches(*candidate, file.size() - sizeof(Header));
+		if (!valid) {
+			close();
+			return false;
+		}
+
+		// Every name has to end where copyTo() expects, a name with a zero byte in it would shift the rest.
+		header = candidate;
+		const char* names = this->names();
+		size_t terminators = static_cast<size_t>(std::count(names, names + header->nameBytes, '\0'));
+		// Each count is at most the number of terminators, so their sum cannot wrap either.
+		if (header->materialCount > terminators || header->libraryCount > terminators
+			|| terminators != header->materialCount + header->submeshCount + header->libraryCount || (header->nameBytes > 0 && names[header->nameBytes - 1] != '\0')) {
+			close();
+			return false;
+		}
+
+		if (!Bvh::isValidTree(bvhNodes(), header->bvhNodeCount, header->bvhTriangleCount)) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	const glm::vec3* CacheFile::vertices() const {
+		return reinterpret_cast<const glm::vec3*>(file.data() + sizeof(Header));
+	}
+
+	const glm::vec3* CacheFile::normals() const {
+		return vertices() + header->vertexCount;
+	}
+
+	const glm::vec2* CacheFile::texCoords() const {
+		return reinterpret_cast<const glm::vec2*>(normals() + header->normalCount);
+	}
+
+	const unsigned int* CacheFile::indices() const {
+		return reinterpret_cast<const unsigned int*>(texCoords() + header->texCoordCount);
+	}
+
+	const MeshLod* CacheFile::lods() const {
+		return reinterpret_cast<const MeshLod*>(indices() + header->indexCount);
+	}
+
+	const Meshlet* CacheFile::meshlets() const {
+		return reinterpret_cast<const Meshlet*>(lods() + header->lodCount);
+	}
+
+	const SubmeshRange* CacheFile::submeshRanges() const {
+		return reinterpret_cast<const SubmeshRange*>(meshlets() + header->meshletCount);
+	}
+
+	const SubmeshRecord* CacheFile::submeshes() const {
+		return reinterpret_cast<const SubmeshRecord*>(submeshRanges() + header->submeshRangeCount);
+	}
+
+	const Bvh::Node* CacheFile::bvhNodes() const {
+		return reinterpret_cast<const Bvh::Node*>(submeshes() + header->submeshCount);
+	}
+
+	const glm::vec3* CacheFile::bvhTriangleVertices() const {
+		return reinterpret_cast<const glm::vec3*>(bvhNodes() + header->bvhNodeCount);
+	}
+
+	const uint32_t* CacheFile::bvhTriangleIds() const {
+		return reinterpret_cast<const uint32_t*>(bvhTriangleVertices() + header->bvhTriangleCount * 3);
+	}
+
+	const char* CacheFile::names() const {
+		return reinterpret_cast<const char*>(bvhTriangleIds() + header->bvhTriangleCount);
+	}
+
+	void CacheFile::copyTo(MeshData& mesh) const {
+		mesh.vertices.assign(vertices(), vertices() + header->vertexCount);
+		mesh.normals.assign(normals(), normals() + header->normalCount);
+		mesh.texCoords.assign(texCoords(), texCoords() + header->texCoordCount);
+		mesh.vertexIndices.assign(indices(), indices() + header->indexCount);
+		mesh.lods.assign(lods(), lods() + header->lodCount);
+		mesh.meshlets.assign(meshlets(), meshlets() + header->meshletCount);
+		mesh.submeshRanges.assign(submeshRanges(), submeshRanges() + header->submeshRangeCount);
+		mesh.bvh.assign(bvhNodes(), header->bvhNodeCount, bvhTriangleVertices(), bvhTriangleIds(), header->bvhTriangleCount);
+
+		const char* name = names();
+		mesh.materials.clear();
+		for (uint64_t i = 0; i < header->materialCount; i++) {
+			mesh.materials.emplace_back(name);
+			name += mesh.materials.back().size() + 1;
+		}
+		mesh.submeshes.resize(header->submeshCount);
+		for (size_t i = 0; i < mesh.submeshes.size(); i++) {
+			const SubmeshRecord& record = submeshes()[i];
+			Submesh& submesh = mesh.submeshes[i];
+			submesh.name = name;
+			name += submesh.name.size() + 1;
+			submesh.material = record.material;
+			submesh.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+			submesh.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+			submesh.radius = record.radius;
+		}
+		mesh.materialLibraries.clear();
+		for (uint64_t i = 0; i < header->libraryCount; i++) {
+			mesh.materialLibraries.emplace_back(name);
+			name += mesh.materialLibraries.back().size() + 1;
+		}
+		mesh.boundsMin = glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+		mesh.boundsMax = glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+		mesh.sphereCenter = glm::vec3(header->sphereCenter[0], header->sphereCenter[1], header->sphereCenter[2]);
+		mesh.sphereRadius = header->sphereRadius;
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.h"
+#include "mesh_data.h"
+
+// Binary sidecar written next to each OBJ ("model.obj" -> "model.obj.mvcache") after its first successful load.
+// It holds the finished mesh (positions, normals, UVs, optimized indices, LODs, meshlets, submeshes, bounds and the BVH) so later loads
+// skip parsing, normal generation, optimization, simplification and the BVH build entirely. A sidecar is only used if its format version, the source size and the source
+// content hash all still match.
+namespace meshcache
+{
+	// Bump whenever the layout below or anything that changes the generated mesh data changes.
+	const uint32_t formatVersion = 10;
+
+	struct Header
+	{
+		char magic[4]; // "MVMC"
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceHash;
+		uint64_t vertexCount;
+		uint64_t normalCount;
+		uint64_t texCoordCount;
+		uint64_t indexCount;
+		uint64_t lodCount;
+		uint64_t meshletCount;
+		uint64_t materialCount;
+		uint64_t submeshCount;
+		uint64_t submeshRangeCount;
+		uint64_t libraryCount;
+		uint64_t bvhNodeCount;
+		uint64_t bvhTriangleCount;
+		uint64_t nameBytes;
+		float boundsMin[3];
+		float boundsMax[3];
+		float sphereCenter[3];
+		float sphereRadius;
+	};
+	// A Submesh without its name.
+	struct SubmeshRecord
+	{
+		uint32_t material;
+		float boundsMin[3];
+		float boundsMax[3];
+		float radius;
+	};
+
+	// Arrays follow the header in this order: vertices, normals, texCoords, indices, lods, meshlets, submeshRanges,
+	// submeshes, the BVH's nodes, triangle vertices (three per triangle) and triangle ids, then the names of the materials, of the submeshes and of the material libraries, each ending in a zero byte.
+	// The libraries themselves are not cached, they are read again on every load (see MeshData::materialTable).
+
+	// Meshes built differently from the same OBJ get their own sidecar ("model.obj.variant.mvcache").
+	std::string sidecarPath(const std::string& objPath, const std::string& variant = "");
+
+	// Writes the sidecar through a temporary file so a crash never leaves a half written cache behind.
+	bool write(const std::string& path, const MeshData& mesh, uint64_t sourceHash, uint64_t sourceSize);
+
+	// A validated, memory mapped sidecar. The array pointers point straight into the mapping.
+	class CacheFile
+	{
+	public:
+		bool open(const std::string& path, uint64_t sourceHash, uint64_t sourceSize);
+		void close() { file.close(); header = nullptr; }
+
+		const Header& info() const { return *header; }
+		const glm::vec3* vertices() const;
+		const glm::vec3* normals() const;
+		const glm::vec2* texCoords() const;
+		const unsigned int* indices() const;
+		const MeshLod* lods() const;
+		const Meshlet* meshlets() const;
+		const SubmeshRange* submeshRanges() const;
+		const SubmeshRecord* submeshes() const;
+		const Bvh::Node* bvhNodes() const;
+		const glm::vec3* bvhTriangleVertices() const;
+		const uint32_t* bvhTriangleIds() const;
+		const char* names() const;
+
+		// Copies the mapped arrays into mesh.
+		void copyTo(MeshData& mesh) const;
+
+	private:
+		MappedFile file;
+		const Header* header = nullptr;
+	};
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef MESH_DATA_H
+#define MESH_DATA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "bounds.h"
+#include "bvh.h"
+#include "material_library.h"
+
+// One level of detail: a range of MeshData::vertexIndices drawn instead of the full mesh, over the same vertices.
+struct MeshLod
+{
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	float error; // Quadric error of the level: about how far the surface moved, relative to the bounding sphere radius
+};
+
+// A cluster of up to a hundred or so neighbouring triangles of the full detail mesh, culled as a whole (see meshlets.h).
+struct Meshlet
+{
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	glm::vec3 center; // Bounding sphere
+	float radius;
+	glm::vec3 coneAxis; // Every triangle's normal is within the cone's half angle of the axis
+	float coneCos;
+	float coneSin;
+};
+
+// The faces of one 'o' or 'g' group of the OBJ file that use one material ('usemtl'). Faces of the same group and
+// material are one submesh wherever they are in the file.
+struct Submesh
+{
+	std::string name;  // Of the last 'o' or 'g' line before the faces, empty if there was none
+	uint32_t material; // Index into MeshData::materials
+	glm::vec3 boundsMin = glm::vec3(0.0f); // Of the vertices its full detail triangles use
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	float radius = 0.0f; // Bounding sphere around the box's center
+};
+
+// Where one submesh is in one level of detail, as the arguments of a glDrawElementsBaseVertex call.
+struct SubmeshRange
+{
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	int32_t baseVertex; // Smallest vertex the range uses. MeshData indices are absolute, only packed ones are relative to it (see vertex_format.h)
+	uint32_t material;
+};
+
+// CPU side copy of a mesh, filled in by the OBJ parser (or the mesh cache) and handed to Model for upload.
+struct MeshData
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;   // Per vertex, from the file or generated (see mesh_normals.h)
+	std::vector<glm::vec2> texCoords;
+	std::vector<unsigned int> vertexIndices; // Faces, already split into triangles, followed by the coarser LODs if there are any
+	std::vector<MeshLod> lods; // Finest first, lods[0] is the full mesh. Empty if no LODs were built (see mesh_simplifier.h)
+	std::vector<Meshlet> meshlets; // Consecutive ranges covering the full detail triangles, in index buffer order
+	// Submeshes are sorted by material, and every level of detail keeps their triangles in that order: one material is
+	// always one consecutive run of each level, and every submesh a consecutive run within it.
+	std::vector<std::string> materials; // 'usemtl' names in order of first use, "" for faces before any
+	std::vector<Submesh> submeshes;     // At least one if there are any faces
+	std::vector<SubmeshRange> submeshRanges; // submeshes.size() per level of detail, finest level first
+	std::vector<std::string> materialLibraries; // 'mtllib' files, relative to the OBJ, in order of first mention
+	// Read from the libraries after every load, cached or not, since the MTL files can change without the OBJ changing.
+	std::vector<Material> materialTable; // One per materials entry, in the same order
+	std::vector<TextureImage> textures;  // Diffuse maps of materialTable, one per distinct file. Model drops the pixels once uploaded
+	std::vector<unsigned int> smoothingGroups; // Per triangle, from the file's 's' lines. Only used for normal generation, so never cached
+	Bvh bvh; // Over the full detail triangles. Built on a cold load and stored in the cache with the rest
+
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec3 sphereCenter = glm::vec3(0.0f); // Bounding sphere, centered on the box (see bounds.h)
+	float sphereRadius = 0.0f;
+
+	void clear() {
+		vertices.clear();
+		normals.clear();
+		texCoords.clear();
+		vertexIndices.clear();
+		smoothingGroups.clear();
+		materials.clear();
+		submeshes.clear();
+		submeshRanges.clear();
+		materialLibraries.clear();
+		materialTable.clear();
+		textures.clear();
+		lods.clear();
+		meshlets.clear();
+		bvh.clear();
+		boundsMin = boundsMax = sphereCenter = glm::vec3(0.0f);
+		sphereRadius = 0.0f;
+	}
+
+	// Indices of the full detail mesh, without the LODs.
+	size_t baseIndexCount() const { return lods.empty() ? vertexIndices.size() : lods[0].indexCount; }
+
+	// Ranges of the submeshes in one level of detail, in submesh order.
+	const SubmeshRange* lodRanges(size_t lod) const { return submeshRanges.data() + lod * submeshes.size(); }
+
+	void computeBounds() {
+		Bounds bounds = computePointBounds(vertices.data(), vertices.size());
+		boundsMin = bounds.min;
+		boundsMax = bounds.max;
+		sphereCenter = bounds.center;
+		sphereRadius = bounds.radius;
+	}
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "mesh_loader.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "material_library.h"
+#include "mesh_cache.h"
+#include "mesh_normals.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "mesh_topology.h"
+#include "meshlets.h"
+#include "obj_parser.h"
+#include "thread_pool.h"
+#include "vertex_dedup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+// "" for the defaults, otherwise something like "unified.crease60".
+std::string cacheVariant(const LoadOptions& options) {
+	std::ostringstream variant;
+	if (options.mode == LoadMode::Unified) {
+		variant << "unified";
+	}
+	if (options.creaseAngle < 180.0f) {
+		variant << (variant.tellp() > 0 ? "." : "") << "crease" << options.creaseAngle;
+	}
+	return variant.str();
+}
+
+// Triangle indices are the same in the BVH and the element buffer, so picked triangles can be drawn straight from it.
+void buildBvh(const std::string& path, MeshData& mesh) {
+	BvhStats stats = mesh.bvh.build(mesh.vertices, mesh.vertexIndices.data(), mesh.baseIndexCount() / 3);
+	std::cout << "Built BVH over " << path << " (" << stats.triangles << " triangles) in " << stats.milliseconds << " ms: " << stats.nodes
+		<< " nodes, " << stats.leaves << " leaves, depth " << stats.depth << ", SAH cost " << stats.sahCost << ", "
+		<< mesh.bvh.bytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// Bounds of every submesh and the base vertex of every range, once the triangles are where they stay.
+void finishSubmeshes(const std::string& path, MeshData& mesh) {
+	if (mesh.submeshes.empty() || mesh.submeshRanges.size() < mesh.submeshes.size()) {
+		return;
+	}
+	const SubmeshRange* ranges = mesh.lodRanges(0);
+	for (size_t s = 0; s < mesh.submeshes.size(); s++) {
+		Bounds bounds = computeIndexedBounds(mesh.vertices.data(), mesh.vertices.size(), &mesh.vertexIndices[ranges[s].indexOffset], ranges[s].indexCount);
+		mesh.submeshes[s].boundsMin = bounds.min;
+		mesh.submeshes[s].boundsMax = bounds.max;
+		mesh.submeshes[s].radius = bounds.radius;
+	}
+	for (SubmeshRange& range : mesh.submeshRanges) {
+		auto first = mesh.vertexIndices.begin() + range.indexOffset;
+		range.baseVertex = range.indexCount > 0 ? static_cast<int32_t>(*std::min_element(first, first + range.indexCount)) : 0;
+	}
+	std::cout << "Split " << path << " into " << mesh.submeshes.size() << " submeshes over " << mesh.materials.size() << " materials" << std::endl;
+}
+
+// Fills the material table from the OBJ's libraries, or from "model.mtl" next to "model.obj" if it names none, and
+// decodes the diffuse maps it uses. Faces without a material, and materials no library defines, get the first material
+// the libraries have (Material's defaults if there is none), so a single material file does not need any 'usemtl'.
+void loadMaterials(const std::string& path, MeshData& mesh) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::string directory = mtl::directoryOf(path);
+	std::vector<Material> library;
+	for (const std::string& file : mesh.materialLibraries) {
+		if (!mtl::load(directory + file, library)) {
+			std::cerr << "ERROR::MTL::FILE_NOT_SUCCESFULLY_READ: " << directory + file << std::endl;
+		}
+	}
+	if (mesh.materialLibraries.empty()) {
+		size_t extension = path.find_last_of('.');
+		bool hasExtension = extension != std::string::npos && extension >= directory.size();
+		mtl::load((hasExtension ? path.substr(0, extension) : path) + ".mtl", library);
+	}
+
+	// The first definition of a name wins.
+	std::unordered_map<std::string, size_t> byName;
+	for (size_t i = 0; i < library.size(); i++) {
+		byName.emplace(library[i].name, i);
+	}
+	Material fallback = library.empty() ? Material() : library[0];
+	mesh.materialTable.clear();
+	mesh.materialTable.reserve(mesh.materials.size());
+	for (const std::string& name : mesh.materials) {
+		auto found = byName.find(name);
+		if (found != byName.end()) {
+			mesh.materialTable.push_back(library[found->second]);
+			continue;
+		}
+		// Without any library every name is missing, which says nothing new.
+		if (!name.empty() && !library.empty()) {
+			std::cerr << "ERROR::MTL::MATERIAL_NOT_FOUND: " << name << std::endl;
+		}
+		mesh.materialTable.push_back(fallback);
+		mesh.materialTable.back().name = name;
+	}
+
+	// One texture per file, however many materials share it, decoded in parallel.
+	std::vector<std::string> files;
+	std::unordered_map<std::string, size_t> fileIds;
+	for (const Material& material : mesh.materialTable) {
+		if (!material.diffuseMap.empty() && fileIds.emplace(material.diffuseMap, files.size()).second) {
+			files.push_back(material.diffuseMap);
+		}
+	}
+	std::vector<TextureImage> images(files.size());
+	std::vector<uint8_t> decoded(files.size(), 0);
+	ThreadPool::global().parallelFor(files.size(), [&](size_t i) {
+		decoded[i] = mtl::loadTexture(files[i], images[i]) ? 1 : 0;
+	});
+	std::vector<int32_t> textureIds(files.size(), -1);
+	mesh.textures.clear();
+	for (size_t i = 0; i < files.size(); i++) {
+		if (decoded[i]) {
+			textureIds[i] = static_cast<int32_t>(mesh.textures.size());
+			mesh.textures.push_back(std::move(images[i]));
+		}
+		else {
+			std::cerr << "ERROR::MTL::TEXTURE_NOT_SUCCESFULLY_READ: " << files[i] << std::endl;
+		}
+	}
+	for (Material& material : mesh.materialTable) {
+		material.texture = material.diffuseMap.empty() ? -1 : textureIds[fileIds[material.diffuseMap]];
+	}
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Materials of " << path << ": " << mesh.materialTable.size() << " used, " << library.size() << " defined, "
+		<< mesh.textures.size() << " textures, read in " << milliseconds << " ms" << std::endl;
+}
+
+}
+
+bool loadMesh(const std::string& path, MeshData& mesh, uint64_t& sourceHash, const LoadOptions& options) {
+	auto loadStart = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "ERROR::MODEL::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		return false;
+	}
+
+	// Hashing the source is far cheaper than parsing it, and tells us if the sidecar is still good.
+	sourceHash = contentHash(file.data(), file.size());
+	std::string cachePath = meshcache::sidecarPath(path, cacheVariant(options));
+
+	meshcache::CacheFile cache;
+	if (cache.open(cachePath, sourceHash, file.size())) {
+		cache.copyTo(mesh);
+		loadMaterials(path, mesh);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+		std::cout << "Loaded " << path << " from cache in " << milliseconds << " ms" << std::endl;
+		return true;
+	}
+
+	auto parseStart = std::chrono::steady_clock::now();
+
+	// Parsing vertex, texture(uv), and face data straight out of the mapped file.
+	// Texture coordinates are kept for the materials' diffuse maps.
+	const obj::ScanKernels& kernels = obj::bestScanKernels();
+	ThreadPool& pool = ThreadPool::global();
+	size_t chunkCount = obj::defaultChunkCount(file.size(), pool);
+	obj::CornerData corners;
+	if (options.mode == LoadMode::Unified) {
+		obj::parseCorners(file.data(), file.end(), corners, kernels, chunkCount, pool);
+	}
+	else {
+		obj::parse(file.data(), file.end(), mesh, kernels, chunkCount, pool);
+	}
+
+	auto parseEnd = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(parseEnd - parseStart).count();
+	double megabytes = file.size() / (1024.0 * 1024.0);
+	std::cout << "Parsed " << path << " (" << kernels.name << ", " << chunkCount << " chunks): " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+		<< (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s)" << std::endl;
+
+	// Unified vertices are welded back into positions for the topology, so UV seams do not show in generated normals.
+	std::vector<unsigned int> positionIndices;
+	size_t positionCount = 0;
+	if (options.mode == LoadMode::Unified) {
+		DedupStats dedup = buildUnifiedMesh(corners, mesh);
+		if (mesh.normals.empty()) {
+			positionIndices.resize(corners.corners.size());
+			for (size_t i = 0; i < positionIndices.size(); i++) {
+				// Out of range positions all read as the same zero vertex, so they share one index too.
+				positionIndices[i] = std::min<unsigned int>(corners.corners[i].position, static_cast<unsigned int>(corners.positions.size()));
+			}
+			positionCount = corners.positions.size() + 1;
+		}
+		corners = obj::CornerData();
+
+		double dedupMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseEnd).count();
+		std::cout << "Deduplicated " << dedup.corners << " corners into " << dedup.vertices << " vertices (" << dedup.ratio() << " : 1) in "
+			<< dedupMilliseconds << " ms: table " << dedup.tableSize << " slots, " << dedup.rehashes << " rehashes, probe length "
+			<< dedup.averageProbe << " average, " << dedup.maxProbe << " max" << std::endl;
+	}
+
+#ifdef _DEBUG
+	// Debug builds double check the SIMD kernels and chunked parsing against the scalar path on every file they load.
+	obj::verify(file.data(), file.end());
+#endif
+
+	// Unified meshes keep the file's normals when every corner has one.
+	if (mesh.normals.empty()) {
+		MeshTopology topology = options.mode == LoadMode::Unified
+			? buildTopology(positionIndices, positionCount)
+			: buildTopology(mesh.vertexIndices, mesh.vertices.size());
+		std::cout << "Built topology (" << topology.cornerCount() << " half-edges) in " << topology.milliseconds << " ms: "
+			<< topology.borderEdges << " border, " << topology.nonManifoldEdges << " non-manifold" << std::endl;
+
+		NormalStats normals = generateNormals(mesh, topology, options.creaseAngle);
+		std::cout << "Generated normals in " << normals.milliseconds << " ms (crease angle " << options.creaseAngle << ", "
+			<< (mesh.smoothingGroups.empty() ? "no" : "with") << " smoothing groups): " << normals.verticesBefore << " -> " << normals.verticesAfter
+			<< " vertices, " << normals.degenerateFaces << " degenerate faces, " << normals.fallbackVertices << " vertices without a normal" << std::endl;
+	}
+	mesh.smoothingGroups = std::vector<unsigned int>();
+	mesh.computeBounds();
+
+	// Done once here so the sidecar holds the optimized order and cached loads get it for free.
+	OptimizeStats optimized = optimizeMesh(mesh);
+	std::cout << "Optimized " << path << " (" << optimized.chunks << " chunks, " << optimized.clusters << " clusters) in " << optimized.milliseconds
+		<< " ms: ACMR " << optimized.before.acmr << " -> " << optimized.after.acmr << ", ATVR " << optimized.before.atvr << " -> " << optimized.after.atvr << std::endl;
+
+	// LODs go last: they index the optimized vertex order, and are not part of what optimizeMesh reorders.
+	SimplifyStats simplified = buildLods(mesh);
+	std::cout << "Built " << (mesh.lods.empty() ? 0 : mesh.lods.size() - 1) << " LODs in " << simplified.milliseconds << " ms ("
+		<< simplified.passes << " passes, " << simplified.lockedVertices << " locked and " << simplified.borderVertices << " border positions):";
+	for (const MeshLod& lod : mesh.lods) {
+		std::cout << " " << lod.indexCount / 3 << " (error " << lod.error << ")";
+	}
+	std::cout << std::endl;
+
+	// Meshlets cover the full detail triangles, which buildLods leaves where they are.
+	MeshletStats meshlets = buildMeshlets(mesh);
+	std::cout << "Built " << meshlets.meshlets << " meshlets in " << meshlets.milliseconds << " ms: " << meshlets.averageTriangles
+		<< " triangles and " << meshlets.averageRadius << " of the mesh radius on average, " << meshlets.cullableCones
+		<< " with a back face cullable cone" << std::endl;
+
+	// After the meshlets, which reorder the triangles.
+	buildBvh(path, mesh);
+	finishSubmeshes(path, mesh);
+	loadMaterials(path, mesh);
+
+	double coldMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+
+	if (!meshcache::write(cachePath, mesh, sourceHash, file.size())) {
+		std::cerr << "ERROR::MODEL::CACHE_NOT_SUCCESFULLY_WRITTEN" << std::endl;
+	}
+
+	std::cout << "Loaded " << path << " cold in " << coldMilliseconds << " ms" << std::endl;
+
+	/* Debug *\
+	std::cout << "Vertex Buffer Size: " << mesh.vertices.size() << std::endl;
+	std::cout << "Normal Buffer Size: " << mesh.normals.size() << std::endl;
+	*/
+
+	return true;
+}
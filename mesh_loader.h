@@ -0,0 +1,34 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <cstdint>
+#include <string>
+
+#include "mesh_data.h"
+
+// CPU half of loading a model: sidecar cache lookup, OBJ parsing, topology and normal generation, bounds and vertex cache optimization.
+// Nothing in here touches OpenGL, so it is safe to run on a worker thread.
+
+// How faces turn into vertices.
+enum class LoadMode
+{
+	Positions, // One vertex per 'v' line. UVs are looked up by position index and file normals are ignored.
+	Unified,   // One vertex per distinct v/vt/vn triple, so UVs and authored normals come out right.
+};
+
+// Everything that changes the mesh loadMesh builds from a file. Each combination gets its own sidecar.
+struct LoadOptions
+{
+	LoadMode mode = LoadMode::Positions;
+
+	// When normals are generated, edges sharper than this many degrees are shaded hard. 180 leaves only the file's smoothing groups.
+	float creaseAngle = 180.0f;
+};
+
+// Fills mesh from the sidecar cache if it is still valid, otherwise parses the OBJ and writes a new sidecar.
+// Either way the material table is then read from the OBJ's 'mtllib' files, or from "model.mtl" next to "model.obj" if
+// it names none, and the diffuse maps it uses are decoded (see MeshData::materialTable).
+// sourceHash receives the content hash of the OBJ file.
+bool loadMesh(const std::string& path, MeshData& mesh, uint64_t& sourceHash, const LoadOptions& options = LoadOptions());
+
+#endif
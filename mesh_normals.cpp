@@ -0,0 +1,390 @@
+#include "mesh_normals.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// SSE2 is always there on x64, so unlike the OBJ scanner this needs no runtime dispatch.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define NORMALS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+const float pi = 3.14159265358979f;
+const float halfPi = 1.57079632679490f;
+
+// Face normals shorter than this are treated as zero area.
+const float minLengthSquared = 1e-30f;
+
+// Unit face normal and the weight it gets at each of its three corners.
+struct FaceNormal
+{
+	glm::vec3 normal = glm::vec3(0.0f);
+	float weight[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+inline bool isDegenerate(const FaceNormal& face) {
+	return face.weight[0] == 0.0f && face.weight[1] == 0.0f && face.weight[2] == 0.0f;
+}
+
+// atan2(y, x) for y >= 0, good to about 1e-5 radians. Plenty for weights, and the SSE2 version below runs the exact same
+// operations, so both paths give the same answer.
+float atan2Positive(float y, float x) {
+	float ax = std::fabs(x);
+	float high = std::max(ax, y);
+	float a = high > 0.0f ? std::min(ax, y) / high : 0.0f;
+	float s = a * a;
+	float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+	if (y > ax) r = halfPi - r;
+	if (x < 0.0f) r = pi - r;
+	return r;
+}
+
+void faceNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, NormalWeighting weighting, FaceNormal& out) {
+	glm::vec3 ab = b - a;
+	glm::vec3 bc = c - b;
+	glm::vec3 ca = a - c;
+	glm::vec3 n = glm::cross(ca, ab);
+
+	float lengthSquared = glm::dot(n, n);
+	if (!(lengthSquared > minLengthSquared) || !std::isfinite(lengthSquared)) {
+		out = FaceNormal();
+		return;
+	}
+
+	// |cross| is the same whichever two edges it is taken from, so each corner angle is atan2(|n|, dot of its two edges).
+	float length = std::sqrt(lengthSquared);
+	out.normal = n / length;
+	if (weighting == NormalWeighting::Area) {
+		out.weight[0] = out.weight[1] = out.weight[2] = length;
+	}
+	else {
+		out.weight[0] = atan2Positive(length, -glm::dot(ab, ca));
+		out.weight[1] = atan2Positive(length, -glm::dot(bc, ab));
+		out.weight[2] = atan2Positive(length, -glm::dot(ca, bc));
+	}
+}
+
+#ifdef NORMALS_SSE2
+inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 atan2Positive(__m128 y, __m128 x) {
+	__m128 ax = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	__m128 high = _mm_max_ps(ax, y);
+	__m128 a = _mm_and_ps(_mm_div_ps(_mm_min_ps(ax, y), high), _mm_cmpgt_ps(high, _mm_setzero_ps()));
+	__m128 s = _mm_mul_ps(a, a);
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(-0.0464964749f), s),
+		_mm_set1_ps(0.15931422f)), s), _mm_set1_ps(0.327622764f)), s), a), a);
+	r = select(_mm_cmpgt_ps(y, ax), _mm_sub_ps(_mm_set1_ps(halfPi), r), r);
+	r = select(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(pi), r), r);
+	return r;
+}
+
+inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// Four faces at once. Corners are gathered into x/y/z registers, everything else is straight SIMD math.
+// Returns false if any of the four is degenerate, so the caller can redo those with the scalar version.
+bool faceNormals4(const glm::vec3* corners[3][4], NormalWeighting weighting, FaceNormal* out) {
+	__m128 x[3], y[3], z[3];
+	for (int k = 0; k < 3; k++) {
+		x[k] = _mm_setr_ps(corners[k][0]->x, corners[k][1]->x, corners[k][2]->x, corners[k][3]->x);
+		y[k] = _mm_setr_ps(corners[k][0]->y, corners[k][1]->y, corners[k][2]->y, corners[k][3]->y);
+		z[k] = _mm_setr_ps(corners[k][0]->z, corners[k][1]->z, corners[k][2]->z, corners[k][3]->z);
+	}
+
+	__m128 abx = _mm_sub_ps(x[1], x[0]), aby = _mm_sub_ps(y[1], y[0]), abz = _mm_sub_ps(z[1], z[0]);
+	__m128 bcx = _mm_sub_ps(x[2], x[1]), bcy = _mm_sub_ps(y[2], y[1]), bcz = _mm_sub_ps(z[2], z[1]);
+	__m128 cax = _mm_sub_ps(x[0], x[2]), cay = _mm_sub_ps(y[0], y[2]), caz = _mm_sub_ps(z[0], z[2]);
+
+	// cross(ca, ab), the same face normal as the scalar version
+	__m128 nx = _mm_sub_ps(_mm_mul_ps(cay, abz), _mm_mul_ps(caz, aby));
+	__m128 ny = _mm_sub_ps(_mm_mul_ps(caz, abx), _mm_mul_ps(cax, abz));
+	__m128 nz = _mm_sub_ps(_mm_mul_ps(cax, aby), _mm_mul_ps(cay, abx));
+
+	__m128 lengthSquared = dot(nx, ny, nz, nx, ny, nz);
+	// The compare is false for NaN and the second one catches infinity.
+	__m128 good = _mm_and_ps(_mm_cmpgt_ps(lengthSquared, _mm_set1_ps(minLengthSquared)), _mm_cmplt_ps(lengthSquared, _mm_set1_ps(INFINITY)));
+	if (_mm_movemask_ps(good) != 0xF) {
+		return false;
+	}
+
+	__m128 length = _mm_sqrt_ps(lengthSquared);
+	nx = _mm_div_ps(nx, length);
+	ny = _mm_div_ps(ny, length);
+	nz = _mm_div_ps(nz, length);
+
+	__m128 w[3];
+	if (weighting == NormalWeighting::Area) {
+		w[0] = w[1] = w[2] = length;
+	}
+	else {
+		__m128 sign = _mm_set1_ps(-0.0f);
+		w[0] = atan2Positive(length, _mm_xor_ps(dot(abx, aby, abz, cax, cay, caz), sign));
+		w[1] = atan2Positive(length, _mm_xor_ps(dot(bcx, bcy, bcz, abx, aby, abz), sign));
+		w[2] = atan2Positive(length, _mm_xor_ps(dot(cax, cay, caz, bcx, bcy, bcz), sign));
+	}
+
+	alignas(16) float lanes[6][4];
+	_mm_store_ps(lanes[0], nx);
+	_mm_store_ps(lanes[1], ny);
+	_mm_store_ps(lanes[2], nz);
+	for (int k = 0; k < 3; k++) {
+		_mm_store_ps(lanes[3 + k], w[k]);
+	}
+	for (int i = 0; i < 4; i++) {
+		out[i].normal = glm::vec3(lanes[0][i], lanes[1][i], lanes[2][i]);
+		out[i].weight[0] = lanes[3][i];
+		out[i].weight[1] = lanes[4][i];
+		out[i].weight[2] = lanes[5][i];
+	}
+	return true;
+}
+#endif
+
+// Face normals and corner weights for every triangle. Faces with an index past the end are left as zero, like degenerate ones.
+std::vector<FaceNormal> computeFaceNormals(const MeshData& mesh, NormalWeighting weighting, size_t& degenerateFaces) {
+	const std::vector<glm::vec3>& vertices = mesh.vertices;
+	const std::vector<unsigned int>& indices = mesh.vertexIndices;
+	size_t vertexCount = vertices.size();
+	size_t faceCount = indices.size() / 3;
+
+	std::vector<FaceNormal> faces(faceCount);
+	size_t blockCount = (faceCount + blockSize - 1) / blockSize;
+	std::vector<size_t> blockDegenerate(blockCount, 0);
+	ThreadPool::global().parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		size_t end = std::min(faceCount, begin + blockSize);
+		size_t degenerate = 0;
+
+		auto scalar = [&](size_t f) {
+			const unsigned int* face = &indices[f * 3];
+			if (face[0] >= vertexCount || face[1] >= vertexCount || face[2] >= vertexCount) {
+				faces[f] = FaceNormal();
+			}
+			else {
+				faceNormal(vertices[face[0]], vertices[face[1]], vertices[face[2]], weighting, faces[f]);
+			}
+			if (isDegenerate(faces[f])) {
+				degenerate++;
+			}
+		};
+
+		size_t f = begin;
+#ifdef NORMALS_SSE2
+		for (; f + 4 <= end; f += 4) {
+			const glm::vec3* corners[3][4];
+			bool inRange = true;
+			for (int i = 0; i < 4; i++) {
+				for (int k = 0; k < 3; k++) {
+					unsigned int index = indices[(f + i) * 3 + k];
+					inRange = inRange && index < vertexCount;
+					corners[k][i] = &vertices[inRange ? index : 0];
+				}
+			}
+			if (!inRange || !faceNormals4(corners, weighting, &faces[f])) {
+				for (size_t i = f; i < f + 4; i++) {
+					scalar(i);
+				}
+			}
+		}
+#endif
+		for (; f < end; f++) {
+			scalar(f);
+		}
+		blockDegenerate[block] = degenerate;
+	});
+
+	degenerateFaces = 0;
+	for (size_t degenerate : blockDegenerate) {
+		degenerateFaces += degenerate;
+	}
+	return faces;
+}
+
+uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t corner) {
+	uint32_t root = corner;
+	while (parent[root] != root) {
+		root = parent[root];
+	}
+	while (parent[corner] != root) {
+		uint32_t up = parent[corner];
+		parent[corner] = root;
+		corner = up;
+	}
+	return root;
+}
+
+}
+
+NormalStats generateNormals(MeshData& mesh, const MeshTopology& topology, float creaseAngle, NormalWeighting weighting) {
+	auto start = std::chrono::steady_clock::now();
+	NormalStats stats;
+	ThreadPool& pool = ThreadPool::global();
+
+	std::vector<FaceNormal> faces = computeFaceNormals(mesh, weighting, stats.degenerateFaces);
+
+	const std::vector<unsigned int>& groups = mesh.smoothingGroups;
+	bool useGroups = groups.size() == faces.size();
+	float minCos = creaseAngle >= 180.0f ? -2.0f : std::cos(creaseAngle * pi / 180.0f);
+
+	// Whether two faces across an edge share their normals there. Degenerate faces have no normal to disagree with.
+	auto smooth = [&](uint32_t f, uint32_t g) {
+		if (useGroups && (groups[f] != groups[g] || groups[f] == 0)) {
+			return false;
+		}
+		return isDegenerate(faces[f]) || isDegenerate(faces[g]) || glm::dot(faces[f].normal, faces[g].normal) >= minCos;
+	};
+
+	// Group the corners around each vertex into fans: runs of faces joined across smooth edges. Every corner points at the
+	// lowest corner of its fan. A vertex only ever touches its own corners, so vertices are processed in parallel.
+	size_t vertexCount = topology.vertexCount();
+	size_t cornerCount = topology.cornerCount();
+	std::vector<uint32_t> parent(cornerCount);
+
+	// A new vertex is one (fan, mesh vertex) pair, so UV seams and authored splits survive and creases add more.
+	// Sorting a vertex's corners by fan, then mesh vertex, puts every fan and every new vertex in one run, whatever the valence.
+	struct SplitCorner
+	{
+		uint32_t fan;
+		unsigned int vertex;
+		uint32_t corner;
+
+		bool operator<(const SplitCorner& other) const {
+			if (fan != other.fan) return fan < other.fan;
+			if (vertex != other.vertex) return vertex < other.vertex;
+			return corner < other.corner;
+		}
+	};
+	auto sortCorners = [&](size_t v, std::vector<SplitCorner>& sorted) {
+		sorted.clear();
+		for (uint32_t i = topology.cornerOffsets[v]; i < topology.cornerOffsets[v + 1]; i++) {
+			uint32_t corner = topology.cornerList[i];
+			sorted.push_back({ parent[corner], mesh.vertexIndices[corner], corner });
+		}
+		std::sort(sorted.begin(), sorted.end());
+	};
+	auto newVertex = [](const SplitCorner& a, const SplitCorner& b) {
+		return a.fan != b.fan || a.vertex != b.vertex;
+	};
+
+	size_t vertexBlocks = (vertexCount + blockSize - 1) / blockSize;
+	std::vector<size_t> blockSplits(vertexBlocks, 0);
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		std::vector<SplitCorner> sorted;
+		size_t count = 0;
+		for (size_t v = block * blockSize; v < end; v++) {
+			for (uint32_t i = topology.cornerOffsets[v]; i < topology.cornerOffsets[v + 1]; i++) {
+				parent[topology.cornerList[i]] = topology.cornerList[i];
+			}
+			for (uint32_t i = topology.cornerOffsets[v]; i < topology.cornerOffsets[v + 1]; i++) {
+				uint32_t corner = topology.cornerList[i];
+				uint32_t opposite = topology.opposite[corner];
+				if (opposite == MeshTopology::none) {
+					continue;
+				}
+				// The face across corner's outgoing edge meets this vertex at the corner after the opposite half-edge.
+				uint32_t neighbour = MeshTopology::next(opposite);
+				if (smooth(MeshTopology::face(corner), MeshTopology::face(neighbour))) {
+					uint32_t a = findRoot(parent, corner);
+					uint32_t b = findRoot(parent, neighbour);
+					parent[std::max(a, b)] = std::min(a, b);
+				}
+			}
+			for (uint32_t i = topology.cornerOffsets[v]; i < topology.cornerOffsets[v + 1]; i++) {
+				findRoot(parent, topology.cornerList[i]);
+			}
+
+			sortCorners(v, sorted);
+			for (size_t i = 0; i < sorted.size(); i++) {
+				if (i == 0 || newVertex(sorted[i - 1], sorted[i])) {
+					count++;
+				}
+			}
+		}
+		blockSplits[block] = count;
+	});
+
+	std::vector<size_t> blockBase(vertexBlocks, 0);
+	size_t newVertexCount = 0;
+	for (size_t block = 0; block < vertexBlocks; block++) {
+		blockBase[block] = newVertexCount;
+		newVertexCount += blockSplits[block];
+	}
+
+	// Corners of triangles the topology left out keep an index that is out of range for any vertex count.
+	bool copyTexCoords = !mesh.texCoords.empty() && mesh.texCoords.size() == mesh.vertices.size();
+	std::vector<glm::vec3> vertices(newVertexCount);
+	std::vector<glm::vec3> normals(newVertexCount);
+	std::vector<glm::vec2> texCoords(copyTexCoords ? newVertexCount : 0);
+	std::vector<unsigned int> indices(mesh.vertexIndices.size(), MeshTopology::none);
+
+	// Sum each fan and normalize. Fans whose faces are all degenerate get +z rather than NaN.
+	std::vector<size_t> blockFallback(vertexBlocks, 0);
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		std::vector<SplitCorner> sorted;
+		size_t next = blockBase[block];
+		size_t fallback = 0;
+		for (size_t v = block * blockSize; v < end; v++) {
+			sortCorners(v, sorted);
+
+			size_t fanEnd = 0;
+			for (size_t fanStart = 0; fanStart < sorted.size(); fanStart = fanEnd) {
+				glm::vec3 sum(0.0f);
+				for (fanEnd = fanStart; fanEnd < sorted.size() && sorted[fanEnd].fan == sorted[fanStart].fan; fanEnd++) {
+					const FaceNormal& face = faces[MeshTopology::face(sorted[fanEnd].corner)];
+					sum += face.normal * face.weight[sorted[fanEnd].corner % 3];
+				}
+
+				glm::vec3 normal(0.0f, 0.0f, 1.0f);
+				float lengthSquared = glm::dot(sum, sum);
+				if (lengthSquared > minLengthSquared && std::isfinite(lengthSquared)) {
+					normal = sum / std::sqrt(lengthSquared);
+				}
+
+				for (size_t i = fanStart; i < fanEnd; i++) {
+					if (i == fanStart || newVertex(sorted[i - 1], sorted[i])) {
+						unsigned int vertex = sorted[i].vertex;
+						vertices[next] = mesh.vertices[vertex];
+						normals[next] = normal;
+						if (copyTexCoords) {
+							texCoords[next] = mesh.texCoords[vertex];
+						}
+						if (!(lengthSquared > minLengthSquared && std::isfinite(lengthSquared))) {
+							fallback++;
+						}
+						next++;
+					}
+					indices[sorted[i].corner] = static_cast<unsigned int>(next - 1);
+				}
+			}
+		}
+		blockFallback[block] = fallback;
+	});
+	for (size_t fallback : blockFallback) {
+		stats.fallbackVertices += fallback;
+	}
+
+	stats.verticesBefore = mesh.vertices.size();
+	stats.verticesAfter = newVertexCount;
+	mesh.vertices = std::move(vertices);
+	mesh.normals = std::move(normals);
+	if (copyTexCoords) {
+		mesh.texCoords = std::move(texCoords);
+	}
+	mesh.vertexIndices = std::move(indices);
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
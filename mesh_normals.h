@@ -0,0 +1,40 @@
+#ifndef MESH_NORMALS_H
+#define MESH_NORMALS_H
+
+#include <cstddef>
+
+#include "mesh_data.h"
+#include "mesh_topology.h"
+
+// How much each face counts towards the normals of its vertices.
+enum class NormalWeighting
+{
+	Area,  // Big faces pull harder. Cheapest.
+	Angle, // By the face's angle at the vertex, so how finely a surface is triangulated does not matter.
+};
+
+struct NormalStats
+{
+	size_t degenerateFaces = 0;  // Zero area (or out of range) faces, left out
+	size_t fallbackVertices = 0; // Vertices with nothing to average, given +z
+	size_t verticesBefore = 0;
+	size_t verticesAfter = 0;    // After splitting along creases. Vertices no face uses are dropped.
+	double milliseconds = 0.0;
+};
+
+// Per corner normals, written back as one normal per vertex by splitting vertices where their corners disagree.
+// The faces around a vertex are joined across every edge that is smooth: both faces in the same smoothing group (group 0,
+// "s off", is never smooth) and less than creaseAngle degrees apart. Each run of joined faces averages its own normal.
+// With creaseAngle 180 and no smoothing groups this is plain smooth shading.
+//
+// topology must be built over the triangles of mesh.vertexIndices, either on those indices or on any that weld vertices
+// sharing a position (like the OBJ position indices of a unified mesh), so that UV seams do not split the shading.
+// It stays valid afterwards, since only vertices change.
+//
+// Face normals and weights are computed in parallel (four faces at a time with SSE2 where available), and vertices are
+// handled in parallel through the topology's corner lists, which buildTopology fills with a parallel count and scatter.
+// Every pass reads each face or vertex once, whatever the thread count, and since every sum runs in corner order the
+// result does not depend on the number of threads either.
+NormalStats generateNormals(MeshData& mesh, const MeshTopology& topology, float creaseAngle = 180.0f, NormalWeighting weighting = NormalWeighting::Angle);
+
+#endif
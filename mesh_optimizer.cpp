@@ -0,0 +1,556 @@
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Meshes with fewer triangles than this are optimized in one piece, bigger ones in chunks of chunkTriangles.
+const size_t parallelTriangleThreshold = 1 << 18;
+const size_t chunkTriangles = 1 << 16;
+
+// Morton code bits per axis for bucketing triangles into spatial chunks, 32^3 cells.
+const unsigned int spatialBits = 5;
+
+// Soft cluster boundaries go wherever the miss ratio so far drops to within this factor of the cluster's overall ratio.
+const float clusterThreshold = 1.05f;
+
+// FIFO cache simulation. A vertex is still cached if fewer than size misses happened since it was loaded.
+class FifoCache
+{
+public:
+	FifoCache(size_t vertexCount, unsigned int size) : stamps(vertexCount, 0), time(size), size(size) { }
+
+	// Returns 1 on a miss.
+	unsigned int access(unsigned int vertex) {
+		if (time - stamps[vertex] < size) {
+			return 0;
+		}
+		stamps[vertex] = time++;
+		return 1;
+	}
+
+	void flush() { time += size; }
+
+private:
+	std::vector<size_t> stamps;
+	size_t time;
+	size_t size;
+};
+
+unsigned int spreadBits(unsigned int value) {
+	unsigned int result = 0;
+	for (unsigned int bit = 0; bit < spatialBits; bit++) {
+		result |= ((value >> bit) & 1) << (3 * bit);
+	}
+	return result;
+}
+
+// Counting sort of the triangles by the Morton code of their centroid. Triangles in the same cell keep their file order.
+void spatialOrder(const MeshData& mesh, std::vector<unsigned int>& triangles, ThreadPool& pool) {
+	const size_t cellCount = size_t(1) << (3 * spatialBits);
+	const size_t blockSize = 1 << 16;
+	const float cellsPerAxis = static_cast<float>(1 << spatialBits);
+
+	size_t triangleCount = triangles.size();
+	size_t blockCount = (triangleCount + blockSize - 1) / blockSize;
+
+	// Centroids are left as the sum of the three corners, so the scale takes the divide by 3.
+	glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+	glm::vec3 scale(0.0f);
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] > 0.0f) {
+			scale[axis] = cellsPerAxis / (3.0f * extent[axis]);
+		}
+	}
+
+	std::vector<uint16_t> codes(triangleCount);
+	std::vector<unsigned int> offsets(blockCount * cellCount, 0);
+	pool.parallelFor(blockCount, [&](size_t block) {
+		unsigned int* counts = &offsets[block * cellCount];
+		size_t end = std::min(triangleCount, (block + 1) * blockSize);
+		for (size_t t = block * blockSize; t < end; t++) {
+			const unsigned int* corners = &mesh.vertexIndices[t * 3];
+			glm::vec3 sum = mesh.vertices[corners[0]] + mesh.vertices[corners[1]] + mesh.vertices[corners[2]];
+			unsigned int cell[3];
+			for (int axis = 0; axis < 3; axis++) {
+				float position = (sum[axis] - 3.0f * mesh.boundsMin[axis]) * scale[axis];
+				cell[axis] = static_cast<unsigned int>(std::min(std::max(position, 0.0f), cellsPerAxis - 1.0f));
+			}
+			codes[t] = static_cast<uint16_t>(spreadBits(cell[0]) | (spreadBits(cell[1]) << 1) | (spreadBits(cell[2]) << 2));
+			counts[codes[t]]++;
+		}
+	});
+
+	// Cell major, so the output is sorted by cell and then by block.
+	unsigned int running = 0;
+	for (size_t cell = 0; cell < cellCount; cell++) {
+		for (size_t block = 0; block < blockCount; block++) {
+			unsigned int count = offsets[block * cellCount + cell];
+			offsets[block * cellCount + cell] = running;
+			running += count;
+		}
+	}
+
+	pool.parallelFor(blockCount, [&](size_t block) {
+		unsigned int* next = &offsets[block * cellCount];
+		size_t end = std::min(triangleCount, (block + 1) * blockSize);
+		for (size_t t = block * blockSize; t < end; t++) {
+			triangles[next[codes[t]]++] = static_cast<unsigned int>(t);
+		}
+	});
+}
+
+// Tipsify: fans around one vertex at a time, then moves on to whichever vertex of the last fan will still be in the cache
+// once its remaining triangles are drawn. When none qualifies it backtracks through recently used vertices, and only then
+// jumps to the next vertex in index order. order receives triangle numbers.
+void tipsify(const unsigned int* indices, size_t triangleCount, size_t vertexCount, unsigned int cacheSize, std::vector<unsigned int>& order) {
+	// Vertex -> triangle adjacency
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		offsets[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		offsets[v + 1] += offsets[v];
+	}
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> next(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int corner = 0; corner < 3; corner++) {
+			adjacency[next[indices[t * 3 + corner]]++] = static_cast<unsigned int>(t);
+		}
+	}
+
+	std::vector<unsigned int> live(vertexCount); // Triangles of each vertex not drawn yet
+	for (size_t v = 0; v < vertexCount; v++) {
+		live[v] = offsets[v + 1] - offsets[v];
+	}
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<unsigned int> deadEnds;
+	std::vector<unsigned int> candidates;
+	size_t time = cacheSize + 1;
+	size_t cursor = 0;
+
+	order.clear();
+	order.reserve(triangleCount);
+
+	auto skipDeadEnd = [&]() -> long long {
+		while (!deadEnds.empty()) {
+			unsigned int v = deadEnds.back();
+			deadEnds.pop_back();
+			if (live[v] > 0) {
+				return v;
+			}
+		}
+		for (; cursor < vertexCount; cursor++) {
+			if (live[cursor] > 0) {
+				return static_cast<long long>(cursor);
+			}
+		}
+		return -1;
+	};
+
+	long long fan = skipDeadEnd();
+	while (fan >= 0) {
+		candidates.clear();
+		for (unsigned int i = offsets[fan]; i < offsets[fan + 1]; i++) {
+			unsigned int t = adjacency[i];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			order.push_back(t);
+
+			for (int corner = 0; corner < 3; corner++) {
+				unsigned int v = indices[t * 3 + corner];
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+		}
+
+		// Prefer the candidate that has been in the cache longest, as long as fanning around it would not push it out.
+		long long best = -1;
+		long long bestPriority = -1;
+		for (unsigned int v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+			long long priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+				priority = static_cast<long long>(time - cacheTime[v]);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		fan = best >= 0 ? best : skipDeadEnd();
+	}
+}
+
+// Splits the Tipsify output into clusters that can be drawn in any order without hurting the cache much.
+// Hard boundaries go where the cache had gone cold anyway (all three vertices missed); each resulting cluster is split
+// again where its miss ratio so far is already close to its overall ratio. starts receives offsets into order.
+void splitClusters(const unsigned int* indices, const std::vector<unsigned int>& order, size_t vertexCount, unsigned int cacheSize, std::vector<size_t>& starts) {
+	auto triangleMisses = [&](FifoCache& cache, unsigned int t) {
+		return cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]);
+	};
+
+	FifoCache cache(vertexCount, cacheSize);
+	std::vector<size_t> hard;
+	for (size_t i = 0; i < order.size(); i++) {
+		if (triangleMisses(cache, order[i]) == 3 || i == 0) {
+			hard.push_back(i);
+		}
+	}
+	hard.push_back(order.size());
+
+	starts.clear();
+	for (size_t h = 0; h + 1 < hard.size(); h++) {
+		size_t begin = hard[h];
+		size_t end = hard[h + 1];
+
+		cache.flush();
+		unsigned int clusterMisses = 0;
+		for (size_t i = begin; i < end; i++) {
+			clusterMisses += triangleMisses(cache, order[i]);
+		}
+		float threshold = clusterThreshold * static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+		cache.flush();
+		starts.push_back(begin);
+		size_t segmentStart = begin;
+		unsigned int misses = 0;
+		for (size_t i = begin; i < end; i++) {
+			misses += triangleMisses(cache, order[i]);
+			if (i + 1 < end && static_cast<float>(misses) <= threshold * static_cast<float>(i + 1 - segmentStart)) {
+				starts.push_back(i + 1);
+				cache.flush();
+				segmentStart = i + 1;
+				misses = 0;
+			}
+		}
+	}
+}
+
+// Moves values[v] to values[remap[v]]. Arrays shorter than the vertex array are padded with zeros.
+template<typename T>
+void permuteVertices(std::vector<T>& values, const std::vector<unsigned int>& remap, ThreadPool& pool) {
+	if (values.empty()) {
+		return;
+	}
+
+	const size_t blockSize = 1 << 16;
+	size_t vertexCount = remap.size();
+	size_t sourceCount = std::min(values.size(), vertexCount);
+
+	std::vector<T> result(vertexCount, T(0.0f));
+	pool.parallelFor((sourceCount + blockSize - 1) / blockSize, [&](size_t block) {
+		size_t end = std::min(sourceCount, (block + 1) * blockSize);
+		for (size_t v = block * blockSize; v < end; v++) {
+			result[remap[v]] = values[v];
+		}
+	});
+	values.swap(result);
+}
+
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize) {
+	VertexCacheStats stats;
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return stats;
+	}
+
+	FifoCache cache(vertexCount, cacheSize);
+	std::vector<char> referenced(vertexCount, 0);
+	size_t misses = 0;
+	size_t uniqueVertices = 0;
+	for (unsigned int index : indices) {
+		misses += cache.access(index);
+		if (!referenced[index]) {
+			referenced[index] = 1;
+			uniqueVertices++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(triangleCount);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueVertices);
+	return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount) {
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	std::vector<unsigned int> order;
+	tipsify(indices.data(), triangleCount, vertexCount, vertexCacheSize, order);
+
+	std::vector<unsigned int> result(triangleCount * 3);
+	for (size_t i = 0; i < triangleCount; i++) {
+		std::copy_n(&indices[order[i] * size_t(3)], 3, &result[i * 3]);
+	}
+	indices.swap(result);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, const std::vector<size_t>& rangeEnds) {
+	if (rangeEnds.size() <= 1) {
+		optimizeVertexCache(indices, vertexCount);
+		return;
+	}
+
+	// Each range is renumbered 0..n in first use order first, so tipsify's per vertex arrays are only as big as the range.
+	const unsigned int unassigned = std::numeric_limits<unsigned int>::max();
+	std::vector<unsigned int> localId(vertexCount, unassigned);
+	std::vector<unsigned int> local, order, result;
+	size_t begin = 0;
+	for (size_t end : rangeEnds) {
+		if (end == begin) {
+			continue;
+		}
+		size_t triangleCount = (end - begin) / 3;
+		unsigned int count = 0;
+		local.resize(end - begin);
+		for (size_t i = begin; i < end; i++) {
+			if (localId[indices[i]] == unassigned) {
+				localId[indices[i]] = count++;
+			}
+			local[i - begin] = localId[indices[i]];
+		}
+
+		tipsify(local.data(), triangleCount, count, vertexCacheSize, order);
+		result.resize(end - begin);
+		for (size_t i = 0; i < triangleCount; i++) {
+			std::copy_n(&indices[begin + order[i] * size_t(3)], 3, &result[i * 3]);
+		}
+		for (size_t i = begin; i < end; i++) {
+			localId[indices[i]] = unassigned;
+		}
+		std::copy(result.begin(), result.end(), indices.begin() + begin);
+		begin = end;
+	}
+}
+
+OptimizeStats optimizeMesh(MeshData& mesh, bool reduceOverdraw) {
+	auto start = std::chrono::steady_clock::now();
+	OptimizeStats stats;
+
+	size_t vertexCount = mesh.vertices.size();
+	size_t triangleCount = mesh.vertexIndices.size() / 3;
+
+	// Leave anything we cannot renumber safely alone. LODs come after optimization, reordering them in with the rest would mix the levels up.
+	if (triangleCount == 0 || !mesh.lods.empty() || mesh.vertexIndices.size() % 3 != 0
+		|| *std::max_element(mesh.vertexIndices.begin(), mesh.vertexIndices.end()) >= vertexCount
+		|| mesh.submeshRanges.size() != mesh.submeshes.size()) {
+		return stats;
+	}
+
+	// Triangles are only ever reordered within their submesh, so the submesh ranges stay as they are. A mesh that did
+	// not come from the parser counts as one submesh.
+	std::vector<size_t> submeshFirsts(1, 0);
+	for (const SubmeshRange& range : mesh.submeshRanges) {
+		submeshFirsts.push_back(submeshFirsts.back() + range.indexCount / 3);
+	}
+	if (submeshFirsts.back() != triangleCount) {
+		submeshFirsts.assign({ 0, triangleCount });
+	}
+	size_t submeshCount = submeshFirsts.size() - 1;
+
+	ThreadPool& pool = ThreadPool::global();
+	stats.before = analyzeVertexCache(mesh.vertexIndices, vertexCount);
+
+	// Big meshes are cut into spatially compact chunks that are optimized independently. The only cost is a cold cache
+	// at the start of each chunk.
+	std::vector<unsigned int> triangles(triangleCount);
+	size_t chunkSize = triangleCount;
+	if (triangleCount >= parallelTriangleThreshold) {
+		chunkSize = chunkTriangles;
+		spatialOrder(mesh, triangles, pool);
+
+		// Spatial order across the whole mesh, grouped back into submeshes.
+		if (submeshCount > 1) {
+			std::vector<unsigned int> grouped(triangleCount);
+			std::vector<size_t> next(submeshFirsts.begin(), submeshFirsts.end() - 1);
+			for (unsigned int t : triangles) {
+				size_t submesh = std::upper_bound(submeshFirsts.begin(), submeshFirsts.end(), t) - submeshFirsts.begin() - 1;
+				grouped[next[submesh]++] = t;
+			}
+			triangles.swap(grouped);
+		}
+	}
+	else {
+		std::iota(triangles.begin(), triangles.end(), 0u);
+	}
+
+	struct Chunk
+	{
+		size_t begin; // Position in triangles
+		size_t count;
+		uint32_t submesh;
+		std::vector<unsigned int> triangles; // In draw order
+		std::vector<size_t> clusterStarts;
+	};
+	std::vector<Chunk> chunks;
+	for (size_t submesh = 0; submesh < submeshCount; submesh++) {
+		for (size_t begin = submeshFirsts[submesh]; begin < submeshFirsts[submesh + 1]; begin += chunkSize) {
+			chunks.push_back({ begin, std::min(submeshFirsts[submesh + 1] - begin, chunkSize), static_cast<uint32_t>(submesh), {}, {} });
+		}
+	}
+	stats.chunks = chunks.size();
+
+	// A lone chunk works on the mesh directly. Otherwise each chunk's vertices are renumbered 0..n in first use order,
+	// so the per vertex arrays in tipsify are only as big as the chunk. One sequential sweep does all chunks.
+	const unsigned int unassigned = std::numeric_limits<unsigned int>::max();
+	std::vector<unsigned int> localIndices;
+	std::vector<size_t> chunkVertexCounts(chunks.size(), vertexCount);
+	if (chunks.size() > 1) {
+		localIndices.resize(triangleCount * 3);
+		std::vector<unsigned int> lastChunk(vertexCount, unassigned);
+		std::vector<unsigned int> localId(vertexCount);
+		for (size_t chunkIndex = 0; chunkIndex < chunks.size(); chunkIndex++) {
+			unsigned int count = 0;
+			size_t end = chunks[chunkIndex].begin + chunks[chunkIndex].count;
+			for (size_t i = chunks[chunkIndex].begin; i < end; i++) {
+				for (int corner = 0; corner < 3; corner++) {
+					unsigned int v = mesh.vertexIndices[triangles[i] * size_t(3) + corner];
+					if (lastChunk[v] != chunkIndex) {
+						lastChunk[v] = static_cast<unsigned int>(chunkIndex);
+						localId[v] = count++;
+					}
+					localIndices[i * 3 + corner] = localId[v];
+				}
+			}
+			chunkVertexCounts[chunkIndex] = count;
+		}
+	}
+
+	pool.parallelFor(chunks.size(), [&](size_t chunkIndex) {
+		Chunk& chunk = chunks[chunkIndex];
+		size_t begin = chunk.begin;
+		size_t count = chunk.count;
+
+		const unsigned int* indices = chunks.size() > 1 ? &localIndices[begin * 3] : mesh.vertexIndices.data();
+		size_t chunkVertexCount = chunkVertexCounts[chunkIndex];
+
+		std::vector<unsigned int> order;
+		tipsify(indices, count, chunkVertexCount, vertexCacheSize, order);
+
+		if (reduceOverdraw) {
+			splitClusters(indices, order, chunkVertexCount, vertexCacheSize, chunk.clusterStarts);
+		}
+		else {
+			chunk.clusterStarts.assign(1, 0);
+		}
+
+		chunk.triangles.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			chunk.triangles[i] = triangles[begin + order[i]];
+		}
+	});
+
+	struct Cluster
+	{
+		const unsigned int* triangles;
+		size_t count;
+		uint32_t submesh;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	std::vector<size_t> firstCluster(chunks.size() + 1, 0);
+	for (size_t c = 0; c < chunks.size(); c++) {
+		const Chunk& chunk = chunks[c];
+		firstCluster[c] = clusters.size();
+		for (size_t k = 0; k < chunk.clusterStarts.size(); k++) {
+			size_t end = k + 1 < chunk.clusterStarts.size() ? chunk.clusterStarts[k + 1] : chunk.triangles.size();
+			clusters.push_back({ &chunk.triangles[chunk.clusterStarts[k]], end - chunk.clusterStarts[k], chunk.submesh, 0.0f });
+		}
+	}
+	firstCluster[chunks.size()] = clusters.size();
+
+	if (reduceOverdraw) {
+		// Linear-speed overdraw ordering (Sander et al.): clusters facing away from the mesh's centre are likely to hide
+		// the rest, so they go first. Centroids and normals are area weighted.
+		std::vector<glm::vec3> centroidSums(clusters.size(), glm::vec3(0.0f));
+		std::vector<glm::vec3> normalSums(clusters.size(), glm::vec3(0.0f));
+		std::vector<float> areas(clusters.size(), 0.0f);
+		pool.parallelFor(chunks.size(), [&](size_t chunkIndex) {
+			for (size_t c = firstCluster[chunkIndex]; c < firstCluster[chunkIndex + 1]; c++) {
+				for (size_t i = 0; i < clusters[c].count; i++) {
+					const unsigned int* corners = &mesh.vertexIndices[clusters[c].triangles[i] * size_t(3)];
+					const glm::vec3& a = mesh.vertices[corners[0]];
+					const glm::vec3& b = mesh.vertices[corners[1]];
+					const glm::vec3& d = mesh.vertices[corners[2]];
+					glm::vec3 normal = glm::cross(b - a, d - a);
+					float area = glm::length(normal);
+					centroidSums[c] += (a + b + d) * (area / 3.0f);
+					normalSums[c] += normal;
+					areas[c] += area;
+				}
+			}
+		});
+
+		glm::vec3 meshCentroidSum(0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusters.size(); c++) {
+			meshCentroidSum += centroidSums[c];
+			meshArea += areas[c];
+		}
+		glm::vec3 meshCentroid = meshArea > 0.0f ? meshCentroidSum / meshArea : (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+
+		for (size_t c = 0; c < clusters.size(); c++) {
+			float normalLength = glm::length(normalSums[c]);
+			if (areas[c] > 0.0f && normalLength > 0.0f) {
+				clusters[c].sortKey = glm::dot(centroidSums[c] / areas[c] - meshCentroid, normalSums[c] / normalLength);
+			}
+		}
+		std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+			return a.submesh != b.submesh ? a.submesh < b.submesh : a.sortKey > b.sortKey;
+		});
+		stats.clusters = clusters.size();
+	}
+
+	std::vector<unsigned int> indices;
+	indices.reserve(triangleCount * 3);
+	for (const Cluster& cluster : clusters) {
+		for (size_t i = 0; i < cluster.count; i++) {
+			const unsigned int* corners = &mesh.vertexIndices[cluster.triangles[i] * size_t(3)];
+			indices.insert(indices.end(), corners, corners + 3);
+		}
+	}
+
+	// Renumber vertices in the order the new index buffer first touches them. Unused vertices go last, in their old order.
+	std::vector<unsigned int> remap(vertexCount, unassigned);
+	unsigned int nextVertex = 0;
+	for (unsigned int& index : indices) {
+		if (remap[index] == unassigned) {
+			remap[index] = nextVertex++;
+		}
+		index = remap[index];
+	}
+	for (unsigned int& target : remap) {
+		if (target == unassigned) {
+			target = nextVertex++;
+		}
+	}
+
+	permuteVertices(mesh.vertices, remap, pool);
+	permuteVertices(mesh.normals, remap, pool);
+	permuteVertices(mesh.texCoords, remap, pool);
+	mesh.vertexIndices.swap(indices);
+
+	stats.after = analyzeVertexCache(mesh.vertexIndices, vertexCount);
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
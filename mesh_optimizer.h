@@ -0,0 +1,45 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh_data.h"
+
+// Post-transform vertex cache behaviour of an index buffer, simulated as a FIFO cache.
+struct VertexCacheStats
+{
+	float acmr = 0.0f; // Average cache miss ratio: vertex shader runs per triangle. 0.5 is the best a regular grid can do, 3 the worst.
+	float atvr = 0.0f; // Average transformed vertex ratio: vertex shader runs per referenced vertex. 1 is ideal.
+};
+
+struct OptimizeStats
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+	size_t chunks = 0;   // Spatial chunks optimized in parallel
+	size_t clusters = 0; // Clusters sorted for overdraw, 0 if that step was skipped
+	double milliseconds = 0.0;
+};
+
+// Size of the FIFO cache both the optimizer and analyzeVertexCache assume. Close to what most GPUs behave like.
+const unsigned int vertexCacheSize = 16;
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = vertexCacheSize);
+
+// Reorders the triangles of mesh for the post-transform vertex cache (Tipsify, Sander et al. 2007), optionally sorts the
+// resulting clusters so outward facing ones are drawn first to cut overdraw, then renumbers the vertices in first use order
+// so vertex fetches walk through memory. Normals and texture coordinates move with their vertices.
+// Big meshes are split into spatial chunks that are optimized in parallel. Triangles never leave their submesh, so
+// mesh.submeshRanges stays valid. mesh.boundsMin/boundsMax have to be up to date.
+OptimizeStats optimizeMesh(MeshData& mesh, bool reduceOverdraw = true);
+
+// Reorders the triangles of indices for the vertex cache with Tipsify alone and leaves the vertices where they are.
+// For extra index buffers over a mesh that has already been through optimizeMesh, like its LODs.
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+// Same for each range of indices on its own, so no triangle leaves its range (like the submeshes of a LOD).
+// rangeEnds are index positions, the last one being indices.size().
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, const std::vector<size_t>& rangeEnds);
+
+#endif
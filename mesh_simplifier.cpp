@@ -0,0 +1,502 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+#include "mesh_topology.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+
+// Open edges get constraint planes this much heavier than the surface's, so the outline of a hole survives.
+const float borderWeight = 10.0f;
+
+// A collapse is rejected if it turns any triangle that survives it by more than about 75 degrees.
+const float minNormalDot = 0.25f;
+
+// Levels with more than this fraction of the previous level's triangles are not worth keeping.
+const float minLevelReduction = 0.8f;
+
+enum VertexKind : uint8_t
+{
+	Manifold, // Free to collapse onto any neighbour
+	Border,   // Only collapses along an open edge, so the outline does not get pulled in
+	Locked,   // Several vertices at this position, never moves
+};
+
+// Weighted sum of squared distances to a set of planes: p.A.p + 2 b.p + c, with A symmetric.
+struct Quadric
+{
+	float a00 = 0.0f, a11 = 0.0f, a22 = 0.0f, a01 = 0.0f, a02 = 0.0f, a12 = 0.0f;
+	float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+	float c = 0.0f;
+	float weight = 0.0f;
+
+	// Plane dot(n, p) + d = 0 with n unit length.
+	void addPlane(const glm::vec3& n, float d, float w) {
+		a00 += w * n.x * n.x;
+		a11 += w * n.y * n.y;
+		a22 += w * n.z * n.z;
+		a01 += w * n.x * n.y;
+		a02 += w * n.x * n.z;
+		a12 += w * n.y * n.z;
+		b0 += w * n.x * d;
+		b1 += w * n.y * d;
+		b2 += w * n.z * d;
+		c += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric& q) {
+		a00 += q.a00;
+		a11 += q.a11;
+		a22 += q.a22;
+		a01 += q.a01;
+		a02 += q.a02;
+		a12 += q.a12;
+		b0 += q.b0;
+		b1 += q.b1;
+		b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+	}
+
+	float evaluate(const glm::vec3& p) const {
+		float rx = a00 * p.x + a01 * p.y + a02 * p.z;
+		float ry = a01 * p.x + a11 * p.y + a12 * p.z;
+		float rz = a02 * p.x + a12 * p.y + a22 * p.z;
+		return p.x * rx + p.y * ry + p.z * rz + 2.0f * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+	}
+};
+
+// Moving vertex from onto vertex to, costing the squared distance from the planes of both.
+struct Collapse
+{
+	float cost;
+	unsigned int from;
+	unsigned int to;
+
+	bool operator<(const Collapse& other) const {
+		if (cost != other.cost) return cost < other.cost;
+		if (from != other.from) return from < other.from;
+		return to < other.to;
+	}
+};
+
+bool canCollapse(uint8_t kind, bool openEdge) {
+	return kind == Manifold ? !openEdge : kind == Border && openEdge;
+}
+
+// Drops triangles that have lost an edge, i.e. use one position twice. The rest keep their order, and their submeshes
+// (one per triangle) go with them.
+void removeDegenerate(std::vector<unsigned int>& indices, std::vector<uint32_t>& submeshes, const std::vector<unsigned int>& position) {
+	size_t write = 0;
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		unsigned int a = position[indices[i]];
+		unsigned int b = position[indices[i + 1]];
+		unsigned int c = position[indices[i + 2]];
+		if (a != b && b != c && c != a) {
+			indices[write] = indices[i];
+			indices[write + 1] = indices[i + 1];
+			indices[write + 2] = indices[i + 2];
+			submeshes[write / 3] = submeshes[i / 3];
+			write += 3;
+		}
+	}
+	indices.resize(write);
+	submeshes.resize(write / 3);
+}
+
+}
+
+SimplifyStats buildLods(MeshData& mesh) {
+	auto start = std::chrono::steady_clock::now();
+	SimplifyStats stats;
+	mesh.lods.clear();
+
+	size_t vertexCount = mesh.vertices.size();
+	size_t indexCount = mesh.vertexIndices.size();
+	if (indexCount == 0 || indexCount % 3 != 0 || vertexCount >= MeshTopology::none
+		|| *std::max_element(mesh.vertexIndices.begin(), mesh.vertexIndices.end()) >= vertexCount) {
+		return stats;
+	}
+
+	ThreadPool& pool = ThreadPool::global();
+	size_t vertexBlocks = (vertexCount + blockSize - 1) / blockSize;
+
+	// Positions around the bounding sphere's centre in units of its radius. Keeps the quadrics well conditioned in float,
+	// and errors come out relative to the radius, which is what LOD selection wants.
+	glm::vec3 center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+	float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f;
+	float scale = radius > 0.0f ? 1.0f / radius : 1.0f;
+	std::vector<glm::vec3> points(vertexCount);
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		for (size_t v = block * blockSize; v < end; v++) {
+			points[v] = (mesh.vertices[v] - center) * scale;
+		}
+	});
+
+	// Vertices split for UVs or creases share a position. Everything below works on positions, so the surface stays
+	// connected across seams, and the seams themselves are locked so their vertices cannot drift apart.
+	std::vector<unsigned int> position = weldPositions(mesh.vertices);
+	std::vector<uint8_t> kind(vertexCount, Manifold);
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (position[v] != v) {
+			kind[v] = Locked;
+			kind[position[v]] = Locked;
+		}
+	}
+
+	// Every level keeps the triangles in the order they came in, so each submesh stays one run. Positions shared by two
+	// submeshes are locked too, the outline of a material would wander off otherwise.
+	bool hasSubmeshes = !mesh.submeshes.empty() && mesh.submeshRanges.size() == mesh.submeshes.size();
+	size_t submeshCount = hasSubmeshes ? mesh.submeshes.size() : 1;
+	std::vector<uint32_t> submeshes(indexCount / 3, 0);
+	if (hasSubmeshes && submeshCount > 1) {
+		const uint32_t none = std::numeric_limits<uint32_t>::max();
+		std::vector<uint32_t> positionSubmesh(vertexCount, none);
+		for (uint32_t s = 0; s < mesh.submeshRanges.size(); s++) {
+			const SubmeshRange& range = mesh.submeshRanges[s];
+			std::fill_n(submeshes.begin() + range.indexOffset / 3, range.indexCount / 3, s);
+			for (size_t i = range.indexOffset; i < range.indexOffset + range.indexCount; i++) {
+				unsigned int p = position[mesh.vertexIndices[i]];
+				if (positionSubmesh[p] == none) {
+					positionSubmesh[p] = s;
+				}
+				else if (positionSubmesh[p] != s) {
+					kind[p] = Locked;
+				}
+			}
+		}
+	}
+
+	// Triangles with two corners at one position have no area and no edges worth collapsing.
+	std::vector<unsigned int> indices(mesh.vertexIndices);
+	removeDegenerate(indices, submeshes, position);
+	if (indices.empty()) {
+		return stats;
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	{
+		std::vector<unsigned int> welded(indices.size());
+		for (size_t i = 0; i < indices.size(); i++) {
+			welded[i] = position[indices[i]];
+		}
+		MeshTopology topology = buildTopology(welded, vertexCount);
+
+		// Every position gathers the planes of its own triangles and open edges, so the positions can be done in parallel.
+		pool.parallelFor(vertexBlocks, [&](size_t block) {
+			size_t end = std::min(vertexCount, (block + 1) * blockSize);
+			for (size_t p = block * blockSize; p < end; p++) {
+				Quadric& quadric = quadrics[p];
+				bool open = false;
+				for (uint32_t k = topology.cornerOffsets[p]; k < topology.cornerOffsets[p + 1]; k++) {
+					uint32_t corner = topology.cornerList[k];
+					uint32_t first = MeshTopology::face(corner) * 3;
+					const glm::vec3& a = points[welded[first]];
+					glm::vec3 n = glm::cross(points[welded[first + 1]] - a, points[welded[first + 2]] - a);
+					float length = glm::length(n);
+					if (length > 0.0f) {
+						n /= length;
+						quadric.addPlane(n, -glm::dot(n, a), length * 0.5f);
+					}
+
+					// The edge leaving p and the edge arriving at it.
+					const uint32_t edges[2] = { corner, MeshTopology::previous(corner) };
+					for (uint32_t edge : edges) {
+						if (topology.opposite[edge] != MeshTopology::none) {
+							continue;
+						}
+						open = true;
+						if (length > 0.0f) {
+							const glm::vec3& from = points[welded[edge]];
+							glm::vec3 along = points[welded[MeshTopology::next(edge)]] - from;
+							glm::vec3 m = glm::cross(along, n);
+							float mLength = glm::length(m);
+							if (mLength > 0.0f) {
+								m /= mLength;
+								quadric.addPlane(m, -glm::dot(m, from), borderWeight * glm::dot(along, along));
+							}
+						}
+					}
+				}
+				if (open && kind[p] == Manifold) {
+					kind[p] = Border;
+				}
+			}
+		});
+	}
+
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (position[v] == v) {
+			stats.lockedVertices += kind[v] == Locked;
+			stats.borderVertices += kind[v] == Border;
+		}
+	}
+
+	auto collapseCost = [&](unsigned int from, unsigned int to) {
+		const Quadric& a = quadrics[position[from]];
+		const Quadric& b = quadrics[position[to]];
+		float weight = a.weight + b.weight;
+		float error = a.evaluate(points[to]) + b.evaluate(points[to]);
+		return weight > 0.0f ? std::max(error, 0.0f) / weight : 0.0f;
+	};
+
+	struct Level
+	{
+		std::vector<unsigned int> indices;
+		float error;
+		std::vector<size_t> submeshEnds; // Index positions
+	};
+	std::vector<Level> levels;
+	size_t fullTriangles = indexCount / 3;
+	size_t lastTriangles = fullTriangles;
+	float maxCost = 0.0f;
+
+	auto keepLevel = [&]() {
+		size_t triangles = indices.size() / 3;
+		if (triangles > 0 && triangles <= lastTriangles * minLevelReduction) {
+			std::vector<size_t> submeshEnds(submeshCount, 0);
+			for (uint32_t submesh : submeshes) {
+				submeshEnds[submesh] += 3;
+			}
+			std::partial_sum(submeshEnds.begin(), submeshEnds.end(), submeshEnds.begin());
+			levels.push_back({ indices, std::sqrt(maxCost), submeshEnds });
+			lastTriangles = triangles;
+		}
+	};
+
+	// Triangles around each position, rebuilt every pass. Triangles never list a position twice after removeDegenerate.
+	std::vector<unsigned int> triangleOffsets(vertexCount + 1);
+	std::vector<unsigned int> triangleCursor(vertexCount);
+	std::vector<unsigned int> triangleList;
+	auto containsPosition = [&](unsigned int triangle, unsigned int p) {
+		const unsigned int* corners = &indices[triangle * size_t(3)];
+		return position[corners[0]] == p || position[corners[1]] == p || position[corners[2]] == p;
+	};
+
+	std::vector<unsigned int> collapseTo(vertexCount);
+	std::iota(collapseTo.begin(), collapseTo.end(), 0u);
+	std::vector<size_t> touchedPass(vertexCount, 0);
+	std::vector<std::vector<Collapse>> blockCollapses;
+	std::vector<Collapse> collapses;
+	// Link check marks: a position is around the current from if its mark is linkStamp, and already counted at linkStamp + 1.
+	std::vector<size_t> linkMark(vertexCount, 0);
+	size_t linkStamp = 0;
+
+	const size_t targetCount = sizeof(lodTargets) / sizeof(lodTargets[0]);
+	size_t targetIndex = 0;
+	while (targetIndex < targetCount) {
+		size_t triangleCount = indices.size() / 3;
+		size_t target = static_cast<size_t>(fullTriangles * lodTargets[targetIndex]);
+		if (triangleCount <= target) {
+			keepLevel();
+			targetIndex++;
+			continue;
+		}
+		size_t pass = ++stats.passes;
+
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0u);
+		for (unsigned int index : indices) {
+			triangleOffsets[position[index] + 1]++;
+		}
+		for (size_t p = 0; p < vertexCount; p++) {
+			triangleOffsets[p + 1] += triangleOffsets[p];
+		}
+		std::copy(triangleOffsets.begin(), triangleOffsets.end() - 1, triangleCursor.begin());
+		triangleList.resize(indices.size());
+		for (size_t i = 0; i < indices.size(); i++) {
+			triangleList[triangleCursor[position[indices[i]]]++] = static_cast<unsigned int>(i / 3);
+		}
+
+		// Cheapest direction of every edge that may collapse at all. Interior edges show up in two triangles and are
+		// only looked at from the one where they run from the lower position to the higher one.
+		size_t triangleBlocks = (triangleCount + blockSize - 1) / blockSize;
+		blockCollapses.resize(triangleBlocks);
+		pool.parallelFor(triangleBlocks, [&](size_t block) {
+			std::vector<Collapse>& out = blockCollapses[block];
+			out.clear();
+			size_t end = std::min(triangleCount, (block + 1) * blockSize);
+			for (size_t t = block * blockSize; t < end; t++) {
+				for (int e = 0; e < 3; e++) {
+					unsigned int a = indices[t * 3 + e];
+					unsigned int b = indices[t * 3 + (e + 1) % 3];
+					unsigned int pa = position[a];
+					unsigned int pb = position[b];
+					if (kind[pa] == Locked && kind[pb] == Locked) {
+						continue;
+					}
+
+					// Open edges only run between border and locked positions, anything else is inside the surface.
+					unsigned int shared = 2;
+					if (kind[pa] != Manifold && kind[pb] != Manifold) {
+						shared = 0;
+						for (unsigned int k = triangleOffsets[pa]; k < triangleOffsets[pa + 1]; k++) {
+							shared += containsPosition(triangleList[k], pb);
+						}
+					}
+					if (shared > 2 || (shared == 2 && pa > pb)) {
+						continue;
+					}
+
+					bool openEdge = shared == 1;
+					Collapse best = { std::numeric_limits<float>::infinity(), 0, 0 };
+					if (canCollapse(kind[pa], openEdge)) {
+						best = { collapseCost(a, b), a, b };
+					}
+					if (canCollapse(kind[pb], openEdge)) {
+						float cost = collapseCost(b, a);
+						if (cost < best.cost) {
+							best = { cost, b, a };
+						}
+					}
+					if (best.cost < std::numeric_limits<float>::infinity()) {
+						out.push_back(best);
+					}
+				}
+			}
+		});
+
+		collapses.clear();
+		for (const std::vector<Collapse>& block : blockCollapses) {
+			collapses.insert(collapses.end(), block.begin(), block.end());
+		}
+		if (collapses.empty()) {
+			break;
+		}
+
+		// Far fewer collapses than that fit into one pass, so only the cheapest quarter gets sorted. Leaving the rest for
+		// later passes is faster, and better than going further down the list while the neighbourhoods are all taken.
+		size_t needed = triangleCount - target;
+		size_t sorted = std::max<size_t>(collapses.size() / 4, 1);
+		std::nth_element(collapses.begin(), collapses.begin() + (sorted - 1), collapses.end());
+		std::sort(collapses.begin(), collapses.begin() + sorted);
+
+		// Collapses within a pass have to be independent: once a vertex moves, every position around it is off limits
+		// until the next pass, so the checks below always see the triangles as they are.
+		size_t removed = 0;
+		size_t accepted = 0;
+		for (size_t i = 0; i < sorted && removed < needed; i++) {
+			const Collapse& collapse = collapses[i];
+			unsigned int from = position[collapse.from];
+			unsigned int to = position[collapse.to];
+			if (touchedPass[from] == pass || touchedPass[to] == pass) {
+				continue;
+			}
+
+			// No triangle may flip or turn sharply, and the edge's end points may not share more neighbours than the
+			// triangles on the edge, or the collapse would pinch the surface into a non-manifold one.
+			size_t shared = 0;
+			bool valid = true;
+			linkStamp += 2;
+			for (unsigned int k = triangleOffsets[from]; k < triangleOffsets[from + 1] && valid; k++) {
+				const unsigned int* corners = &indices[triangleList[k] * size_t(3)];
+				for (int c = 0; c < 3; c++) {
+					linkMark[position[corners[c]]] = linkStamp;
+				}
+				if (containsPosition(triangleList[k], to)) {
+					shared++;
+					continue;
+				}
+
+				glm::vec3 before[3];
+				glm::vec3 after[3];
+				for (int c = 0; c < 3; c++) {
+					before[c] = points[corners[c]];
+					after[c] = position[corners[c]] == from ? points[collapse.to] : before[c];
+				}
+				glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+				valid = glm::dot(n0, n1) > minNormalDot * glm::length(n0) * glm::length(n1);
+			}
+			if (!valid) {
+				continue;
+			}
+
+			size_t common = 0;
+			linkMark[from] = linkStamp + 1;
+			linkMark[to] = linkStamp + 1;
+			for (unsigned int k = triangleOffsets[to]; k < triangleOffsets[to + 1]; k++) {
+				const unsigned int* corners = &indices[triangleList[k] * size_t(3)];
+				for (int c = 0; c < 3; c++) {
+					if (linkMark[position[corners[c]]] == linkStamp) {
+						linkMark[position[corners[c]]] = linkStamp + 1;
+						common++;
+					}
+				}
+			}
+			if (common > shared) {
+				continue;
+			}
+
+			collapseTo[collapse.from] = collapse.to;
+			quadrics[to].add(quadrics[from]);
+			maxCost = std::max(maxCost, collapse.cost);
+			for (unsigned int k = triangleOffsets[from]; k < triangleOffsets[from + 1]; k++) {
+				const unsigned int* corners = &indices[triangleList[k] * size_t(3)];
+				for (int c = 0; c < 3; c++) {
+					touchedPass[position[corners[c]]] = pass;
+				}
+			}
+			removed += shared;
+			accepted++;
+		}
+		if (accepted == 0) {
+			break;
+		}
+
+		// Targets of this pass's collapses did not move themselves, so one lookup finds where every corner ends up.
+		pool.parallelFor(triangleBlocks, [&](size_t block) {
+			size_t end = std::min(indices.size(), (block + 1) * blockSize * 3);
+			for (size_t i = block * blockSize * 3; i < end; i++) {
+				indices[i] = collapseTo[indices[i]];
+			}
+		});
+		removeDegenerate(indices, submeshes, position);
+	}
+
+	// Seams and borders can stop the simplification early, whatever it got down to is still worth having.
+	if (targetIndex < targetCount) {
+		keepLevel();
+	}
+
+	pool.parallelFor(levels.size(), [&](size_t level) {
+		optimizeVertexCache(levels[level].indices, vertexCount, levels[level].submeshEnds);
+	});
+
+	size_t totalIndices = indexCount;
+	for (const Level& level : levels) {
+		totalIndices += level.indices.size();
+	}
+	if (totalIndices > std::numeric_limits<uint32_t>::max()) {
+		return stats;
+	}
+
+	mesh.vertexIndices.reserve(totalIndices);
+	mesh.lods.push_back({ 0, static_cast<uint32_t>(indexCount), 0.0f });
+	for (const Level& level : levels) {
+		uint32_t offset = static_cast<uint32_t>(mesh.vertexIndices.size());
+		mesh.lods.push_back({ offset, static_cast<uint32_t>(level.indices.size()), level.error });
+		mesh.vertexIndices.insert(mesh.vertexIndices.end(), level.indices.begin(), level.indices.end());
+
+		// Submeshes that simplified away entirely keep an empty range.
+		if (hasSubmeshes) {
+			for (size_t s = 0; s < submeshCount; s++) {
+				size_t begin = s > 0 ? level.submeshEnds[s - 1] : 0;
+				mesh.submeshRanges.push_back({ offset + static_cast<uint32_t>(begin), static_cast<uint32_t>(level.submeshEnds[s] - begin), 0, mesh.submeshes[s].material });
+			}
+		}
+	}
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
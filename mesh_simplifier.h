@@ -0,0 +1,29 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <cstddef>
+
+#include "mesh_data.h"
+
+// Triangle counts buildLods aims for, as fractions of the full mesh, finest first.
+const float lodTargets[] = { 0.5f, 0.25f, 0.1f, 0.02f };
+
+struct SimplifyStats
+{
+	size_t lockedVertices = 0; // Positions split by UV seams or creases, or shared by two submeshes. Collapsing them would tear the mesh, so they never move
+	size_t borderVertices = 0; // On open edges, only collapsed along the edge
+	size_t passes = 0;
+	double milliseconds = 0.0;
+};
+
+// Builds the LOD chain for mesh by edge collapse in order of quadric error (Garland and Heckbert 1997).
+// Vertices only ever collapse onto a neighbour, never to a new position, so every level indexes the existing vertex buffer:
+// the levels are appended to mesh.vertexIndices and described by mesh.lods, lods[0] being the original triangles.
+// Each level carries on from the previous one. Collapses are picked in passes of independent edges, with the costs evaluated
+// in parallel on the global thread pool, and each level is reordered for the vertex cache at the end.
+// Triangles keep their submesh and order, so every level gets its own mesh.submeshRanges, and positions on the border
+// between two submeshes are locked like seams.
+// mesh.boundsMin/boundsMax have to be up to date. Levels that would not be noticeably smaller than the one before are left out.
+SimplifyStats buildLods(MeshData& mesh);
+
+#endif
@@ -0,0 +1,218 @@
+#include "mesh_topology.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+
+// Marks a half-edge that found more than one candidate opposite.
+const uint32_t ambiguous = MeshTopology::none - 1;
+
+inline size_t hashPosition(const glm::vec3& p) {
+	uint32_t bits[3];
+	std::memcpy(bits, &p, sizeof(bits));
+	uint64_t hash = (bits[0] + uint64_t(1)) * 0x9E3779B97F4A7C15ull;
+	hash = (hash ^ (hash >> 32) ^ bits[1]) * 0xC2B2AE3D27D4EB4Full;
+	hash = (hash ^ (hash >> 32) ^ bits[2]) * 0x165667B19E3779F9ull;
+	return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+}
+
+MeshTopology buildTopology(const std::vector<unsigned int>& indices, size_t vertexCount) {
+	auto start = std::chrono::steady_clock::now();
+	MeshTopology topology;
+
+	size_t faceCount = indices.size() / 3;
+	size_t cornerCount = faceCount * 3;
+	ThreadPool& pool = ThreadPool::global();
+
+	auto validFace = [&](size_t f) {
+		return indices[f * 3] < vertexCount && indices[f * 3 + 1] < vertexCount && indices[f * 3 + 2] < vertexCount;
+	};
+
+	// Vertex -> corner lists, built in parallel over blocks of faces: corners are counted per vertex with atomic
+	// increments, the counts become offsets with a prefix sum over blocks of vertices, and each corner is scattered to the
+	// next free slot of its vertex. The scatter fills a list in whatever order the blocks ran, so every list is sorted
+	// afterwards, which puts it back in corner order.
+	size_t faceBlocks = (faceCount + blockSize - 1) / blockSize;
+	size_t vertexBlocks = (vertexCount + blockSize - 1) / blockSize;
+	std::vector<std::atomic<uint32_t>> cursor(vertexCount);
+	pool.parallelFor(faceBlocks, [&](size_t block) {
+		size_t end = std::min(faceCount, (block + 1) * blockSize);
+		for (size_t f = block * blockSize; f < end; f++) {
+			if (validFace(f)) {
+				for (size_t i = f * 3; i < f * 3 + 3; i++) {
+					cursor[indices[i]].fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	});
+
+	topology.cornerOffsets.assign(vertexCount + 1, 0);
+	std::vector<uint32_t> blockCorners(vertexBlocks + 1, 0);
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		uint32_t total = 0;
+		for (size_t v = block * blockSize; v < end; v++) {
+			total += cursor[v].load(std::memory_order_relaxed);
+		}
+		blockCorners[block + 1] = total;
+	});
+	for (size_t block = 0; block < vertexBlocks; block++) {
+		blockCorners[block + 1] += blockCorners[block];
+	}
+	// Counts become offsets, and the cursors start there.
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		uint32_t next = blockCorners[block];
+		for (size_t v = block * blockSize; v < end; v++) {
+			topology.cornerOffsets[v] = next;
+			next += cursor[v].load(std::memory_order_relaxed);
+			cursor[v].store(topology.cornerOffsets[v], std::memory_order_relaxed);
+		}
+	});
+	size_t listedCorners = blockCorners[vertexBlocks];
+	topology.cornerOffsets[vertexCount] = static_cast<uint32_t>(listedCorners);
+	topology.cornerList.resize(listedCorners);
+
+	pool.parallelFor(faceBlocks, [&](size_t block) {
+		size_t end = std::min(faceCount, (block + 1) * blockSize);
+		for (size_t f = block * blockSize; f < end; f++) {
+			if (validFace(f)) {
+				for (size_t i = f * 3; i < f * 3 + 3; i++) {
+					topology.cornerList[cursor[indices[i]].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(i);
+				}
+			}
+		}
+	});
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		for (size_t v = block * blockSize; v < end; v++) {
+			std::sort(topology.cornerList.begin() + topology.cornerOffsets[v], topology.cornerList.begin() + topology.cornerOffsets[v + 1]);
+		}
+	});
+	std::vector<std::atomic<uint32_t>>().swap(cursor);
+
+	// Opposite half-edges, a vertex at a time so everything looked at sits in one corner list. At vertex a, corner c starts
+	// the half-edge a -> next vertex, and the corner before each corner d at a ends one coming in, previous vertex -> a.
+	// The half-edge a -> b pairs with the one coming in from b. Only an edge with exactly one such candidate is paired here...
+	std::vector<uint32_t> candidate(cornerCount, MeshTopology::none);
+	pool.parallelFor(vertexBlocks, [&](size_t block) {
+		size_t end = std::min(vertexCount, (block + 1) * blockSize);
+		std::vector<unsigned int> outgoing;
+		std::vector<unsigned int> incoming;
+		std::vector<std::pair<unsigned int, uint32_t>> sortedIncoming;
+		for (size_t a = block * blockSize; a < end; a++) {
+			const uint32_t* corners = topology.cornerList.data() + topology.cornerOffsets[a];
+			size_t count = topology.cornerOffsets[a + 1] - topology.cornerOffsets[a];
+			outgoing.resize(count);
+			incoming.resize(count);
+			for (size_t i = 0; i < count; i++) {
+				outgoing[i] = indices[MeshTopology::next(corners[i])];
+				incoming[i] = indices[MeshTopology::previous(corners[i])];
+				// Triangles with a repeated vertex would make their edge look non-manifold. They pair with nothing.
+				if (outgoing[i] == a || incoming[i] == a || outgoing[i] == incoming[i]) {
+					outgoing[i] = static_cast<unsigned int>(a);
+					incoming[i] = MeshTopology::none;
+				}
+			}
+
+			// A handful of corners is quicker to search directly; high valence vertices (cone tips, fans) get a sorted search.
+			bool sortedSearch = count > 32;
+			if (sortedSearch) {
+				sortedIncoming.clear();
+				for (size_t j = 0; j < count; j++) {
+					sortedIncoming.push_back({ incoming[j], static_cast<uint32_t>(j) });
+				}
+				std::sort(sortedIncoming.begin(), sortedIncoming.end());
+			}
+
+			for (size_t i = 0; i < count; i++) {
+				if (outgoing[i] == a) {
+					continue;
+				}
+				size_t match = 0;
+				size_t matches = 0;
+				if (sortedSearch) {
+					auto found = std::lower_bound(sortedIncoming.begin(), sortedIncoming.end(), std::make_pair(outgoing[i], uint32_t(0)));
+					for (; found != sortedIncoming.end() && found->first == outgoing[i]; ++found) {
+						match = found->second;
+						matches++;
+					}
+				}
+				else {
+					for (size_t j = 0; j < count; j++) {
+						if (incoming[j] == outgoing[i]) {
+							match = j;
+							matches++;
+						}
+					}
+				}
+				candidate[corners[i]] = matches == 1 ? MeshTopology::previous(corners[match]) : matches > 1 ? ambiguous : MeshTopology::none;
+			}
+		}
+	});
+
+	// ...and only if the pairing is mutual, which rules out a second face winding the same way along the edge.
+	topology.opposite.assign(cornerCount, MeshTopology::none);
+	size_t blockCount = (faceCount + blockSize - 1) / blockSize;
+	std::vector<size_t> blockBorder(blockCount, 0);
+	std::vector<size_t> blockUnpaired(blockCount, 0);
+	pool.parallelFor(blockCount, [&](size_t block) {
+		size_t end = std::min(cornerCount, (block + 1) * blockSize * 3);
+		size_t border = 0;
+		size_t unpaired = 0;
+		for (size_t c = block * blockSize * 3; c < end; c++) {
+			uint32_t d = candidate[c];
+			if (d < cornerCount && candidate[d] == c) {
+				topology.opposite[c] = d;
+			}
+			else if (d != MeshTopology::none) {
+				unpaired++;
+			}
+			else if (validFace(c / 3)) {
+				border++;
+			}
+		}
+		blockBorder[block] = border;
+		blockUnpaired[block] = unpaired;
+	});
+	for (size_t block = 0; block < blockCount; block++) {
+		topology.borderEdges += blockBorder[block];
+		topology.nonManifoldEdges += blockUnpaired[block];
+	}
+
+	topology.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return topology;
+}
+
+std::vector<unsigned int> weldPositions(const std::vector<glm::vec3>& vertices) {
+	const unsigned int empty = std::numeric_limits<unsigned int>::max();
+	size_t tableSize = 1;
+	while (tableSize < vertices.size() * 2) {
+		tableSize <<= 1;
+	}
+	size_t mask = tableSize - 1;
+
+	std::vector<unsigned int> table(tableSize, empty);
+	std::vector<unsigned int> position(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++) {
+		size_t slot = hashPosition(vertices[v]) & mask;
+		while (table[slot] != empty && std::memcmp(&vertices[table[slot]], &vertices[v], sizeof(glm::vec3)) != 0) {
+			slot = (slot + 1) & mask;
+		}
+		if (table[slot] == empty) {
+			table[slot] = static_cast<unsigned int>(v);
+		}
+		position[v] = table[slot];
+	}
+	return position;
+}
@@ -0,0 +1,45 @@
+#ifndef MESH_TOPOLOGY_H
+#define MESH_TOPOLOGY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+// Corner table over a triangle index buffer: corner c is index c, of triangle c / 3, and also the half-edge running from its
+// vertex to the next corner's. Next and previous are implicit, so the only stored links are the opposite half-edges and
+// the corners around each vertex, all in flat 32 bit arrays.
+// The table stays valid for as long as the triangles are not reordered, so later passes can share one build.
+struct MeshTopology
+{
+	static constexpr uint32_t none = 0xFFFFFFFF;
+
+	// The corners at vertex v are cornerList[cornerOffsets[v]] .. cornerList[cornerOffsets[v + 1] - 1], in increasing order.
+	std::vector<uint32_t> cornerOffsets;
+	std::vector<uint32_t> cornerList;
+
+	// Per corner, the half-edge running the other way along the same edge, or none for border and non-manifold edges.
+	std::vector<uint32_t> opposite;
+
+	size_t borderEdges = 0;      // Half-edges with nothing opposite
+	size_t nonManifoldEdges = 0; // Half-edges left unpaired because three or more faces share the edge, or two wind the same way
+	double milliseconds = 0.0;
+
+	static uint32_t face(uint32_t corner) { return corner / 3; }
+	static uint32_t next(uint32_t corner) { return corner % 3 == 2 ? corner - 2 : corner + 1; }
+	static uint32_t previous(uint32_t corner) { return corner % 3 == 0 ? corner + 2 : corner - 1; }
+
+	size_t vertexCount() const { return cornerOffsets.empty() ? 0 : cornerOffsets.size() - 1; }
+	size_t cornerCount() const { return opposite.size(); }
+};
+
+// Builds the table for indices over vertexCount vertices in linear time, in parallel on the global thread pool.
+// Triangles with an index past vertexCount are left out: their corners are in no vertex's list and have no opposites.
+MeshTopology buildTopology(const std::vector<unsigned int>& indices, size_t vertexCount);
+
+// For every vertex, the first vertex with bit for bit the same position. Indexing through this stitches the mesh back
+// together across UV seams and split normals, for passes that only care about the surface.
+std::vector<unsigned int> weldPositions(const std::vector<glm::vec3>& vertices);
+
+#endif
@@ -0,0 +1,528 @@
+#include "meshlets.h"
+#include "frustum.h"
+#include "mesh_topology.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+// Same as the normal generator: SSE2 is always there on x64.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MESHLETS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t blockSize = size_t(1) << 16;
+
+// Meshlets per culling job. Small meshes are culled on the calling thread alone.
+const size_t cullBlockSize = 4096;
+
+// A triangle whose normal is further than about 45 degrees from the meshlet's average starts a new meshlet, so the cones
+// stay narrow enough to be culled from behind.
+const float coneSplitCos = 0.7071f;
+
+// Meshlets do not grow through vertices with more triangles than this, a big fan would be scanned at every step.
+const uint32_t maxGrowValence = 1024;
+
+enum Visibility : uint8_t
+{
+	Visible,
+	OutsideFrustum,
+	BackFacing,
+};
+
+struct CullView
+{
+	float planes[6][4];
+	float camera[3];
+};
+
+// The meshlet is back facing if every point in its bounding sphere sees every normal in its cone from behind: the
+// smallest dot(normal, point - camera) over both, |d| cos(angle(d, axis) + half angle) - radius with d = center - camera,
+// has to be positive. Cones of 90 degrees or more never pass, build() stores those as cos 0, sin 1.
+uint8_t classify(const CullView& view, float cx, float cy, float cz, float r, float ax, float ay, float az, float cosine, float sine) {
+	bool outside = false;
+	for (const float* plane : view.planes) {
+		float distance = plane[0] * cx + plane[1] * cy + plane[2] * cz + plane[3];
+		outside |= distance < -r;
+	}
+	if (outside) {
+		return OutsideFrustum;
+	}
+
+	float dx = cx - view.camera[0];
+	float dy = cy - view.camera[1];
+	float dz = cz - view.camera[2];
+	float along = dx * ax + dy * ay + dz * az;
+	float lengthSquared = dx * dx + dy * dy + dz * dz;
+	float across = std::sqrt(std::max(lengthSquared - along * along, 0.0f));
+	return along * cosine - across * sine > r ? BackFacing : Visible;
+}
+
+#ifdef MESHLETS_SSE2
+// Four meshlets at once, the exact same operations as classify().
+void classify4(const CullView& view, const float* cx, const float* cy, const float* cz, const float* r,
+	const float* ax, const float* ay, const float* az, const float* cosine, const float* sine, uint8_t* out) {
+	__m128 x = _mm_loadu_ps(cx);
+	__m128 y = _mm_loadu_ps(cy);
+	__m128 z = _mm_loadu_ps(cz);
+	__m128 radius = _mm_loadu_ps(r);
+	__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+	__m128 outside = _mm_setzero_ps();
+	for (const float* plane : view.planes) {
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), x), _mm_mul_ps(_mm_set1_ps(plane[1]), y)),
+			_mm_mul_ps(_mm_set1_ps(plane[2]), z)), _mm_set1_ps(plane[3]));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+	}
+
+	__m128 dx = _mm_sub_ps(x, _mm_set1_ps(view.camera[0]));
+	__m128 dy = _mm_sub_ps(y, _mm_set1_ps(view.camera[1]));
+	__m128 dz = _mm_sub_ps(z, _mm_set1_ps(view.camera[2]));
+	__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(ax)), _mm_mul_ps(dy, _mm_loadu_ps(ay))), _mm_mul_ps(dz, _mm_loadu_ps(az)));
+	__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	__m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSquared, _mm_mul_ps(along, along)), _mm_setzero_ps()));
+	__m128 back = _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(along, _mm_loadu_ps(cosine)), _mm_mul_ps(across, _mm_loadu_ps(sine))), radius);
+
+	int outsideBits = _mm_movemask_ps(outside);
+	int backBits = _mm_movemask_ps(back);
+	for (int lane = 0; lane < 4; lane++) {
+		out[lane] = (outsideBits >> lane) & 1 ? OutsideFrustum : (backBits >> lane) & 1 ? BackFacing : Visible;
+	}
+}
+#endif
+
+}
+
+MeshletStats buildMeshlets(MeshData& mesh) {
+	auto start = std::chrono::steady_clock::now();
+	MeshletStats stats;
+	mesh.meshlets.clear();
+
+	size_t vertexCount = mesh.vertices.size();
+	size_t indexCount = mesh.baseIndexCount();
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || indexCount % 3 != 0
+		|| *std::max_element(mesh.vertexIndices.begin(), mesh.vertexIndices.begin() + indexCount) >= vertexCount) {
+		return stats;
+	}
+
+	ThreadPool& pool = ThreadPool::global();
+	const unsigned int* indices = mesh.vertexIndices.data();
+
+	// Meshlets never take triangles from two submeshes, so every submesh is still one run of whole meshlets afterwards.
+	std::vector<uint32_t> triangleSubmesh(triangleCount, 0);
+	bool hasSubmeshes = mesh.submeshes.size() > 1 && mesh.submeshRanges.size() >= mesh.submeshes.size();
+	if (hasSubmeshes) {
+		const SubmeshRange* ranges = mesh.lodRanges(0);
+		for (uint32_t s = 0; s < mesh.submeshes.size(); s++) {
+			std::fill_n(triangleSubmesh.begin() + ranges[s].indexOffset / 3, ranges[s].indexCount / 3, s);
+		}
+	}
+
+	// Unit face normals, zero for triangles without area, and centroids.
+	std::vector<glm::vec3> faceNormals(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	pool.parallelFor((triangleCount + blockSize - 1) / blockSize, [&](size_t block) {
+		size_t end = std::min(triangleCount, (block + 1) * blockSize);
+		for (size_t t = block * blockSize; t < end; t++) {
+			const glm::vec3& a = mesh.vertices[indices[t * 3]];
+			const glm::vec3& b = mesh.vertices[indices[t * 3 + 1]];
+			const glm::vec3& c = mesh.vertices[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float length = glm::length(n);
+			faceNormals[t] = length > 0.0f && std::isfinite(length) ? n / length : glm::vec3(0.0f);
+			centroids[t] = (a + b + c) / 3.0f;
+		}
+	});
+
+	// Triangles around each position, with the mesh welded back together so meshlets grow across UV seams and hard edges
+	// as well. Triangles without area are left out.
+	std::vector<unsigned int> position = weldPositions(mesh.vertices);
+	std::vector<unsigned int> welded(indexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < indexCount; i++) {
+		welded[i] = position[indices[i]];
+		if (faceNormals[i / 3] != glm::vec3(0.0f)) {
+			adjacencyOffsets[welded[i] + 1]++;
+		}
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	}
+	std::vector<uint32_t> adjacency(adjacencyOffsets[vertexCount]);
+	{
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indexCount; i++) {
+			if (faceNormals[i / 3] != glm::vec3(0.0f)) {
+				adjacency[fill[welded[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	}
+
+	// Meshlets are grown one at a time from a seed triangle, always taking the neighbouring triangle that shares the most
+	// vertices with the meshlet, then the one whose vertices have the fewest triangles left so nothing gets stranded
+	// between meshlets, then the one closest to its middle. Neighbours of the last triangle are tried first, the whole
+	// edge of the meshlet only when none of those shares an edge with it. Triangles too far off the meshlet's normal are left for a later
+	// one once it is big enough. The next seed comes from the edge of the last meshlet, so neighbours stay close in the
+	// index buffer too.
+	const uint32_t none = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+	}
+	std::vector<uint32_t> vertexMeshlet(vertexCount, none);
+	std::vector<uint32_t> frontierMeshlet(triangleCount, none);
+	std::vector<uint8_t> assigned(triangleCount, 0);
+	std::vector<uint32_t> order;
+	order.reserve(triangleCount);
+	std::vector<size_t> starts;
+	std::vector<uint32_t> frontier;
+	size_t cursor = 0;
+	uint32_t seed = none;
+
+	uint32_t current = 0;
+	uint32_t currentSubmesh = 0;
+	glm::vec3 normalSum(0.0f);
+	float normalLength = 0.0f;
+	glm::vec3 middle(0.0f);
+	size_t size = 0;
+	uint32_t best = none;
+	int bestShared = 0;
+	uint32_t bestLive = 0;
+	float bestDistance = 0.0f;
+	auto consider = [&](uint32_t t) {
+		if (triangleSubmesh[t] != currentSubmesh) {
+			return;
+		}
+		int shared = 0;
+		uint32_t live = 0;
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = welded[t * 3 + k];
+			shared += vertexMeshlet[v] == current;
+			live += liveTriangles[v];
+		}
+		// Holes are filled in whatever their normal, otherwise they end up as meshlets of a triangle or two later.
+		if (shared < 3 && size >= meshletMinTriangles && glm::dot(faceNormals[t], normalSum) < coneSplitCos * normalLength) {
+			return;
+		}
+		glm::vec3 offset = centroids[t] - middle;
+		float distance = glm::dot(offset, offset);
+		if (best == none || shared > bestShared || (shared == bestShared && (live < bestLive || (live == bestLive && distance < bestDistance)))) {
+			best = t;
+			bestShared = shared;
+			bestLive = live;
+			bestDistance = distance;
+		}
+	};
+
+	// Triangles without area take no part, they are packed into meshlets of their own at the end.
+	std::vector<uint32_t> degenerate;
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (faceNormals[t] == glm::vec3(0.0f)) {
+			assigned[t] = 1;
+			degenerate.push_back(static_cast<uint32_t>(t));
+		}
+	}
+
+	while (order.size() + degenerate.size() < triangleCount) {
+		if (seed == none) {
+			while (assigned[cursor]) {
+				cursor++;
+			}
+			seed = static_cast<uint32_t>(cursor);
+		}
+
+		current = static_cast<uint32_t>(starts.size());
+		currentSubmesh = triangleSubmesh[seed];
+		starts.push_back(order.size());
+		frontier.clear();
+		normalSum = glm::vec3(0.0f);
+		glm::vec3 centroidSum(0.0f);
+		size = 0;
+
+		uint32_t next = seed;
+		while (next != none) {
+			assigned[next] = 1;
+			order.push_back(next);
+			normalSum += faceNormals[next];
+			centroidSum += centroids[next];
+			size++;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = welded[next * 3 + k];
+				liveTriangles[v]--;
+				if (vertexMeshlet[v] == current) {
+					continue;
+				}
+				vertexMeshlet[v] = current;
+				if (adjacencyOffsets[v + 1] - adjacencyOffsets[v] > maxGrowValence) {
+					continue;
+				}
+				for (uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v + 1]; i++) {
+					uint32_t t = adjacency[i];
+					if (!assigned[t] && frontierMeshlet[t] != current && triangleSubmesh[t] == currentSubmesh) {
+						frontierMeshlet[t] = current;
+						frontier.push_back(t);
+					}
+				}
+			}
+			if (size >= meshletMaxTriangles) {
+				break;
+			}
+
+			middle = centroidSum / static_cast<float>(size);
+			normalLength = glm::length(normalSum);
+			best = none;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = welded[next * 3 + k];
+				if (adjacencyOffsets[v + 1] - adjacencyOffsets[v] > maxGrowValence) {
+					continue;
+				}
+				for (uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v + 1]; i++) {
+					if (!assigned[adjacency[i]]) {
+						consider(adjacency[i]);
+					}
+				}
+			}
+			if (best == none || bestShared < 2) {
+				for (size_t i = 0; i < frontier.size();) {
+					if (assigned[frontier[i]]) {
+						frontier[i] = frontier.back();
+						frontier.pop_back();
+						continue;
+					}
+					consider(frontier[i++]);
+				}
+			}
+			next = best;
+		}
+
+		// Start the next meshlet where this one left the fewest triangles behind.
+		seed = none;
+		uint32_t seedLive = 0;
+		for (uint32_t t : frontier) {
+			if (!assigned[t]) {
+				uint32_t live = liveTriangles[welded[t * 3]] + liveTriangles[welded[t * 3 + 1]] + liveTriangles[welded[t * 3 + 2]];
+				if (seed == none || live < seedLive) {
+					seed = t;
+					seedLive = live;
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < degenerate.size(); i++) {
+		if (i == 0 || order.size() - starts.back() == meshletMaxTriangles || triangleSubmesh[degenerate[i]] != triangleSubmesh[degenerate[i - 1]]) {
+			starts.push_back(order.size());
+		}
+		order.push_back(degenerate[i]);
+	}
+
+	// Seeds walk through the submeshes in order, but the meshlets without area were left for the end.
+	if (hasSubmeshes) {
+		std::vector<uint32_t> meshletOrder(starts.size());
+		std::iota(meshletOrder.begin(), meshletOrder.end(), 0u);
+		std::stable_sort(meshletOrder.begin(), meshletOrder.end(), [&](uint32_t a, uint32_t b) {
+			return triangleSubmesh[order[starts[a]]] < triangleSubmesh[order[starts[b]]];
+		});
+		std::vector<uint32_t> sortedOrder;
+		std::vector<size_t> sortedStarts;
+		sortedOrder.reserve(triangleCount);
+		sortedStarts.reserve(starts.size());
+		for (uint32_t m : meshletOrder) {
+			size_t last = m + 1 < starts.size() ? starts[m + 1] : triangleCount;
+			sortedStarts.push_back(sortedOrder.size());
+			sortedOrder.insert(sortedOrder.end(), order.begin() + starts[m], order.begin() + last);
+		}
+		order.swap(sortedOrder);
+		starts.swap(sortedStarts);
+	}
+
+	// Within a meshlet the triangles keep optimizeMesh's order, which is still fairly good for the vertex cache.
+	for (size_t m = 0; m < starts.size(); m++) {
+		size_t last = m + 1 < starts.size() ? starts[m + 1] : triangleCount;
+		std::sort(order.begin() + starts[m], order.begin() + last);
+	}
+
+	// Each meshlet becomes a run of the index buffer. Only the full detail range moves, the LODs after it are left alone.
+	{
+		std::vector<unsigned int> reordered(indexCount);
+		std::vector<glm::vec3> reorderedNormals(triangleCount);
+		for (size_t i = 0; i < triangleCount; i++) {
+			uint32_t t = order[i];
+			reordered[i * 3] = indices[t * 3];
+			reordered[i * 3 + 1] = indices[t * 3 + 1];
+			reordered[i * 3 + 2] = indices[t * 3 + 2];
+			reorderedNormals[i] = faceNormals[t];
+		}
+		std::copy(reordered.begin(), reordered.end(), mesh.vertexIndices.begin());
+		faceNormals.swap(reorderedNormals);
+	}
+
+	mesh.meshlets.resize(starts.size());
+	size_t meshletBlock = blockSize / meshletMaxTriangles;
+	pool.parallelFor((starts.size() + meshletBlock - 1) / meshletBlock, [&](size_t block) {
+		size_t end = std::min(starts.size(), (block + 1) * meshletBlock);
+		for (size_t m = block * meshletBlock; m < end; m++) {
+			size_t first = starts[m];
+			size_t last = m + 1 < starts.size() ? starts[m + 1] : triangleCount;
+
+			glm::vec3 boxMin = mesh.vertices[indices[first * 3]];
+			glm::vec3 boxMax = boxMin;
+			glm::vec3 axis(0.0f);
+			for (size_t i = first * 3; i < last * 3; i++) {
+				boxMin = glm::min(boxMin, mesh.vertices[indices[i]]);
+				boxMax = glm::max(boxMax, mesh.vertices[indices[i]]);
+			}
+			for (size_t t = first; t < last; t++) {
+				axis += faceNormals[t];
+			}
+
+			Meshlet& meshlet = mesh.meshlets[m];
+			meshlet.indexOffset = static_cast<uint32_t>(first * 3);
+			meshlet.indexCount = static_cast<uint32_t>((last - first) * 3);
+			meshlet.center = (boxMin + boxMax) * 0.5f;
+			meshlet.radius = 0.0f;
+			for (size_t i = first * 3; i < last * 3; i++) {
+				meshlet.radius = std::max(meshlet.radius, glm::length(mesh.vertices[indices[i]] - meshlet.center));
+			}
+
+			// Triangles without area do not count towards the cone, they are never drawn anyway.
+			float axisLength = glm::length(axis);
+			float cosine = -1.0f;
+			if (axisLength > 0.0f) {
+				axis /= axisLength;
+				cosine = 1.0f;
+				for (size_t t = first; t < last; t++) {
+					if (faceNormals[t] != glm::vec3(0.0f)) {
+						cosine = std::min(cosine, glm::dot(faceNormals[t], axis));
+					}
+				}
+			}
+			meshlet.coneAxis = axis;
+			meshlet.coneCos = cosine > 0.0f ? cosine : 0.0f;
+			meshlet.coneSin = cosine > 0.0f ? std::sqrt(std::max(1.0f - cosine * cosine, 0.0f)) : 1.0f;
+		}
+	});
+
+	float meshRadius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f;
+	double radiusSum = 0.0;
+	for (const Meshlet& meshlet : mesh.meshlets) {
+		stats.cullableCones += meshlet.coneCos > 0.0f;
+		radiusSum += meshlet.radius;
+	}
+	stats.meshlets = mesh.meshlets.size();
+	stats.averageTriangles = static_cast<float>(triangleCount) / stats.meshlets;
+	stats.averageRadius = meshRadius > 0.0f ? static_cast<float>(radiusSum / stats.meshlets / meshRadius) : 0.0f;
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+void MeshletCuller::build(const std::vector<Meshlet>& meshlets) {
+	count = meshlets.size();
+	size_t padded = (count + 3) & ~size_t(3);
+
+	// Padding lanes get classified like the rest and then ignored.
+	centerX.assign(padded, 0.0f);
+	centerY.assign(padded, 0.0f);
+	centerZ.assign(padded, 0.0f);
+	radius.assign(padded, 0.0f);
+	axisX.assign(padded, 0.0f);
+	axisY.assign(padded, 0.0f);
+	axisZ.assign(padded, 0.0f);
+	coneCos.assign(padded, 0.0f);
+	coneSin.assign(padded, 1.0f);
+	indexOffsets.resize(count);
+	indexCounts.resize(count);
+	results.assign(padded, Visible);
+
+	for (size_t i = 0; i < count; i++) {
+		const Meshlet& meshlet = meshlets[i];
+		centerX[i] = meshlet.center.x;
+		centerY[i] = meshlet.center.y;
+		centerZ[i] = meshlet.center.z;
+		radius[i] = meshlet.radius;
+		axisX[i] = meshlet.coneAxis.x;
+		axisY[i] = meshlet.coneAxis.y;
+		axisZ[i] = meshlet.coneAxis.z;
+		coneCos[i] = meshlet.coneCos;
+		coneSin[i] = meshlet.coneSin;
+		indexOffsets[i] = meshlet.indexOffset;
+		indexCounts[i] = meshlet.indexCount;
+	}
+}
+
+size_t MeshletCuller::bytes() const {
+	return centerX.capacity() * sizeof(float) * 9 + indexOffsets.capacity() * sizeof(uint32_t) * 2 + results.capacity();
+}
+
+CullStats MeshletCuller::cull(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, MeshletDrawList& draws) {
+	auto start = std::chrono::steady_clock::now();
+	CullStats stats;
+	stats.meshlets = count;
+	draws.firsts.clear();
+	draws.counts.clear();
+	if (count == 0) {
+		return stats;
+	}
+
+	// Bringing the frustum and the camera into model space is two matrix operations, bringing thousands of bounds out of it is not.
+	CullView view;
+	Frustum frustum = Frustum::fromMatrix(viewProjection * model);
+	for (int p = 0; p < 6; p++) {
+		for (int k = 0; k < 4; k++) {
+			view.planes[p][k] = frustum.planes[p][k];
+		}
+	}
+	glm::vec3 camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+	view.camera[0] = camera.x;
+	view.camera[1] = camera.y;
+	view.camera[2] = camera.z;
+
+	size_t padded = centerX.size();
+	size_t blocks = (padded + cullBlockSize - 1) / cullBlockSize;
+	auto cullBlock = [&](size_t block) {
+		size_t i = block * cullBlockSize;
+		size_t end = std::min(padded, i + cullBlockSize);
+#ifdef MESHLETS_SSE2
+		for (; i < end; i += 4) {
+			classify4(view, &centerX[i], &centerY[i], &centerZ[i], &radius[i], &axisX[i], &axisY[i], &axisZ[i], &coneCos[i], &coneSin[i], &results[i]);
+		}
+#endif
+		for (; i < end; i++) {
+			results[i] = classify(view, centerX[i], centerY[i], centerZ[i], radius[i], axisX[i], axisY[i], axisZ[i], coneCos[i], coneSin[i]);
+		}
+	};
+	if (blocks > 1) {
+		ThreadPool::global().parallelFor(blocks, cullBlock);
+	}
+	else {
+		cullBlock(0);
+	}
+
+	// Meshlets are consecutive in the index buffer, so runs of visible ones become single draws.
+	for (size_t i = 0; i < count; i++) {
+		if (results[i] == OutsideFrustum) {
+			stats.frustumCulled++;
+		}
+		else if (results[i] == BackFacing) {
+			stats.backfaceCulled++;
+		}
+		else if (!draws.firsts.empty() && draws.firsts.back() + draws.counts.back() == indexOffsets[i]) {
+			draws.counts.back() += indexCounts[i];
+		}
+		else {
+			draws.firsts.push_back(indexOffsets[i]);
+			draws.counts.push_back(indexCounts[i]);
+		}
+	}
+	stats.drawRanges = draws.firsts.size();
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
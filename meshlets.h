@@ -0,0 +1,77 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "mesh_data.h"
+
+// Meshlets end after meshletMaxTriangles, or earlier once they have meshletMinTriangles and no neighbouring triangle fits
+// their normal cone. They can come out smaller when they run out of neighbours.
+const unsigned int meshletMinTriangles = 64;
+const unsigned int meshletMaxTriangles = 128;
+
+struct MeshletStats
+{
+	size_t meshlets = 0;
+	size_t cullableCones = 0; // Meshlets whose normal cone is narrow enough to ever be back facing as a whole
+	float averageTriangles = 0.0f;
+	float averageRadius = 0.0f; // Relative to the mesh's bounding sphere
+	double milliseconds = 0.0;
+};
+
+// Splits the full detail triangles of mesh into mesh.meshlets, each with a bounding sphere and a cone around its normals.
+// Meshlets are grown across shared positions so they stay compact, but never into another submesh, and the full detail
+// part of mesh.vertexIndices is reordered so each one is a consecutive run of it within its submesh's range. The LODs are not touched. Bounds are computed in parallel on the
+// global thread pool.
+MeshletStats buildMeshlets(MeshData& mesh);
+
+struct CullStats
+{
+	size_t meshlets = 0;
+	size_t frustumCulled = 0;
+	size_t backfaceCulled = 0;
+	size_t drawRanges = 0; // Visible meshlets next to each other in the index buffer are drawn as one range
+	double milliseconds = 0.0;
+
+	float culledFraction() const { return meshlets > 0 ? static_cast<float>(frustumCulled + backfaceCulled) / meshlets : 0.0f; }
+};
+
+// Parts of the index buffer left to draw, as first index and index count.
+struct MeshletDrawList
+{
+	std::vector<uint32_t> firsts;
+	std::vector<uint32_t> counts;
+};
+
+// Per frame culling of a mesh's meshlets against the view frustum and their normal cones.
+// The bounds are kept in structure of arrays form so four meshlets are tested at once with SSE2, and big meshes are split
+// over the global thread pool.
+class MeshletCuller
+{
+public:
+	void build(const std::vector<Meshlet>& meshlets);
+	void clear() { build(std::vector<Meshlet>()); }
+
+	bool empty() const { return count == 0; }
+	size_t bytes() const;
+
+	// Culls in the model's own space, so model must scale all axes by the same amount for the normal cones to hold.
+	// cameraPosition is in world space.
+	CullStats cull(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, MeshletDrawList& draws);
+
+private:
+	size_t count = 0;
+
+	// Padded to a multiple of four.
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> axisX, axisY, axisZ, coneCos, coneSin;
+	std::vector<uint32_t> indexOffsets, indexCounts;
+
+	std::vector<uint8_t> results; // Per meshlet, see the Visibility enum in meshlets.cpp
+};
+
+#endif
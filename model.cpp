@@ -1,282 +1,547 @@
 #include "model.h"
-#include <iostream>
-#include <fstream>
-#include <sstream>
+#include "gl_state.h"
+#include "mesh_loader.h"
 
-Model::Model() { }
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
 
-Model::~Model() {
-	glDeleteVertexArrays(1, &vao);
-	glDeleteBuffers(1, &vbo);
-	glDeleteBuffers(1, &ebo);
-}
+static_assert(sizeof(GpuMaterial) == 48, "GpuMaterial has to match the std140 layout of Material in fragment_shader.glsl");
 
-bool Model::loadOBJ(const std::string& path) {
-	vertices.clear();
-	// normals.clear();
-	texCoords.clear();
-	GL_normals.clear();
-	vertexIndices.clear();
+namespace {
 
-	std::ifstream file(path);
-	if (!file.is_open()) {
-		std::cerr << "ERROR::MODEL::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-		return false;
-	}
+// Vertex attributes of Instance: four columns of the model matrix, the color and the material.
+const GLuint firstInstanceAttribute = 3;
+const GLuint endInstanceAttribute = 9;
 
-	std::string line;
-	// Parsing vertex, texture(uv), normal, and face data
-	// As of right now, textures are not used, but I still parse them for future use.
-	while (std::getline(file, line)) {
-		if (line.substr(0, 2) == "v ") {
-			parseVertex(line);
+// They are part of the vertex array, so the cache drops this whenever the last draw of the model was the same kind.
+// Left on, the plain draws would read instance 0 of whatever the buffer holds.
+void setInstanceAttributes(bool enabled) {
+	GlState& state = GlState::current();
+	for (GLuint attribute = firstInstanceAttribute; attribute < endInstanceAttribute; attribute++) {
+		if (enabled) {
+			state.enableVertexAttribArray(attribute);
 		}
-		else if (line.substr(0, 3) == "vt ") {
-			parseTexCoord(line);
-		}
-		/*
-		else if (line.substr(0, 3) == "vn ") {
-			parseNormal(line);
-		}*/ // Unused for now, normals are directly calculated from vertices.
-		else if (line.substr(0, 2) == "f ") {
-			parseFace(line);
+		else {
+			state.disableVertexAttribArray(attribute);
 		}
 	}
+}
 
-	file.close();
+}
 
-	setupBuffers();
+Model::Model(VertexFormat format) : format(format) { }
 
-	/* Debug *\
-	std::cout << "Vertex Buffer Size: " << vertices.size() << std::endl;
-	std::cout << "Normal Buffer Size: " << normals.size() << std::endl;
-	std::cout << "GL_Normal Buffer Size: " << GL_normals.size() << std::endl;
-	*/
+Model::~Model() {
+	releaseBuffers(current);
+	releaseBuffers(pending);
+}
+
+bool Model::loadOBJ(const std::string& path, const LoadOptions& options) {
+	MeshData data;
+	uint64_t sourceHash;
+	if (!loadMesh(path, data, sourceHash, options)) {
+		return false;
+	}
 
+	beginUpload(std::move(data));
+	continueUpload(std::numeric_limits<size_t>::max());
 	return true;
 }
 
-void Model::render(Shader shader) {
-	glBindVertexArray(vao);
+size_t Model::lodTriangles(unsigned int lod) const {
+	if (current.lods.empty()) {
+		return current.indexCount / 3;
+	}
+	return current.lods[std::min<size_t>(lod, current.lods.size() - 1)].indexCount / 3;
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+unsigned int Model::selectLod(float projectedRadius, float maxPixelError) const {
+	// Errors only grow down the chain, so the first level that is too coarse ends the search.
+	unsigned int lod = 0;
+	while (lod + 1 < current.lods.size() && current.lods[lod + 1].error * projectedRadius <= maxPixelError) {
+		lod++;
+	}
+	return lod;
+}
 
-	shader.use();
+CullStats Model::cullMeshlets(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, MeshletDrawList& draws) {
+	return culler.cull(model, viewProjection, cameraPosition, draws);
+}
+
+void Model::renderMaterial(Shader& shader, uint32_t material, unsigned int lod, const MeshletDrawList* draws, const std::vector<uint8_t>* visibleSubmeshes) {
+	if (material >= materialCount()) {
+		return;
+	}
+	beginDraw(shader, false);
+	bindMaterials(shader);
+	drawMaterial(shader, material, lod, draws, visibleSubmeshes, 0);
+}
+
+void Model::renderInstanced(Shader& shader, const Instance* instances, size_t count, unsigned int lod) {
+	if (count == 0) {
+		return;
+	}
+	beginDraw(shader, true);
+
+	// Orphaned on every call, so the driver hands out fresh storage instead of waiting for draws still reading the old.
+	// The size only changes when the count outgrows it or drops below half of it, so the storage can be recycled.
+	size_t bytes = count * sizeof(Instance);
+	current.instanceCapacity = std::max(bytes, std::min(current.instanceCapacity, bytes * 2));
+	GlState::current().bindBuffer(GL_ARRAY_BUFFER, current.instanceVbo);
+	glBufferData(GL_ARRAY_BUFFER, current.instanceCapacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances);
+
+	bindMaterials(shader);
+	for (uint32_t material : current.materialOrder) {
+		drawMaterial(shader, material, lod, nullptr, nullptr, static_cast<GLsizei>(count));
+	}
+}
+
+void Model::beginDraw(Shader& shader, bool instanced) {
+	// The element buffer is part of the vertex array, and nothing unbinds either afterwards: the next draw binds what it
+	// needs, and the state cache drops the binds that are already in place.
+	GlState::current().bindVertexArray(current.vao);
+	setInstanceAttributes(instanced);
 
-	glDrawElements(GL_TRIANGLES, vertexIndices.size(), GL_UNSIGNED_INT, 0);
+	shader.use();
+	shader.setVec3("positionScale", current.positionScale);
+	shader.setVec3("positionOffset", current.positionOffset);
+	shader.setFloat("normalScale", current.normalScale);
+}
 
-	glBindVertexArray(0);
+void Model::bindMaterials(Shader& shader) {
+	GlState& state = GlState::current();
+	state.bindBufferBase(GL_UNIFORM_BUFFER, materialBlockBinding, current.materialUbo);
+	state.activeTexture(GL_TEXTURE0);
+	shader.setInt("diffuseMap", 0);
 }
 
-void Model::setupBuffers() {
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+void Model::drawMaterial(Shader& shader, uint32_t material, unsigned int lod, const MeshletDrawList* draws, const std::vector<uint8_t>* visibleSubmeshes, GLsizei instanceCount) {
+	// Every level lives in the same element buffer, so picking one is just a different set of ranges of it.
+	lod = std::min(lod, lodCount() - 1);
+	bool meshlets = draws && lod == 0 && !culler.empty();
+	const SubmeshRange* ranges = current.submeshRanges.data() + lod * current.submeshCount;
+	// Meshes without submeshes still have one range, which the flags do not cover.
+	bool masked = visibleSubmeshes && visibleSubmeshes->size() == current.submeshCount && current.submeshCount == mesh.submeshes.size();
+
+	uint32_t firstSubmesh = current.materialSubmeshes[material];
+	uint32_t endSubmesh = current.materialSubmeshes[material + 1];
+	size_t next = 0;
+	if (meshlets) {
+		// Meshlet draws are in index buffer order, so the material's first one can be bisected for.
+		uint32_t start = ranges[firstSubmesh].indexOffset;
+		size_t high = draws->firsts.size();
+		while (next < high) {
+			size_t middle = (next + high) / 2;
+			if (draws->firsts[middle] + draws->counts[middle] <= start) {
+				next = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+	}
 
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	for (size_t s = firstSubmesh; s < endSubmesh; s++) {
+		const SubmeshRange& range = ranges[s];
+		bool visible = !masked || (*visibleSubmeshes)[s];
+		if (visible && meshlets) {
+			// Both lists are in index buffer order, and one run of visible meshlets can reach over several submeshes.
+			uint32_t end = range.indexOffset + range.indexCount;
+			while (next < draws->firsts.size() && draws->firsts[next] + draws->counts[next] <= range.indexOffset) {
+				next++;
+			}
+			for (size_t d = next; d < draws->firsts.size() && draws->firsts[d] < end; d++) {
+				uint32_t first = std::max(draws->firsts[d], range.indexOffset);
+				queueDraw(first, std::min(draws->firsts[d] + draws->counts[d], end) - first, range.baseVertex);
+			}
+		}
+		else if (visible) {
+			queueDraw(range.indexOffset, range.indexCount, range.baseVertex);
+		}
+	}
+	if (drawCounts.empty()) {
+		return;
+	}
 
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+	// The state cache drops the bind if the texture is already there; boundTexture only counts the switches for the stats.
+	int32_t texture = current.materialTextures[material];
+	if (texture >= 0) {
+		GlState::current().bindTexture(GL_TEXTURE_2D, current.textures[texture]);
+		if (current.textures[texture] != boundTexture) {
+			boundTexture = current.textures[texture];
+			bindCounts.textureBinds++;
+		}
+	}
+	shader.setInt("materialIndex", static_cast<int>(std::min(material, maxMaterials - 1)));
+	bindCounts.materialBinds++;
+	flushDraws(instanceCount);
+}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	glEnableVertexAttribArray(0);
+void Model::queueDraw(uint32_t first, uint32_t count, int32_t baseVertex) {
+	if (count == 0) {
+		return;
+	}
+	size_t indexSize = current.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+	// A material's submeshes sit next to each other in the element buffer, so a range that starts where the last one ended
+	// and shares its base vertex (always, unless the indices were rebased) extends it instead of becoming another draw.
+	if (!drawCounts.empty() && drawBaseVertices.back() == baseVertex
+		&& reinterpret_cast<uintptr_t>(drawOffsets.back()) + drawCounts.back() * indexSize == first * indexSize) {
+		drawCounts.back() += static_cast<GLsizei>(count);
+		return;
+	}
+	drawCounts.push_back(static_cast<GLsizei>(count));
+	drawOffsets.push_back(reinterpret_cast<const void*>(first * indexSize));
+	drawBaseVertices.push_back(baseVertex);
+}
 
-	// Loading relevant data into the correct position per vertex.
- 
-	
-	// Texture coordinates are probably broken right now, but I haven't test them yet so I can't say for sure.
-	// Probably needs the same treament as the normals.
-	if (!texCoords.empty()) {
-		GLuint texVbo;
-		glGenBuffers(1, &texVbo);
-		glBindBuffer(GL_ARRAY_BUFFER, texVbo);
-		glBufferData(GL_ARRAY_BUFFER, texCoords.size() * sizeof(glm::vec2), texCoords.data(), GL_STATIC_DRAW);
-		
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-		glEnableVertexAttribArray(1);
+void Model::flushDraws(GLsizei instanceCount) {
+	if (instanceCount > 0) {
+		// GL 3.3 has no instanced multi-draw, that takes the indirect draws of 4.3.
+		for (size_t i = 0; i < drawCounts.size(); i++) {
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, drawCounts[i], current.indexType, drawOffsets[i], instanceCount, drawBaseVertices[i]);
+		}
+		bindCounts.instancedDraws += drawCounts.size();
 	}
-	if (!GL_normals.empty()) {
-		GLuint normalVbo;
-		glGenBuffers(1, &normalVbo);
-		glBindBuffer(GL_ARRAY_BUFFER, normalVbo);
-		glBufferData(GL_ARRAY_BUFFER, GL_normals.size() * sizeof(glm::vec3), GL_normals.data(), GL_STATIC_DRAW);
+	else if (!drawCounts.empty()) {
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), current.indexType, drawOffsets.data(),
+			static_cast<GLsizei>(drawCounts.size()), drawBaseVertices.data());
+		bindCounts.multiDraws++;
+	}
+	drawCounts.clear();
+	drawOffsets.clear();
+	drawBaseVertices.clear();
+}
 
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-		glEnableVertexAttribArray(2);
+void Model::renderTriangle(Shader& shader, uint32_t triangle) {
+	size_t baseCount = current.lods.empty() ? current.indexCount : current.lods[0].indexCount;
+	if (static_cast<size_t>(triangle) * 3 + 3 > baseCount) {
+		return;
 	}
 
-	// Load the index buffer into the EBO.
-	glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, vertexIndices.size() * sizeof(unsigned int), vertexIndices.data(), GL_STATIC_DRAW);
+	beginDraw(shader, false);
+
+	// The full detail triangles start the element buffer, in the order the BVH numbers them.
+	uint32_t first = triangle * 3;
+	const SubmeshRange* ranges = current.submeshRanges.data();
+	const SubmeshRange* range = std::upper_bound(ranges, ranges + current.submeshCount, first,
+		[](uint32_t index, const SubmeshRange& r) { return index < r.indexOffset; }) - 1;
+	size_t indexSize = current.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+	glDrawElementsBaseVertex(GL_TRIANGLES, 3, current.indexType, reinterpret_cast<const void*>(first * indexSize), range->baseVertex);
+}
+
+Occluder Model::getOccluder(size_t maxTriangles, const glm::mat4& model) const {
+	size_t first = 0;
+	size_t count = mesh.baseIndexCount();
+	for (const MeshLod& lod : mesh.lods) {
+		first = lod.indexOffset;
+		count = lod.indexCount;
+		if (count / 3 <= maxTriangles) {
+			break;
+		}
+	}
 
-	glBindVertexArray(0);
+	Occluder occluder;
+	occluder.vertices = mesh.vertices.data();
+	occluder.indices = mesh.vertexIndices.data() + first;
+	occluder.triangleCount = count / 3;
+	occluder.model = model;
+	return occluder;
 }
 
-// OBJ File Vertex format:
-// v xCoord yCoord zCoord 
-// Vertices can have optional extra paramters, but for now I only use x, y, z
-void Model::parseVertex(const std::string& line) {
-	std::istringstream s(line.substr(2));
-	glm::vec3 vertex;
-	s >> vertex.x >> vertex.y >> vertex.z;
-	vertices.push_back(vertex);
+void Model::beginUpload(MeshData&& data) {
+	PackedMesh packedData = packMesh(data, format);
+	beginUpload(std::move(data), std::move(packedData));
 }
 
-// OBJ File Texture format:
-// vt uCoord vCoord
-// Similar to Vertices, texture coordinates can have extra parameters.
-void Model::parseTexCoord(const std::string& line) {
-	std::istringstream s(line.substr(3));
-	glm::vec2 texCoord;
-	s >> texCoord.x >> texCoord.y;
-	texCoords.push_back(texCoord);
+void Model::beginUpload(MeshData&& data, PackedMesh&& packedData) {
+	// A newer mesh replaces one that is still half uploaded.
+	releaseBuffers(pending);
+	uploads.clear();
+	textureUploads.clear();
+
+	pendingMesh = std::move(data);
+	packed = packedData.format == format ? std::move(packedData) : packMesh(pendingMesh, format);
+	createBuffers(pendingMesh, packed, pending);
+
+	// Packed arrays replace the MeshData arrays they were made from.
+	auto queue = [&](GLuint buffer, const auto& packedArray, const auto& meshArray) {
+		const void* source = packedArray.empty() ? static_cast<const void*>(meshArray.data()) : packedArray.data();
+		size_t size = packedArray.empty() ? meshArray.size() * sizeof(meshArray[0]) : packedArray.size() * sizeof(packedArray[0]);
+		if (size > 0) {
+			uploads.push_back({ buffer, static_cast<const char*>(source), size, 0 });
+		}
+	};
+	queue(pending.vbo, packed.positions, pendingMesh.vertices);
+	queue(pending.texVbo, packed.texCoords, pendingMesh.texCoords);
+	if (format == VertexFormat::CompactSmall) {
+		queue(pending.normalVbo, packed.normals8, pendingMesh.normals);
+	}
+	else {
+		queue(pending.normalVbo, packed.normals16, pendingMesh.normals);
+	}
+	queue(pending.ebo, packed.indices, pendingMesh.vertexIndices);
+	for (size_t i = 0; i < pending.textures.size(); i++) {
+		textureUploads.push_back({ pending.textures[i], &pendingMesh.textures[i], 0 });
+	}
+
+	if (format != VertexFormat::Float) {
+		size_t floatBytes = pendingMesh.vertices.size() * sizeof(glm::vec3) + pendingMesh.normals.size() * sizeof(glm::vec3)
+			+ pendingMesh.texCoords.size() * sizeof(glm::vec2) + pendingMesh.vertexIndices.size() * sizeof(unsigned int);
+		std::cout << "Packed " << pendingMesh.vertices.size() << " vertices as " << vertexFormatName(format) << ": "
+			<< floatBytes / 1024 << " KB -> " << pending.bytes / 1024 << " KB, max error position " << packed.error.position
+			<< " (bound " << packed.error.positionBound << "), normal " << packed.error.normalDegrees << " deg, uv "
+			<< packed.error.texCoord << std::endl;
+	}
 }
 
-// OBJ File Normal format:
-// vn normalX normalY normalZ
-// Normals represent vectors orthogonal (perpendicular) to a surface point, usually a vertex.
+bool Model::continueUpload(size_t byteBudget) {
+	if (!isUploading()) {
+		return false;
+	}
+	GlState& state = GlState::current();
+
+	// The copy-write binding is not part of any VAO, so filling the element buffer here cannot disturb what is bound for drawing.
+	size_t next = 0;
+	while (next < uploads.size() && byteBudget > 0) {
+		BufferUpload& upload = uploads[next];
+		size_t size = std::min(byteBudget, upload.size - upload.offset);
+
+		state.bindBuffer(GL_COPY_WRITE_BUFFER, upload.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, upload.offset, size, upload.data + upload.offset);
 
-/* As of right now, normals are directly calculated, so this is unused.
-void Model::parseNormal(const std::string& line) {
-	std::istringstream s(line.substr(3));
-	glm::vec3 normal;
-	s >> normal.x >> normal.y >> normal.z;
-	normals.push_back(normal);
+		upload.offset += size;
+		byteBudget -= size;
+		if (upload.offset == upload.size) {
+			next++;
+		}
+	}
+	uploads.erase(uploads.begin(), uploads.begin() + next);
+
+	// At least one row per call, so a texture wider than the budget still gets there.
+	next = 0;
+	while (uploads.empty() && next < textureUploads.size() && byteBudget > 0) {
+		TextureUpload& upload = textureUploads[next];
+		const TextureImage& image = *upload.image;
+		size_t rowBytes = static_cast<size_t>(image.width) * 4;
+		int rows = static_cast<int>(std::min<size_t>(std::max<size_t>(byteBudget / rowBytes, 1), image.height - upload.row));
+
+		state.bindTexture(GL_TEXTURE_2D, upload.texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.row, image.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data() + upload.row * rowBytes);
+
+		upload.row += rows;
+		byteBudget -= std::min(byteBudget, rows * rowBytes);
+		if (upload.row == image.height) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+			next++;
+		}
+	}
+	textureUploads.erase(textureUploads.begin(), textureUploads.begin() + next);
+
+	if (!uploads.empty() || !textureUploads.empty()) {
+		return false;
+	}
+
+	// Everything is on the GPU, swap the new mesh in.
+	releaseBuffers(current);
+	boundTexture = 0;
+	current = pending;
+	pending = GpuMesh();
+	mesh = std::move(pendingMesh);
+	pendingMesh = MeshData();
+	// The pixels are on the GPU now, and nothing reads them back.
+	for (TextureImage& image : mesh.textures) {
+		std::vector<unsigned char>().swap(image.pixels);
+	}
+	culler.build(mesh.meshlets);
+	packed = PackedMesh();
+	return true;
 }
-*/
-
-// OBJ File Face format:
-// f vertexIndex1/textureIndex1/normalIndex1 ... vertexIndexN/textureIndexN/normalIndexN
-// faces can omit texture parameter, leaving the following format:
-// f vertexIndex1//normalIndex1 ...
-void Model::parseFace(const std::string& line) {
-	std::stringstream s(line.substr(2));
-	std::vector<unsigned int> vIndices;
-	std::vector<unsigned int> tIndices; 
-	std::vector<unsigned int> nIndices;
-	std::string vertexData;
-
-	// Get each vertex of a face.
-	while (s >> vertexData) {
-		std::istringstream vertexStream(vertexData);
-		unsigned int vIndex, tIndex, nIndex;
-		char slash;
+
+// Creates the VAO and allocates (but does not fill) every buffer the mesh needs.
+// The compact formats store integers that are converted to float unnormalized; the shaders scale them with the decoding uniforms.
+void Model::createBuffers(const MeshData& data, const PackedMesh& packedData, GpuMesh& gpu) {
+	GlState& state = GlState::current();
+	bool compact = packedData.format != VertexFormat::Float;
+	bool smallNormals = packedData.format == VertexFormat::CompactSmall;
+
+	size_t positionBytes = data.vertices.size() * (compact ? 3 * sizeof(uint16_t) : sizeof(glm::vec3));
+	size_t texCoordBytes = data.texCoords.size() * (compact ? 2 * sizeof(uint16_t) : sizeof(glm::vec2));
+	size_t normalBytes = data.normals.size() * (smallNormals ? 2 * sizeof(int8_t) : compact ? 2 * sizeof(int16_t) : sizeof(glm::vec3));
+	size_t indexBytes = data.vertexIndices.size() * (packedData.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+
+	glGenVertexArrays(1, &gpu.vao);
+	state.bindVertexArray(gpu.vao);
+
+	glGenBuffers(1, &gpu.vbo);
+	state.bindBuffer(GL_ARRAY_BUFFER, gpu.vbo);
+
+	glBufferData(GL_ARRAY_BUFFER, positionBytes, nullptr, GL_STATIC_DRAW);
+
+	glVertexAttribPointer(0, 3, compact ? GL_UNSIGNED_SHORT : GL_FLOAT, GL_FALSE, 0, (void*)0);
+	state.enableVertexAttribArray(0);
+
+	// Loading relevant data into the correct position per vertex.
+ 
+	
+	// Texture coordinates are only right for meshes loaded with LoadMode::Unified; with LoadMode::Positions they are
+	// looked up by position index, which only works if the file happens to line them up.
+	if (!data.texCoords.empty()) {
+		glGenBuffers(1, &gpu.texVbo);
+		state.bindBuffer(GL_ARRAY_BUFFER, gpu.texVbo);
+		glBufferData(GL_ARRAY_BUFFER, texCoordBytes, nullptr, GL_STATIC_DRAW);
 		
-		vertexStream >> vIndex; 
-		if (vertexStream.peek() == '/') {
-			vertexStream >> slash;
-			if (vertexStream.peek() == '/') {
-				vertexStream >> slash >> nIndex;
-				tIndex = 0;
-			}
-			else {
-				vertexStream >> tIndex >> slash >> nIndex;
-			}
+		glVertexAttribPointer(1, 2, compact ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, 0, (void*)0);
+		state.enableVertexAttribArray(1);
+	}
+	if (!data.normals.empty()) {
+		glGenBuffers(1, &gpu.normalVbo);
+		state.bindBuffer(GL_ARRAY_BUFFER, gpu.normalVbo);
+		glBufferData(GL_ARRAY_BUFFER, normalBytes, nullptr, GL_STATIC_DRAW);
+
+		// Octahedral normals are two components; the shader reads them from aNormal.xy.
+		if (compact) {
+			glVertexAttribPointer(2, 2, smallNormals ? GL_BYTE : GL_SHORT, GL_FALSE, 0, (void*)0);
 		}
 		else {
-			tIndex = 0;
-			nIndex = 0;
+			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
 		}
-		
-		vIndices.push_back(vIndex - 1);
-		if(tIndex != 0) tIndices.push_back(tIndex - 1); // Store texture index
-		/* Not a fan of how this has been working, decided to calculate my own normals.
-		if (nIndex != 0) {
-			nIndices.push_back(nIndex - 1); // Store normal index
-
-			// If the current vertex index does not match the normal index
-			if (vIndex != nIndex) {
-				// Resize the GL_normals buffer accordingly.
-				if (GL_normals.size() < vIndex) {
-					GL_normals.resize(vIndex);
-				}
-				// Set the normal vector at the vertex index to be the correct normal
-				GL_normals.at(vIndex - 1) =  normals.at(nIndex-1);
+		state.enableVertexAttribArray(2);
+	}
+
+	// Per instance attributes, all advancing once per instance. The buffer is only filled, and the arrays only enabled, by renderInstanced.
+	glGenBuffers(1, &gpu.instanceVbo);
+	state.bindBuffer(GL_ARRAY_BUFFER, gpu.instanceVbo);
+	for (GLuint column = 0; column < 4; column++) {
+		glVertexAttribPointer(firstInstanceAttribute + column, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			reinterpret_cast<const void*>(offsetof(Instance, model) + column * sizeof(glm::vec4)));
+	}
+	glVertexAttribPointer(firstInstanceAttribute + 4, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), reinterpret_cast<const void*>(offsetof(Instance, color)));
+	glVertexAttribIPointer(firstInstanceAttribute + 5, 1, GL_INT, sizeof(Instance), reinterpret_cast<const void*>(offsetof(Instance, material)));
+	for (GLuint attribute = firstInstanceAttribute; attribute < endInstanceAttribute; attribute++) {
+		glVertexAttribDivisor(attribute, 1);
+	}
+
+	// Allocate the index buffer and attach it to the VAO.
+	glGenBuffers(1, &gpu.ebo);
+	state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_STATIC_DRAW);
+	gpu.indexCount = static_cast<GLsizei>(data.vertexIndices.size());
+	gpu.indexType = packedData.indexType;
+	gpu.lods = data.lods;
+
+	gpu.submeshCount = data.submeshes.size();
+	if (gpu.submeshCount > 0 && data.submeshRanges.size() == gpu.submeshCount * std::max<size_t>(data.lods.size(), 1)) {
+		gpu.submeshRanges = data.submeshRanges;
+		if (!packedData.rebased) {
+			for (SubmeshRange& range : gpu.submeshRanges) {
+				range.baseVertex = 0;
 			}
-			// This method works.. somewhat
-			// Unfortunately some faces in obj file use multiple normals for the same vetex on different faces.
-			// So this method almost certainly overwrites normals on some faces, causing strange patches of incorrect lighting.
-			// Overall though, this method works MUCH better than the previous method of not rearranging normal buffer, essentially getting random surface normals.
 		}
-		*/
-	}
-
-	size_t count = vIndices.size();
-	// Split the face into OpenGL readable triangles.
-	if (count == 3) {
-		// Triangle: directly add the indices
-		vertexIndices.push_back(vIndices[0]);
-		vertexIndices.push_back(vIndices[1]);
-		vertexIndices.push_back(vIndices[2]);
-		generateNormals(0, 1, 2, vIndices);
-	}
-	else if (count == 4) {
-		// Quad: split into two triangles
-		vertexIndices.push_back(vIndices[0]);
-		vertexIndices.push_back(vIndices[1]);
-		vertexIndices.push_back(vIndices[2]);
-		generateNormals(0, 1, 2, vIndices);
-
-
-		vertexIndices.push_back(vIndices[0]);
-		vertexIndices.push_back(vIndices[2]);
-		vertexIndices.push_back(vIndices[3]);
-		generateNormals(0, 2, 3, vIndices);
-	}
-	else if (count > 4) {
-		// Polygon: triangulate using fan triangulation
-		for (size_t i = 1; i < count - 1; i++) {
-			vertexIndices.push_back(vIndices[0]);
-			vertexIndices.push_back(vIndices[i]);
-			vertexIndices.push_back(vIndices[i+1]);
-			generateNormals(0, i, i+1, vIndices);
+	}
+	else if (data.lods.empty()) {
+		gpu.submeshCount = 1;
+		gpu.submeshRanges.push_back({ 0, static_cast<uint32_t>(data.vertexIndices.size()), 0, 0 });
+	}
+	else {
+		gpu.submeshCount = 1;
+		for (const MeshLod& lod : data.lods) {
+			gpu.submeshRanges.push_back({ lod.indexOffset, lod.indexCount, 0, 0 });
 		}
 	}
-}
-
-// Takes more time for intial model load, but is considerably more reliable than the loading of normals from the file 
-void Model::generateNormals(unsigned int aIndex, unsigned int bIndex, unsigned int cIndex, std::vector<unsigned int>& vIndices) {
-	// Calculating for the normal at vertex A, we need to take the vectors of A to B and A to C. Thus, n_A = normalize(cross(B - A, C - A));
-	unsigned int a = vIndices[aIndex];
-	unsigned int b = vIndices[bIndex];
-	unsigned int c = vIndices[cIndex];
 
-	glm::vec3 nA = glm::normalize(glm::cross(vertices[b] - vertices[a], vertices[c] - vertices[a]));
-	glm::vec3 nB = glm::normalize(glm::cross(vertices[c] - vertices[b], vertices[a] - vertices[b]));
-	glm::vec3 nC = glm::normalize(glm::cross(vertices[a] - vertices[c], vertices[b] - vertices[c]));
-
-	unsigned int maxIndex = std::max({ a, b, c });
-	if (GL_normals.size() <= maxIndex) {
-		GL_normals.resize(maxIndex + 1); // Ensure GL_normals can hold the largest index
-		normal_count.resize(maxIndex + 1);
+	// Submeshes are sorted by material, so each material's are one run.
+	size_t materialCount = std::max<size_t>(data.materialTable.size(), 1);
+	gpu.materialSubmeshes.assign(materialCount + 1, 0);
+	for (size_t s = 0; s < gpu.submeshCount; s++) {
+		gpu.materialSubmeshes[std::min<size_t>(gpu.submeshRanges[s].material, materialCount - 1) + 1]++;
 	}
-
-	// Averaging Normal vectors if a single index has more than one normal associated with it.
-	// This fixes a lot of the problems, most notably with cubes; however, it seems to be causing some rippling effects on more high definition models?
-	// I can't tell yet if I'm satisfied with this method, but I do believe it is an improvement.
-	if (normal_count[a] == 0)
-	{
-		GL_normals[a] = nA;
-		normal_count[a]++;
+	std::partial_sum(gpu.materialSubmeshes.begin(), gpu.materialSubmeshes.end(), gpu.materialSubmeshes.begin());
+
+	std::vector<GpuMaterial> materials(maxMaterials);
+	gpu.materialTextures.assign(materialCount, -1);
+	for (size_t m = 0; m < materialCount; m++) {
+		Material material = data.materialTable.empty() ? Material() : data.materialTable[m];
+		bool textured = material.texture >= 0 && static_cast<size_t>(material.texture) < data.textures.size();
+		gpu.materialTextures[m] = textured ? material.texture : -1;
+		if (m < maxMaterials) {
+			materials[m].ambient = glm::vec4(material.ambient, textured ? 1.0f : 0.0f);
+			materials[m].diffuse = glm::vec4(material.diffuse, material.opacity);
+			materials[m].specular = glm::vec4(material.specular, material.shininess);
+		}
 	}
-	else
-	{
-		GL_normals[a] = (GL_normals[a] + nA) / static_cast<float>(normal_count[a]);
+	if (materialCount > maxMaterials) {
+		std::cerr << "ERROR::MODEL::TOO_MANY_MATERIALS: " << materialCount << ", the last " << materialCount - maxMaterials + 1
+			<< " share one slot" << std::endl;
 	}
-	if (normal_count[b] == 0)
-	{
-		GL_normals[b] = nB;
+	gpu.materialOrder.resize(materialCount);
+	std::iota(gpu.materialOrder.begin(), gpu.materialOrder.end(), 0u);
+	std::stable_sort(gpu.materialOrder.begin(), gpu.materialOrder.end(), [&](uint32_t a, uint32_t b) {
+		return gpu.materialTextures[a] < gpu.materialTextures[b];
+	});
+
+	// Small enough to go up in one go.
+	glGenBuffers(1, &gpu.materialUbo);
+	state.bindBuffer(GL_UNIFORM_BUFFER, gpu.materialUbo);
+	glBufferData(GL_UNIFORM_BUFFER, materials.size() * sizeof(GpuMaterial), materials.data(), GL_STATIC_DRAW);
+
+	// Allocated here, filled by continueUpload.
+	size_t textureBytes = 0;
+	gpu.textures.assign(data.textures.size(), 0);
+	if (!gpu.textures.empty()) {
+		glGenTextures(static_cast<GLsizei>(gpu.textures.size()), gpu.textures.data());
 	}
-	else
-	{
-		GL_normals[b] = (GL_normals[b] + nB) / static_cast<float>(normal_count[b]);
+	for (size_t i = 0; i < gpu.textures.size(); i++) {
+		const TextureImage& image = data.textures[i];
+		state.bindTexture(GL_TEXTURE_2D, gpu.textures[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		// A third on top for the mipmaps.
+		textureBytes += static_cast<size_t>(image.width) * image.height * 4 * 4 / 3;
 	}
-	if (normal_count[c] == 0)
-	{
-		GL_normals[c] = nC;
+
+	gpu.positionScale = packedData.positionScale;
+	gpu.positionOffset = packedData.positionOffset;
+	gpu.normalScale = packedData.normalScale;
+
+	gpu.bytes = positionBytes + texCoordBytes + normalBytes + indexBytes + materials.size() * sizeof(GpuMaterial) + textureBytes;
+}
+
+size_t Model::meshBytes(const MeshData& data) {
+	return data.vertices.capacity() * sizeof(glm::vec3) + data.normals.capacity() * sizeof(glm::vec3)
+		+ data.texCoords.capacity() * sizeof(glm::vec2) + data.vertexIndices.capacity() * sizeof(unsigned int)
+		+ data.lods.capacity() * sizeof(MeshLod) + data.meshlets.capacity() * sizeof(Meshlet) + data.bvh.bytes()
+		+ data.submeshes.capacity() * sizeof(Submesh) + data.submeshRanges.capacity() * sizeof(SubmeshRange)
+		+ data.materialTable.capacity() * sizeof(Material) + imageBytes(data);
+}
+
+size_t Model::imageBytes(const MeshData& data) {
+	size_t bytes = 0;
+	for (const TextureImage& image : data.textures) {
+		bytes += image.pixels.capacity();
 	}
-	else
-	{
-		GL_normals[c] = (GL_normals[c] + nC) / static_cast<float>(normal_count[c]);
+	return bytes;
+}
+
+void Model::releaseBuffers(GpuMesh& gpu) {
+	GlState& state = GlState::current();
+	// Deleting the name 0 is a no-op, so this is safe before the first load.
+	state.deleteVertexArrays(1, &gpu.vao);
+	state.deleteBuffers(1, &gpu.vbo);
+	state.deleteBuffers(1, &gpu.normalVbo);
+	state.deleteBuffers(1, &gpu.texVbo);
+	state.deleteBuffers(1, &gpu.ebo);
+	state.deleteBuffers(1, &gpu.instanceVbo);
+	state.deleteBuffers(1, &gpu.materialUbo);
+	if (!gpu.textures.empty()) {
+		state.deleteTextures(static_cast<GLsizei>(gpu.textures.size()), gpu.textures.data());
 	}
-}
\ No newline at end of file
+	gpu = GpuMesh();
+}
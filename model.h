@@ -8,43 +8,214 @@
 
 #include "glm/glm/glm.hpp"
 
+#include "mesh_data.h"
+#include "mesh_loader.h"
+#include "meshlets.h"
+#include "occlusion_culling.h"
 #include "shader.h"
+#include "vertex_format.h"
+
+// Size of the Materials uniform block in fragment_shader.glsl, and the binding point it is read from. Materials past
+// the last slot are drawn with the last slot's.
+const unsigned int maxMaterials = 256;
+const GLuint materialBlockBinding = 0;
+
+// One entry of the Materials block, in std140 layout.
+struct GpuMaterial
+{
+	glm::vec4 ambient;  // w is 1 if the material's diffuse map is bound to diffuseMap
+	glm::vec4 diffuse;  // w is the opacity
+	glm::vec4 specular; // w is the shininess
+};
+
+// State changes renderMaterial() and renderInstanced() made, summed until Model::resetBindStats().
+struct MaterialBindStats
+{
+	size_t materialBinds = 0; // materialIndex changes, one per material with anything to draw
+	size_t textureBinds = 0;
+	size_t multiDraws = 0;
+	size_t instancedDraws = 0; // One per run of adjacent submesh ranges and renderInstanced() call
+};
+
+// One copy of the model for renderInstanced(), laid out the way the instance buffer holds it (vertex attributes 3 to 8).
+struct Instance
+{
+	glm::mat4 model; // Scaled the same along every axis: the shaders turn normals with its upper 3x3 as it is
+	glm::vec4 color = glm::vec4(1.0f); // Multiplies the shaded color
+	int32_t material = -1;             // Replaces the material of every submesh (the textures stay those of the submeshes'), -1 keeps them
+};
 
 class Model
 {
 public:
-	Model();
+	explicit Model(VertexFormat format = VertexFormat::Float);
 	~Model();
 
-	bool loadOBJ(const std::string& path);
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	// Loads and uploads in one go, blocking the calling (GL) thread. See loadMesh() for the CPU side.
+	bool loadOBJ(const std::string& path, const LoadOptions& options = LoadOptions());
+
+	// Memory held by this model, including a mesh that is still being uploaded.
+	size_t gpuBytes() const { return current.bytes + pending.bytes + current.instanceCapacity; }
+	size_t cpuBytes() const { return meshBytes(mesh) + meshBytes(pendingMesh) + packed.bytes() + culler.bytes(); }
+
+	// Incremental upload, for meshes loaded on another thread.
+	// beginUpload allocates the new buffers for a mesh packed into the model's vertex format (see packMesh, which is slow
+	// enough to belong on the loading thread too); continueUpload copies up to byteBudget bytes per call and, once
+	// everything is on the GPU, swaps the new mesh in. Until then the old one keeps being drawn.
+	// A packed mesh in another format is packed again.
+	void beginUpload(MeshData&& data, PackedMesh&& packedData);
+	// Packs the mesh on the calling thread first.
+	void beginUpload(MeshData&& data);
+	bool continueUpload(size_t byteBudget);
+	bool isUploading() const { return pending.vao != 0; }
+
+	std::vector<glm::vec3> getVertices() const { return mesh.vertices; }
+	std::vector<glm::vec3> getNormals() const { return mesh.normals; }
+	std::vector<glm::vec2> getTexCoords() const { return mesh.texCoords; }
+
+	glm::vec3 getBoundsMin() const { return mesh.boundsMin; }
+	glm::vec3 getBoundsMax() const { return mesh.boundsMax; }
+	glm::vec3 getBoundsCenter() const { return mesh.sphereCenter; } // Of the box and the bounding sphere
+	float getBoundsRadius() const { return mesh.sphereRadius; }
+
+	VertexFormat getVertexFormat() const { return format; }
 
-	std::vector<glm::vec3> getVertices() const { return vertices; }
-	// std::vector<glm::vec3> getNormals() const { return normals; }
-	std::vector<glm::vec2> getTexCoords() const { return texCoords; }
+	// Levels of detail of the mesh on screen, finest first. Meshes without LODs have just the one level.
+	unsigned int lodCount() const { return current.lods.empty() ? 1 : static_cast<unsigned int>(current.lods.size()); }
+	size_t lodTriangles(unsigned int lod) const;
 
-	void render(Shader shader);
+	// Coarsest level whose error stays within maxPixelError on screen, for a bounding sphere (see getBoundsMin/Max)
+	// that covers projectedRadius pixels.
+	unsigned int selectLod(float projectedRadius, float maxPixelError = 1.0f) const;
+
+	// Culls the meshlets of the full detail level for drawing with the model matrix model. draws is only good for this
+	// model, until the next model swap.
+	CullStats cullMeshlets(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, MeshletDrawList& draws);
+
+	// Draws count copies of the given level of detail, each placed by its Instance instead of the model uniform. The
+	// instances are streamed into the model's instance buffer on every call, so they can change freely from frame to
+	// frame; culling them is up to the caller. Each material's submesh ranges are merged where they are adjacent in the
+	// element buffer, and every merged run is one glDrawElementsInstancedBaseVertex.
+	// The shader has to be a variant with shaderfeature::instancing.
+	void renderInstanced(Shader& shader, const Instance* instances, size_t count, unsigned int lod = 0);
+
+	// Sets the position/normal decoding uniforms the vertex shaders need, then draws one material at the given level of
+	// detail. With draws (see cullMeshlets) level 0 only draws the meshlets that survived culling.
+	// visibleSubmeshes has one flag per submesh (see submeshCount), and only the ones that are set get drawn; without it
+	// they all are. The visible submeshes of the material go out as one glMultiDrawElementsBaseVertex call, with the
+	// model's material table bound to materialBlockBinding and materialIndex set to the material. Whole models are drawn
+	// through RenderQueue::addModel(), which sorts their materials along with everything else.
+	void renderMaterial(Shader& shader, uint32_t material, unsigned int lod = 0, const MeshletDrawList* draws = nullptr,
+		const std::vector<uint8_t>* visibleSubmeshes = nullptr);
+
+	// Materials of the mesh on screen, the ones renderMaterial() takes, and the state their draws need.
+	uint32_t materialCount() const { return static_cast<uint32_t>(current.materialTextures.size()); }
+	GLuint getMaterialTexture(uint32_t material) const {
+		int32_t texture = material < materialCount() ? current.materialTextures[material] : -1;
+		return texture >= 0 ? current.textures[texture] : 0;
+	}
+	GLuint getVertexArray() const { return current.vao; }
+
+	// Submeshes of the mesh on screen, sorted by material (see MeshData::submeshes).
+	size_t submeshCount() const { return mesh.submeshes.size(); }
+	const Submesh& getSubmesh(size_t submesh) const { return mesh.submeshes[submesh]; }
+	const std::string& getMaterialName(uint32_t material) const { return mesh.materials[material]; }
+
+	const MaterialBindStats& bindStats() const { return bindCounts; }
+	void resetBindStats() { bindCounts = MaterialBindStats(); }
+
+	// BVH over the full detail triangles of the mesh on screen, in the model's own space. Empty before the first swap.
+	const Bvh& getBvh() const { return mesh.bvh; }
+
+	// Draws a single full detail triangle, as numbered by the BVH, with the same uniforms as renderMaterial().
+	void renderTriangle(Shader& shader, uint32_t triangle);
+
+	// The finest level with at most maxTriangles triangles (or the coarsest there is) as an occluder for the software
+	// rasterizer, placed by model. It points into the mesh on screen, so it is only good until the next model swap.
+	Occluder getOccluder(size_t maxTriangles, const glm::mat4& model) const;
 
 private:
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec3> GL_normals;
-	std::vector<unsigned int> normal_count;
-	// std::vector<glm::vec3> normals;
-	std::vector<glm::vec2> texCoords;
-	std::vector<unsigned int> vertexIndices; // Faces
+	struct GpuMesh
+	{
+		GLuint vao = 0;
+		GLuint vbo = 0;
+		GLuint normalVbo = 0;
+		GLuint texVbo = 0;
+		GLuint ebo = 0;
+		GLuint instanceVbo = 0; // Attached to the VAO, but only enabled by renderInstanced
+		size_t instanceCapacity = 0;
+		GLsizei indexCount = 0;
+		GLenum indexType = GL_UNSIGNED_INT;
+		size_t bytes = 0;
+		std::vector<MeshLod> lods; // Ranges of the element buffer, see MeshData::lods
+		// See MeshData::submeshRanges, with the base vertices zeroed unless the indices were rebased (see PackedMesh).
+		// A mesh without submeshes gets one range per level.
+		std::vector<SubmeshRange> submeshRanges;
+		size_t submeshCount = 0;
+
+		GLuint materialUbo = 0; // maxMaterials GpuMaterials, from MeshData::materialTable (one default one if it is empty)
+		std::vector<GLuint> textures; // See MeshData::textures
+		std::vector<int32_t> materialTextures; // Per material, index into textures or -1
+		// Materials in the order renderInstanced() draws them, the untextured ones first and the rest grouped by texture. The submeshes
+		// of material m are [materialSubmeshes[m], materialSubmeshes[m + 1]).
+		std::vector<uint32_t> materialOrder;
+		std::vector<uint32_t> materialSubmeshes;
+
+		// See PackedMesh
+		glm::vec3 positionScale = glm::vec3(1.0f);
+		glm::vec3 positionOffset = glm::vec3(0.0f);
+		float normalScale = 0.0f;
+	};
+
+	struct BufferUpload
+	{
+		GLuint buffer;
+		const char* data;
+		size_t size;
+		size_t offset;
+	};
 
-	GLuint vao;
-	GLuint vbo;
-	GLuint ebo;
+	// Textures go up a few rows at a time under the same byte budget as the buffers.
+	struct TextureUpload
+	{
+		GLuint texture;
+		const TextureImage* image;
+		int row;
+	};
 
-	void parseVertex(const std::string& line);
-	void parseTexCoord(const std::string& line);
-	void parseNormal(const std::string& line);
-	void parseFace(const std::string& line);
+	VertexFormat format;
 
-	void setupBuffers();
+	MeshData mesh;
+	GpuMesh current;
 
-	void generateNormals(unsigned int a, unsigned int b, unsigned int c, std::vector<unsigned int>& vIndices);
+	MeshData pendingMesh;
+	PackedMesh packed; // Only kept until the upload finishes
+	GpuMesh pending;
+	std::vector<BufferUpload> uploads;
+	std::vector<TextureUpload> textureUploads;
+
+	MeshletCuller culler;
+	std::vector<GLsizei> drawCounts;        // glMultiDrawElementsBaseVertex arguments, kept around so rendering does not allocate
+	std::vector<const void*> drawOffsets;
+	std::vector<GLint> drawBaseVertices;
+	MaterialBindStats bindCounts;
+	GLuint boundTexture = 0; // Last texture drawMaterial() bound, for bindCounts
+
+	// Binds the vertex array and program and sets the decoding uniforms.
+	void beginDraw(Shader& shader, bool instanced);
+	// Binds the material table and points diffuseMap at the unit the textures go to.
+	void bindMaterials(Shader& shader);
+	void drawMaterial(Shader& shader, uint32_t material, unsigned int lod, const MeshletDrawList* draws, const std::vector<uint8_t>* visibleSubmeshes, GLsizei instanceCount);
+	void queueDraw(uint32_t first, uint32_t count, int32_t baseVertex);
+	void flushDraws(GLsizei instanceCount);
+
+	void createBuffers(const MeshData& data, const PackedMesh& packedData, GpuMesh& gpu);
+	static void releaseBuffers(GpuMesh& gpu);
+	static size_t meshBytes(const MeshData& data);
+	static size_t imageBytes(const MeshData& data);
 };
 
 #endif
-
@@ -0,0 +1,65 @@
+#include "model_loader.h"
+
+ModelLoader::ModelLoader(const LoadOptions& options, VertexFormat format) : options(options), format(format), requestedTag(0), hasRequest(false), stopping(false), inFlight(false) {
+	worker = std::thread(&ModelLoader::workerLoop, this);
+}
+
+ModelLoader::~ModelLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	requestReady.notify_one();
+	worker.join();
+}
+
+bool ModelLoader::request(const std::string& path, int tag) {
+	if (inFlight.exchange(true, std::memory_order_acq_rel)) {
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requestedPath = path;
+		requestedTag = tag;
+		hasRequest = true;
+	}
+	requestReady.notify_one();
+	return true;
+}
+
+bool ModelLoader::poll(Result& result) {
+	std::unique_ptr<Result> done;
+	if (!finished.pop(done)) {
+		return false;
+	}
+
+	result = std::move(*done);
+	inFlight.store(false, std::memory_order_release);
+	return true;
+}
+
+void ModelLoader::workerLoop() {
+	while (true) {
+		std::unique_ptr<Result> result(new Result());
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			requestReady.wait(lock, [&] { return stopping || hasRequest; });
+			if (stopping) {
+				return;
+			}
+			result->path = requestedPath;
+			result->tag = requestedTag;
+			result->sourceHash = 0;
+			hasRequest = false;
+		}
+
+		result->success = loadMesh(result->path, result->mesh, result->sourceHash, options);
+		if (result->success) {
+			result->packed = packMesh(result->mesh, format);
+		}
+
+		// Only one load is ever in flight, so the queue always has room.
+		finished.push(std::move(result));
+	}
+}
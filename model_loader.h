@@ -0,0 +1,65 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "mesh_data.h"
+#include "mesh_loader.h"
+#include "spsc_queue.h"
+#include "vertex_format.h"
+
+// Loads meshes on a background thread so the render loop never waits on parsing, normal generation or vertex packing.
+// Finished meshes come back through a lock-free queue that the GL thread polls once per frame.
+class ModelLoader
+{
+public:
+	struct Result
+	{
+		std::string path;
+		int tag;
+		bool success;
+		uint64_t sourceHash;
+		MeshData mesh;
+		PackedMesh packed; // mesh in the loader's vertex format, for Model::beginUpload
+	};
+
+	explicit ModelLoader(const LoadOptions& options = LoadOptions(), VertexFormat format = VertexFormat::Float);
+	~ModelLoader();
+
+	ModelLoader(const ModelLoader&) = delete;
+	ModelLoader& operator=(const ModelLoader&) = delete;
+
+	// Starts loading path. tag is handed back with the result so the caller knows what it asked for.
+	// Returns false if a load is already in flight.
+	bool request(const std::string& path, int tag);
+
+	// Never blocks. Returns true and fills result when a load has finished.
+	bool poll(Result& result);
+
+	// True from request() until the result has been picked up by poll().
+	bool busy() const { return inFlight.load(std::memory_order_acquire); }
+
+private:
+	LoadOptions options;
+	VertexFormat format;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable requestReady;
+	std::string requestedPath;
+	int requestedTag;
+	bool hasRequest;
+	bool stopping;
+
+	std::atomic<bool> inFlight;
+	SpscQueue<std::unique_ptr<Result>, 4> finished;
+
+	void workerLoop();
+};
+
+#endif
@@ -0,0 +1,895 @@
+#include "obj_parser.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <string>
+#include <string_view>
+
+namespace {
+
+enum class LineType
+{
+	Other,
+	Vertex,
+	TexCoord,
+	Normal,
+	Face,
+	Smoothing,
+	Group,    // 'o' or 'g'
+	Material, // 'usemtl'
+	Library   // 'mtllib'
+};
+
+inline LineType classifyLine(const char* line, const char* lineEnd) {
+	size_t length = lineEnd - line;
+	if (length >= 2 && line[1] == ' ') {
+		if (line[0] == 'v') return LineType::Vertex;
+		if (line[0] == 'f') return LineType::Face;
+		if (line[0] == 's') return LineType::Smoothing;
+		if (line[0] == 'o' || line[0] == 'g') return LineType::Group;
+	}
+	else if (length >= 3 && line[0] == 'v' && line[2] == ' ') {
+		if (line[1] == 't') return LineType::TexCoord;
+		if (line[1] == 'n') return LineType::Normal;
+	}
+	if (length >= 7 && std::memcmp(line, "usemtl ", 7) == 0) return LineType::Material;
+	if (length >= 7 && std::memcmp(line, "mtllib ", 7) == 0) return LineType::Library;
+	return LineType::Other;
+}
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// How much output a chunk produces. Vertex, texture and normal counts are exact, the triangle count
+// is an upper bound (a malformed index ends a face early).
+struct ChunkCounts
+{
+	size_t vertices = 0;
+	size_t texCoords = 0;
+	size_t normals = 0;
+	size_t triangles = 0;
+	size_t smoothingLines = 0;
+};
+
+// An 'o', 'g' or 'usemtl' line, at the point of the chunk's faces it came in.
+struct GroupLine
+{
+	size_t triangle; // Triangles the chunk had written before it
+	bool material;
+	std::string_view name; // Points into the file
+};
+
+// Where a chunk writes its output. Each chunk owns a disjoint slice of the final arrays.
+// Faces go to indices (position only) or corners, whichever is set; normals and smoothing groups are skipped if null.
+struct ChunkOutput
+{
+	glm::vec3* vertices = nullptr;
+	glm::vec2* texCoords = nullptr;
+	glm::vec3* normals = nullptr;
+	unsigned int* indices = nullptr;
+	obj::Corner* corners = nullptr;
+	unsigned int* smoothingGroups = nullptr; // One per triangle
+
+	size_t vertexCount = 0;
+	size_t texCoordCount = 0;
+	size_t normalCount = 0;
+	size_t indexCount = 0; // Indices or corners, three per triangle either way
+
+	// What all earlier chunks defined, needed to resolve relative (negative) face indices.
+	size_t vertexBase = 0;
+	size_t texCoordBase = 0;
+	size_t normalBase = 0;
+
+	// A chunk cannot know the smoothing group the chunks before it left on. Its triangles up to its first 's' line
+	// are filled in afterwards, from the last group set in an earlier chunk.
+	unsigned int smoothingGroup = obj::defaultSmoothingGroup;
+	bool setSmoothingGroup = false;
+	size_t inheritedTriangles = 0;
+
+	// Submeshes are only worked out once every chunk is done, these lines say where they change.
+	std::vector<GroupLine> groupLines;
+	std::vector<std::string_view> libraries; // Every file named on an 'mtllib' line, pointing into the file
+};
+
+// The arrays a whole parse fills; the optional ones match ChunkOutput.
+struct ParseTarget
+{
+	std::vector<glm::vec3>* vertices = nullptr;
+	std::vector<glm::vec2>* texCoords = nullptr;
+	std::vector<glm::vec3>* normals = nullptr;
+	std::vector<unsigned int>* indices = nullptr;
+	std::vector<obj::Corner>* corners = nullptr;
+	std::vector<unsigned int>* smoothingGroups = nullptr;
+	std::vector<std::string>* materials = nullptr;
+	std::vector<Submesh>* submeshes = nullptr;
+	std::vector<SubmeshRange>* submeshRanges = nullptr;
+	std::vector<std::string>* materialLibraries = nullptr;
+};
+
+// OBJ indices are one based, negative ones count back from the last element defined so far, and 0 means none.
+inline unsigned int resolveIndex(long long index, size_t defined) {
+	if (index == 0) {
+		return obj::noIndex;
+	}
+	return index < 0
+		? static_cast<unsigned int>(static_cast<long long>(defined) + index)
+		: static_cast<unsigned int>(index - 1);
+}
+
+ChunkCounts countChunk(const char* begin, const char* end, const obj::ScanKernels& kernels) {
+	ChunkCounts counts;
+	const char* line = begin;
+	while (line < end) {
+		const char* lineEnd = kernels.findNewline(line, end);
+
+		switch (classifyLine(line, lineEnd)) {
+		case LineType::Vertex:
+			counts.vertices++;
+			break;
+		case LineType::TexCoord:
+			counts.texCoords++;
+			break;
+		case LineType::Normal:
+			counts.normals++;
+			break;
+		case LineType::Smoothing:
+			counts.smoothingLines++;
+			break;
+		case LineType::Face: {
+			size_t tokens = 0;
+			bool inToken = false;
+			for (const char* p = line + 2; p < lineEnd; p++) {
+				bool space = isSpace(*p);
+				if (!space && !inToken) {
+					tokens++;
+				}
+				inToken = !space;
+			}
+			if (tokens >= 3) {
+				counts.triangles += tokens - 2;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		line = lineEnd + 1;
+	}
+	return counts;
+}
+
+// OBJ File Vertex format:
+// v xCoord yCoord zCoord 
+// Vertices can have optional extra paramters, but for now I only use x, y, z
+void parseVertex(const char* p, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	glm::vec3 vertex(0.0f);
+	kernels.parseFloats(p, end, &vertex.x, 3);
+	out.vertices[out.vertexCount++] = vertex;
+}
+
+// OBJ File Texture format:
+// vt uCoord vCoord
+// Similar to Vertices, texture coordinates can have extra parameters.
+void parseTexCoord(const char* p, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	glm::vec2 texCoord(0.0f);
+	kernels.parseFloats(p, end, &texCoord.x, 2);
+	out.texCoords[out.texCoordCount++] = texCoord;
+}
+
+// OBJ File Normal format:
+// vn x y z
+// Only kept when parsing corners; position only parsing generates its own normals.
+void parseNormal(const char* p, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	glm::vec3 normal(0.0f);
+	kernels.parseFloats(p, end, &normal.x, 3);
+	out.normals[out.normalCount++] = normal;
+}
+
+// OBJ File Smoothing group format:
+// s groupNumber
+// "s off" and "s 0" turn smoothing off, so faces after them are shaded flat.
+void parseSmoothingGroup(const char* p, const char* end, ChunkOutput& out) {
+	while (p < end && isSpace(*p)) {
+		p++;
+	}
+	unsigned int group = 0;
+	std::from_chars(p, end, group); // "off" (or anything else that is not a number) leaves 0
+	out.smoothingGroup = group;
+	out.setSmoothingGroup = true;
+}
+
+// o objectName, g groupName, usemtl materialName
+// Everything after the keyword is the name, so group lines listing several groups count as one group.
+void parseGroupLine(const char* p, const char* end, bool material, ChunkOutput& out) {
+	while (p < end && isSpace(*p)) {
+		p++;
+	}
+	while (end > p && isSpace(end[-1])) {
+		end--;
+	}
+	out.groupLines.push_back({ out.indexCount / 3, material, std::string_view(p, end - p) });
+}
+
+// mtllib file1 file2 ...
+void parseLibraryLine(const char* p, const char* end, ChunkOutput& out) {
+	while (p < end) {
+		while (p < end && isSpace(*p)) {
+			p++;
+		}
+		const char* name = p;
+		while (p < end && !isSpace(*p)) {
+			p++;
+		}
+		if (p > name) {
+			out.libraries.emplace_back(name, p - name);
+		}
+	}
+}
+
+// Must be called before the triangle's indices are written, while indexCount still counts the triangles before it.
+inline void addSmoothingGroup(ChunkOutput& out) {
+	if (out.smoothingGroups) {
+		out.smoothingGroups[out.indexCount / 3] = out.smoothingGroup;
+		if (!out.setSmoothingGroup) {
+			out.inheritedTriangles++;
+		}
+	}
+}
+
+// OBJ File Face format:
+// f vertexIndex1/textureIndex1/normalIndex1 ... vertexIndexN/textureIndexN/normalIndexN
+// faces can omit texture parameter, leaving the following format:
+// f vertexIndex1//normalIndex1 ...
+// Polygons are fan triangulated as they are read, so no per-face index list is needed.
+// Every triangle also gets the smoothing group in force, when the file has any.
+void parseFace(const char* p, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	const int batchSize = 64;
+	long long indices[batchSize];
+
+	unsigned int first = 0, previous = 0;
+	size_t count = 0;
+
+	while (p < end) {
+		int read = kernels.parseFaceIndices(p, end, indices, batchSize);
+		for (int i = 0; i < read; i++) {
+			unsigned int vIndex = resolveIndex(indices[i], out.vertexBase + out.vertexCount);
+
+			if (count == 0) {
+				first = vIndex;
+			}
+			else if (count >= 2) {
+				addSmoothingGroup(out);
+				out.indices[out.indexCount++] = first;
+				out.indices[out.indexCount++] = previous;
+				out.indices[out.indexCount++] = vIndex;
+			}
+			previous = vIndex;
+			count++;
+		}
+		if (read < batchSize) {
+			break;
+		}
+	}
+}
+
+// Same fan triangulation, keeping the texture and normal index of every face vertex.
+void parseFaceCorners(const char* p, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	const int batchSize = 32;
+	long long values[batchSize * 3];
+
+	obj::Corner first = {}, previous = {};
+	size_t count = 0;
+
+	while (p < end) {
+		int read = kernels.parseFaceCorners(p, end, values, batchSize);
+		for (int i = 0; i < read; i++) {
+			obj::Corner corner;
+			corner.position = resolveIndex(values[i * 3], out.vertexBase + out.vertexCount);
+			corner.texCoord = resolveIndex(values[i * 3 + 1], out.texCoordBase + out.texCoordCount);
+			corner.normal = resolveIndex(values[i * 3 + 2], out.normalBase + out.normalCount);
+
+			if (count == 0) {
+				first = corner;
+			}
+			else if (count >= 2) {
+				addSmoothingGroup(out);
+				out.corners[out.indexCount++] = first;
+				out.corners[out.indexCount++] = previous;
+				out.corners[out.indexCount++] = corner;
+			}
+			previous = corner;
+			count++;
+		}
+		if (read < batchSize) {
+			break;
+		}
+	}
+}
+
+void parseChunk(const char* begin, const char* end, ChunkOutput& out, const obj::ScanKernels& kernels) {
+	const char* line = begin;
+	while (line < end) {
+		const char* lineEnd = kernels.findNewline(line, end);
+
+		switch (classifyLine(line, lineEnd)) {
+		case LineType::Vertex:
+			parseVertex(line + 2, lineEnd, out, kernels);
+			break;
+		case LineType::TexCoord:
+			parseTexCoord(line + 3, lineEnd, out, kernels);
+			break;
+		case LineType::Normal:
+			if (out.normals) {
+				parseNormal(line + 3, lineEnd, out, kernels);
+			}
+			break;
+		case LineType::Smoothing:
+			if (out.smoothingGroups) {
+				parseSmoothingGroup(line + 2, lineEnd, out);
+			}
+			break;
+		case LineType::Group:
+			parseGroupLine(line + 2, lineEnd, false, out);
+			break;
+		case LineType::Material:
+			parseGroupLine(line + 7, lineEnd, true, out);
+			break;
+		case LineType::Library:
+			parseLibraryLine(line + 7, lineEnd, out);
+			break;
+		case LineType::Face:
+			if (out.corners) {
+				parseFaceCorners(line + 2, lineEnd, out, kernels);
+			}
+			else {
+				parseFace(line + 2, lineEnd, out, kernels);
+			}
+			break;
+		default:
+			break;
+		}
+
+		line = lineEnd + 1;
+	}
+}
+
+// Compacts the face output of every chunk to the front of its array, in chunk order, and trims the array.
+// Malformed faces can come up short of the counted upper bound. perTriangle is 3 for indices and corners, 1 for smoothing groups.
+template <typename T>
+void closeGaps(std::vector<T>& values, const std::vector<ChunkOutput>& outputs, T* ChunkOutput::* slice, size_t perTriangle) {
+	size_t count = 0;
+	for (const ChunkOutput& output : outputs) {
+		T* destination = values.data() + count;
+		size_t written = output.indexCount / 3 * perTriangle;
+		if (output.*slice != destination && written > 0) {
+			std::memmove(destination, output.*slice, written * sizeof(T));
+		}
+		count += written;
+	}
+	values.resize(count);
+}
+
+// Moves each run of triangles from values to the position given for it in values, perTriangle values per triangle.
+// Runs are copied in parallel, in groups of about blockSize triangles.
+template <typename T>
+void moveRuns(std::vector<T>& values, const std::vector<size_t>& sources, const std::vector<size_t>& destinations,
+	const std::vector<size_t>& counts, size_t perTriangle, ThreadPool& pool) {
+	const size_t blockSize = size_t(1) << 16;
+	std::vector<size_t> blockStarts(1, 0);
+	size_t triangles = 0;
+	for (size_t run = 0; run < counts.size(); run++) {
+		triangles += counts[run];
+		if (triangles >= blockSize && run + 1 < counts.size()) {
+			blockStarts.push_back(run + 1);
+			triangles = 0;
+		}
+	}
+	blockStarts.push_back(counts.size());
+
+	std::vector<T> moved(values.size());
+	pool.parallelFor(blockStarts.size() - 1, [&](size_t block) {
+		for (size_t run = blockStarts[block]; run < blockStarts[block + 1]; run++) {
+			std::copy_n(values.begin() + sources[run] * perTriangle, counts[run] * perTriangle, moved.begin() + destinations[run] * perTriangle);
+		}
+	});
+	values.swap(moved);
+}
+
+// Works out the submeshes from the chunks' group lines, once every chunk's faces are in place, and moves the faces of
+// each submesh together. Submeshes go in order of material, then of first appearance; the faces of each keep their file order.
+void groupSubmeshes(const ParseTarget& target, const std::vector<ChunkOutput>& outputs, ThreadPool& pool) {
+	std::vector<std::string>& materials = *target.materials;
+	std::vector<Submesh>& submeshes = *target.submeshes;
+	materials.clear();
+	submeshes.clear();
+	target.submeshRanges->clear();
+
+	// Runs of consecutive triangles of one submesh, in file order.
+	std::vector<size_t> runFirsts, runCounts;
+	std::vector<uint32_t> runSubmeshes;
+	std::map<std::string_view, uint32_t> materialIds;
+	std::map<std::pair<std::string_view, uint32_t>, uint32_t> submeshIds;
+	std::string_view name, material;
+	size_t runStart = 0;
+	auto endRun = [&](size_t triangle) {
+		if (triangle > runStart) {
+			// Materials and submeshes only count once they have a face.
+			auto materialId = materialIds.emplace(material, static_cast<uint32_t>(materials.size()));
+			if (materialId.second) {
+				materials.emplace_back(material);
+			}
+			auto submeshId = submeshIds.emplace(std::make_pair(name, materialId.first->second), static_cast<uint32_t>(submeshes.size()));
+			if (submeshId.second) {
+				Submesh submesh;
+				submesh.name = std::string(name);
+				submesh.material = materialId.first->second;
+				submeshes.push_back(submesh);
+			}
+			if (!runSubmeshes.empty() && runSubmeshes.back() == submeshId.first->second) {
+				runCounts.back() += triangle - runStart;
+			}
+			else {
+				runFirsts.push_back(runStart);
+				runCounts.push_back(triangle - runStart);
+				runSubmeshes.push_back(submeshId.first->second);
+			}
+		}
+		runStart = triangle;
+	};
+	size_t chunkStart = 0;
+	for (const ChunkOutput& output : outputs) {
+		for (const GroupLine& line : output.groupLines) {
+			endRun(chunkStart + line.triangle);
+			(line.material ? material : name) = line.name;
+		}
+		chunkStart += output.indexCount / 3;
+	}
+	endRun(chunkStart);
+
+	// Stable, so submeshes of one material stay in order of appearance.
+	std::vector<uint32_t> order(submeshes.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return submeshes[a].material < submeshes[b].material; });
+	std::vector<uint32_t> rank(submeshes.size());
+	std::vector<Submesh> sorted(submeshes.size());
+	for (uint32_t i = 0; i < order.size(); i++) {
+		rank[order[i]] = i;
+		sorted[i] = std::move(submeshes[order[i]]);
+	}
+	submeshes.swap(sorted);
+
+	std::vector<size_t> firsts(submeshes.size() + 1, 0);
+	for (size_t run = 0; run < runCounts.size(); run++) {
+		firsts[rank[runSubmeshes[run]] + 1] += runCounts[run];
+	}
+	std::partial_sum(firsts.begin(), firsts.end(), firsts.begin());
+	for (size_t i = 0; i < submeshes.size(); i++) {
+		target.submeshRanges->push_back({ static_cast<uint32_t>(firsts[i] * 3), static_cast<uint32_t>((firsts[i + 1] - firsts[i]) * 3), 0, submeshes[i].material });
+	}
+
+	// Most files are already in order, one submesh or a few that never come back.
+	std::vector<size_t> destinations(runCounts.size());
+	bool moved = false;
+	for (size_t run = 0; run < runCounts.size(); run++) {
+		size_t& next = firsts[rank[runSubmeshes[run]]];
+		destinations[run] = next;
+		moved |= next != runFirsts[run];
+		next += runCounts[run];
+	}
+	if (!moved) {
+		return;
+	}
+	if (target.corners) {
+		moveRuns(*target.corners, runFirsts, destinations, runCounts, 3, pool);
+	}
+	else {
+		moveRuns(*target.indices, runFirsts, destinations, runCounts, 3, pool);
+	}
+	if (!target.smoothingGroups->empty()) {
+		moveRuns(*target.smoothingGroups, runFirsts, destinations, runCounts, 1, pool);
+	}
+}
+
+void parseInto(const char* begin, const char* end, const ParseTarget& target, const obj::ScanKernels& kernels, size_t chunkCount, ThreadPool& pool) {
+	chunkCount = std::max<size_t>(chunkCount, 1);
+
+	// Split at newlines so no line straddles two chunks.
+	std::vector<const char*> bounds(chunkCount + 1);
+	bounds[0] = begin;
+	bounds[chunkCount] = end;
+	size_t size = end - begin;
+	for (size_t i = 1; i < chunkCount; i++) {
+		const char* split = std::max(begin + size * i / chunkCount, bounds[i - 1]);
+		const char* newline = kernels.findNewline(split, end);
+		bounds[i] = newline < end ? newline + 1 : end;
+	}
+
+	// Counting pass.
+	std::vector<ChunkCounts> counts(chunkCount);
+	pool.parallelFor(chunkCount, [&](size_t i) {
+		counts[i] = countChunk(bounds[i], bounds[i + 1], kernels);
+	});
+
+	// Prefix sums give every chunk its slice of the output.
+	std::vector<ChunkCounts> offsets(chunkCount);
+	ChunkCounts totals;
+	for (size_t i = 0; i < chunkCount; i++) {
+		offsets[i] = totals;
+		totals.vertices += counts[i].vertices;
+		totals.texCoords += counts[i].texCoords;
+		totals.normals += counts[i].normals;
+		totals.triangles += counts[i].triangles;
+		totals.smoothingLines += counts[i].smoothingLines;
+	}
+
+	target.vertices->resize(totals.vertices);
+	target.texCoords->resize(totals.texCoords);
+	if (target.normals) {
+		target.normals->resize(totals.normals);
+	}
+	if (target.corners) {
+		target.corners->resize(totals.triangles * 3);
+	}
+	else {
+		target.indices->resize(totals.triangles * 3);
+	}
+	// Most files never set a smoothing group; they get no array at all.
+	bool smoothing = target.smoothingGroups && totals.smoothingLines > 0;
+	if (target.smoothingGroups) {
+		target.smoothingGroups->assign(smoothing ? totals.triangles : 0, obj::defaultSmoothingGroup);
+	}
+
+	std::vector<ChunkOutput> outputs(chunkCount);
+	for (size_t i = 0; i < chunkCount; i++) {
+		outputs[i].vertices = target.vertices->data() + offsets[i].vertices;
+		outputs[i].texCoords = target.texCoords->data() + offsets[i].texCoords;
+		if (target.normals) {
+			outputs[i].normals = target.normals->data() + offsets[i].normals;
+		}
+		if (target.corners) {
+			outputs[i].corners = target.corners->data() + offsets[i].triangles * 3;
+		}
+		else {
+			outputs[i].indices = target.indices->data() + offsets[i].triangles * 3;
+		}
+		if (smoothing) {
+			outputs[i].smoothingGroups = target.smoothingGroups->data() + offsets[i].triangles;
+		}
+		outputs[i].vertexBase = offsets[i].vertices;
+		outputs[i].texCoordBase = offsets[i].texCoords;
+		outputs[i].normalBase = offsets[i].normals;
+	}
+
+	// Parsing pass.
+	pool.parallelFor(chunkCount, [&](size_t i) {
+		parseChunk(bounds[i], bounds[i + 1], outputs[i], kernels);
+	});
+
+	if (target.corners) {
+		closeGaps(*target.corners, outputs, &ChunkOutput::corners, 3);
+	}
+	else {
+		closeGaps(*target.indices, outputs, &ChunkOutput::indices, 3);
+	}
+
+	if (smoothing) {
+		closeGaps(*target.smoothingGroups, outputs, &ChunkOutput::smoothingGroups, 1);
+
+		// Carry each chunk's last group into the start of the next.
+		unsigned int group = obj::defaultSmoothingGroup;
+		size_t triangle = 0;
+		for (const ChunkOutput& output : outputs) {
+			std::fill_n(target.smoothingGroups->begin() + triangle, output.inheritedTriangles, group);
+			if (output.setSmoothingGroup) {
+				group = output.smoothingGroup;
+			}
+			triangle += output.indexCount / 3;
+		}
+	}
+
+	groupSubmeshes(target, outputs, pool);
+
+	// Each library once, in file order.
+	target.materialLibraries->clear();
+	for (const ChunkOutput& output : outputs) {
+		for (std::string_view library : output.libraries) {
+			if (std::find(target.materialLibraries->begin(), target.materialLibraries->end(), library) == target.materialLibraries->end()) {
+				target.materialLibraries->emplace_back(library);
+			}
+		}
+	}
+}
+
+template <typename T>
+bool sameBits(const std::vector<T>& a, const std::vector<T>& b) {
+	return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+bool sameSubmeshes(const std::vector<Submesh>& a, const std::vector<Submesh>& b) {
+	return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const Submesh& x, const Submesh& y) {
+		return x.name == y.name && x.material == y.material;
+	});
+}
+
+bool sameMesh(const MeshData& a, const MeshData& b) {
+	return sameBits(a.vertices, b.vertices) && sameBits(a.texCoords, b.texCoords) && a.vertexIndices == b.vertexIndices
+		&& a.smoothingGroups == b.smoothingGroups && a.materials == b.materials && sameSubmeshes(a.submeshes, b.submeshes)
+		&& sameBits(a.submeshRanges, b.submeshRanges) && a.materialLibraries == b.materialLibraries;
+}
+
+bool sameCorners(const obj::CornerData& a, const obj::CornerData& b) {
+	return sameBits(a.positions, b.positions) && sameBits(a.texCoords, b.texCoords) && sameBits(a.normals, b.normals)
+		&& sameBits(a.corners, b.corners) && a.smoothingGroups == b.smoothingGroups && a.materials == b.materials
+		&& sameSubmeshes(a.submeshes, b.submeshes) && sameBits(a.submeshRanges, b.submeshRanges) && a.materialLibraries == b.materialLibraries;
+}
+
+// Number and face token inputs for selfTest(). Each one is also cut off at every length.
+const char* const floatInputs[] = {
+	"1.0 2.0 3.0 4.0",
+	"-0.123456 +1 -.5 7.",
+	"0.1234567890 1.23456789012 12345678901234567890",
+	"16777216 16777217 -16777217.5 1677721.7 3355443.1 0.00000000001",
+	"1e5 -2.5E-3 3.40282347e+38 1e-50 1e39",
+	"nan inf -inf 0x10 abc",
+	"  \t1.5\r\n2.5",
+	"1.5/2 -/ + - .",
+	"00000000000000000001.5 0.000000000000000000012345",
+};
+
+const char* const faceInputs[] = {
+	"1 2 3",
+	"1/2/3 4/5/6 7/8/9 10/11/12",
+	"1//3 -1//-2 -3//4",
+	"-1 -2 -3 -4 -5 -6 -7 -8 -9",
+	"99999999999999999999 1 123456789012345678 1234567890123456789",
+	"1/ 2/x 3/4/ 5//",
+	"x y z",
+	"1/2/3/4 \t 5\r",
+	"7 8 9 10 11 12 13 14 15 16 17 18",
+};
+
+// Lines of 16 and 32 bytes, so they end exactly on the SIMD blocks, and no newline at the end.
+const char selfTestFile[] =
+	"mtllib test.mtl\n"
+	"v 1.0 2.0 3.000\n"
+	"v -1.5 0.25 -0.125 # a comment\n"
+	"v 0.5 0.5 -0.5\n"
+	"v 4 5 6\n"
+	"vt 0.5 0.75\n"
+	"vn 0.0 0.0 1.0000000000000000\n"
+	"g first\n"
+	"usemtl red\n"
+	"s 1\n"
+	"f 1/1/1 2/1/1 3/1/1\n"
+	"f 1 2 3 4\n"
+	"o second\n"
+	"usemtl blue\n"
+	"s off\n"
+	"f -1//1 -2//1 -3//1 -4//1 -3//1\n"
+	"f 1/1 2/1 4/1";
+
+const size_t selfTestAlignments = 32;
+
+// Copies text to the given alignment in a buffer that ends where the text does, so reads past the end are not hidden
+// by the bytes behind it.
+const char* place(std::vector<char>& buffer, const char* text, size_t length, size_t alignment) {
+	if (alignment + length == 0) {
+		return text; // An empty vector has no data() to point into
+	}
+	buffer.assign(alignment + length, ' ');
+	std::memcpy(buffer.data() + alignment, text, length);
+	return buffer.data() + alignment;
+}
+
+bool sameFindNewline(const obj::ScanKernels& kernels, const obj::ScanKernels& reference) {
+	std::vector<char> buffer;
+	std::string line(96, 'a');
+	for (size_t newline = 0; newline <= line.size(); newline++) {
+		std::string text = line;
+		if (newline < text.size()) {
+			text[newline] = '\n';
+		}
+		for (size_t alignment = 0; alignment < selfTestAlignments; alignment++) {
+			for (size_t length : { newline, newline + 1, text.size() }) {
+				length = std::min(length, text.size());
+				const char* p = place(buffer, text.data(), length, alignment);
+				if (kernels.findNewline(p, p + length) != reference.findNewline(p, p + length)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool sameParseFloats(const obj::ScanKernels& kernels, const obj::ScanKernels& reference) {
+	std::vector<char> buffer;
+	for (const char* input : floatInputs) {
+		size_t inputLength = std::strlen(input);
+		for (size_t length = 0; length <= inputLength; length++) {
+			for (size_t alignment = 0; alignment < selfTestAlignments; alignment++) {
+				const char* p = place(buffer, input, length, alignment);
+				for (int count : { 2, 3, 4, 8 }) {
+					float values[8] = {};
+					float expected[8] = {};
+					if (kernels.parseFloats(p, p + length, values, count) != reference.parseFloats(p, p + length, expected, count)
+						|| std::memcmp(values, expected, sizeof(values)) != 0) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool sameParseFaces(const obj::ScanKernels& kernels, const obj::ScanKernels& reference) {
+	std::vector<char> buffer;
+	for (const char* input : faceInputs) {
+		size_t inputLength = std::strlen(input);
+		for (size_t length = 0; length <= inputLength; length++) {
+			for (size_t alignment = 0; alignment < selfTestAlignments; alignment++) {
+				const char* text = place(buffer, input, length, alignment);
+				for (int maxCount : { 3, 16 }) {
+					long long indices[16] = {};
+					long long expectedIndices[16] = {};
+					const char* p = text;
+					const char* q = text;
+					if (kernels.parseFaceIndices(p, text + length, indices, maxCount) != reference.parseFaceIndices(q, text + length, expectedIndices, maxCount)
+						|| p != q || std::memcmp(indices, expectedIndices, sizeof(indices)) != 0) {
+						return false;
+					}
+
+					long long corners[16 * 3] = {};
+					long long expectedCorners[16 * 3] = {};
+					p = text;
+					q = text;
+					if (kernels.parseFaceCorners(p, text + length, corners, maxCount) != reference.parseFaceCorners(q, text + length, expectedCorners, maxCount)
+						|| p != q || std::memcmp(corners, expectedCorners, sizeof(corners)) != 0) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+}
+
+namespace obj
+{
+	size_t defaultChunkCount(size_t fileSize, const ThreadPool& pool) {
+		// Below a few MB the thread handoff costs more than it saves.
+		const size_t minChunkSize = 1 << 20;
+		if (fileSize < 4 * minChunkSize || pool.size() == 1) {
+			return 1;
+		}
+		// A few chunks per thread so an unlucky chunk full of long faces does not hold everyone up.
+		return std::min<size_t>(pool.size() * 4, fileSize / minChunkSize);
+	}
+
+	void parse(const char* begin, const char* end, MeshData& mesh) {
+		ThreadPool& pool = ThreadPool::global();
+		parse(begin, end, mesh, bestScanKernels(), defaultChunkCount(end - begin, pool), pool);
+	}
+
+	void parse(const char* begin, const char* end, MeshData& mesh, const ScanKernels& kernels, size_t chunkCount, ThreadPool& pool) {
+		mesh.clear();
+
+		ParseTarget target;
+		target.vertices = &mesh.vertices;
+		target.texCoords = &mesh.texCoords;
+		target.indices = &mesh.vertexIndices;
+		target.smoothingGroups = &mesh.smoothingGroups;
+		target.materials = &mesh.materials;
+		target.submeshes = &mesh.submeshes;
+		target.submeshRanges = &mesh.submeshRanges;
+		target.materialLibraries = &mesh.materialLibraries;
+		parseInto(begin, end, target, kernels, chunkCount, pool);
+	}
+
+	void parseCorners(const char* begin, const char* end, CornerData& data, const ScanKernels& kernels, size_t chunkCount, ThreadPool& pool) {
+		ParseTarget target;
+		target.vertices = &data.positions;
+		target.texCoords = &data.texCoords;
+		target.normals = &data.normals;
+		target.corners = &data.corners;
+		target.smoothingGroups = &data.smoothingGroups;
+		target.materials = &data.materials;
+		target.submeshes = &data.submeshes;
+		target.submeshRanges = &data.submeshRanges;
+		target.materialLibraries = &data.materialLibraries;
+		parseInto(begin, end, target, kernels, chunkCount, pool);
+	}
+
+	bool verify(const char* begin, const char* end) {
+		ThreadPool& pool = ThreadPool::global();
+
+		MeshData reference;
+		parse(begin, end, reference, scanKernels(SimdLevel::Scalar), 1, pool);
+		CornerData cornerReference;
+		parseCorners(begin, end, cornerReference, scanKernels(SimdLevel::Scalar), 1, pool);
+
+		bool ok = true;
+		for (SimdLevel level : { SimdLevel::SSE2, SimdLevel::AVX2 }) {
+			const ScanKernels& kernels = scanKernels(level);
+			if (kernels.level != level) {
+				continue; // Not supported on this CPU.
+			}
+
+			MeshData mesh;
+			parse(begin, end, mesh, kernels, 1, pool);
+			CornerData corners;
+			parseCorners(begin, end, corners, kernels, 1, pool);
+			if (!sameMesh(mesh, reference) || !sameCorners(corners, cornerReference)) {
+				std::cerr << "ERROR::OBJ::" << kernels.name << "_KERNELS_DO_NOT_MATCH_SCALAR" << std::endl;
+				ok = false;
+			}
+		}
+
+		for (size_t chunkCount : { size_t(2), size_t(7), defaultChunkCount(end - begin, pool) }) {
+			MeshData mesh;
+			parse(begin, end, mesh, bestScanKernels(), chunkCount, pool);
+			CornerData corners;
+			parseCorners(begin, end, corners, bestScanKernels(), chunkCount, pool);
+			if (!sameMesh(mesh, reference) || !sameCorners(corners, cornerReference)) {
+				std::cerr << "ERROR::OBJ::" << chunkCount << "_CHUNKS_DO_NOT_MATCH_SINGLE_CHUNK" << std::endl;
+				ok = false;
+			}
+		}
+		return ok;
+	}
+
+	bool selfTest() {
+		auto start = std::chrono::steady_clock::now();
+		const ScanKernels& reference = scanKernels(SimdLevel::Scalar);
+
+		bool ok = true;
+		std::string checked;
+		for (SimdLevel level : { SimdLevel::SSE2, SimdLevel::AVX2 }) {
+			const ScanKernels& kernels = scanKernels(level);
+			if (kernels.level != level) {
+				continue; // Not supported on this CPU.
+			}
+			checked += checked.empty() ? kernels.name : std::string(", ") + kernels.name;
+
+			if (!sameFindNewline(kernels, reference)) {
+				std::cerr << "ERROR::OBJ::" << kernels.name << "_FIND_NEWLINE_DOES_NOT_MATCH_SCALAR" << std::endl;
+				ok = false;
+			}
+			if (!sameParseFloats(kernels, reference)) {
+				std::cerr << "ERROR::OBJ::" << kernels.name << "_PARSE_FLOATS_DOES_NOT_MATCH_SCALAR" << std::endl;
+				ok = false;
+			}
+			if (!sameParseFaces(kernels, reference)) {
+				std::cerr << "ERROR::OBJ::" << kernels.name << "_PARSE_FACES_DOES_NOT_MATCH_SCALAR" << std::endl;
+				ok = false;
+			}
+		}
+
+		// verify() reports what did not match, the first length it fails at is enough to go on.
+		std::vector<char> buffer;
+		for (size_t length = 0; length < sizeof(selfTestFile); length++) {
+			const char* p = place(buffer, selfTestFile, length, 0);
+			if (!verify(p, p + length)) {
+				std::cerr << "ERROR::OBJ::SELF_TEST_FILE_CUT_AT_" << length << "_BYTES_DOES_NOT_MATCH" << std::endl;
+				ok = false;
+				break;
+			}
+		}
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Scanner self-test " << (ok ? "passed" : "FAILED") << " for " << (checked.empty() ? "no SIMD" : checked)
+			<< " kernels in " << milliseconds << " ms" << std::endl;
+		return ok;
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "mesh_data.h"
+#include "obj_scanner.h"
+
+class ThreadPool;
+
+// In-place OBJ tokenizer.
+// Works directly on the bytes of a (memory mapped) file, so there are no per-line or per-token allocations.
+// Large files are split into newline aligned chunks that are parsed in parallel. A counting pass sizes every
+// chunk first, so the output arrays are allocated exactly once and each chunk writes straight into its own slice.
+// Faces come out grouped into submeshes by their 'o'/'g' name and 'usemtl' material, sorted by material, so
+// MeshData::submeshRanges only has the full detail level filled in (with a base vertex of 0) after parsing.
+namespace obj
+{
+	// Marks a texture or normal index a face vertex did not have.
+	const unsigned int noIndex = 0xFFFFFFFF;
+
+	// Smoothing group of faces that come before the first 's' line. It is smoothed like any other group;
+	// group 0 ("s off") is the only one that is never smoothed.
+	const unsigned int defaultSmoothingGroup = 0xFFFFFFFF;
+
+	// One triangle corner as written in the file, resolved to zero based indices into the CornerData streams.
+	struct Corner
+	{
+		unsigned int position;
+		unsigned int texCoord;
+		unsigned int normal;
+	};
+
+	// Every stream of an OBJ file, with faces kept as v/vt/vn corners (three per triangle) rather than position indices.
+	struct CornerData
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+		std::vector<Corner> corners;
+		std::vector<unsigned int> smoothingGroups; // Per triangle, empty if the file has no 's' lines
+		std::vector<std::string> materials;        // Same as in MeshData
+		std::vector<Submesh> submeshes;
+		std::vector<SubmeshRange> submeshRanges;   // Of the corners, three per triangle
+		std::vector<std::string> materialLibraries;
+	};
+
+	// Replaces the contents of mesh with the OBJ data in [begin, end), using the best kernels for this CPU
+	// and as many chunks as the global thread pool can keep busy.
+	void parse(const char* begin, const char* end, MeshData& mesh);
+	// The result does not depend on kernels or chunkCount, only the speed does.
+	void parse(const char* begin, const char* end, MeshData& mesh, const ScanKernels& kernels, size_t chunkCount, ThreadPool& pool);
+
+	// Same, keeping file normals and the texture/normal index of every face vertex.
+	void parseCorners(const char* begin, const char* end, CornerData& data, const ScanKernels& kernels, size_t chunkCount, ThreadPool& pool);
+
+	// Chunk count parse() picks for a file of the given size.
+	size_t defaultChunkCount(size_t fileSize, const ThreadPool& pool);
+
+	// Parses [begin, end) with every supported SIMD level and several chunk counts, in both position and corner mode,
+	// and checks the results are bit-identical to the single chunk scalar path.
+	bool verify(const char* begin, const char* end);
+
+	// Checks every supported SIMD level against the scalar kernels on fixed inputs: newlines at every position of a few
+	// 32 byte blocks, numbers and face tokens that run up to the end of the buffer without a newline, and a small file
+	// cut off at every length, run through verify(). Inputs are placed at every alignment in buffers of their exact size.
+	bool selfTest();
+}
+
+#endif
@@ -0,0 +1,366 @@
+#include "obj_scanner.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OBJ_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic, GCC and Clang need to be told per function.
+#if defined(OBJ_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define OBJ_TARGET(isa) __attribute__((target(isa)))
+#else
+#define OBJ_TARGET(isa)
+#endif
+
+namespace {
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+	return static_cast<unsigned char>(c - '0') < 10;
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && isSpace(*p)) {
+		p++;
+	}
+	return p;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Scalar reference path. The SIMD levels must produce bit-identical results to these.
+// ---------------------------------------------------------------------------------------------
+
+const char* scalarFindNewline(const char* p, const char* end) {
+	const char* found = static_cast<const char*>(std::memchr(p, '\n', end - p));
+	return found ? found : end;
+}
+
+// Reads one float with from_chars. On malformed input the value is 0 and p is left where the number should have been.
+inline const char* scalarParseFloat(const char* p, const char* end, float& value) {
+	p = skipSpaces(p, end);
+	// from_chars does not accept a leading '+', strtof (and so operator>>) does.
+	if (p < end && *p == '+') {
+		p++;
+	}
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) {
+		value = 0.0f;
+	}
+	return result.ptr;
+}
+
+const char* scalarParseFloats(const char* p, const char* end, float* values, int count) {
+	for (int i = 0; i < count; i++) {
+		p = scalarParseFloat(p, end, values[i]);
+	}
+	return p;
+}
+
+// Reads one index at p. On malformed input it returns false and leaves p alone.
+inline bool scalarParseIndex(const char*& p, const char* end, long long& value) {
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) {
+		return false;
+	}
+	p = result.ptr;
+	return true;
+}
+
+// Face parsing is shared by every level, only the index conversion differs.
+template <bool (*ParseIndex)(const char*&, const char*, long long&)>
+int parseFaceIndicesWith(const char*& p, const char* end, long long* indices, int maxCount) {
+	int count = 0;
+	while (count < maxCount) {
+		p = skipSpaces(p, end);
+		if (p >= end) {
+			break;
+		}
+
+		if (!ParseIndex(p, end, indices[count])) {
+			p = end;
+			break;
+		}
+		count++;
+
+		// Skip the "/t/n" part of the token.
+		while (p < end && !isSpace(*p)) {
+			p++;
+		}
+	}
+	return count;
+}
+
+// Tokens are "v", "v/t", "v//n" or "v/t/n". A missing or malformed texture/normal index is returned as 0.
+template <bool (*ParseIndex)(const char*&, const char*, long long&)>
+int parseFaceCornersWith(const char*& p, const char* end, long long* corners, int maxCount) {
+	int count = 0;
+	while (count < maxCount) {
+		p = skipSpaces(p, end);
+		if (p >= end) {
+			break;
+		}
+
+		long long* corner = corners + count * 3;
+		if (!ParseIndex(p, end, corner[0])) {
+			p = end;
+			break;
+		}
+		corner[1] = corner[2] = 0;
+		for (int k = 1; k < 3 && p < end && *p == '/'; k++) {
+			p++;
+			if (p < end && *p != '/' && !isSpace(*p) && !ParseIndex(p, end, corner[k])) {
+				corner[k] = 0;
+			}
+		}
+		count++;
+
+		while (p < end && !isSpace(*p)) {
+			p++;
+		}
+	}
+	return count;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Fast number conversion shared by the SIMD levels.
+// ---------------------------------------------------------------------------------------------
+
+// SWAR digit parsing: converts 8 ASCII digits with three multiplies instead of eight.
+// Assumes a little-endian target, which every x86 is.
+inline bool isEightDigits(const char* p) {
+	uint64_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return (((value & 0xF0F0F0F0F0F0F0F0ull) | (((value + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+inline uint32_t parseEightDigits(const char* p) {
+	uint64_t value;
+	std::memcpy(&value, p, sizeof(value));
+	value = (value & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+	value = (value & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+	return static_cast<uint32_t>((value & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+}
+
+// Accumulates a run of digits into mantissa. Gives up (returns false) before more than 19 digits could overflow it.
+inline bool readDigits(const char*& p, const char* end, uint64_t& mantissa, int& digits) {
+	while (end - p >= 8 && isEightDigits(p)) {
+		if (digits + 8 > 19) {
+			return false;
+		}
+		mantissa = mantissa * 100000000ull + parseEightDigits(p);
+		digits += 8;
+		p += 8;
+	}
+	while (p < end && isDigit(*p)) {
+		if (digits + 1 > 19) {
+			return false;
+		}
+		mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+		digits++;
+		p++;
+	}
+	return true;
+}
+
+inline bool isSeparator(char c) {
+	return isSpace(c) || c == '\n' || c == '/';
+}
+
+// Exact fast path for plain decimals like "-0.123456" that make up almost every OBJ file.
+// When the significand fits in a float's 24 bits and the power of ten is exactly representable (10^0..10^10),
+// a single IEEE division is correctly rounded, which is exactly what from_chars returns.
+// Anything else (exponents, long mantissas, inf/nan, junk) returns nullptr and is left to the scalar path.
+inline const char* fastParseFloat(const char* p, const char* end, float& value) {
+	static const float powersOfTen[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	if (!readDigits(p, end, mantissa, digits)) {
+		return nullptr;
+	}
+
+	int fraction = 0;
+	if (p < end && *p == '.') {
+		p++;
+		int integerDigits = digits;
+		if (!readDigits(p, end, mantissa, digits)) {
+			return nullptr;
+		}
+		fraction = digits - integerDigits;
+	}
+
+	// The number has to fill its whole token, otherwise from_chars might read it differently (e.g. "1e5").
+	if ((p < end && !isSeparator(*p)) || digits == 0 || fraction > 10 || mantissa > (1ull << 24)) {
+		return nullptr;
+	}
+
+	float result = static_cast<float>(mantissa);
+	if (fraction > 0) {
+		result /= powersOfTen[fraction];
+	}
+	value = negative ? -result : result;
+	return p;
+}
+
+// Numbers in OBJ files are shorter than a vector register, so they are converted with the digit loop above
+// rather than by vector scanning ahead for the end of each token.
+const char* fastParseFloats(const char* p, const char* end, float* values, int count) {
+	for (int i = 0; i < count; i++) {
+		p = skipSpaces(p, end);
+		const char* next = fastParseFloat(p, end, values[i]);
+		p = next ? next : scalarParseFloat(p, end, values[i]);
+	}
+	return p;
+}
+
+// Same contract as scalarParseIndex: an optional '-' followed by digits.
+inline bool fastParseIndex(const char*& p, const char* end, long long& value) {
+	const char* digitsStart = p + (*p == '-' ? 1 : 0);
+	const char* q = digitsStart;
+	long long result = 0;
+	while (q < end && isDigit(*q) && q - digitsStart < 18) {
+		result = result * 10 + (*q - '0');
+		q++;
+	}
+	if (q == digitsStart || (q < end && isDigit(*q))) {
+		// No digits, or too many to be sure there is no overflow: let from_chars decide.
+		return scalarParseIndex(p, end, value);
+	}
+	value = *p == '-' ? -result : result;
+	p = q;
+	return true;
+}
+
+// ---------------------------------------------------------------------------------------------
+// SSE2: two 16 byte compares per 32 byte block.
+// ---------------------------------------------------------------------------------------------
+#ifdef OBJ_SIMD_X86
+
+OBJ_TARGET("sse2")
+const char* sse2FindNewline(const char* p, const char* end) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (end - p >= 32) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+		unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, newline)))
+			| (static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(b, newline))) << 16);
+		if (mask != 0) {
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return p + bit;
+#else
+			return p + __builtin_ctz(mask);
+#endif
+		}
+		p += 32;
+	}
+	return scalarFindNewline(p, end);
+}
+
+// ---------------------------------------------------------------------------------------------
+// AVX2: one 32 byte compare per block.
+// ---------------------------------------------------------------------------------------------
+
+OBJ_TARGET("avx2,bmi")
+const char* avx2FindNewline(const char* p, const char* end) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	while (end - p >= 32) {
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+		if (mask != 0) {
+			return p + _tzcnt_u32(mask);
+		}
+		p += 32;
+	}
+	return scalarFindNewline(p, end);
+}
+
+#endif
+
+const obj::ScanKernels scalarKernels = {
+	obj::SimdLevel::Scalar, "Scalar",
+	scalarFindNewline, scalarParseFloats, parseFaceIndicesWith<scalarParseIndex>, parseFaceCornersWith<scalarParseIndex>
+};
+
+#ifdef OBJ_SIMD_X86
+const obj::ScanKernels sse2Kernels = {
+	obj::SimdLevel::SSE2, "SSE2",
+	sse2FindNewline, fastParseFloats, parseFaceIndicesWith<fastParseIndex>, parseFaceCornersWith<fastParseIndex>
+};
+
+const obj::ScanKernels avx2Kernels = {
+	obj::SimdLevel::AVX2, "AVX2",
+	avx2FindNewline, fastParseFloats, parseFaceIndicesWith<fastParseIndex>, parseFaceCornersWith<fastParseIndex>
+};
+#endif
+
+}
+
+namespace obj
+{
+	SimdLevel detectSimdLevel() {
+#if defined(OBJ_SIMD_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+
+		bool avx2 = false;
+		if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0 && (info[1] & (1 << 3)) != 0; // AVX2 and BMI1
+		}
+
+		if (avx2) return SimdLevel::AVX2;
+		if (sse2) return SimdLevel::SSE2;
+#elif defined(OBJ_SIMD_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")) return SimdLevel::AVX2;
+		if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+#endif
+		return SimdLevel::Scalar;
+	}
+
+	const ScanKernels& scanKernels(SimdLevel level) {
+		static const SimdLevel supported = detectSimdLevel();
+		if (level > supported) {
+			level = supported;
+		}
+
+#ifdef OBJ_SIMD_X86
+		switch (level) {
+		case SimdLevel::AVX2:
+			return avx2Kernels;
+		case SimdLevel::SSE2:
+			return sse2Kernels;
+		default:
+			break;
+		}
+#endif
+		return scalarKernels;
+	}
+
+	const ScanKernels& bestScanKernels() {
+		return scanKernels(SimdLevel::AVX2);
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef OBJ_SCANNER_H
+#define OBJ_SCANNER_H
+
+// Byte scanning and number conversion kernels used by the OBJ parser.
+// There is one kernel table per instruction set; the best one the CPU supports is picked at runtime.
+namespace obj
+{
+	enum class SimdLevel
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	struct ScanKernels
+	{
+		SimdLevel level;
+		const char* name;
+
+		// Returns the first '\n' in [p, end), or end.
+		const char* (*findNewline)(const char* p, const char* end);
+
+		// Reads `count` whitespace separated floats from [p, end). Values that are missing or malformed are set to 0.
+		// Returns the position after the last number read.
+		const char* (*parseFloats)(const char* p, const char* end, float* values, int count);
+		// Reads up to `maxCount` face vertices from [p, end), keeping only the position index of each "v/t/n" token.
+		// Indices are returned exactly as written in the file (one based, or negative for relative indices).
+		int (*parseFaceIndices)(const char*& p, const char* end, long long* indices, int maxCount);
+		// Same as parseFaceIndices, but keeps all of "v/t/n": three values per face vertex, 0 where an index is missing.
+		int (*parseFaceCorners)(const char*& p, const char* end, long long* corners, int maxCount);
+	};
+
+	SimdLevel detectSimdLevel();
+
+	// Kernels for the requested level, or for the best supported level below it.
+	const ScanKernels& scanKernels(SimdLevel level);
+	// Kernels for the best level this CPU supports. Detection only runs once.
+	const ScanKernels& bestScanKernels();
+}
+
+#endif
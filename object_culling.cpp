@@ -0,0 +1,325 @@
+#include "object_culling.h"
+#include "frustum.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// SSE2 is always there on x64; AVX is not, so its kernel is compiled for it on its own and only run where the CPU says
+// so (see obj::detectSimdLevel).
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CULLING_SIMD
+#include <immintrin.h>
+#endif
+
+// MSVC lets any function use any intrinsic, GCC and Clang need to be told per function.
+#if defined(CULLING_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define CULLING_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CULLING_TARGET(isa)
+#endif
+
+namespace {
+
+// Objects per culling job, a multiple of the widest kernel. Smaller sets are culled on the calling thread alone.
+const size_t cullBlockSize = 16384;
+
+const size_t padding = 8;
+
+struct CullPlanes
+{
+	float normal[6][3];
+	float absNormal[6][3];
+	float distance[6];
+};
+
+struct CullInput
+{
+	const float* centerX;
+	const float* centerY;
+	const float* centerZ;
+	const float* extentX;
+	const float* extentY;
+	const float* extentZ;
+	const float* radius;
+	size_t count; // Lanes past this are padding
+};
+
+// Culls objects [begin, end), begin a multiple of eight, and writes the visible ones to out. Returns how many there were.
+// Every kernel writes a whole lane group to out before knowing which lanes count, so out needs room for end - begin.
+typedef size_t (*CullKernel)(const CullPlanes& planes, const CullInput& input, size_t begin, size_t end, uint32_t* out);
+
+// The box's extent along the plane's normal is dot(|normal|, extents). Whichever of the box and the sphere reaches less
+// far decides, since the object is inside both.
+size_t scalarCull(const CullPlanes& planes, const CullInput& input, size_t begin, size_t end, uint32_t* out) {
+	size_t visible = 0;
+	for (size_t i = begin; i < std::min(end, input.count); i++) {
+		bool inside = true;
+		for (int p = 0; p < 6; p++) {
+			float distance = planes.normal[p][0] * input.centerX[i] + planes.normal[p][1] * input.centerY[i]
+				+ planes.normal[p][2] * input.centerZ[i] + planes.distance[p];
+			float reach = std::min(input.radius[i], planes.absNormal[p][0] * input.extentX[i] + planes.absNormal[p][1] * input.extentY[i]
+				+ planes.absNormal[p][2] * input.extentZ[i]);
+			inside &= !(distance < -reach);
+		}
+		out[visible] = static_cast<uint32_t>(i);
+		visible += inside ? 1 : 0;
+	}
+	return visible;
+}
+
+// Lanes of bits that are set, in order, without a branch per lane.
+inline size_t compact(unsigned int bits, unsigned int lanes, size_t first, uint32_t* out) {
+	size_t written = 0;
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		out[written] = static_cast<uint32_t>(first + lane);
+		written += (bits >> lane) & 1;
+	}
+	return written;
+}
+
+inline unsigned int validLanes(const CullInput& input, size_t first, unsigned int lanes) {
+	size_t remaining = input.count - std::min(input.count, first);
+	return remaining >= lanes ? (1u << lanes) - 1 : (1u << remaining) - 1;
+}
+
+#ifdef CULLING_SIMD
+// Four objects at once, the exact same operations as scalarCull().
+size_t sse2Cull(const CullPlanes& planes, const CullInput& input, size_t begin, size_t end, uint32_t* out) {
+	size_t visible = 0;
+	for (size_t i = begin; i < end; i += 4) {
+		__m128 x = _mm_loadu_ps(input.centerX + i);
+		__m128 y = _mm_loadu_ps(input.centerY + i);
+		__m128 z = _mm_loadu_ps(input.centerZ + i);
+		__m128 ex = _mm_loadu_ps(input.extentX + i);
+		__m128 ey = _mm_loadu_ps(input.extentY + i);
+		__m128 ez = _mm_loadu_ps(input.extentZ + i);
+		__m128 radius = _mm_loadu_ps(input.radius + i);
+
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.normal[p][0]), x),
+				_mm_mul_ps(_mm_set1_ps(planes.normal[p][1]), y)), _mm_mul_ps(_mm_set1_ps(planes.normal[p][2]), z)), _mm_set1_ps(planes.distance[p]));
+			__m128 reach = _mm_min_ps(radius, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.absNormal[p][0]), ex),
+				_mm_mul_ps(_mm_set1_ps(planes.absNormal[p][1]), ey)), _mm_mul_ps(_mm_set1_ps(planes.absNormal[p][2]), ez)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), reach)));
+		}
+
+		unsigned int bits = ~static_cast<unsigned int>(_mm_movemask_ps(outside)) & validLanes(input, i, 4);
+		visible += compact(bits, 4, i, out + visible);
+	}
+	return visible;
+}
+
+// Eight objects at once, the same again.
+CULLING_TARGET("avx")
+size_t avxCull(const CullPlanes& planes, const CullInput& input, size_t begin, size_t end, uint32_t* out) {
+	size_t visible = 0;
+	for (size_t i = begin; i < end; i += 8) {
+		__m256 x = _mm256_loadu_ps(input.centerX + i);
+		__m256 y = _mm256_loadu_ps(input.centerY + i);
+		__m256 z = _mm256_loadu_ps(input.centerZ + i);
+		__m256 ex = _mm256_loadu_ps(input.extentX + i);
+		__m256 ey = _mm256_loadu_ps(input.extentY + i);
+		__m256 ez = _mm256_loadu_ps(input.extentZ + i);
+		__m256 radius = _mm256_loadu_ps(input.radius + i);
+
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.normal[p][0]), x),
+				_mm256_mul_ps(_mm256_set1_ps(planes.normal[p][1]), y)), _mm256_mul_ps(_mm256_set1_ps(planes.normal[p][2]), z)),
+				_mm256_set1_ps(planes.distance[p]));
+			__m256 reach = _mm256_min_ps(radius, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.absNormal[p][0]), ex),
+				_mm256_mul_ps(_mm256_set1_ps(planes.absNormal[p][1]), ey)), _mm256_mul_ps(_mm256_set1_ps(planes.absNormal[p][2]), ez)));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_sub_ps(_mm256_setzero_ps(), reach), _CMP_LT_OQ));
+		}
+
+		unsigned int bits = ~static_cast<unsigned int>(_mm256_movemask_ps(outside)) & validLanes(input, i, 8);
+		visible += compact(bits, 8, i, out + visible);
+	}
+	return visible;
+}
+#endif
+
+struct KernelChoice
+{
+	CullKernel kernel;
+	const char* name;
+};
+
+KernelChoice pickKernel(obj::SimdLevel maxLevel) {
+	static const obj::SimdLevel supported = obj::detectSimdLevel();
+	obj::SimdLevel level = std::min(maxLevel, supported);
+#ifdef CULLING_SIMD
+	// The parser's AVX2 level implies AVX, which is all this needs.
+	if (level == obj::SimdLevel::AVX2) {
+		return { avxCull, "AVX" };
+	}
+	if (level == obj::SimdLevel::SSE2) {
+		return { sse2Cull, "SSE2" };
+	}
+#else
+	(void)level;
+#endif
+	return { scalarCull, "Scalar" };
+}
+
+}
+
+ObjectBounds ObjectBounds::transform(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float radius, const glm::mat4& model) {
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extents = (boundsMax - boundsMin) * 0.5f;
+
+	ObjectBounds bounds;
+	bounds.center = glm::vec3(model * glm::vec4(center, 1.0f));
+	float scale = 0.0f;
+	for (int row = 0; row < 3; row++) {
+		bounds.extents[row] = std::abs(model[0][row]) * extents.x + std::abs(model[1][row]) * extents.y + std::abs(model[2][row]) * extents.z;
+	}
+	for (int column = 0; column < 3; column++) {
+		scale = std::max(scale, glm::length(glm::vec3(model[column])));
+	}
+	bounds.radius = radius * scale;
+	return bounds;
+}
+
+void ObjectCuller::clear() {
+	count = 0;
+	for (std::vector<float>* values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius }) {
+		values->clear();
+	}
+}
+
+void ObjectCuller::reserve(size_t objects) {
+	for (std::vector<float>* values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius }) {
+		values->reserve(objects + padding);
+	}
+}
+
+uint32_t ObjectCuller::add(const ObjectBounds& bounds) {
+	uint32_t object = static_cast<uint32_t>(count++);
+	// Padding lanes are zero sized objects at the origin, the kernels mask them out.
+	size_t padded = (count + padding - 1) / padding * padding;
+	for (std::vector<float>* values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius }) {
+		values->resize(padded, 0.0f);
+	}
+	set(object, bounds);
+	return object;
+}
+
+void ObjectCuller::set(uint32_t object, const ObjectBounds& bounds) {
+	centerX[object] = bounds.center.x;
+	centerY[object] = bounds.center.y;
+	centerZ[object] = bounds.center.z;
+	extentX[object] = bounds.extents.x;
+	extentY[object] = bounds.extents.y;
+	extentZ[object] = bounds.extents.z;
+	radius[object] = bounds.radius;
+}
+
+size_t ObjectCuller::bytes() const {
+	return centerX.capacity() * sizeof(float) * 7;
+}
+
+ObjectCullStats ObjectCuller::cull(const glm::mat4& projection, const glm::mat4& view, std::vector<uint32_t>& visible, obj::SimdLevel maxLevel) const {
+	auto start = std::chrono::steady_clock::now();
+	KernelChoice choice = pickKernel(maxLevel);
+	ObjectCullStats stats;
+	stats.objects = count;
+	stats.kernel = choice.name;
+
+	CullPlanes planes;
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+	for (int p = 0; p < 6; p++) {
+		for (int k = 0; k < 3; k++) {
+			planes.normal[p][k] = frustum.planes[p][k];
+			planes.absNormal[p][k] = std::abs(frustum.planes[p][k]);
+		}
+		planes.distance[p] = frustum.planes[p].w;
+	}
+	CullInput input = { centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data(), radius.data(), count };
+
+	// Each block writes its visible objects to the start of its own part of visible, then the parts are moved together.
+	size_t padded = centerX.size();
+	visible.resize(padded);
+	size_t blocks = (padded + cullBlockSize - 1) / cullBlockSize;
+	std::vector<size_t> blockVisible(blocks);
+	auto cullBlock = [&](size_t block) {
+		size_t begin = block * cullBlockSize;
+		blockVisible[block] = choice.kernel(planes, input, begin, std::min(padded, begin + cullBlockSize), visible.data() + begin);
+	};
+	if (blocks > 1) {
+		ThreadPool::global().parallelFor(blocks, cullBlock);
+	}
+	else if (blocks == 1) {
+		cullBlock(0);
+	}
+
+	size_t total = 0;
+	for (size_t block = 0; block < blocks; block++) {
+		// total never passes begin. Equal means every block so far was fully visible, and the part is already in place;
+		// std::copy must not be given a destination inside its source.
+		size_t begin = block * cullBlockSize;
+		if (total != begin) {
+			std::copy(visible.begin() + begin, visible.begin() + begin + blockVisible[block], visible.begin() + total);
+		}
+		total += blockVisible[block];
+	}
+	visible.resize(total);
+	stats.visible = total;
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+void benchmarkObjectCulling(const glm::mat4& projection, const glm::mat4& view) {
+	// Objects fill a cube around the camera that reaches past the far plane, so some of every kind of case shows up:
+	// inside, outside and straddling planes.
+	glm::vec3 camera = glm::vec3(glm::inverse(view)[3]);
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<float> position(-120.0f, 120.0f);
+	std::uniform_real_distribution<float> size(0.05f, 2.0f);
+	std::uniform_real_distribution<float> roundness(0.6f, 1.0f);
+
+	obj::SimdLevel supported = obj::detectSimdLevel();
+	for (size_t objects : { size_t(10000), size_t(100000), size_t(1000000) }) {
+		ObjectCuller culler;
+		culler.reserve(objects);
+		for (size_t i = 0; i < objects; i++) {
+			ObjectBounds bounds;
+			bounds.center = camera + glm::vec3(position(random), position(random), position(random));
+			bounds.extents = glm::vec3(size(random), size(random), size(random));
+			bounds.radius = glm::length(bounds.extents) * roundness(random);
+			culler.add(bounds);
+		}
+
+		// About 20 million object tests per kernel, so small sets are not timed off a handful of runs.
+		unsigned int runs = static_cast<unsigned int>(std::max<size_t>(3, 20000000 / objects));
+		std::vector<uint32_t> reference;
+		std::vector<uint32_t> visible;
+		for (obj::SimdLevel level : { obj::SimdLevel::Scalar, obj::SimdLevel::SSE2, obj::SimdLevel::AVX2 }) {
+			if (level > supported) {
+				break;
+			}
+			ObjectCullStats stats = culler.cull(projection, view, visible, level); // Warm up
+			double total = 0.0;
+			double best = stats.milliseconds;
+			for (unsigned int run = 0; run < runs; run++) {
+				stats = culler.cull(projection, view, visible, level);
+				total += stats.milliseconds;
+				best = std::min(best, stats.milliseconds);
+			}
+			if (level == obj::SimdLevel::Scalar) {
+				reference = visible;
+			}
+			else if (visible != reference) {
+				std::cerr << "ERROR::CULLING::KERNELS_DISAGREE" << std::endl;
+			}
+			std::cout << "Culled " << objects << " objects (" << stats.kernel << "): " << stats.visible << " visible, " << total / runs
+				<< " ms average, " << best << " ms best (" << best * 1e6 / objects << " ns per object)" << std::endl;
+		}
+	}
+}
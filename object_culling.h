@@ -0,0 +1,66 @@
+#ifndef OBJECT_CULLING_H
+#define OBJECT_CULLING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "obj_scanner.h"
+
+// World space bounds of one object: an axis aligned box, as its center and half extents, and a sphere around the same
+// center. An object is culled if either of the two is fully outside one of the frustum's planes.
+struct ObjectBounds
+{
+	glm::vec3 center;
+	glm::vec3 extents;
+	float radius;
+
+	// Local bounds (see Bounds in bounds.h) moved by a model matrix. The box is refit around the transformed one, the
+	// radius grows by the largest scale of the matrix.
+	static ObjectBounds transform(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float radius, const glm::mat4& model);
+};
+
+struct ObjectCullStats
+{
+	size_t objects = 0;
+	size_t visible = 0;
+	const char* kernel = ""; // Which of the scalar, SSE2 and AVX paths ran
+	double milliseconds = 0.0;
+};
+
+// Frustum culling of many objects at once. The bounds are kept in structure of arrays form and tested eight at a time
+// with AVX where the CPU has it (four with SSE2 otherwise), with big sets split over the global thread pool.
+class ObjectCuller
+{
+public:
+	void clear();
+	void reserve(size_t objects);
+
+	// Returns the object's index, which is what cull() reports it as.
+	uint32_t add(const ObjectBounds& bounds);
+	void set(uint32_t object, const ObjectBounds& bounds);
+
+	size_t size() const { return count; }
+	size_t bytes() const;
+
+	// Writes the indices of the objects at least partly inside the frustum of projection * view to visible, in order.
+	// maxLevel caps the instruction set, for comparing the kernels.
+	ObjectCullStats cull(const glm::mat4& projection, const glm::mat4& view, std::vector<uint32_t>& visible,
+		obj::SimdLevel maxLevel = obj::SimdLevel::AVX2) const;
+
+private:
+	size_t count = 0;
+
+	// Padded to a multiple of eight.
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+};
+
+// Culls 10k, 100k and 1M random objects scattered around the camera with every kernel the CPU supports, checks they
+// agree and prints the timings.
+void benchmarkObjectCulling(const glm::mat4& projection, const glm::mat4& view);
+
+#endif
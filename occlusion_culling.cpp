@@ -0,0 +1,337 @@
+#include "occlusion_culling.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Same as the meshlet culler: SSE2 is always there on x64.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Occluder triangles per setup job.
+const size_t setupBlockTriangles = 1024;
+
+// Rows per rasterizer job. Every band goes over every triangle's bounds, but there are only a few thousand of those.
+const unsigned int bandHeight = 16;
+
+// Triangles reaching further off screen than this are dropped rather than rasterized with edge functions that have
+// run out of float precision. Dropping occluder triangles only ever lets more through.
+const float guardBand = 8192.0f;
+
+// Boxes are tested on the pyramid level where they cover at most this many texels across.
+const unsigned int testTexels = 4;
+
+struct ScreenTriangle
+{
+	float x[3], y[3], z[3]; // Pixels, y up, and depth in [0, 1]
+};
+
+struct SetupJob
+{
+	size_t occluder;
+	size_t first, end;
+};
+
+// Clip space to pixels and depth. Triangles that are back facing, cross the near plane or leave the guard band are
+// dropped: near plane clipping would add triangles for little gain, since an occluder that close covers the screen.
+bool setupTriangle(const glm::vec4 clip[3], ScreenTriangle& triangle) {
+	for (int k = 0; k < 3; k++) {
+		if (!(clip[k].z >= -clip[k].w) || !(clip[k].w > 0.0f)) {
+			return false;
+		}
+		float inverseW = 1.0f / clip[k].w;
+		triangle.x[k] = (clip[k].x * inverseW * 0.5f + 0.5f) * occlusionWidth;
+		triangle.y[k] = (clip[k].y * inverseW * 0.5f + 0.5f) * occlusionHeight;
+		triangle.z[k] = clip[k].z * inverseW * 0.5f + 0.5f;
+		if (!(std::abs(triangle.x[k]) < guardBand) || !(std::abs(triangle.y[k]) < guardBand)) {
+			return false;
+		}
+	}
+	// Front faces wind counter clockwise, like GL's default.
+	float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+	return area > 0.0f;
+}
+
+// Rasterizes the rows [bandBegin, bandEnd) of triangle into depth, keeping the nearest depth per pixel. A pixel is
+// covered if its center is inside or on an edge.
+void rasterizeTriangle(const ScreenTriangle& t, unsigned int bandBegin, unsigned int bandEnd, float* depth) {
+	float minX = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+	float maxX = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+	float minY = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+	float maxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+	// Pixel centers are at +0.5, so pixel i can only be covered if the bounds reach i + 0.5.
+	int x0 = std::max(0, static_cast<int>(std::ceil(minX - 0.5f)));
+	int x1 = std::min(static_cast<int>(occlusionWidth) - 1, static_cast<int>(std::floor(maxX - 0.5f)));
+	int y0 = std::max(static_cast<int>(bandBegin), static_cast<int>(std::ceil(minY - 0.5f)));
+	int y1 = std::min(static_cast<int>(bandEnd) - 1, static_cast<int>(std::floor(maxY - 0.5f)));
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+	// Whole groups of four, occlusionWidth is a multiple of four so the last group never leaves the row.
+	x0 &= ~3;
+
+	// Edge k runs from corner k to corner k + 1 and is >= 0 on the inside. Stepping one pixel right subtracts stepX,
+	// one row up adds stepY.
+	float stepX[3], stepY[3], edgeStart[3];
+	float startX = x0 + 0.5f;
+	float startY = y0 + 0.5f;
+	for (int k = 0; k < 3; k++) {
+		int next = (k + 1) % 3;
+		stepX[k] = t.y[next] - t.y[k];
+		stepY[k] = t.x[next] - t.x[k];
+		edgeStart[k] = stepY[k] * (startY - t.y[k]) - stepX[k] * (startX - t.x[k]);
+	}
+
+	// Depth is linear in screen space after the divide, so it is a plane over the pixels.
+	float area = stepY[0] * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * stepX[0];
+	float dzdx = ((t.z[1] - t.z[0]) * (t.y[2] - t.y[0]) - (t.z[2] - t.z[0]) * (t.y[1] - t.y[0])) / area;
+	float dzdy = ((t.z[2] - t.z[0]) * (t.x[1] - t.x[0]) - (t.z[1] - t.z[0]) * (t.x[2] - t.x[0])) / area;
+	float zStart = t.z[0] + dzdx * (startX - t.x[0]) + dzdy * (startY - t.y[0]);
+
+	for (int y = y0; y <= y1; y++) {
+		float rowOffset = static_cast<float>(y - y0);
+		float e0 = edgeStart[0] + stepY[0] * rowOffset;
+		float e1 = edgeStart[1] + stepY[1] * rowOffset;
+		float e2 = edgeStart[2] + stepY[2] * rowOffset;
+		float z = zStart + dzdy * rowOffset;
+		float* row = depth + static_cast<size_t>(y) * occlusionWidth;
+		int x = x0;
+#ifdef OCCLUSION_SSE2
+		const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		__m128 edge0 = _mm_sub_ps(_mm_set1_ps(e0), _mm_mul_ps(_mm_set1_ps(stepX[0]), lanes));
+		__m128 edge1 = _mm_sub_ps(_mm_set1_ps(e1), _mm_mul_ps(_mm_set1_ps(stepX[1]), lanes));
+		__m128 edge2 = _mm_sub_ps(_mm_set1_ps(e2), _mm_mul_ps(_mm_set1_ps(stepX[2]), lanes));
+		__m128 depths = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(dzdx), lanes));
+		const __m128 edgeStep0 = _mm_set1_ps(stepX[0] * 4.0f);
+		const __m128 edgeStep1 = _mm_set1_ps(stepX[1] * 4.0f);
+		const __m128 edgeStep2 = _mm_set1_ps(stepX[2] * 4.0f);
+		const __m128 depthStep = _mm_set1_ps(dzdx * 4.0f);
+		const __m128 zero = _mm_setzero_ps();
+		for (; x <= x1; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+			if (_mm_movemask_ps(inside) != 0) {
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(old, depths);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+			edge0 = _mm_sub_ps(edge0, edgeStep0);
+			edge1 = _mm_sub_ps(edge1, edgeStep1);
+			edge2 = _mm_sub_ps(edge2, edgeStep2);
+			depths = _mm_add_ps(depths, depthStep);
+		}
+#else
+		for (; x <= x1; x++) {
+			float offset = static_cast<float>(x - x0);
+			if (e0 - stepX[0] * offset >= 0.0f && e1 - stepX[1] * offset >= 0.0f && e2 - stepX[2] * offset >= 0.0f) {
+				row[x] = std::min(row[x], z + dzdx * offset);
+			}
+		}
+#endif
+	}
+}
+
+}
+
+OcclusionCuller::OcclusionCuller() : hasWork(false), busy(false), stopping(false) {
+	unsigned int width = occlusionWidth;
+	unsigned int height = occlusionHeight;
+	while (true) {
+		levelWidths.push_back(width);
+		levelHeights.push_back(height);
+		levels.push_back(std::vector<float>(static_cast<size_t>(width) * height, 1.0f));
+		if (width == 1 && height == 1) {
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	worker = std::thread(&OcclusionCuller::workerLoop, this);
+}
+
+OcclusionCuller::~OcclusionCuller() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_one();
+	worker.join();
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection, std::vector<Occluder> occluders) {
+	finish();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->viewProjection = viewProjection;
+		this->occluders = std::move(occluders);
+		frameStats = OcclusionStats();
+		frameStats.occluders = this->occluders.size();
+		for (const Occluder& occluder : this->occluders) {
+			frameStats.occluderTriangles += occluder.triangleCount;
+		}
+		hasWork = true;
+		busy = true;
+	}
+	workReady.notify_one();
+}
+
+void OcclusionCuller::finish() {
+	auto start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [&] { return !busy; });
+	frameStats.waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionCuller::workerLoop() {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [&] { return stopping || hasWork; });
+			if (stopping) {
+				return;
+			}
+			hasWork = false;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		rasterize();
+		buildPyramid();
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			frameStats.rasterMilliseconds = milliseconds;
+			occluders.clear();
+			busy = false;
+		}
+		workDone.notify_all();
+	}
+}
+
+void OcclusionCuller::rasterize() {
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+
+	std::vector<SetupJob> jobs;
+	for (size_t o = 0; o < occluders.size(); o++) {
+		for (size_t first = 0; first < occluders[o].triangleCount; first += setupBlockTriangles) {
+			jobs.push_back({ o, first, std::min(occluders[o].triangleCount, first + setupBlockTriangles) });
+		}
+	}
+
+	ThreadPool& pool = ThreadPool::global();
+	std::vector<std::vector<ScreenTriangle>> triangles(jobs.size());
+	pool.parallelFor(jobs.size(), [&](size_t j) {
+		const SetupJob& job = jobs[j];
+		const Occluder& occluder = occluders[job.occluder];
+		glm::mat4 toClip = viewProjection * occluder.model;
+		triangles[j].reserve(job.end - job.first);
+		for (size_t t = job.first; t < job.end; t++) {
+			glm::vec4 clip[3];
+			for (int k = 0; k < 3; k++) {
+				clip[k] = toClip * glm::vec4(occluder.vertices[occluder.indices[t * 3 + k]], 1.0f);
+			}
+			ScreenTriangle triangle;
+			if (setupTriangle(clip, triangle)) {
+				triangles[j].push_back(triangle);
+			}
+		}
+	});
+	for (const std::vector<ScreenTriangle>& part : triangles) {
+		frameStats.rasterizedTriangles += part.size();
+	}
+
+	// Bands own their rows outright, so they need no locking. Triangles keep their order within a band, not that the
+	// nearest depth cares.
+	unsigned int bands = (occlusionHeight + bandHeight - 1) / bandHeight;
+	float* depth = levels[0].data();
+	pool.parallelFor(bands, [&](size_t band) {
+		unsigned int bandBegin = static_cast<unsigned int>(band) * bandHeight;
+		unsigned int bandEnd = std::min(occlusionHeight, bandBegin + bandHeight);
+		for (const std::vector<ScreenTriangle>& part : triangles) {
+			for (const ScreenTriangle& triangle : part) {
+				rasterizeTriangle(triangle, bandBegin, bandEnd, depth);
+			}
+		}
+	});
+}
+
+void OcclusionCuller::buildPyramid() {
+	for (size_t level = 1; level < levels.size(); level++) {
+		const std::vector<float>& source = levels[level - 1];
+		unsigned int sourceWidth = levelWidths[level - 1];
+		unsigned int sourceHeight = levelHeights[level - 1];
+		std::vector<float>& target = levels[level];
+		for (unsigned int y = 0; y < levelHeights[level]; y++) {
+			// Odd sizes repeat their last row or column, which changes nothing for a max.
+			unsigned int row0 = std::min(2 * y, sourceHeight - 1) * sourceWidth;
+			unsigned int row1 = std::min(2 * y + 1, sourceHeight - 1) * sourceWidth;
+			for (unsigned int x = 0; x < levelWidths[level]; x++) {
+				unsigned int column0 = std::min(2 * x, sourceWidth - 1);
+				unsigned int column1 = std::min(2 * x + 1, sourceWidth - 1);
+				target[static_cast<size_t>(y) * levelWidths[level] + x] = std::max(std::max(source[row0 + column0], source[row0 + column1]),
+					std::max(source[row1 + column0], source[row1 + column1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::isVisible(const ObjectBounds& bounds) {
+	auto start = std::chrono::steady_clock::now();
+	frameStats.tested++;
+
+	// Screen rectangle and nearest depth of the box's corners.
+	float minX = guardBand, maxX = -guardBand, minY = guardBand, maxY = -guardBand;
+	float nearest = 1.0f;
+	bool visible = false;
+	for (int corner = 0; corner < 8 && !visible; corner++) {
+		glm::vec3 sign((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+		glm::vec4 clip = viewProjection * glm::vec4(bounds.center + sign * bounds.extents, 1.0f);
+		if (!(clip.z >= -clip.w) || !(clip.w > 0.0f)) {
+			visible = true;
+			break;
+		}
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * occlusionWidth;
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * occlusionHeight;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+	}
+
+	if (!visible) {
+		// Pixels whose area the rectangle touches, not just their centers, the depth buffer only knows the centers.
+		int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+		int x1 = std::min(static_cast<int>(occlusionWidth) - 1, static_cast<int>(std::floor(maxX)));
+		int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+		int y1 = std::min(static_cast<int>(occlusionHeight) - 1, static_cast<int>(std::floor(maxY)));
+		if (x0 > x1 || y0 > y1) {
+			visible = true; // Off screen, which is for the frustum culler to decide
+		}
+		else {
+			size_t level = 0;
+			unsigned int size = static_cast<unsigned int>(std::max(x1 - x0, y1 - y0)) + 1;
+			while (size > testTexels && level + 1 < levels.size()) {
+				size = (size + 1) / 2 + 1;
+				level++;
+			}
+			float farthest = 0.0f;
+			const std::vector<float>& texels = levels[level];
+			for (int y = y0 >> level; y <= (y1 >> level); y++) {
+				for (int x = x0 >> level; x <= (x1 >> level); x++) {
+					farthest = std::max(farthest, texels[static_cast<size_t>(y) * levelWidths[level] + x]);
+				}
+			}
+			visible = nearest <= farthest;
+		}
+	}
+
+	frameStats.occluded += visible ? 0 : 1;
+	frameStats.testMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return visible;
+}
@@ -0,0 +1,95 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "object_culling.h"
+
+// Size of the software depth buffer. It only has to be good enough to tell big occluders apart, and matches the
+// window's 16:9 so pixels stay square.
+const unsigned int occlusionWidth = 256;
+const unsigned int occlusionHeight = 144;
+
+// Triangles of one occluder, usually a coarse LOD of a model. The arrays are not copied, they have to stay alive and
+// unchanged until OcclusionCuller::finish() returns.
+struct Occluder
+{
+	const glm::vec3* vertices;
+	const unsigned int* indices;
+	size_t triangleCount;
+	glm::mat4 model;
+};
+
+struct OcclusionStats
+{
+	size_t occluders = 0;
+	size_t occluderTriangles = 0;
+	size_t rasterizedTriangles = 0; // After dropping back facing ones and those through the near plane
+	size_t tested = 0;
+	size_t occluded = 0;
+	double rasterMilliseconds = 0.0; // Setup, rasterization and the pyramid, on the culler's thread
+	double waitMilliseconds = 0.0;   // How long finish() blocked, so how much of the above was not hidden
+	double testMilliseconds = 0.0;
+};
+
+// Software occlusion culling: a handful of occluders are rasterized into a small depth buffer on the CPU, a Hi-Z pyramid
+// of farthest depths is built from it, and object bounds are tested against the pyramid before their draw calls go out.
+// begin() hands the work to the culler's own thread, which spreads it over the global thread pool, so the frame can go on
+// with whatever CPU work it has left (and the GPU with the previous frame) until finish() is called. Rows are split into
+// bands that are rasterized in parallel, each pixel row four pixels at a time with SSE2.
+class OcclusionCuller
+{
+public:
+	OcclusionCuller();
+	~OcclusionCuller();
+
+	OcclusionCuller(const OcclusionCuller&) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+	// Starts rasterizing occluders as seen through viewProjection. Calls finish() first if the last frame's work is
+	// still running.
+	void begin(const glm::mat4& viewProjection, std::vector<Occluder> occluders);
+
+	// Waits for the rasterizer. Tests and depth() are only valid after this.
+	void finish();
+
+	// True if any part of bounds (world space, see ObjectBounds) might be in front of the occluders. Boxes reaching
+	// through the near plane or out of the screen always are.
+	bool isVisible(const ObjectBounds& bounds);
+
+	// Stats since the last begin().
+	const OcclusionStats& stats() const { return frameStats; }
+
+	// The full resolution depth buffer, rows bottom up, 0 at the near plane and 1 at the far one or where no occluder is.
+	const std::vector<float>& depth() const { return levels[0]; }
+
+private:
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+	bool hasWork;
+	bool busy;
+	bool stopping;
+
+	glm::mat4 viewProjection;
+	std::vector<Occluder> occluders;
+	OcclusionStats frameStats;
+
+	// Hi-Z pyramid, levels[0] is the depth buffer and each level after it holds the farthest depth of 2x2 of the last.
+	std::vector<std::vector<float>> levels;
+	std::vector<unsigned int> levelWidths, levelHeights;
+
+	void workerLoop();
+	void rasterize();
+	void buildPyramid();
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "program_cache.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// From GL 4.1 / ARB_get_program_binary and KHR_parallel_shader_compile, which the 3.3 loader has no names for.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+
+const char magic[4] = { 'M', 'V', 'P', 'B' };
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+struct Driver
+{
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+	bool binaries = false;
+	bool parallel = false;
+	std::string strings; // Vendor, renderer and version
+};
+
+Driver driver;
+
+bool hasExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+		if (extension && std::strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string driverString(GLenum name) {
+	const char* value = reinterpret_cast<const char*>(glGetString(name));
+	return value ? value : "";
+}
+
+}
+
+namespace programcache
+{
+	void init(GLADloadproc load) {
+		driver = Driver();
+		driver.strings = driverString(GL_VENDOR) + '\n' + driverString(GL_RENDERER) + '\n' + driverString(GL_VERSION);
+
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 1) || hasExtension("GL_ARB_get_program_binary")) {
+			driver.getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+			driver.programBinary = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+			driver.programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+			// A driver can offer the calls and no format to save in.
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			driver.binaries = driver.getProgramBinary && driver.programBinary && driver.programParameteri && formats > 0;
+		}
+
+		MaxShaderCompilerThreadsProc maxThreads = nullptr;
+		if (hasExtension("GL_KHR_parallel_shader_compile")) {
+			maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+		}
+		else if (hasExtension("GL_ARB_parallel_shader_compile")) {
+			maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+		}
+		if (maxThreads) {
+			// All ones lets the driver pick how many.
+			maxThreads(0xFFFFFFFFu);
+			driver.parallel = true;
+		}
+	}
+
+	bool binariesSupported() {
+		return driver.binaries;
+	}
+
+	bool parallelCompileSupported() {
+		return driver.parallel;
+	}
+
+	uint64_t programKey(const std::string& vertexSource, const std::string& fragmentSource) {
+		// Zero bytes cannot be in GLSL, so no two different triples join into the same bytes.
+		std::string key = driver.strings;
+		key += '\0';
+		key += vertexSource;
+		key += '\0';
+		key += fragmentSource;
+		return contentHash(key.data(), key.size());
+	}
+
+	std::string sidecarPath(const std::string& fragmentPath, const std::string& variant) {
+		return variant.empty() ? fragmentPath + ".mvprogram" : fragmentPath + "." + variant + ".mvprogram";
+	}
+
+	void prepare(GLuint program) {
+		if (driver.binaries) {
+			driver.programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	bool load(const std::string& path, uint64_t key, GLuint program) {
+		if (!driver.binaries) {
+			return false;
+		}
+		MappedFile file;
+		if (!file.open(path) || file.size() < sizeof(Header)) {
+			return false;
+		}
+		const Header* header = reinterpret_cast<const Header*>(file.data());
+		bool valid = std::memcmp(header->magic, magic, sizeof(magic)) == 0
+			&& header->version == formatVersion
+			&& header->key == key
+			&& file.size() == sizeof(Header) + header->binaryLength;
+		if (!valid) {
+			return false;
+		}
+
+		driver.programBinary(program, header->binaryFormat, file.data() + sizeof(Header), static_cast<GLsizei>(header->binaryLength));
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		return success != 0;
+	}
+
+	bool store(const std::string& path, uint64_t key, GLuint program) {
+		if (!driver.binaries) {
+			return false;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			return false;
+		}
+		std::vector<char> binary(length);
+		GLsizei written = 0;
+		GLenum binaryFormat = 0;
+		driver.getProgramBinary(program, length, &written, &binaryFormat, binary.data());
+		if (written <= 0) {
+			return false;
+		}
+
+		Header header;
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = formatVersion;
+		header.key = key;
+		header.binaryFormat = binaryFormat;
+		header.binaryLength = static_cast<uint32_t>(written);
+
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out.is_open()) {
+				return false;
+			}
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(binary.data(), written);
+			if (!out) {
+				out.close();
+				std::remove(tempPath.c_str());
+				return false;
+			}
+		}
+
+		// rename() will not replace an existing file on Windows.
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+
+	bool completed(GLuint program) {
+		if (!driver.parallel) {
+			return true;
+		}
+		GLint done = 0;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+		return done != 0;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+
+// Linked programs saved with glGetProgramBinary next to their fragment shader ("lit.glsl" -> "lit.glsl.mvprogram"),
+// so later startups skip compiling and linking. A binary is only used if its format version and key still match, the
+// key being a hash of both sources and of the driver's vendor, renderer and version strings. Drivers may still reject
+// a binary (after an update that kept the strings, say), which just counts as a miss.
+//
+// Program binaries are core in GL 4.1 and parallel compiles an extension, neither is in the 3.3 loader, so their
+// entry points are looked up here. Without them everything below does nothing and programs compile the usual way.
+namespace programcache
+{
+	// Bump whenever the header changes.
+	const uint32_t formatVersion = 1;
+
+	struct Header
+	{
+		char magic[4]; // "MVPB"
+		uint32_t version;
+		uint64_t key;
+		uint32_t binaryFormat;
+		uint32_t binaryLength; // The binary follows the header
+	};
+
+	// Looks up the entry points and the driver strings with the same loader glad was given. Needs the context current.
+	void init(GLADloadproc load);
+
+	bool binariesSupported();
+	// GL_KHR_parallel_shader_compile (or the ARB version): compiles and links run on the driver's threads and can be
+	// polled for with completed().
+	bool parallelCompileSupported();
+
+	uint64_t programKey(const std::string& vertexSource, const std::string& fragmentSource);
+
+	// Programs built differently from the same fragment shader get their own file ("lit.glsl.variant.mvprogram").
+	std::string sidecarPath(const std::string& fragmentPath, const std::string& variant = "");
+
+	// Has to be called on a program before it links for its binary to be retrievable afterwards.
+	void prepare(GLuint program);
+
+	// Loads the program from the binary at path. False if there is none, it is stale or the driver rejects it; the
+	// program then has to be compiled and linked as usual.
+	bool load(const std::string& path, uint64_t key, GLuint program);
+
+	// Saves a linked program's binary, through a temporary file like the mesh cache.
+	bool store(const std::string& path, uint64_t key, GLuint program);
+
+	// True once program has finished linking, without waiting for it. Always true without parallel compiles.
+	bool completed(GLuint program);
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include "render_queue.h"
+#include "gl_state.h"
+#include "uniform_blocks.h"
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+
+namespace {
+
+// Where each field of the key starts, see RenderQueue.
+const unsigned int passShift = 60;
+const unsigned int programShift = 52;
+const unsigned int textureShift = 36;
+const unsigned int vertexArrayShift = 24;
+const uint64_t programMask = 0xFF;
+const uint64_t textureMask = 0xFFFF;
+const uint64_t vertexArrayMask = 0xFFF;
+const uint64_t depthMask = 0xFFFFFF;
+
+}
+
+void RenderQueue::begin(const glm::mat4& view, float nearPlane, float farPlane) {
+	this->view = view;
+	this->nearPlane = nearPlane;
+	this->farPlane = farPlane;
+	transforms.clear();
+	packets.clear();
+	entries.clear();
+}
+
+uint32_t RenderQueue::programSlot(Shader& shader) {
+	// Only a handful of programs are ever drawn with, so a linear search is as fast as anything.
+	for (size_t i = 0; i < programs.size(); i++) {
+		if (programs[i].shader == &shader) {
+			return static_cast<uint32_t>(i);
+		}
+	}
+	shader.finish();
+	Program program;
+	program.shader = &shader;
+	program.model = shader.uniform<glm::mat4>("model");
+	program.normalMatrix = shader.uniform<glm::mat3>("normalMatrix");
+	programs.push_back(program);
+	return static_cast<uint32_t>(programs.size() - 1);
+}
+
+uint32_t RenderQueue::addTransform(uint32_t program, const glm::mat4& transform) {
+	Transform entry;
+	entry.model = transform;
+	// The inverse is only worth it for programs that shade with normals.
+	entry.normalMatrix = programs[program].normalMatrix.valid() ? normalMatrix(transform) : glm::mat3(1.0f);
+	transforms.push_back(entry);
+	return static_cast<uint32_t>(transforms.size() - 1);
+}
+
+uint64_t RenderQueue::depthKey(const glm::vec3& point) const {
+	float depth = -(view * glm::vec4(point, 1.0f)).z;
+	float t = (depth - nearPlane) / (farPlane - nearPlane);
+	// Written so NaN ends up at 0 too.
+	t = t > 0.0f ? std::min(t, 1.0f) : 0.0f;
+	return static_cast<uint64_t>(t * depthMask);
+}
+
+void RenderQueue::push(RenderPass pass, const Packet& packet, GLuint texture, uint64_t depth) {
+	SortEntry entry;
+	entry.key = static_cast<uint64_t>(pass) << passShift
+		| std::min<uint64_t>(packet.program, programMask) << programShift
+		| (texture & textureMask) << textureShift
+		| (packet.model->getVertexArray() & vertexArrayMask) << vertexArrayShift
+		| depth;
+	entry.packet = static_cast<uint32_t>(packets.size());
+	packets.push_back(packet);
+	entries.push_back(entry);
+}
+
+void RenderQueue::addModel(RenderPass pass, Shader& shader, Model& model, const glm::mat4& transform, unsigned int lod,
+	const MeshletDrawList* draws, const std::vector<uint8_t>* visibleSubmeshes) {
+	uint32_t program = programSlot(shader);
+	uint32_t object = addTransform(program, transform);
+	uint64_t depth = depthKey(glm::vec3(transform * glm::vec4(model.getBoundsCenter(), 1.0f)));
+	for (uint32_t material = 0; material < model.materialCount(); material++) {
+		Packet packet = { PacketKind::Material, program, object, material, lod, &model, draws, visibleSubmeshes, nullptr, 0 };
+		push(pass, packet, model.getMaterialTexture(material), depth);
+	}
+}
+
+void RenderQueue::addMaterial(RenderPass pass, Shader& shader, Model& model, uint32_t material, const glm::mat4& transform, unsigned int lod) {
+	uint32_t program = programSlot(shader);
+	Packet packet = { PacketKind::Material, program, addTransform(program, transform), material, lod, &model, nullptr, nullptr, nullptr, 0 };
+	push(pass, packet, model.getMaterialTexture(material), depthKey(glm::vec3(transform * glm::vec4(model.getBoundsCenter(), 1.0f))));
+}
+
+void RenderQueue::addInstances(RenderPass pass, Shader& shader, Model& model, const Instance* instances, size_t count, unsigned int lod) {
+	if (count == 0) {
+		return;
+	}
+	Packet packet = { PacketKind::Instances, programSlot(shader), 0, 0, lod, &model, nullptr, nullptr, instances, count };
+	push(pass, packet, 0, 0);
+}
+
+void RenderQueue::addTriangle(RenderPass pass, Shader& shader, Model& model, uint32_t triangle, const glm::mat4& transform) {
+	uint32_t program = programSlot(shader);
+	Packet packet = { PacketKind::Triangle, program, addTransform(program, transform), triangle, 0, &model, nullptr, nullptr, nullptr, 0 };
+	push(pass, packet, 0, depthKey(glm::vec3(transform * glm::vec4(model.getBoundsCenter(), 1.0f))));
+}
+
+void RenderQueue::sort() {
+	if (entries.size() < 2) {
+		return;
+	}
+
+	// One read of the keys counts every byte, and finds the bytes that differ at all. The pass, program and texture
+	// bytes are often the same for the whole frame.
+	size_t histograms[8][256] = {};
+	uint64_t differing = 0;
+	uint64_t first = entries.front().key;
+	for (const SortEntry& entry : entries) {
+		differing |= entry.key ^ first;
+		for (unsigned int digit = 0; digit < 8; digit++) {
+			histograms[digit][(entry.key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	scratch.resize(entries.size());
+	for (unsigned int digit = 0; digit < 8; digit++) {
+		if (((differing >> (digit * 8)) & 0xFF) == 0) {
+			continue;
+		}
+		size_t offset = 0;
+		for (size_t& bucket : histograms[digit]) {
+			size_t count = bucket;
+			bucket = offset;
+			offset += count;
+		}
+		for (const SortEntry& entry : entries) {
+			scratch[histograms[digit][(entry.key >> (digit * 8)) & 0xFF]++] = entry;
+		}
+		entries.swap(scratch);
+	}
+}
+
+void RenderQueue::applyPass(RenderPass pass) {
+	GlState& state = GlState::current();
+	if (pass == RenderPass::Decal) {
+		state.enable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(-1.0f, -1.0f);
+		state.depthFunc(GL_LEQUAL);
+	}
+	else {
+		state.disable(GL_POLYGON_OFFSET_FILL);
+		state.depthFunc(GL_LESS);
+	}
+}
+
+void RenderQueue::submit(bool sorted) {
+	if (entries.empty()) {
+		return;
+	}
+	auto sortStart = std::chrono::steady_clock::now();
+	if (sorted) {
+		sort();
+	}
+	auto submitStart = std::chrono::steady_clock::now();
+
+	RenderPass pass = static_cast<RenderPass>(entries.front().key >> passShift);
+	applyPass(pass);
+	uint32_t lastProgram = std::numeric_limits<uint32_t>::max();
+	for (const SortEntry& entry : entries) {
+		RenderPass entryPass = static_cast<RenderPass>(entry.key >> passShift);
+		if (entryPass != pass) {
+			pass = entryPass;
+			applyPass(pass);
+		}
+
+		const Packet& packet = packets[entry.packet];
+		Program& program = programs[packet.program];
+		Shader& shader = *program.shader;
+		if (packet.program != lastProgram) {
+			lastProgram = packet.program;
+			counts.programSwitches++;
+		}
+		// The uniforms belong to the program, so it has to be in use before they are set; the draw's own use() is dropped.
+		shader.use();
+		if (packet.kind != PacketKind::Instances) {
+			const Transform& transform = transforms[packet.transform];
+			if (program.model.valid()) {
+				shader.set(program.model, transform.model);
+			}
+			if (program.normalMatrix.valid()) {
+				shader.set(program.normalMatrix, transform.normalMatrix);
+			}
+		}
+
+		switch (packet.kind) {
+		case PacketKind::Material:
+			packet.model->renderMaterial(shader, packet.item, packet.lod, packet.draws, packet.visibleSubmeshes);
+			break;
+		case PacketKind::Instances:
+			packet.model->renderInstanced(shader, packet.instances, packet.instanceCount, packet.lod);
+			break;
+		case PacketKind::Triangle:
+			packet.model->renderTriangle(shader, packet.item);
+			break;
+		}
+	}
+	if (pass != RenderPass::Opaque) {
+		applyPass(RenderPass::Opaque);
+	}
+
+	auto submitEnd = std::chrono::steady_clock::now();
+	counts.packets += entries.size();
+	counts.sortMilliseconds += std::chrono::duration<double, std::milli>(submitStart - sortStart).count();
+	counts.submitMilliseconds += std::chrono::duration<double, std::milli>(submitEnd - submitStart).count();
+}
+
+void benchmarkRenderQueue(Model& model, const std::vector<Shader*>& shaders, const glm::mat4& view, float nearPlane, float farPlane) {
+	if (shaders.empty() || model.materialCount() == 0) {
+		return;
+	}
+	const size_t packetCount = 100000;
+
+	// Small copies spread through the view, at the coarsest level so the GPU is not what is measured.
+	glm::mat4 camera = glm::inverse(view);
+	glm::vec3 position = glm::vec3(camera[3]);
+	glm::vec3 right = glm::vec3(camera[0]);
+	glm::vec3 up = glm::vec3(camera[1]);
+	glm::vec3 forward = -glm::vec3(camera[2]);
+	float scale = model.getBoundsRadius() > 0.0f ? 0.1f / model.getBoundsRadius() : 1.0f;
+	unsigned int lod = model.lodCount() - 1;
+
+	std::mt19937 random(12345);
+	std::uniform_real_distribution<float> distance(nearPlane + 1.0f, std::max(nearPlane + 1.0f, 0.5f * farPlane));
+	std::uniform_real_distribution<float> lateral(-0.5f, 0.5f);
+	std::uniform_int_distribution<size_t> shader(0, shaders.size() - 1);
+	std::uniform_int_distribution<uint32_t> material(0, model.materialCount() - 1);
+
+	RenderQueue queue;
+	queue.begin(view, nearPlane, farPlane);
+	for (size_t i = 0; i < packetCount; i++) {
+		float depth = distance(random);
+		glm::vec3 center = position + depth * (forward + lateral(random) * right + lateral(random) * up);
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), center);
+		transform = glm::scale(transform, glm::vec3(scale));
+		transform = glm::translate(transform, -model.getBoundsCenter());
+		queue.addMaterial(RenderPass::Opaque, *shaders[shader(random)], model, material(random), transform, lod);
+	}
+	const std::vector<RenderQueue::SortEntry> unsorted = queue.entries;
+
+	const unsigned int runs = 20;
+	double radixTotal = 0.0;
+	double radixBest = std::numeric_limits<double>::max();
+	double referenceTotal = 0.0;
+	std::vector<RenderQueue::SortEntry> reference;
+	for (unsigned int run = 0; run < runs; run++) {
+		queue.entries = unsorted;
+		auto start = std::chrono::steady_clock::now();
+		queue.sort();
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		radixTotal += milliseconds;
+		radixBest = std::min(radixBest, milliseconds);
+
+		reference = unsorted;
+		start = std::chrono::steady_clock::now();
+		std::stable_sort(reference.begin(), reference.end(),
+			[](const RenderQueue::SortEntry& a, const RenderQueue::SortEntry& b) { return a.key < b.key; });
+		referenceTotal += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	for (size_t i = 0; i < reference.size(); i++) {
+		if (reference[i].packet != queue.entries[i].packet) {
+			std::cerr << "ERROR::RENDER_QUEUE::SORTS_DISAGREE" << std::endl;
+			break;
+		}
+	}
+	std::cout << "Render queue, " << packetCount << " packets: radix sort " << radixTotal / runs << " ms average, " << radixBest
+		<< " ms best, std::stable_sort " << referenceTotal / runs << " ms average" << std::endl;
+
+	// Each submit starts from an idle GPU and ends with a glFinish, so the CPU and GPU sides can be told apart.
+	for (bool sorted : { false, true }) {
+		queue.entries = unsorted;
+		queue.resetStats();
+		GlStateStats glBefore = GlState::current().stats();
+		UniformStats uniformsBefore = Shader::uniformStats();
+		glFinish();
+		queue.submit(sorted);
+		auto finishStart = std::chrono::steady_clock::now();
+		glFinish();
+		double finishMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - finishStart).count();
+
+		const RenderQueueStats& stats = queue.stats();
+		const GlStateStats& glAfter = GlState::current().stats();
+		std::cout << "  " << (sorted ? "Sorted" : "Unsorted") << ": sort " << stats.sortMilliseconds << " ms, submit "
+			<< stats.submitMilliseconds << " ms, GPU done " << finishMilliseconds << " ms later, " << stats.programSwitches
+			<< " program switches, " << glAfter.issued - glBefore.issued << " GL state calls issued ("
+			<< glAfter.elided - glBefore.elided << " dropped), " << Shader::uniformStats().uploads - uniformsBefore.uploads
+			<< " uniform uploads" << std::endl;
+	}
+}
@@ -0,0 +1,136 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "meshlets.h"
+#include "model.h"
+#include "shader.h"
+
+// Passes in the order they are drawn.
+enum class RenderPass : uint8_t
+{
+	Opaque = 0,
+	Decal = 1, // Pulled in front of what Opaque drew at the same depth (polygon offset and GL_LEQUAL), like the picked triangle
+};
+
+// Packets and state changes of the submits since the last RenderQueue::resetStats().
+struct RenderQueueStats
+{
+	size_t packets = 0;
+	size_t programSwitches = 0; // Packets with another program than the one before
+	double sortMilliseconds = 0.0;
+	double submitMilliseconds = 0.0; // Issuing the draws, after sorting
+};
+
+// Draws are collected for the frame as packets, each with a 64 bit sort key, radix sorted once and only then submitted.
+// From the top bit down a key holds the pass (4 bits), the program (8), the material's texture (16), the vertex array
+// (12) and the depth (24), so each pass is drawn program by program, texture by texture, and opaque draws that share
+// all of that front to back. Keys only decide the order: program slots past 255 and GL names past the bits they get
+// are folded together, which costs some state changes but draws the same.
+// Packets place their object with the shader's model and normalMatrix uniforms, where it has them. Everything a packet
+// points to (the model, the shader, meshlet draws, submesh flags, instances) has to stay alive until submit().
+class RenderQueue
+{
+public:
+	// Drops the last frame's packets. Depths are measured along view's forward axis, and [nearPlane, farPlane] is what
+	// the key's depth bits cover.
+	void begin(const glm::mat4& view, float nearPlane, float farPlane);
+
+	// Every material of the model, one packet each.
+	void addModel(RenderPass pass, Shader& shader, Model& model, const glm::mat4& transform, unsigned int lod = 0,
+		const MeshletDrawList* draws = nullptr, const std::vector<uint8_t>* visibleSubmeshes = nullptr);
+	// One material of the model, see Model::renderMaterial().
+	void addMaterial(RenderPass pass, Shader& shader, Model& model, uint32_t material, const glm::mat4& transform, unsigned int lod = 0);
+	// See Model::renderInstanced(). The copies are spread out with no one depth to sort by, so the packet sorts as if it
+	// were at the near plane.
+	void addInstances(RenderPass pass, Shader& shader, Model& model, const Instance* instances, size_t count, unsigned int lod = 0);
+	// See Model::renderTriangle().
+	void addTriangle(RenderPass pass, Shader& shader, Model& model, uint32_t triangle, const glm::mat4& transform);
+
+	size_t size() const { return packets.size(); }
+
+	// Sorts the packets and draws them. The pass state is set on every pass change and back to Opaque's at the end.
+	// Unsorted, the packets go in the order they were added, which is only there to compare against.
+	void submit(bool sorted = true);
+
+	const RenderQueueStats& stats() const { return counts; }
+	void resetStats() { counts = RenderQueueStats(); }
+
+private:
+	enum class PacketKind : uint8_t
+	{
+		Material,
+		Instances,
+		Triangle,
+	};
+
+	struct Packet
+	{
+		PacketKind kind;
+		uint32_t program;   // Index into programs
+		uint32_t transform; // Index into transforms, unused by instances
+		uint32_t item;      // The material, or the triangle
+		unsigned int lod;
+		Model* model;
+		const MeshletDrawList* draws;
+		const std::vector<uint8_t>* visibleSubmeshes;
+		const Instance* instances;
+		size_t instanceCount;
+	};
+
+	struct SortEntry
+	{
+		uint64_t key;
+		uint32_t packet;
+	};
+
+	// Programs seen so far and their object uniforms, looked up once. A program's index is its slot in the keys, so slots
+	// stay the same from frame to frame.
+	struct Program
+	{
+		Shader* shader;
+		UniformHandle<glm::mat4> model;
+		UniformHandle<glm::mat3> normalMatrix;
+	};
+
+	struct Transform
+	{
+		glm::mat4 model;
+		glm::mat3 normalMatrix;
+	};
+
+	glm::mat4 view = glm::mat4(1.0f);
+	float nearPlane = 0.0f;
+	float farPlane = 1.0f;
+
+	std::vector<Program> programs;
+	std::vector<Transform> transforms;
+	std::vector<Packet> packets;
+	std::vector<SortEntry> entries; // In insertion order until sort()
+	std::vector<SortEntry> scratch;
+	RenderQueueStats counts;
+
+	uint32_t programSlot(Shader& shader);
+	uint32_t addTransform(uint32_t program, const glm::mat4& transform);
+	// The key's depth bits for a point in world space.
+	uint64_t depthKey(const glm::vec3& point) const;
+	void push(RenderPass pass, const Packet& packet, GLuint texture, uint64_t depth);
+	// LSD radix sort of the entries by key, a byte per pass. It is stable, so packets with the same key stay in the order
+	// they were added, and passes over bytes every key has the same are skipped.
+	void sort();
+	static void applyPass(RenderPass pass);
+
+	friend void benchmarkRenderQueue(Model& model, const std::vector<Shader*>& shaders, const glm::mat4& view, float nearPlane, float farPlane);
+};
+
+// Queues 100k packets of model's materials scattered in front of the camera, drawn with shaders picked at random, and
+// times the radix sort against std::stable_sort and a sorted submit against an unsorted one. The draws go to the framebuffer
+// that is bound, which the caller has to clear afterwards.
+void benchmarkRenderQueue(Model& model, const std::vector<Shader*>& shaders, const glm::mat4& view, float nearPlane, float farPlane);
+
+#endif
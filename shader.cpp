@@ -1,7 +1,76 @@
 #include "shader.h"
 
+#include "gl_state.h"
+#include "program_cache.h"
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+UniformStats Shader::stats;
+
+namespace {
+
+int uniformComponents(GLenum type) {
+	switch (type) {
+	case GL_FLOAT: case GL_INT: case GL_BOOL:
+	case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+	case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER:
+		return 1;
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2:
+		return 2;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3:
+		return 3;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2:
+		return 4;
+	case GL_FLOAT_MAT3:
+		return 9;
+	case GL_FLOAT_MAT4:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+// The defines go after #version, which has to come first, and a #line puts the line numbers in the driver's error
+// messages back to those of the file.
+std::string withDefines(const std::string& source, const std::string& defines) {
+	if (defines.empty()) {
+		return source;
+	}
+	size_t body = 0;
+	if (source.compare(0, 8, "#version") == 0) {
+		size_t newline = source.find('\n');
+		if (newline == std::string::npos) {
+			return source + "\n" + defines;
+		}
+		body = newline + 1;
+	}
+	return source.substr(0, body) + defines + "#line " + std::to_string(body > 0 ? 2 : 1) + "\n" + source.substr(body);
+}
+
+bool isIntegerUniform(GLenum type) {
+	switch (type) {
+	case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+	case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+		return false;
+	default:
+		return true;
+	}
+}
+
+}
+
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, bool deferred) {
+	build(vertexPath, fragmentPath, "", "", deferred);
+}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines, const std::string& variant, bool deferred) {
+	build(vertexPath, fragmentPath, defines, variant, deferred);
+}
+
+void Shader::build(const char* vertexPath, const char* fragmentPath, const std::string& defines, const std::string& variant, bool deferred) {
 	std::string vertexCode, fragmentCode;
 	std::ifstream vShaderFile, fShaderFile;
 
@@ -17,84 +86,244 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 
 		vShaderFile.close();
 		fShaderFile.close();
-		vertexCode = vShaderStream.str();
-		fragmentCode = fShaderStream.str();
+		vertexCode = withDefines(vShaderStream.str(), defines);
+		fragmentCode = withDefines(fShaderStream.str(), defines);
 	}
 	catch (std::ifstream::failure e) {
 		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 	}
+
+	binaryPath = programcache::sidecarPath(fragmentPath, variant);
+	binaryKey = programcache::programKey(vertexCode, fragmentCode);
+	ID = glCreateProgram();
+	if (programcache::load(binaryPath, binaryKey, ID)) {
+		cached = true;
+		reflect();
+		return;
+	}
+	// A rejected binary may have left the program in some state of its own, so the compiled one starts afresh.
+	glDeleteProgram(ID);
+	ID = glCreateProgram();
+
 	const char* vShaderCode = vertexCode.c_str();
 	const char* fShaderCode = fragmentCode.c_str();
 
-	unsigned int vertex, fragment;
-	int success;
-	char infoLog[1024];
-
+	// The status checks wait for the driver, so they are all left to finish(); until then the compile and link can run
+	// alongside other programs' (and with parallel compiles, on the driver's threads).
 	vertex = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(vertex, 1, &vShaderCode, NULL);
 	glCompileShader(vertex);
 
+	fragment = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragment, 1, &fShaderCode, NULL);
+	glCompileShader(fragment);
+
+	glAttachShader(ID, vertex);
+	glAttachShader(ID, fragment);
+	programcache::prepare(ID);
+	glLinkProgram(ID);
+	pending = true;
+
+	if (!deferred) {
+		finish();
+	}
+}
+
+void Shader::finish() {
+	if (!pending) {
+		return;
+	}
+	pending = false;
+
+	int success;
+	char infoLog[1024];
+
 	glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
 	if (!success) {
 		glGetShaderInfoLog(vertex, 512, NULL, infoLog);
 		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
 	}
 
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, NULL);
-	glCompileShader(fragment);
-
 	glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		glGetShaderInfoLog(vertex, 512, NULL, infoLog);
+		glGetShaderInfoLog(fragment, 512, NULL, infoLog);
 		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 	}
 
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
-	glLinkProgram(ID);
-
 	glGetProgramiv(ID, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(ID, 612, NULL, infoLog);
 		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
 	}
+	else {
+		programcache::store(binaryPath, binaryKey, ID);
+	}
 
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
+	vertex = fragment = 0;
+
+	reflect();
+}
+
+bool Shader::ready() const {
+	return !pending || programcache::completed(ID);
+}
+
+void Shader::finishAll(const std::vector<Shader*>& shaders) {
+	// Finished in whatever order the driver completes them, so no program waits behind a slower one.
+	std::vector<Shader*> waiting(shaders);
+	while (!waiting.empty()) {
+		size_t before = waiting.size();
+		for (size_t i = 0; i < waiting.size();) {
+			if (waiting[i]->ready()) {
+				waiting[i]->finish();
+				waiting.erase(waiting.begin() + i);
+			}
+			else {
+				i++;
+			}
+		}
+		if (waiting.size() == before) {
+			std::this_thread::yield();
+		}
+	}
 }
 
 void Shader::use() {
-	glUseProgram(ID);
+	finish();
+	GlState::current().useProgram(ID);
 }
 
-void Shader::setBool(const std::string& name, bool value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+void Shader::set(UniformHandle<bool> uniform, bool value) {
+	int bits = value;
+	if (changed(uniform.slot, &bits)) {
+		glUniform1i(uniforms[uniform.slot].location, bits);
+	}
 }
-void Shader::setInt(const std::string& name, int value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+void Shader::set(UniformHandle<int> uniform, int value) {
+	if (changed(uniform.slot, &value)) {
+		glUniform1i(uniforms[uniform.slot].location, value);
+	}
 }
-void Shader::setFloat(const std::string& name, float value) const {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+void Shader::set(UniformHandle<float> uniform, float value) {
+	if (changed(uniform.slot, &value)) {
+		glUniform1f(uniforms[uniform.slot].location, value);
+	}
 }
 
-void Shader::setVec2(const std::string& name, glm::vec2 value) const {
-	glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::set(UniformHandle<glm::vec2> uniform, const glm::vec2& value) {
+	if (changed(uniform.slot, &value[0])) {
+		glUniform2fv(uniforms[uniform.slot].location, 1, &value[0]);
+	}
 }
-void Shader::setVec3(const std::string& name, glm::vec3 value) const {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::set(UniformHandle<glm::vec3> uniform, const glm::vec3& value) {
+	if (changed(uniform.slot, &value[0])) {
+		glUniform3fv(uniforms[uniform.slot].location, 1, &value[0]);
+	}
 }
-void Shader::setVec4(const std::string& name, glm::vec4 value) const {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::set(UniformHandle<glm::vec4> uniform, const glm::vec4& value) {
+	if (changed(uniform.slot, &value[0])) {
+		glUniform4fv(uniforms[uniform.slot].location, 1, &value[0]);
+	}
 }
 
-void Shader::setMat2(const std::string& name, glm::mat2 mat) const {
-	glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+void Shader::set(UniformHandle<glm::mat2> uniform, const glm::mat2& mat) {
+	if (changed(uniform.slot, &mat[0][0])) {
+		glUniformMatrix2fv(uniforms[uniform.slot].location, 1, GL_FALSE, &mat[0][0]);
+	}
+}
+void Shader::set(UniformHandle<glm::mat3> uniform, const glm::mat3& mat) {
+	if (changed(uniform.slot, &mat[0][0])) {
+		glUniformMatrix3fv(uniforms[uniform.slot].location, 1, GL_FALSE, &mat[0][0]);
+	}
+}
+void Shader::set(UniformHandle<glm::mat4> uniform, const glm::mat4& mat) {
+	if (changed(uniform.slot, &mat[0][0])) {
+		glUniformMatrix4fv(uniforms[uniform.slot].location, 1, GL_FALSE, &mat[0][0]);
+	}
 }
-void Shader::setMat3(const std::string& name, glm::mat3 mat) const {
-	glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+
+void Shader::setUniformBlock(const char* name, unsigned int binding) const {
+	GLuint index = glGetUniformBlockIndex(ID, name);
+	if (index != GL_INVALID_INDEX) {
+		glUniformBlockBinding(ID, index, binding);
+	}
+}
+
+void Shader::reflect() {
+	uniforms.clear();
+	values.clear();
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> name(std::max(maxLength, 1));
+
+	for (GLint i = 0; i < count; i++) {
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(ID, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), nullptr, &size, &type, name.data());
+		// Members of uniform blocks have no location, they are set through the block's buffer.
+		GLint location = glGetUniformLocation(ID, name.data());
+		if (location < 0) {
+			continue;
+		}
+
+		UniformSlot slot{ name.data(), location, uniformComponents(type), isIntegerUniform(type), values.size(), false, false };
+		values.resize(values.size() + slot.components);
+		uniforms.push_back(slot);
+		// Arrays are listed once, as "name[0]". GL takes that and the bare name for the first element, and "name[i]" for
+		// the others, which each get a slot of their own.
+		if (slot.name.size() > 3 && slot.name.compare(slot.name.size() - 3, 3, "[0]") == 0) {
+			std::string base = slot.name.substr(0, slot.name.size() - 3);
+			slot.name = base;
+			uniforms.push_back(slot);
+			for (GLint element = 1; element < size; element++) {
+				UniformSlot elementSlot = slot;
+				elementSlot.name = base + "[" + std::to_string(element) + "]";
+				elementSlot.location = glGetUniformLocation(ID, elementSlot.name.c_str());
+				if (elementSlot.location < 0) {
+					continue;
+				}
+				elementSlot.offset = values.size();
+				values.resize(values.size() + elementSlot.components);
+				uniforms.push_back(elementSlot);
+			}
+		}
+	}
+	std::sort(uniforms.begin(), uniforms.end(), [](const UniformSlot& a, const UniformSlot& b) { return a.name < b.name; });
+}
+
+int Shader::find(const char* name, int components, bool integer) const {
+	auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name,
+		[](const UniformSlot& slot, const char* key) { return std::strcmp(slot.name.c_str(), key) < 0; });
+	if (it == uniforms.end() || it->name != name) {
+		return -1;
+	}
+	if (it->components != components || it->integer != integer) {
+		if (!it->mismatchReported) {
+			std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << name << std::endl;
+			it->mismatchReported = true;
+		}
+		return -1;
+	}
+	return static_cast<int>(it - uniforms.begin());
+}
+
+bool Shader::changed(int slot, const void* value) {
+	if (slot < 0) {
+		stats.missing++;
+		return false;
+	}
+	UniformSlot& uniform = uniforms[slot];
+	uint32_t* current = values.data() + uniform.offset;
+	size_t bytes = uniform.components * sizeof(uint32_t);
+	if (uniform.known && std::memcmp(current, value, bytes) == 0) {
+		stats.skipped++;
+		return false;
+	}
+	std::memcpy(current, value, bytes);
+	uniform.known = true;
+	stats.uploads++;
+	return true;
 }
-void Shader::setMat4(const std::string& name, glm::mat4 mat) const{
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-}
\ No newline at end of file
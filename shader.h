@@ -4,30 +4,128 @@
 #include <glad/glad.h>
 #include <glm/glm/glm.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 
+// glUniform* calls of every program, summed until Shader::resetUniformStats().
+struct UniformStats
+{
+	size_t uploads = 0; // Calls issued
+	size_t skipped = 0; // Sets of the value the program already had
+	size_t missing = 0; // Sets of uniforms the program does not have, such as ones the compiler dropped as unused
+};
+
+// A uniform of one program, looked up once with Shader::uniform(). T is the type it is set with. Handles of uniforms
+// the program does not have, or has with another type, are invalid, and setting them does nothing.
+template <typename T>
+struct UniformHandle
+{
+	int slot = -1;
+	bool valid() const { return slot >= 0; }
+};
+
+// The program's active uniforms are read once it links, and each keeps a copy of the value it was last set to, so sets
+// by name need no glGetUniformLocation and sets of an unchanged value no GL call at all. That copy is only right as long
+// as every set goes through the one Shader, which is why it cannot be copied.
 class Shader {
 public:
 	unsigned int ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath);
+	// Reads the sources and loads the program from its binary (see programcache) or compiles and links it. Deferred
+	// compiles are only submitted: the program is finished by finish() or finishAll(), or at the latest by use(), and
+	// nothing else may be called on it before, so several programs can compile at once.
+	Shader(const char* vertexPath, const char* fragmentPath, bool deferred = false);
+	// Same, with defines ("#define A\n#define B\n") put in front of both sources, after their #version line. variant
+	// tells the program's binary apart from the other variants' (see programcache::sidecarPath).
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines, const std::string& variant, bool deferred = false);
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+
+	// Waits for the compile and link, reports their errors and saves the binary. Does nothing once the program is done.
+	void finish();
+	// True if finish() would not have to wait. Without parallel compiles the driver cannot tell, and this is always true.
+	bool ready() const;
+	static void finishAll(const std::vector<Shader*>& shaders);
+
+	// True if the program came from its binary rather than from a compile.
+	bool fromCache() const { return cached; }
 
 	void use();
 
-	void setBool(const std::string& name, bool value) const;
-	void setInt(const std::string& name, int value) const;
-	void setFloat(const std::string& name, float value) const;
+	template <typename T>
+	UniformHandle<T> uniform(const char* name) const {
+		// bool goes up as an int, like every other integer
+		int components = static_cast<int>(std::is_same<T, bool>::value ? 1 : sizeof(T) / sizeof(float));
+		return UniformHandle<T>{ find(name, components, std::is_same<T, bool>::value || std::is_same<T, int>::value) };
+	}
+
+	void set(UniformHandle<bool> uniform, bool value);
+	void set(UniformHandle<int> uniform, int value);
+	void set(UniformHandle<float> uniform, float value);
+
+	void set(UniformHandle<glm::vec2> uniform, const glm::vec2& value);
+	void set(UniformHandle<glm::vec3> uniform, const glm::vec3& value);
+	void set(UniformHandle<glm::vec4> uniform, const glm::vec4& value);
+
+	void set(UniformHandle<glm::mat2> uniform, const glm::mat2& mat);
+	void set(UniformHandle<glm::mat3> uniform, const glm::mat3& mat);
+	void set(UniformHandle<glm::mat4> uniform, const glm::mat4& mat);
+
+	void setBool(const char* name, bool value) { set(uniform<bool>(name), value); }
+	void setInt(const char* name, int value) { set(uniform<int>(name), value); }
+	void setFloat(const char* name, float value) { set(uniform<float>(name), value); }
+
+	void setVec2(const char* name, const glm::vec2& value) { set(uniform<glm::vec2>(name), value); }
+	void setVec3(const char* name, const glm::vec3& value) { set(uniform<glm::vec3>(name), value); }
+	void setVec4(const char* name, const glm::vec4& value) { set(uniform<glm::vec4>(name), value); }
+
+	void setMat2(const char* name, const glm::mat2& mat) { set(uniform<glm::mat2>(name), mat); }
+	void setMat3(const char* name, const glm::mat3& mat) { set(uniform<glm::mat3>(name), mat); }
+	void setMat4(const char* name, const glm::mat4& mat) { set(uniform<glm::mat4>(name), mat); }
+
+	// Points the named uniform block at a binding point (GLSL 330 has no layout(binding) for it). Programs without the block are left alone.
+	void setUniformBlock(const char* name, unsigned int binding) const;
+
+	static const UniformStats& uniformStats() { return stats; }
+	static void resetUniformStats() { stats = UniformStats(); }
+
+private:
+	// An active uniform outside any block. Arrays are there under both "name" and "name[0]" for their first element, and
+	// as "name[i]" for each of the others.
+	struct UniformSlot
+	{
+		std::string name;
+		GLint location;
+		int components; // Floats or ints the value takes, 0 for types there is no set() for
+		bool integer;
+		size_t offset;  // Of the value in values
+		bool known;     // False until the first set(), the program's own initial value is not read back
+		mutable bool mismatchReported; // Set once a type mismatch has been printed, so it is printed only once
+	};
+	std::vector<UniformSlot> uniforms; // Sorted by name
+	std::vector<uint32_t> values;      // Bit patterns of the values last set, compared bit for bit
+
+	static UniformStats stats;
 
-	void setVec2(const std::string& name, glm::vec2 value) const;
-	void setVec3(const std::string& name, glm::vec3 value) const;
-	void setVec4(const std::string& name, glm::vec4 value) const;
+	// Compile state, until finish()
+	unsigned int vertex = 0;
+	unsigned int fragment = 0;
+	bool pending = false;
+	bool cached = false;
+	std::string binaryPath;
+	uint64_t binaryKey = 0;
 
-	void setMat2(const std::string& name, glm::mat2 mat) const;
-	void setMat3(const std::string& name, glm::mat3 mat) const;
-	void setMat4(const std::string& name, glm::mat4 mat) const;
+	void build(const char* vertexPath, const char* fragmentPath, const std::string& defines, const std::string& variant, bool deferred);
+	void reflect();
+	int find(const char* name, int components, bool integer) const;
+	// True if value differs from the one last set, and then takes its place; the caller uploads it.
+	bool changed(int slot, const void* value);
 };
 
 #endif
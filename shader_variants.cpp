@@ -0,0 +1,71 @@
+#include "shader_variants.h"
+
+#include <iostream>
+
+namespace {
+
+const char* const featureDefines[shaderfeature::count] = { "LIGHTING", "DIFFUSE_MAP", "NORMAL_VIEW", "INSTANCING" };
+
+}
+
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath) {
+}
+
+void ShaderVariants::bindBlock(const char* name, GLuint binding) {
+	blocks.emplace_back(name, binding);
+	blocksBound.fill(false);
+}
+
+std::vector<Shader*> ShaderVariants::prepare(const std::vector<uint32_t>& features) {
+	std::vector<Shader*> pending;
+	for (uint32_t feature : features) {
+		if (feature < shaderfeature::variantCount && !variants[feature]) {
+			Shader& shader = create(feature, true);
+			if (!shader.fromCache()) {
+				pending.push_back(&shader);
+			}
+		}
+	}
+	return pending;
+}
+
+Shader& ShaderVariants::get(uint32_t features) {
+	if (!shaderfeature::valid(features)) {
+		std::cout << "ERROR::SHADER::INVALID_VARIANT: " << features << std::endl;
+		features = 0;
+	}
+	if (!variants[features]) {
+		create(features, false);
+	}
+	Shader& shader = *variants[features];
+	// Blocks are bound once the variant is first handed out, which also finishes a deferred compile.
+	if (!blocksBound[features]) {
+		shader.finish();
+		for (const auto& block : blocks) {
+			shader.setUniformBlock(block.first.c_str(), block.second);
+		}
+		blocksBound[features] = true;
+	}
+	return shader;
+}
+
+size_t ShaderVariants::compiledCount() const {
+	size_t count = 0;
+	for (const std::unique_ptr<Shader>& variant : variants) {
+		count += variant ? 1 : 0;
+	}
+	return count;
+}
+
+Shader& ShaderVariants::create(uint32_t features, bool deferred) {
+	std::string defines;
+	for (unsigned int i = 0; i < shaderfeature::count; i++) {
+		if (features & (1u << i)) {
+			defines += std::string("#define ") + featureDefines[i] + "\n";
+		}
+	}
+	// The sidecar is named by the bitmask, "fragment_shader.glsl.v3.mvprogram".
+	variants[features].reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines, "v" + std::to_string(features), deferred));
+	variantStats.compiled++;
+	return *variants[features];
+}
@@ -0,0 +1,81 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "shader.h"
+
+// Features of the scene uber-shader (vertex_shader.glsl and fragment_shader.glsl). Each one is a #define in the source,
+// and a variant is the program compiled with one combination of them, picked by the bitmask of its features.
+namespace shaderfeature
+{
+	const uint32_t lighting = 1u << 0;   // LIGHTING: Phong shading with the model's materials. Without it the color is the instance's tint
+	const uint32_t diffuseMap = 1u << 1; // DIFFUSE_MAP: materials with a texture read it; needs lighting
+	const uint32_t normalView = 1u << 2; // NORMAL_VIEW: the normals as colors, instead of any shading
+	const uint32_t instancing = 1u << 3; // INSTANCING: transform, tint and material from the instance buffer, for Model::renderInstanced
+
+	const unsigned int count = 4;
+	const uint32_t variantCount = 1u << count;
+
+	constexpr bool valid(uint32_t features) {
+		return features < variantCount && (!(features & diffuseMap) || (features & lighting))
+			&& (!(features & normalView) || !(features & (lighting | diffuseMap)));
+	}
+}
+
+// Variant compiles since the last ShaderVariants::resetStats().
+struct ShaderVariantStats
+{
+	size_t compiled = 0; // Variants compiled or loaded from their binary
+};
+
+// Every variant of one uber-shader, each compiled (or loaded through the program cache) the first time it is asked
+// for. Variants are kept in a flat array indexed by the feature bitmask, so getting one is an index and a null check.
+// The template versions check the features at compile time.
+class ShaderVariants
+{
+public:
+	ShaderVariants(const char* vertexPath, const char* fragmentPath);
+
+	ShaderVariants(const ShaderVariants&) = delete;
+	ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+	// Points the named uniform block of every variant, the ones compiled later too, at binding.
+	void bindBlock(const char* name, GLuint binding);
+
+	// Submits the compiles of variants that are known to be needed, so they can all compile at once. Returns the ones
+	// still compiling, for Shader::finishAll().
+	std::vector<Shader*> prepare(const std::vector<uint32_t>& features);
+
+	Shader& get(uint32_t features);
+
+	template <uint32_t Features>
+	Shader& get() {
+		static_assert(shaderfeature::valid(Features), "unsupported combination of shader features");
+		return get(Features);
+	}
+
+	size_t compiledCount() const;
+	const ShaderVariantStats& stats() const { return variantStats; }
+	void resetStats() { variantStats = ShaderVariantStats(); }
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::array<std::unique_ptr<Shader>, shaderfeature::variantCount> variants;
+	std::array<bool, shaderfeature::variantCount> blocksBound{};
+	std::vector<std::pair<std::string, GLuint>> blocks;
+	ShaderVariantStats variantStats;
+
+	Shader& create(uint32_t features, bool deferred);
+};
+
+#endif
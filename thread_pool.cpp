@@ -0,0 +1,97 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned int workerCount) : stopping(false) {
+	workers.reserve(workerCount);
+	for (unsigned int i = 0; i < workerCount; i++) {
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) {
+	if (count == 0) {
+		return;
+	}
+	if (count == 1 || workers.empty()) {
+		for (size_t i = 0; i < count; i++) {
+			body(i);
+		}
+		return;
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->body = &body;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	jobAvailable.notify_all();
+
+	runJob(*job);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobFinished.wait(lock, [&] { return job->done.load() == job->count; });
+	for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+		if (*it == job) {
+			jobs.erase(it);
+			break;
+		}
+	}
+}
+
+ThreadPool& ThreadPool::global() {
+	static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+	return pool;
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [&] { return stopping || !jobs.empty(); });
+			if (stopping) {
+				return;
+			}
+			job = jobs.front();
+		}
+
+		runJob(*job);
+
+		// Every iteration has been handed out, stop offering this job to other workers.
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!jobs.empty() && jobs.front() == job) {
+			jobs.pop_front();
+		}
+	}
+}
+
+void ThreadPool::runJob(Job& job) {
+	while (true) {
+		size_t i = job.next.fetch_add(1);
+		if (i >= job.count) {
+			return;
+		}
+
+		(*job.body)(i);
+
+		if (job.done.fetch_add(1) + 1 == job.count) {
+			std::lock_guard<std::mutex> lock(mutex);
+			jobFinished.notify_all();
+		}
+	}
+}
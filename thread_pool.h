@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops.
+// The thread calling parallelFor works on the loop too, so nested parallelFor calls cannot deadlock.
+class ThreadPool
+{
+public:
+	// workerCount extra threads are started; the calling thread is always the +1.
+	explicit ThreadPool(unsigned int workerCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads that can run a loop body at once, including the caller.
+	unsigned int size() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+	// Runs body(i) for every i in [0, count) and returns once all of them have finished.
+	// Iterations are handed out one at a time, so make each one a reasonably sized chunk of work.
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+	// Shared pool sized to the machine, created on first use.
+	static ThreadPool& global();
+
+private:
+	struct Job
+	{
+		const std::function<void(size_t)>* body;
+		size_t count;
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<Job>> jobs;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobFinished;
+	bool stopping;
+
+	void workerLoop();
+	void runJob(Job& job);
+};
+
+#endif
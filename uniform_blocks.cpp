@@ -0,0 +1,39 @@
+#include "uniform_blocks.h"
+#include "gl_state.h"
+
+#include <cstring>
+
+static_assert(sizeof(FrameBlock) == 208, "FrameBlock has to match the std140 layout of Frame in the shaders");
+static_assert(offsetof(FrameBlock, view) == 64 && offsetof(FrameBlock, viewProjection) == 128 && offsetof(FrameBlock, viewPos) == 192,
+	"FrameBlock has to match the std140 layout of Frame in the shaders");
+static_assert(sizeof(LightBlock) == 64, "LightBlock has to match the std140 layout of Light in fragment_shader.glsl");
+static_assert(offsetof(LightBlock, ambient) == 16 && offsetof(LightBlock, diffuse) == 32 && offsetof(LightBlock, specular) == 48,
+	"LightBlock has to match the std140 layout of Light in fragment_shader.glsl");
+
+UniformBlockBuffer::UniformBlockBuffer(GLuint binding, size_t size) : size(size) {
+	GlState& state = GlState::current();
+	glGenBuffers(1, &buffer);
+	state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+	state.bindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+UniformBlockBuffer::~UniformBlockBuffer() {
+	GlState::current().deleteBuffers(1, &buffer);
+}
+
+bool UniformBlockBuffer::update(const void* data) {
+	if (!contents.empty() && std::memcmp(contents.data(), data, size) == 0) {
+		return false;
+	}
+	contents.assign(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+	// Binding the block to its index also bound it to the generic target, so with one block updated per frame this
+	// bind is usually dropped.
+	GlState::current().bindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	return true;
+}
+
+glm::mat3 normalMatrix(const glm::mat4& model) {
+	return glm::transpose(glm::inverse(glm::mat3(model)));
+}
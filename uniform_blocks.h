@@ -0,0 +1,56 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+// Binding points of the blocks every scene program shares. Materials (model.h) is at 0.
+const GLuint frameBlockBinding = 1;
+const GLuint lightBlockBinding = 2;
+
+// The Frame block of the vertex and fragment shaders, in std140 layout: camera data, the same for every draw of a frame.
+struct FrameBlock
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::mat4 viewProjection;
+	glm::vec4 viewPos; // w unused, std140 pads a vec3 to 16 bytes anyway
+};
+
+// The Light block of fragment_shader.glsl, in std140 layout. The w components are unused.
+struct LightBlock
+{
+	glm::vec4 position;
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+};
+
+// A uniform buffer bound to one binding point for its whole life, so programs only have to be pointed at the binding
+// once (Shader::setUniformBlock). update() skips the upload when the contents have not changed.
+class UniformBlockBuffer
+{
+public:
+	UniformBlockBuffer(GLuint binding, size_t size);
+	~UniformBlockBuffer();
+
+	UniformBlockBuffer(const UniformBlockBuffer&) = delete;
+	UniformBlockBuffer& operator=(const UniformBlockBuffer&) = delete;
+
+	// Returns true if it uploaded.
+	bool update(const void* data);
+
+private:
+	GLuint buffer = 0;
+	std::vector<unsigned char> contents; // What the buffer holds, empty until the first update()
+	size_t size;
+};
+
+// Transforms normals of a model with the given model matrix: the inverse transpose of its upper 3x3.
+glm::mat3 normalMatrix(const glm::mat4& model);
+
+#endif
@@ -0,0 +1,135 @@
+#include "vertex_dedup.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+const unsigned int emptySlot = 0xFFFFFFFF;
+
+// The key is kept in the slot, so a probe never has to look anywhere else.
+struct Slot
+{
+	obj::Corner key;
+	unsigned int vertex;
+};
+
+// Multiply-xorshift mixing. Triples in OBJ files are often (i, i, i), so each index has to be mixed in on its own.
+inline size_t hashCorner(const obj::Corner& corner) {
+	uint64_t hash = (corner.position + 1) * 0x9E3779B97F4A7C15ull;
+	hash = (hash ^ (hash >> 32) ^ corner.texCoord) * 0xC2B2AE3D27D4EB4Full;
+	hash = (hash ^ (hash >> 32) ^ corner.normal) * 0x165667B19E3779F9ull;
+	return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+inline bool sameCorner(const obj::Corner& a, const obj::Corner& b) {
+	return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+}
+
+// Doubles the table and reinserts every key.
+void grow(std::vector<Slot>& table) {
+	std::vector<Slot> grown(table.size() * 2, Slot{ {}, emptySlot });
+	size_t mask = grown.size() - 1;
+	for (const Slot& slot : table) {
+		if (slot.vertex == emptySlot) {
+			continue;
+		}
+		size_t index = hashCorner(slot.key) & mask;
+		while (grown[index].vertex != emptySlot) {
+			index = (index + 1) & mask;
+		}
+		grown[index] = slot;
+	}
+	table.swap(grown);
+}
+
+}
+
+DedupStats buildUnifiedMesh(const obj::CornerData& data, MeshData& mesh) {
+	DedupStats stats;
+	stats.corners = data.corners.size();
+	mesh.clear();
+
+	// Most files have about one distinct triple per position; seams and hard edges grow the table from there.
+	// It is kept at most half full so probes stay short.
+	size_t capacity = 1024;
+	while (capacity < std::min(data.positions.size(), data.corners.size()) * 2) {
+		capacity *= 2;
+	}
+	std::vector<Slot> table(capacity, Slot{ {}, emptySlot });
+
+	std::vector<obj::Corner> unique;
+	unique.reserve(data.positions.size());
+	mesh.vertexIndices.resize(data.corners.size());
+	mesh.smoothingGroups = data.smoothingGroups;
+	mesh.materials = data.materials;
+	mesh.submeshes = data.submeshes;
+	mesh.submeshRanges = data.submeshRanges;
+	mesh.materialLibraries = data.materialLibraries;
+
+	bool anyTexCoords = false;
+	bool allNormals = !data.corners.empty();
+	size_t probes = 0;
+
+	for (size_t i = 0; i < data.corners.size(); i++) {
+		const obj::Corner& corner = data.corners[i];
+		anyTexCoords |= corner.texCoord < data.texCoords.size();
+		allNormals &= corner.normal < data.normals.size();
+
+		size_t mask = table.size() - 1;
+		size_t index = hashCorner(corner) & mask;
+		size_t probe = 1;
+		while (table[index].vertex != emptySlot && !sameCorner(table[index].key, corner)) {
+			index = (index + 1) & mask;
+			probe++;
+		}
+		probes += probe;
+		stats.maxProbe = std::max(stats.maxProbe, probe);
+
+		if (table[index].vertex != emptySlot) {
+			mesh.vertexIndices[i] = table[index].vertex;
+			continue;
+		}
+
+		unsigned int vertex = static_cast<unsigned int>(unique.size());
+		table[index] = { corner, vertex };
+		unique.push_back(corner);
+		mesh.vertexIndices[i] = vertex;
+
+		if (unique.size() * 2 > table.size()) {
+			grow(table);
+			stats.rehashes++;
+		}
+	}
+
+	stats.vertices = unique.size();
+	stats.tableSize = table.size();
+	stats.averageProbe = stats.corners > 0 ? static_cast<double>(probes) / stats.corners : 0.0;
+
+	// Gather the attributes of each distinct triple.
+	mesh.vertices.resize(unique.size());
+	if (anyTexCoords) {
+		mesh.texCoords.resize(unique.size());
+	}
+	if (allNormals) {
+		mesh.normals.resize(unique.size());
+	}
+
+	const size_t blockSize = 1 << 16;
+	ThreadPool::global().parallelFor((unique.size() + blockSize - 1) / blockSize, [&](size_t block) {
+		size_t end = std::min(unique.size(), (block + 1) * blockSize);
+		for (size_t v = block * blockSize; v < end; v++) {
+			const obj::Corner& corner = unique[v];
+			mesh.vertices[v] = corner.position < data.positions.size() ? data.positions[corner.position] : glm::vec3(0.0f);
+			if (anyTexCoords) {
+				mesh.texCoords[v] = corner.texCoord < data.texCoords.size() ? data.texCoords[corner.texCoord] : glm::vec2(0.0f);
+			}
+			if (allNormals) {
+				mesh.normals[v] = data.normals[corner.normal];
+			}
+		}
+	});
+
+	return stats;
+}
@@ -0,0 +1,29 @@
+#ifndef VERTEX_DEDUP_H
+#define VERTEX_DEDUP_H
+
+#include <cstddef>
+
+#include "mesh_data.h"
+#include "obj_parser.h"
+
+// How well deduplication went, and how hard the hash table had to work for it.
+struct DedupStats
+{
+	size_t corners = 0;  // Triangle corners read
+	size_t vertices = 0; // Distinct v/vt/vn triples, so vertices emitted
+	size_t tableSize = 0;
+	size_t rehashes = 0;
+	double averageProbe = 0.0; // Slots looked at per lookup, 1 is a direct hit
+	size_t maxProbe = 0;
+
+	// Corners per emitted vertex.
+	double ratio() const { return vertices > 0 ? static_cast<double>(corners) / vertices : 0.0; }
+};
+
+// Emits one vertex per distinct (v, vt, vn) triple in data and one index stream over them, using a flat open
+// addressing hash table with linear probing. Texture coordinates are only filled in when the file has some;
+// normals only when every corner has one, otherwise they are left empty for generateNormals(). Smoothing groups, submeshes and material libraries are copied over.
+// Missing or out of range indices read as zero.
+DedupStats buildUnifiedMesh(const obj::CornerData& data, MeshData& mesh);
+
+#endif
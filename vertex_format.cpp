@@ -0,0 +1,249 @@
+#include "vertex_format.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const float positionLevels = 65535.0f;
+const float normalLevels16 = 32767.0f;
+const float normalLevels8 = 127.0f;
+
+// Runs body(begin, end, error) over blocks of [0, count) on the global pool and folds the block errors into error.
+template<typename Body>
+void forEachBlock(size_t count, PackError& error, const Body& body) {
+	const size_t blockSize = 1 << 16;
+	size_t blockCount = (count + blockSize - 1) / blockSize;
+
+	std::vector<PackError> blockErrors(blockCount);
+	ThreadPool::global().parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		body(begin, std::min(count, begin + blockSize), blockErrors[block]);
+	});
+
+	for (const PackError& blockError : blockErrors) {
+		error.position = std::max(error.position, blockError.position);
+		error.normalDegrees = std::max(error.normalDegrees, blockError.normalDegrees);
+		error.texCoord = std::max(error.texCoord, blockError.texCoord);
+	}
+}
+
+float angleDegrees(glm::vec3 a, glm::vec3 b) {
+	// atan2 stays accurate for tiny angles, where acos of the dot product just returns 0.
+	return glm::degrees(std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b)));
+}
+
+// Rounding each coordinate on its own is not always the closest representable direction,
+// so try all four neighbouring grid points and keep the best one.
+template<typename T>
+void encodeNormal(glm::vec3 n, float levels, T* out, float& errorDegrees) {
+	float length = glm::length(n);
+	if (!(length > 0.0f) || !std::isfinite(length)) {
+		// Degenerate normals (zero area faces) decode to +z and are left out of the error.
+		out[0] = out[1] = 0;
+		return;
+	}
+	n /= length;
+
+	glm::vec2 e = octEncode(n);
+	float baseX = std::floor(e.x * levels);
+	float baseY = std::floor(e.y * levels);
+
+	float bestError = 180.0f;
+	for (int i = 0; i < 4; i++) {
+		float x = glm::clamp(baseX + static_cast<float>(i & 1), -levels, levels);
+		float y = glm::clamp(baseY + static_cast<float>(i >> 1), -levels, levels);
+		float error = angleDegrees(n, octDecode(glm::vec2(x, y) * (1.0f / levels)));
+		if (error < bestError) {
+			bestError = error;
+			out[0] = static_cast<T>(x);
+			out[1] = static_cast<T>(y);
+		}
+	}
+	errorDegrees = std::max(errorDegrees, bestError);
+}
+
+template<typename T>
+void packNormals(const MeshData& mesh, float levels, std::vector<T>& normals, PackError& error) {
+	normals.resize(mesh.normals.size() * 2);
+	forEachBlock(mesh.normals.size(), error, [&](size_t begin, size_t end, PackError& blockError) {
+		for (size_t i = begin; i < end; i++) {
+			encodeNormal(mesh.normals[i], levels, &normals[i * 2], blockError.normalDegrees);
+		}
+	});
+}
+
+float signNotZero(float value) {
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+}
+
+const char* vertexFormatName(VertexFormat format) {
+	switch (format) {
+	case VertexFormat::Compact:
+		return "compact";
+	case VertexFormat::CompactSmall:
+		return "compact (8 bit normals)";
+	default:
+		return "float";
+	}
+}
+
+size_t PackedMesh::bytes() const {
+	return positions.capacity() * sizeof(uint16_t) + normals16.capacity() * sizeof(int16_t) + normals8.capacity() * sizeof(int8_t)
+		+ texCoords.capacity() * sizeof(uint16_t) + indices.capacity() * sizeof(uint16_t);
+}
+
+PackedMesh packMesh(const MeshData& mesh, VertexFormat format) {
+	PackedMesh packed;
+	packed.format = format;
+
+	// Indices only need 16 bits if no vertex past 65535 exists. This is lossless, so every format gets it.
+	if (!mesh.vertexIndices.empty() && mesh.vertices.size() <= 65536) {
+		packed.indices.assign(mesh.vertexIndices.begin(), mesh.vertexIndices.end());
+		packed.indexType = GL_UNSIGNED_SHORT;
+	}
+	else if (!mesh.vertexIndices.empty() && mesh.submeshes.size() > 1) {
+		// Bigger meshes still fit if every submesh range spans less than 65536 vertices above its base vertex, which
+		// optimizeMesh's first use order makes likely for meshes split into many parts.
+		size_t covered = 0;
+		bool fits = true;
+		for (const SubmeshRange& range : mesh.submeshRanges) {
+			auto first = mesh.vertexIndices.begin() + range.indexOffset;
+			fits = fits && std::all_of(first, first + range.indexCount, [&](unsigned int index) {
+				return index >= static_cast<unsigned int>(range.baseVertex) && index - range.baseVertex <= 65535;
+			});
+			covered += range.indexCount;
+		}
+		if (fits && covered == mesh.vertexIndices.size()) {
+			packed.indices.resize(mesh.vertexIndices.size());
+			for (const SubmeshRange& range : mesh.submeshRanges) {
+				for (size_t i = range.indexOffset; i < range.indexOffset + range.indexCount; i++) {
+					packed.indices[i] = static_cast<uint16_t>(mesh.vertexIndices[i] - range.baseVertex);
+				}
+			}
+			packed.indexType = GL_UNSIGNED_SHORT;
+			packed.rebased = true;
+		}
+	}
+
+	if (format == VertexFormat::Float) {
+		return packed;
+	}
+
+	// Positions: 16 bit fixed point across the bounding box, so the step on each axis is extent / 65535.
+	glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+	glm::vec3 toLevels(0.0f);
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] > 0.0f) {
+			toLevels[axis] = positionLevels / extent[axis];
+		}
+	}
+	packed.positionOffset = mesh.boundsMin;
+	packed.positionScale = extent / positionLevels;
+	packed.error.positionBound = 0.5f * std::max(packed.positionScale.x, std::max(packed.positionScale.y, packed.positionScale.z));
+
+	packed.positions.resize(mesh.vertices.size() * 3);
+	forEachBlock(mesh.vertices.size(), packed.error, [&](size_t begin, size_t end, PackError& blockError) {
+		for (size_t i = begin; i < end; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				float value = mesh.vertices[i][axis];
+				float level = glm::clamp(std::round((value - mesh.boundsMin[axis]) * toLevels[axis]), 0.0f, positionLevels);
+				packed.positions[i * 3 + axis] = static_cast<uint16_t>(level);
+
+				float decoded = packed.positionOffset[axis] + packed.positionScale[axis] * level;
+				blockError.position = std::max(blockError.position, std::fabs(decoded - value));
+			}
+		}
+	});
+
+	if (format == VertexFormat::CompactSmall) {
+		packed.normalScale = 1.0f / normalLevels8;
+		packNormals(mesh, normalLevels8, packed.normals8, packed.error);
+	}
+	else {
+		packed.normalScale = 1.0f / normalLevels16;
+		packNormals(mesh, normalLevels16, packed.normals16, packed.error);
+	}
+
+	packed.texCoords.resize(mesh.texCoords.size() * 2);
+	forEachBlock(mesh.texCoords.size(), packed.error, [&](size_t begin, size_t end, PackError& blockError) {
+		for (size_t i = begin; i < end; i++) {
+			for (int component = 0; component < 2; component++) {
+				float value = mesh.texCoords[i][component];
+				uint16_t half = floatToHalf(value);
+				packed.texCoords[i * 2 + component] = half;
+				blockError.texCoord = std::max(blockError.texCoord, std::fabs(halfToFloat(half) - value));
+			}
+		}
+	});
+
+	return packed;
+}
+
+glm::vec2 octEncode(glm::vec3 n) {
+	n /= std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	if (n.z >= 0.0f) {
+		return glm::vec2(n.x, n.y);
+	}
+	// Fold the lower hemisphere over the diagonals.
+	return glm::vec2((1.0f - std::fabs(n.y)) * signNotZero(n.x), (1.0f - std::fabs(n.x)) * signNotZero(n.y));
+}
+
+// Same as octDecode in the vertex shaders.
+glm::vec3 octDecode(glm::vec2 e) {
+	glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7FFFFFFF;
+
+	if (magnitude > 0x7F800000) {
+		return sign | 0x7E00; // NaN
+	}
+	if (magnitude >= 0x47800000) {
+		return sign | 0x7C00; // Infinity, or too big for a half
+	}
+	if (magnitude < 0x38800000) {
+		// Below the smallest normal half, count in steps of 2^-24. 1024 steps lands on the smallest normal, which is the right encoding too.
+		float absolute;
+		std::memcpy(&absolute, &magnitude, sizeof(absolute));
+		return sign | static_cast<uint16_t>(std::nearbyint(absolute * 16777216.0f));
+	}
+
+	// Rebias the exponent and round the 13 dropped mantissa bits to nearest even. A carry out of the mantissa bumps
+	// the exponent, which is exactly right, and values that round past 65504 come out as infinity.
+	uint32_t rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1);
+	return sign | static_cast<uint16_t>((rounded - 0x38000000) >> 13);
+}
+
+float halfToFloat(uint16_t value) {
+	uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1F;
+	uint32_t mantissa = value & 0x3FF;
+
+	float result;
+	if (exponent == 0) {
+		result = std::ldexp(static_cast<float>(mantissa), -24);
+		uint32_t bits;
+		std::memcpy(&bits, &result, sizeof(bits));
+		bits |= sign;
+		std::memcpy(&result, &bits, sizeof(bits));
+		return result;
+	}
+
+	uint32_t bits = exponent == 0x1F ? (sign | 0x7F800000 | (mantissa << 13)) : (sign | ((exponent + 112) << 23) | (mantissa << 13));
+	std::memcpy(&result, &bits, sizeof(bits));
+	return result;
+}
@@ -0,0 +1,73 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm/glm.hpp"
+
+#include "mesh_data.h"
+
+// How a mesh's vertices are laid out on the GPU.
+enum class VertexFormat
+{
+	Float,        // vec3 positions and normals, vec2 texture coordinates, exactly what MeshData holds
+	Compact,      // 3x16 bit positions within the bounding box, 2x16 bit octahedral normals, half float texture coordinates
+	CompactSmall, // Compact with 2x8 bit octahedral normals
+};
+
+const char* vertexFormatName(VertexFormat format);
+
+// Largest error packing introduced, measured against the source mesh.
+struct PackError
+{
+	float position = 0.0f;      // Per axis, in model units
+	float positionBound = 0.0f; // Half a quantization step along the longest axis, position only exceeds it by float rounding
+	float normalDegrees = 0.0f; // Angle between a source normal and its decoded normal
+	float texCoord = 0.0f;      // Per component
+};
+
+// Vertex and index data converted for upload.
+// An empty array means the matching MeshData array is uploaded as it is.
+struct PackedMesh
+{
+	VertexFormat format = VertexFormat::Float;
+
+	std::vector<uint16_t> positions; // xyz per vertex
+	std::vector<int16_t> normals16;  // Compact
+	std::vector<int8_t> normals8;    // CompactSmall
+	std::vector<uint16_t> texCoords; // Half floats
+	std::vector<uint16_t> indices;   // Only filled when every index fits in 16 bits
+
+	GLenum indexType = GL_UNSIGNED_INT;
+	bool rebased = false; // indices are relative to the baseVertex of their submesh range, see SubmeshRange
+
+	// What the vertex shaders decode with:
+	// position = positionOffset + positionScale * stored, normal = octDecode(normalScale * stored).
+	// A normalScale of 0 means the normals are plain floats.
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	float normalScale = 0.0f;
+
+	PackError error;
+
+	size_t bytes() const;
+};
+
+// Converts mesh to format. Index width is picked from the vertex count for every format, since that part is lossless,
+// or from the vertices each submesh range spans when the whole mesh has too many.
+// mesh.boundsMin/boundsMax have to be up to date.
+PackedMesh packMesh(const MeshData& mesh, VertexFormat format);
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2 and back.
+glm::vec2 octEncode(glm::vec3 n);
+glm::vec3 octDecode(glm::vec2 e);
+
+// IEEE half precision, rounded to nearest even.
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+#endif
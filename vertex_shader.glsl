@@ -1,19 +1,68 @@
 #version 330 core
+// Scene uber-shader, compiled once for each combination of features main() asks for; they come in as #defines right
+// after the #version line (see shaderfeature in shader_variants.h).
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
 
+#ifdef INSTANCING
+// Per instance, see Instance in model.h. Plain draws are placed by model instead.
+layout (location = 3) in mat4 aInstanceModel;
+layout (location = 7) in vec4 aInstanceColor;
+layout (location = 8) in int aInstanceMaterial;
+#endif
+
 out vec2 TexCoord;
 out vec3 Normal;
 out vec3 FragPos;
+out vec4 InstanceColor;
+flat out int MaterialIndex;
+
+// Camera, set once per frame for every program (see FrameBlock in uniform_blocks.h).
+layout (std140) uniform Frame{
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec4 viewPos;
+};
 
+#ifndef INSTANCING
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix; // Of model, worked out on the CPU once per draw
+#endif
+uniform int materialIndex;
+
+// Decoding for the compact vertex formats (see vertex_format.h). Float meshes pass 1, 0 and 0.
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform float normalScale;
+
+vec3 octDecode(vec2 e){
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
 
 void main(){
-	gl_Position = projection * view * model * vec4(aPos, 1.0f);
+	vec3 position = positionOffset + positionScale * aPos;
+	vec3 normal = normalScale > 0.0 ? octDecode(aNormal.xy * normalScale) : aNormal;
+#ifdef INSTANCING
+	mat4 world = aInstanceModel;
+	// Instances are scaled uniformly, so their own upper 3x3 keeps normals perpendicular.
+	mat3 normalWorld = mat3(aInstanceModel);
+	InstanceColor = aInstanceColor;
+	MaterialIndex = aInstanceMaterial >= 0 ? aInstanceMaterial : materialIndex;
+#else
+	mat4 world = model;
+	mat3 normalWorld = normalMatrix;
+	InstanceColor = vec4(1.0);
+	MaterialIndex = materialIndex;
+#endif
+
+	FragPos = vec3(world * vec4(position, 1.0));
+	gl_Position = viewProjection * vec4(FragPos, 1.0);
 	TexCoord = vec2(aTexCoord.x, aTexCoord.y);
-	FragPos = vec3(model * vec4(aPos, 1.0));
-	Normal = normalize(mat3(transpose(inverse(model))) * aNormal);
+	Normal = normalize(normalWorld * normal);
 }
\ No newline at end of file